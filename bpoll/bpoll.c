@@ -32,6 +32,7 @@
 #endif
 
 #include "bpoll.h"
+#include "bpoll_sdt.h"
 
 #include <plasma/plasma_feature.h>
 #include <plasma/plasma_attr.h>
@@ -41,6 +42,7 @@
 #pragma GCC visibility push(hidden)
 #endif
 #include <plasma/plasma_atomic.h>
+#include <plasma/plasma_membar.h>
 #ifdef __GNUC__
 #pragma GCC visibility pop
 #endif
@@ -53,6 +55,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>        /* sigaction(), sigprocmask() */
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -73,12 +76,59 @@
 #define pthread_mutex_destroy(mutexp) 0
 #endif
 
+#ifdef __linux__
+#include <sys/signalfd.h>  /* signalfd() (Linux 2.6.27+, glibc 2.8+) */
+#define HAS_SIGNALFD 1
+#else
+#define HAS_SIGNALFD 0
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>   /* syscall() SYS_pidfd_open (Linux 5.3+) */
+#endif
+#include <sys/socket.h>    /* accept(), accept4() */
+#if defined(__linux__) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+#define HAS_ACCEPT4 1      /* (Linux 2.6.28+, glibc 2.10+) */
+#else
+#define HAS_ACCEPT4 0
+#endif
+
+#ifdef SYS_pidfd_open
+#define HAS_PIDFD 1
+#include <spawn.h>         /* posix_spawn() */
+#include <sys/wait.h>      /* waitid(), waitpid() */
+extern char **environ;
+#else
+#define HAS_PIDFD 0
+#endif
+
+#ifdef NSIG
+#define BPOLL_NSIG NSIG
+#else
+#define BPOLL_NSIG 65
+#endif
+
 #ifdef __cplusplus
 #ifndef SIZE_MAX
 #define SIZE_MAX ((size_t)-1)
 #endif
 #endif
 
+/* statistics counters (bpoll.h BPOLL_STATS)
+ * (histogram bucket is bit length of n: 0, 1, 2-3, 4-7, ...) */
+#if BPOLL_STATS
+#define BPOLL_STATS_INC(bpollset, ctr) (++(bpollset)->stats.ctr)
+#define BPOLL_STATS_HIST(bpollset, hist, n)                                   \
+  (++(bpollset)->stats.hist[(n) <= 0                                          \
+                            ? 0                                               \
+                            : (n) >= (1 << (BPOLL_STATS_HIST_SZ-2))           \
+                              ? BPOLL_STATS_HIST_SZ-1                         \
+                              : 32 - __builtin_clz((unsigned int)(n))])
+#else
+#define BPOLL_STATS_INC(bpollset, ctr)      ((void)0)
+#define BPOLL_STATS_HIST(bpollset, hist, n) ((void)0)
+#endif
+
 
 /*
  * bpoll static (internal) support functions
@@ -168,6 +218,7 @@ bpoll_mem_chunk_alloc (bpollset_t * const restrict bpollset)
             bpollset->mem_chunk_head = block;
         bpollset->mem_chunk_tail = block;
         bpollset->mem_block_head = block;
+        BPOLL_STATS_INC(bpollset, mem_chunk_alloc);
         chunk_end = (bpoll_mem_block_t *)
           ((char *)block + bpollset->mem_chunk_sz);
         while (block < chunk_end) {
@@ -249,8 +300,10 @@ bpoll_maint_mem_block (bpollset_t * const restrict bpollset)
     /* reorder free blocks once in a while
      * XXX: test how frequently this triggers and if it has locality benefit */
     if (__builtin_expect(
-           (bpollset->mem_block_freed >= BPOLL_MEM_BLOCK_REORDER), 0))
+           (bpollset->mem_block_freed >= BPOLL_MEM_BLOCK_REORDER), 0)) {
+        BPOLL_STATS_INC(bpollset, mem_block_reorder);
         bpoll_mem_block_reorder(bpollset);
+    }
 }
 
 
@@ -291,6 +344,30 @@ bpoll_elt_alloc (bpollset_t * const restrict bpollset)
 }
 
 
+__attribute_cold__
+__attribute_noinline__
+__attribute_nonnull__
+static void  __attribute_regparm__((2))
+bpoll_rdlist_remove (bpollset_t * const restrict bpollset,
+                     bpollelt_t * const restrict bpollelt);
+static void  __attribute_regparm__((2))
+bpoll_rdlist_remove (bpollset_t * const restrict bpollset,
+                     bpollelt_t * const restrict bpollelt)
+{
+    /* remove bpollelt from user-space ready list (order is preserved) */
+    bpollelt_t ** const restrict rdlist = bpollset->rdlist;
+    const int rdidx = bpollset->rdidx;
+    int i = 0;
+    while (i < rdidx && rdlist[i] != bpollelt)
+        ++i;
+    if (i < rdidx) {
+        memmove(rdlist+i, rdlist+i+1, (size_t)(rdidx-i-1)*sizeof(bpollelt_t*));
+        bpollset->rdidx = rdidx - 1;
+    }
+    bpollelt->flpriv &= ~BPOLL_FL_RDLIST;
+}
+
+
 __attribute_nonnull__
 static void  __attribute_regparm__((2))
 bpoll_elt_free (bpollset_t * const restrict bpollset,
@@ -302,6 +379,8 @@ bpoll_elt_free (bpollset_t * const restrict bpollset,
     /* check bpollelt allocated from bpollset and not already on free list
      * (idx == ~1u indicates double free; caller should try not to trigger this)
      * (safety here since some bpoll error paths might conceivably hit twice)*/
+    if (__builtin_expect( (bpollelt->flpriv & BPOLL_FL_RDLIST), 0))
+        bpoll_rdlist_remove(bpollset, bpollelt);
     if (__builtin_expect( (bpollelt->flpriv & BPOLL_FL_MEM_BLOCK), 1)
         && __builtin_expect( (bpollelt->idx != ~1u), 1)) {
         bpollelt->idx = ~1u;
@@ -464,6 +543,78 @@ bpoll_rmlist_resize (bpollset_t * const restrict bpollset)
 }
 
 
+__attribute_cold__
+__attribute_noinline__
+__attribute_nonnull__
+__attribute_warn_unused_result__
+static int  __attribute_regparm__((2))
+bpoll_rdlist_resize (bpollset_t * const restrict bpollset, const size_t n);
+static int  __attribute_regparm__((2))
+bpoll_rdlist_resize (bpollset_t * const restrict bpollset, const size_t n)
+{
+    size_t rdsz = (bpollset->rdsz != 0)
+      ? (size_t)(bpollset->rdsz)
+      : (bpollset->limit <= BPOLL_FD_THRESH)
+          ? BPOLL_FD_THRESH
+          : BPOLL_FD_THRESH << 1;
+    bpollelt_t **rdlist;
+
+    while (rdsz < n) {
+        if (__builtin_expect( (rdsz > UINT_MAX/sizeof(bpollelt_t *)/2), 0))
+            return (errno = ENOMEM);
+        rdsz <<= 1;
+    }
+    rdlist = (bpollelt_t **)
+      bpollset->fn_mem_alloc(bpollset->vdata, rdsz * sizeof(bpollelt_t *));
+    if (__builtin_expect( (rdlist == NULL), 0))
+        return (errno = ENOMEM);
+
+    if (bpollset->rdlist != NULL) {
+        memcpy(rdlist, bpollset->rdlist,
+               (size_t)(bpollset->rdidx) * sizeof(bpollelt_t *));
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->rdlist);
+    }
+    bpollset->rdlist = rdlist;
+    bpollset->rdsz   = (int)rdsz;
+    return 0;
+}
+
+
+__attribute_cold__
+__attribute_noinline__
+__attribute_nonnull__
+__attribute_warn_unused_result__
+static int  __attribute_regparm__((2))
+bpoll_rddisp_resize (bpollset_t * const restrict bpollset, const size_t n);
+static int  __attribute_regparm__((2))
+bpoll_rddisp_resize (bpollset_t * const restrict bpollset, const size_t n)
+{
+    /* (separate from rdlist, which callbacks may append to (and resize)
+     *  with bpoll_elt_mark_pending() while bpollelts are dispatched) */
+    size_t sz = (bpollset->rddispsz != 0)
+      ? (size_t)(bpollset->rddispsz)
+      : (size_t)(bpollset->rdsz);
+    bpollelt_t **rddisp;
+
+    while (sz < n) {
+        if (__builtin_expect( (sz > UINT_MAX/sizeof(bpollelt_t *)/2), 0))
+            return (errno = ENOMEM);
+        sz <<= 1;
+    }
+    rddisp = (bpollelt_t **)
+      bpollset->fn_mem_alloc(bpollset->vdata, sz * sizeof(bpollelt_t *));
+    if (__builtin_expect( (rddisp == NULL), 0))
+        return (errno = ENOMEM);
+
+    if (bpollset->rddisp != NULL && bpollset->fn_mem_free != NULL)
+        bpollset->fn_mem_free(bpollset->vdata, bpollset->rddisp);
+    bpollset->rddisp   = rddisp;
+    bpollset->rddispsz = (int)sz;
+    return 0;
+}
+
+
 __attribute_noinline__
 __attribute_nonnull__
 __attribute_warn_unused_result__
@@ -775,6 +926,17 @@ bpoll_mem_free_default (void * const restrict vdata  __attribute_unused__,
 }
 
 
+__attribute_cold__
+__attribute_nonnull__
+static void  __attribute_regparm__((1))
+bpoll_sigwatch_cleanup (bpollset_t * const restrict bpollset);
+
+__attribute_cold__
+__attribute_nonnull__
+static void
+bpoll_sim_cleanup (bpollset_t * const restrict bpollset);
+
+
 __attribute_noinline__
 __attribute_nonnull__
 static void  __attribute_regparm__((1))
@@ -784,6 +946,9 @@ bpoll_cleanup (bpollset_t * const restrict bpollset)
 {
     int rc = 0;
 
+    if (bpollset->trace != NULL)
+        bpoll_trace_disable(bpollset);
+
     /* walk *all* bpollset->bpollelts looking for BPOLL_FL_CLOSE and close() */
     if (bpollset->bpollelts != NULL) {
         bpollelt_t ** const restrict bpollelts = bpollset->bpollelts;
@@ -795,6 +960,11 @@ bpoll_cleanup (bpollset_t * const restrict bpollset)
                 bpoll_elt_close(bpollset, bpollelts[idx]);
         }
     }
+    bpollset->nintern = 0;
+    bpollset->sigready = 0;
+
+    if (bpollset->sigwatch != NULL)
+        bpoll_sigwatch_cleanup(bpollset);
 
     /* free() allocated memory and close mechanism-specific fd, if applicable */
     if (bpollset->fn_mem_free != NULL) {
@@ -849,6 +1019,9 @@ bpoll_cleanup (bpollset_t * const restrict bpollset)
                 bpollset->pollfds = NULL;
             }
             break;
+          case BPOLL_M_SIM:
+            bpoll_sim_cleanup(bpollset);
+            break;
           case BPOLL_M_NOT_SET:
           default:
             break;
@@ -863,6 +1036,24 @@ bpoll_cleanup (bpollset_t * const restrict bpollset)
             bpollset->fn_mem_free(bpollset->vdata, bpollset->rmlist);
             bpollset->rmlist = NULL;
         }
+        if (bpollset->watchdog != NULL) {
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->watchdog);
+            bpollset->watchdog = NULL;
+        }
+        if (bpollset->flight != NULL) {
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->flight);
+            bpollset->flight = NULL;
+        }
+        if (bpollset->rdlist != NULL) {
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->rdlist);
+            bpollset->rdlist = NULL;
+            bpollset->rdsz = 0;
+        }
+        if (bpollset->rddisp != NULL) {
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->rddisp);
+            bpollset->rddisp = NULL;
+            bpollset->rddispsz = 0;
+        }
         if (bpollset->results != NULL) {
             bpollset->fn_mem_free(bpollset->vdata, bpollset->results);
             bpollset->results = NULL;
@@ -880,6 +1071,15 @@ bpoll_cleanup (bpollset_t * const restrict bpollset)
         for (unsigned int i = 0;
              i < sizeof(bpollset->bpollelts_used)/sizeof(bpollelt_t*); ++i)
             bpollset->fn_mem_free(bpollset->vdata, bpollset->bpollelts_used[i]);
+        if (bpollset->vsig != NULL) {
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->vsig);
+            bpollset->vsig = NULL;
+            bpollset->vsig_sz = 0;
+        }
+        if (bpollset->rmq != NULL) {
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->rmq);
+            bpollset->rmq = NULL;
+        }
       #endif
     }
 
@@ -890,6 +1090,11 @@ bpoll_cleanup (bpollset_t * const restrict bpollset)
     }
 
   #ifdef _THREAD_SAFE
+    if (bpollset->vsig_fd != -1) {  /*(read end closed above; BPOLL_FL_CLOSE)*/
+        close(bpollset->vsig_fd);
+        bpollset->vsig_fd = -1;
+        bpollset->vsig_elt = NULL;
+    }
     /* destroy mutex; ignore error; mutex might not have been initialized yet */
     pthread_mutex_destroy(&bpollset->mutex);
   #endif
@@ -924,6 +1129,74 @@ bpoll_cleanup (bpollset_t * const restrict bpollset)
 
 #define BPOLL_EVENTS_FILT(events)    (events & ~(BPOLLET|BPOLLDISPATCH))
 
+/* run fn_cb_event (timed if slow-callback watchdog or flight recorder)
+ * (internal bpollelts are handled by bpoll_cb_event_slow(); no fn_cb_event) */
+__attribute_noinline__
+__attribute_nonnull__
+static void
+bpoll_cb_event_slow (bpollset_t * const restrict bpollset,
+                     bpollelt_t * const restrict bpollelt, const int data);
+__attribute_nonnull__
+static void  __attribute_regparm__((2))
+bpoll_elt_internal (bpollset_t * const restrict bpollset,
+                    bpollelt_t * const restrict bpollelt);
+#define BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, data)                 \
+  (__builtin_expect( ((bpollset)->watchdog == NULL), 1)                       \
+   && __builtin_expect( ((bpollset)->flight == NULL), 1)                      \
+   && __builtin_expect( !((bpollelt)->flpriv & BPOLL_FL_INTERNAL), 1)         \
+    ? (fn_cb_event)((bpollset), (bpollelt), (data))                           \
+    : bpoll_cb_event_slow((bpollset), (bpollelt), (data)))
+
+/* record flight recorder entry (if enabled) (ns 0 reads clock) */
+__attribute_noinline__
+__attribute_nonnull__
+static void
+bpoll_flight_rec (struct bpoll_flight * const restrict flight, int64_t ns,
+                  const int type, const unsigned int fdtype,
+                  const int32_t arg, const uint32_t arg2);
+#define BPOLL_FLIGHT(bpollset, type, fdtype, arg, arg2)                       \
+  (__builtin_expect( ((bpollset)->flight == NULL), 1)                         \
+    ? (void)0                                                                 \
+    : bpoll_flight_rec((bpollset)->flight, 0, (type), (fdtype),               \
+                       (int32_t)(arg), (uint32_t)(arg2)))
+
+/* record trace record (if enabled) */
+__attribute_noinline__
+__attribute_nonnull__
+static void
+bpoll_trace_rec (struct bpoll_trace * const restrict trace, const int type,
+                 const unsigned int fdtype, const int32_t fd,
+                 const uint32_t events);
+#define BPOLL_TRACE(bpollset, type, fdtype, fd, events)                       \
+  (__builtin_expect( ((bpollset)->trace == NULL), 1)                          \
+    ? (void)0                                                                 \
+    : bpoll_trace_rec((bpollset)->trace, (type), (fdtype),                    \
+                      (int32_t)(fd), (uint32_t)(events)))
+
+/* record bpollelt returned ready by kernel (if trace enabled) */
+#define BPOLL_TRACE_ELT_READY(bpollset, bpollelt)                             \
+  BPOLL_TRACE((bpollset), BPOLL_TRACE_READY, (bpollelt)->fdtype,              \
+              (bpollelt)->fd, (bpollelt)->revents)
+
+/* commit of n changes to kernel (statistics, flight recorder, USDT probe) */
+#define BPOLL_COMMIT_NOTE(bpollset, n)                                        \
+  (BPOLL_STATS_HIST((bpollset), commit_sz, (n)),                              \
+   BPOLL_FLIGHT((bpollset), BPOLL_FLIGHT_COMMIT, 0, (n), 0),                  \
+   BPOLL_SDT_PROBE2(bpoll, commit, (bpollset)->mech, (n)))
+
+/* set revents from kernel (combined with pending revents if bpollelt is on
+ * user-space ready list, so that pending events are not lost, e.g. BPOLLET) */
+#define BPOLL_ELT_REVENTS_SET(bpollelt, ev) \
+  ((bpollelt)->revents = ((bpollelt)->flpriv & BPOLL_FL_RDLIST) \
+                       ? (bpollelt)->revents | (ev)           \
+                       : (ev))
+
+/* clear revents after callback (unless callback marked bpollelt pending) */
+#define BPOLL_ELT_REVENTS_DONE(bpollelt) \
+  ((bpollelt)->revents = ((bpollelt)->flpriv & BPOLL_FL_RDLIST) \
+                       ? (bpollelt)->revents                  \
+                       : 0)
+
 
 __attribute_nonnull__
 static int
@@ -988,6 +1261,7 @@ bpoll_maint_default (bpollset_t * const restrict bpollset)
 {
     bpollelt_t ** const restrict rmlist = bpollset->rmlist;
     const int rmidx = bpollset->rmidx;
+    BPOLL_STATS_INC(bpollset, rmlist_flush);
     bpoll_fd_remove_eltlist(bpollset, rmlist, rmidx); /* min critical section */
     for (int idx = 0; idx < rmidx; ++idx) {
         bpoll_elt_close(bpollset, rmlist[idx]);
@@ -1243,7 +1517,8 @@ bpoll_process_pollfds (bpollset_t * const restrict bpollset)
             continue;
         --nremain;
         if ((bpollelt = bpoll_elt_fetch(bpollset, pfd_ready[i].fd)) != NULL) {
-            bpollelt->revents = (int) pfd_ready[i].revents;
+            BPOLL_ELT_REVENTS_SET(bpollelt, (int) pfd_ready[i].revents);
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
             if (__builtin_expect( (bpollelt->events & BPOLLDISPATCH), 0)) {
                 events = bpollelt->events;
                 bpoll_elt_modify_pollfds(bpollset, bpollelt, 0);
@@ -1253,8 +1528,8 @@ bpoll_process_pollfds (bpollset_t * const restrict bpollset)
             if (results != NULL)
                 results[j++] = bpollelt;
             else {
-                fn_cb_event(bpollset, bpollelt, -1);
-                bpollelt->revents = 0;
+                BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, -1);
+                BPOLL_ELT_REVENTS_DONE(bpollelt);
             }
         }
     }
@@ -1275,6 +1550,7 @@ bpoll_elt_add_immed_pollfds (bpollset_t * const restrict bpollset,
 #define bpoll_prepidx_pollfds(bpollset)                                       \
     __builtin_prefetch(bpollset->pollfds+bpollset->idx, 1, 1);                \
     if (__builtin_expect( (bpollset->idx == bpollset->queue_sz), 0))          \
+        BPOLL_STATS_INC(bpollset, queue_full),                                \
         bpoll_commit_poll_events(bpollset)
 
 
@@ -1324,9 +1600,9 @@ bpoll_elt_add_pollfds (bpollset_t * const restrict bpollset,
         return rc;
     bpollset->pollfds[(bpollelt->idx = bpollset->idx++)].fd = fd;
     bpollelt->revents = 0;
-    /*(bpoll_elt_modify() always succeeds for BPOLL_M_POLL)*/
-    bpollelt->events = !events;  /* must be set by bpoll_elt_modify() */
-    (void) bpoll_elt_modify(bpollset, bpollelt, events);
+    /*(bpoll_elt_modify_pollfds() always succeeds)*/
+    /*(called directly so that add is not also traced as modify)*/
+    (void) bpoll_elt_modify_pollfds(bpollset, bpollelt, events);
  #if !HAS_POLL
     if (bpollset->maxfd < fd && (bpollset->maxfd != -1 || bpollset->nelts == 0))
         bpollset->maxfd = fd;
@@ -1605,6 +1881,7 @@ bpoll_commit_kevents (bpollset_t * const restrict bpollset)
 
     /*assert(bpollset->idx != 0);*/
 
+    BPOLL_COMMIT_NOTE(bpollset, (int)bpollset->idx);
     for (sum = 0; (n = (int)bpollset->idx - sum) != 0; sum += n) {
         if (n > (BPOLL_IMMED_SZ<<2))
             n =  BPOLL_IMMED_SZ<<2;
@@ -1701,13 +1978,18 @@ bpoll_process_kqueue (bpollset_t * const restrict bpollset)
             bpollelt->revents |= revents;
         }
         else {
-            bpollelt->revents = revents;
-            fn_cb_event(bpollset, bpollelt, keready[i].data);
-            bpollelt->revents = 0;
+            BPOLL_ELT_REVENTS_SET(bpollelt, revents);
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
+            BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, keready[i].data);
+            BPOLL_ELT_REVENTS_DONE(bpollelt);
         }
     }
     if (results != NULL) {
         bpollset->nfound = j;/*(events might have been combined into bpollelt)*/
+        if (bpollset->trace != NULL) {
+            for (i = 0; i < j; ++i)
+                BPOLL_TRACE_ELT_READY(bpollset, results[i]);
+        }
         /*(extra pass to disable additional filters for dispatched fds
          * due to bpoll data structure limitation where bpollelt focuses on fd
          * (with multiple filters) whereas kqueue treats filters separately)
@@ -1836,6 +2118,7 @@ bpoll_elt_add_immed_kqueue (bpollset_t * const restrict bpollset,
 #define bpoll_prepidx_kqueue(bpollset)                                        \
     __builtin_prefetch(bpollset->kevents+bpollset->idx, 1, 1),                \
       (__builtin_expect( (bpollset->idx > (bpollset->queue_sz<<1)-2), 0)      \
+       && (BPOLL_STATS_INC(bpollset, queue_full), 1)                          \
        && __builtin_expect( (bpoll_commit_kevents(bpollset) != 0), 0))
 
 
@@ -2169,8 +2452,9 @@ bpoll_commit_evport_events (bpollset_t * const restrict bpollset);
 static int
 bpoll_commit_evport_events (bpollset_t * const restrict bpollset)
 {
-    const int rc = bpoll_commit_evport_impl(bpollset, bpollset->evport_events,
-                                            (int)bpollset->idx);
+    const int rc = (BPOLL_COMMIT_NOTE(bpollset, (int)bpollset->idx),
+                    bpoll_commit_evport_impl(bpollset, bpollset->evport_events,
+                                             (int)bpollset->idx));
     if (__builtin_expect( (rc == 0), 1)) {
         bpollset->idx = 0;
         if (bpollset->rmidx != 0)
@@ -2223,7 +2507,7 @@ bpoll_kernel_evport (bpollset_t * const restrict bpollset)
         bpollelt_t * restrict bpollelt;
         for (int i = 0; i < nfound; ++i) {
             bpollelt = portev[i].portev_user;
-            bpollelt->revents = portev[i].portev_events;
+            BPOLL_ELT_REVENTS_SET(bpollelt, portev[i].portev_events);
             if (!(bpollelt->events & BPOLLDISPATCH)) { /*cross-ref for reassoc*/
                 bpollelt->idx = (unsigned int)(reassoc = i);
                 bpollelt->flpriv |= BPOLL_FL_CTL_ADD;
@@ -2288,16 +2572,19 @@ bpoll_process_evport (bpollset_t * const restrict bpollset)
 
     /* (portev_events copied to bpollelt->revents in bpoll_kernel_evport()) */
     if (results != NULL) {
-        for (int i = 0; i < nfound; ++i)
+        for (int i = 0; i < nfound; ++i) {
             results[i] = portev[i].portev_user;
+            BPOLL_TRACE_ELT_READY(bpollset, results[i]);
+        }
     }
     else {
         bpollelt_t * restrict bpollelt;
         bpoll_fn_cb_event_t const fn_cb_event = bpollset->fn_cb_event;
         for (int i = 0; i < nfound; ++i) {
             bpollelt = portev[i].portev_user;
-            fn_cb_event(bpollset, bpollelt, -1);
-            bpollelt->revents = 0;
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
+            BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, -1);
+            BPOLL_ELT_REVENTS_DONE(bpollelt);
         }
     }
     return nfound;
@@ -2342,6 +2629,7 @@ bpoll_elt_add_immed_evport (bpollset_t * const restrict bpollset,
 #define bpoll_prepidx_evport(bpollset)                                        \
     __builtin_prefetch(bpollset->evport_events+bpollset->idx, 1, 1),          \
       (__builtin_expect( (bpollset->idx == bpollset->queue_sz), 0)            \
+       && (BPOLL_STATS_INC(bpollset, queue_full), 1)                          \
        && __builtin_expect( (bpoll_commit_evport_events(bpollset) != 0), 0))
 
 
@@ -2494,8 +2782,9 @@ static int
 bpoll_commit_devpoll_events (bpollset_t * const restrict bpollset)
 {
     /*assert(bpollset->idx != 0);*/
-    const int rc = bpoll_commit_devpoll_impl(bpollset, bpollset->pollfds,
-                                             (int)bpollset->idx);
+    const int rc = (BPOLL_COMMIT_NOTE(bpollset, (int)bpollset->idx),
+                    bpoll_commit_devpoll_impl(bpollset, bpollset->pollfds,
+                                              (int)bpollset->idx));
     return (__builtin_expect( (rc == 0), 1)) ? (int)(bpollset->idx = 0) : rc;
 }
 
@@ -2583,6 +2872,7 @@ bpoll_elt_add_immed_devpoll (bpollset_t * const restrict bpollset,
 #define bpoll_prepidx_devpoll(bpollset)                                       \
     __builtin_prefetch(bpollset->pollfds+bpollset->idx, 1, 1),                \
       (__builtin_expect( (bpollset->idx == bpollset->queue_sz), 0)            \
+       && (BPOLL_STATS_INC(bpollset, queue_full), 1)                          \
        && __builtin_expect( (bpoll_commit_devpoll_events(bpollset) != 0), 0))
 
 
@@ -2783,8 +3073,10 @@ static int
 bpoll_commit_pollset_events (bpollset_t * const restrict bpollset)
 {
     /*assert(bpollset->idx != 0);*/
-    const int rc = bpoll_commit_pollset_impl(bpollset, bpollset->pollset_events,
-                                             (int)bpollset->idx);
+    const int rc = (BPOLL_COMMIT_NOTE(bpollset, (int)bpollset->idx),
+                    bpoll_commit_pollset_impl(bpollset,
+                                              bpollset->pollset_events,
+                                              (int)bpollset->idx));
     return (__builtin_expect( (rc == 0), 1)) ? (int)(bpollset->idx = 0) : rc;
 }
 
@@ -2856,6 +3148,7 @@ bpoll_elt_add_immed_pollset (bpollset_t * const restrict bpollset,
 #define bpoll_prepidx_pollset(bpollset)                                       \
     __builtin_prefetch(bpollset->pollset_events+bpollset->idx, 1, 1),         \
       (__builtin_expect( (bpollset->idx == bpollset->queue_sz), 0)            \
+       && (BPOLL_STATS_INC(bpollset, queue_full), 1)                          \
        && __builtin_expect( (bpoll_commit_pollset_events(bpollset) != 0), 0))
 
 
@@ -2974,7 +3267,8 @@ bpoll_process_devpollset (bpollset_t * const restrict bpollset)
      * a bpollelt in the bpollset */
     for (int i = 0; i < nfound; ++i) {
         if ((bpollelt = bpoll_elt_fetch(bpollset, pfd_ready[i].fd)) != NULL) {
-            bpollelt->revents = (int) pfd_ready[i].revents;
+            BPOLL_ELT_REVENTS_SET(bpollelt, (int) pfd_ready[i].revents);
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
             if (__builtin_expect( (bpollelt->events & BPOLLDISPATCH), 0)) {
                 events = bpollelt->events;
                 /*(unlikely that queueing removal would fail, but if it did then
@@ -2992,8 +3286,8 @@ bpoll_process_devpollset (bpollset_t * const restrict bpollset)
             if (results != NULL)
                 results[i] = bpollelt;
             else {
-                fn_cb_event(bpollset, bpollelt, -1);
-                bpollelt->revents = 0;
+                BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, -1);
+                BPOLL_ELT_REVENTS_DONE(bpollelt);
             }
         }
     }
@@ -3051,11 +3345,35 @@ bpoll_init_epoll (bpollset_t * const restrict bpollset)
 
 /*(avoid library overhead; epoll_ctl operates on single fd; called frequently)*/
 #include <sys/syscall.h>
+#ifdef EPIOCSPARAMS
+#include <sys/ioctl.h>     /* ioctl() EPIOCSPARAMS (Linux 6.9+) */
+#endif
 #ifdef __NR_epoll_ctl
 #define epoll_ctl(epfd, op, fd, event) \
   (syscall(__NR_epoll_ctl, (epfd), (op), (fd), (event)))
 #endif
 
+/*(epoll_pwait2() glibc wrapper is recent (glibc 2.35); invoke via syscall())*/
+#if HAS_EPOLL_PWAIT2
+#ifdef __NR_epoll_pwait2
+/*(sigsetsize is kernel sigset_t size (_NSIG/8), not sizeof(sigset_t) in libc)
+ *(libc _NSIG is 65 or 129 (MIPS); /8 rounds down to kernel 8 or 16 bytes)*/
+#ifdef _NSIG
+#define BPOLL_KERNEL_SIGSETSIZE ((size_t)(_NSIG/8))
+#else
+#define BPOLL_KERNEL_SIGSETSIZE ((size_t)8)
+#endif
+#define bpoll_epoll_pwait2(epfd, events, maxevents, ts, sigmask) \
+  ((int)syscall(__NR_epoll_pwait2, (epfd), (events), (maxevents), \
+                (ts), (sigmask), BPOLL_KERNEL_SIGSETSIZE))
+/*(set if kernel returns ENOSYS; process-wide; benign race if threads race)*/
+static int bpoll_epoll_pwait2_enosys;
+#else
+#undef  HAS_EPOLL_PWAIT2
+#define HAS_EPOLL_PWAIT2 0
+#endif
+#endif
+
 
 __attribute_noinline__
 __attribute_nonnull__
@@ -3073,6 +3391,7 @@ bpoll_maint_epoll (bpollset_t * const restrict bpollset)
         if ((rmlist[idx]->flpriv
              & (BPOLL_FL_CTL_ADD | BPOLL_FL_CTL_DEL | BPOLL_FL_DISPATCHED))
             == BPOLL_FL_CTL_DEL) {
+            BPOLL_STATS_INC(bpollset, ctl_del);
             do { /*(Linux kernel 2.6.9+ required with NULL epoll_event arg)*/
                 rv = epoll_ctl(fd, EPOLL_CTL_DEL, rmlist[idx]->fd, NULL);
             } while (__builtin_expect( (rv != 0), 0) && errno == EINTR);
@@ -3109,6 +3428,12 @@ bpoll_commit_epoll_impl (bpollset_t * const restrict bpollset,
           ? EPOLL_CTL_ADD
           : EPOLL_CTL_MOD;
         bpollelt->flpriv &= ~BPOLL_FL_CTL_ADD;
+      #if BPOLL_STATS
+        if (op == EPOLL_CTL_ADD)
+            BPOLL_STATS_INC(bpollset, ctl_add);
+        else
+            BPOLL_STATS_INC(bpollset, ctl_mod);
+      #endif
         do {
             rv = epoll_ctl(epollfd, op, bpollelt->fd, &epoll_events[i]);
         } while (__builtin_expect( (rv == -1), 0) && errno == EINTR);
@@ -3135,8 +3460,9 @@ bpoll_commit_epoll_events (bpollset_t * const restrict bpollset);
 static int  __attribute_regparm__((1))
 bpoll_commit_epoll_events (bpollset_t * const restrict bpollset)
 {
-    const int rc = bpoll_commit_epoll_impl(bpollset, bpollset->epoll_events,
-                                           (int)bpollset->idx);
+    const int rc = (BPOLL_COMMIT_NOTE(bpollset, (int)bpollset->idx),
+                    bpoll_commit_epoll_impl(bpollset, bpollset->epoll_events,
+                                            (int)bpollset->idx));
     if (__builtin_expect( (rc == 0), 1)) {
         bpollset->idx = 0;
         if (bpollset->rmidx != 0)
@@ -3158,6 +3484,23 @@ bpoll_kernel_epoll (bpollset_t * const restrict bpollset)
         && bpoll_commit_epoll_events(bpollset) != 0)
         return -1;
 
+    /* epoll_pwait2() added in kernel 5.11; takes timespec timeout so that
+     * bpollset->ts is honored at full precision (not rounded up to msec) */
+  #if HAS_EPOLL_PWAIT2
+    if (__builtin_expect( (!bpoll_epoll_pwait2_enosys), 1)) {
+        bpollset->nfound =
+          bpoll_epoll_pwait2(bpollset->fd, bpollset->epoll_ready,
+                             (int)bpollset->queue_sz,
+                             bpollset->timeout >= 0 ? &bpollset->ts : NULL,
+                             bpollset->sigmaskp);
+        if (__builtin_expect( (bpollset->nfound >= 0), 1) || errno != ENOSYS) {
+            bpoll_maint_mem_block(bpollset);
+            return bpollset->nfound;
+        }
+        bpoll_epoll_pwait2_enosys = 1; /*(fall through to epoll_pwait())*/
+    }
+  #endif
+
     /* epoll_pwait() added in kernel 2.6.19;
        use epoll_wait() without sigmask arg if epoll_pwait() not available*/
   #if HAS_EPOLL_PWAIT
@@ -3176,6 +3519,51 @@ bpoll_kernel_epoll (bpollset_t * const restrict bpollset)
 }
 
 
+__attribute_noinline__
+__attribute_nonnull__
+static int
+bpoll_kernel_epoll_append (bpollset_t * const restrict bpollset);
+static int
+bpoll_kernel_epoll_append (bpollset_t * const restrict bpollset)
+{
+    /* re-poll kernel (zero timeout) and append to events already in
+     * epoll_ready (from previous bpoll_kernel_epoll()), merging duplicates
+     * (level-triggered bpollelts are returned again; edge-triggered and
+     *  BPOLLDISPATCH bpollelts are not, so previous events are not discarded)
+     * (bpollelt->idx temporarily overloaded to hold epoll_ready index;
+     *  pending changes were committed by bpoll_kernel_epoll(), so idx is ~0u
+     *  (no pending change) on entry and is restored to ~0u before return)
+     * (bpollelt->revents is not touched; bpollelts on rdlist retain revents)*/
+    struct epoll_event * const restrict epoll_ready = bpollset->epoll_ready;
+    bpollelt_t * restrict bpollelt;
+    const int nfound = bpollset->nfound;
+    int i, j, n;
+    for (i = 0; i < nfound; ++i) {
+        bpollelt = (bpollelt_t *)epoll_ready[i].data.ptr;
+        bpollelt->flpriv |= BPOLL_FL_BATCHED;
+        bpollelt->idx = (unsigned int)i;
+    }
+    n = epoll_wait(bpollset->fd, epoll_ready+nfound,
+                   (int)bpollset->queue_sz - nfound, 0);
+    for (i = nfound, j = nfound, n += nfound; i < n; ++i) {
+        bpollelt = (bpollelt_t *)epoll_ready[i].data.ptr;
+        if (bpollelt->flpriv & BPOLL_FL_BATCHED)
+            epoll_ready[bpollelt->idx].events |= epoll_ready[i].events;
+        else {
+            bpollelt->flpriv |= BPOLL_FL_BATCHED;
+            bpollelt->idx = (unsigned int)j;
+            epoll_ready[j++] = epoll_ready[i];
+        }
+    }
+    for (i = 0; i < j; ++i) {
+        bpollelt = (bpollelt_t *)epoll_ready[i].data.ptr;
+        bpollelt->flpriv &= ~BPOLL_FL_BATCHED;
+        bpollelt->idx = ~0u;
+    }
+    return (bpollset->nfound = j); /*(errors ignored; retain prior results)*/
+}
+
+
 __attribute_nonnull__
 static int
 bpoll_process_epoll (bpollset_t * const restrict bpollset);
@@ -3192,7 +3580,8 @@ bpoll_process_epoll (bpollset_t * const restrict bpollset)
     if (results != NULL) {
         for (int i = 0; i < nfound; ++i) {
             results[i] = bpollelt = (bpollelt_t *)epoll_ready[i].data.ptr;
-            bpollelt->revents = (int) epoll_ready[i].events;
+            BPOLL_ELT_REVENTS_SET(bpollelt, (int) epoll_ready[i].events);
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
             if (bpollelt->events & BPOLLDISPATCH)
                 bpollelt->flpriv |= BPOLL_FL_DISPATCHED;
         }
@@ -3201,11 +3590,12 @@ bpoll_process_epoll (bpollset_t * const restrict bpollset)
         bpoll_fn_cb_event_t const fn_cb_event = bpollset->fn_cb_event;
         for (int i = 0; i < nfound; ++i) {
             bpollelt = (bpollelt_t *)epoll_ready[i].data.ptr;
-            bpollelt->revents = (int) epoll_ready[i].events;
+            BPOLL_ELT_REVENTS_SET(bpollelt, (int) epoll_ready[i].events);
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
             if (bpollelt->events & BPOLLDISPATCH)
                 bpollelt->flpriv |= BPOLL_FL_DISPATCHED;
-            fn_cb_event(bpollset, bpollelt, -1);
-            bpollelt->revents = 0;
+            BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, -1);
+            BPOLL_ELT_REVENTS_DONE(bpollelt);
         }
     }
     return nfound;
@@ -3252,6 +3642,7 @@ bpoll_elt_add_immed_epoll (bpollset_t * const restrict bpollset,
 #define bpoll_prepidx_epoll(bpollset)                                         \
     __builtin_prefetch(bpollset->epoll_events+bpollset->idx, 1, 1),           \
       (__builtin_expect( (bpollset->idx == bpollset->queue_sz), 0)            \
+       && (BPOLL_STATS_INC(bpollset, queue_full), 1)                          \
        && __builtin_expect( (bpoll_commit_epoll_events(bpollset) != 0), 0))   \
 
 
@@ -3335,108 +3726,589 @@ bpoll_elt_remove_epoll (bpollset_t * const restrict bpollset
 #endif /* HAS_EPOLL */
 
 
+/*
+ * BPOLL_M_SIM: simulated kernel in user space (see bpoll_sim_ready())
+ * Modelled on epoll: changes are queued (queue_sz) and committed to the
+ * simulated interest set (sim->fds, indexed by fd) before each poll, and
+ * results are returned in sim->ready (queue_sz).  Ready fds are queued FIFO,
+ * linked through sim->fds[].next, each fd at most once.
+ */
+
+#define BPOLL_SIM_UNQUEUED -2   /* sim->fds[].next: fd not on ready queue */
+
+struct bpoll_sim_event {
+    bpollelt_t *ptr;
+    int events;
+};
+
+struct bpoll_sim_fd {
+    bpollelt_t *ptr;    /* committed bpollelt (NULL if none) */
+    int events;         /* committed interest */
+    int mask;           /* revents returnable (0 if none, or dispatched) */
+    int revents;        /* readiness made ready and not yet returned */
+    int next;           /* next fd on ready queue (-1 if tail) */
+};
+
+struct bpoll_sim {
+    struct bpoll_sim_fd *fds;
+    unsigned int fds_sz;
+    int head;           /* ready queue head fd (-1 if empty) */
+    int tail;           /* ready queue tail fd (-1 if empty) */
+    struct bpoll_sim_event *ready;
+    struct bpoll_sim_event changes[];
+};
+
+
+__attribute_cold__
 __attribute_noinline__
 __attribute_nonnull__
-static int  __attribute_regparm__((3))
-bpoll_elt_rearm_immed_impl (bpollset_t * const restrict bpollset,
-                            bpollelt_t ** const restrict bpollelt,
-                            int * const restrict nelts,
-                            const int events, const int flpriv);
-static int  __attribute_regparm__((3))
-bpoll_elt_rearm_immed_impl (bpollset_t * const restrict bpollset,
-                            bpollelt_t ** const restrict bpollelt,
-                            int * const restrict nelts,
-                            const int events, const int flpriv)
+__attribute_warn_unused_result__
+static int
+bpoll_sim_fds_resize (bpollset_t * const restrict bpollset, const int fd);
+static int
+bpoll_sim_fds_resize (bpollset_t * const restrict bpollset, const int fd)
 {
-    int rc;
-    const int n = *nelts;
-
-   #if HAS_KQUEUE
-    if (bpollset->mech == BPOLL_M_KQUEUE)
-        rc = bpoll_elt_add_immed_kqueue(bpollset, bpollelt, nelts,
-                                        events, flpriv);
-    else
-   #endif
-   #if HAS_EVPORT
-    if (bpollset->mech == BPOLL_M_EVPORT)
-        rc = bpoll_elt_add_immed_evport(bpollset, bpollelt, nelts,
-                                        events, flpriv);
-    else
-   #endif
-   #if HAS_POLLSET
-    if (bpollset->mech == BPOLL_M_POLLSET)
-        rc = bpoll_elt_add_immed_pollset(bpollset, bpollelt, nelts,
-                                         events, flpriv);
-    else
-   #endif
-   #if HAS_DEVPOLL
-    if (bpollset->mech == BPOLL_M_DEVPOLL)
-        rc = bpoll_elt_add_immed_devpoll(bpollset, bpollelt, nelts,
-                                         events, flpriv);
-    else
-   #endif
-   #if HAS_EPOLL
-    if (bpollset->mech == BPOLL_M_EPOLL)
-        rc = bpoll_elt_add_immed_epoll(bpollset, bpollelt, nelts,
-                                       events, flpriv);
-    else
-   #endif
-        /* BPOLL_M_POLL does not support immed add while another thread polls */
-        rc = (errno = EINVAL);
+    struct bpoll_sim * const restrict sim = bpollset->sim;
+    size_t sz = sim->fds_sz != 0 ? (size_t)sim->fds_sz : BPOLL_FD_THRESH;
+    struct bpoll_sim_fd *fds;
 
-  #if !HAS_KQUEUE && !HAS_EVPORT && !HAS_POLLSET && !HAS_DEVPOLL && !HAS_EPOLL
-    /* (quell compiler warnings for unused params and unused routines) */
-    (void)bpollset; (void)bpollelt; (void)events; (void)flpriv;
-    (void)&bpoll_fd_add_thrsafe; (void)&bpoll_elt_abort;
-  #endif
+    while (sz <= (size_t)fd) {
+        if (__builtin_expect( (sz > UINT_MAX/sizeof(*fds)/2), 0))
+            return (errno = ENOMEM);
+        sz <<= 1;
+    }
+    fds = (struct bpoll_sim_fd *)
+      bpollset->fn_mem_alloc(bpollset->vdata, sz * sizeof(*fds));
+    if (__builtin_expect( (fds == NULL), 0))
+        return (errno = ENOMEM);
 
-    /* some elements might have been added even if return value != 0 */
-    return __builtin_expect( (n == *nelts), 1)
-      ? rc
-      : rc != 0 ? rc : ((errno = ENOSPC), -1);
+    if (sim->fds != NULL) {
+        memcpy(fds, sim->fds, (size_t)sim->fds_sz * sizeof(*fds));
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, sim->fds);
+    }
+    for (size_t i = (size_t)sim->fds_sz; i < sz; ++i) {
+        fds[i].ptr     = NULL;
+        fds[i].events  = 0;
+        fds[i].mask    = 0;
+        fds[i].revents = 0;
+        fds[i].next    = BPOLL_SIM_UNQUEUED;
+    }
+    sim->fds    = fds;
+    sim->fds_sz = (unsigned int)sz;
+    return 0;
 }
 
 
-/*
- * bpoll public interfaces
- */
+__attribute_nonnull__
+static void
+bpoll_sim_enqueue (struct bpoll_sim * const restrict sim, const int fd);
+static void
+bpoll_sim_enqueue (struct bpoll_sim * const restrict sim, const int fd)
+{
+    if (sim->fds[fd].next == BPOLL_SIM_UNQUEUED) {
+        sim->fds[fd].next = -1;
+        if (sim->tail != -1)
+            sim->fds[sim->tail].next = fd;
+        else
+            sim->head = fd;
+        sim->tail = fd;
+    }
+}
 
 
-unsigned int
-bpoll_mechanisms (void)
+static void
+bpoll_sim_cleanup (bpollset_t * const restrict bpollset)
 {
-    return BPOLL_M_POLL
-       #if HAS_DEVPOLL
-         | BPOLL_M_DEVPOLL
-       #endif
-       #if HAS_EPOLL
-         | BPOLL_M_EPOLL
-       #endif
-       #if HAS_KQUEUE
-         | BPOLL_M_KQUEUE
-       #endif
-       #if HAS_EVPORT
-         | BPOLL_M_EVPORT
-       #endif
-       #if HAS_POLLSET
-         | BPOLL_M_POLLSET
-       #endif
-         ;
+    struct bpoll_sim * const restrict sim = bpollset->sim;
+    if (sim != NULL) {
+        if (sim->fds != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, sim->fds);
+        bpollset->fn_mem_free(bpollset->vdata, sim);
+        bpollset->sim = NULL;
+    }
 }
 
 
-int  __attribute_regparm__((1))
-bpoll_flush_pending (bpollset_t * const restrict bpollset)
+__attribute_nonnull__
+static int
+bpoll_init_sim (bpollset_t * const restrict bpollset);
+static int
+bpoll_init_sim (bpollset_t * const restrict bpollset)
 {
-    if (bpollset->idx != 0 || bpollset->rmidx != 0) {
-        switch (bpollset->mech) {
-         #if HAS_KQUEUE
-          case BPOLL_M_KQUEUE:
-            if (0 == bpoll_commit_kevents(bpollset)) break;
-            return errno;
-         #endif
-         #if HAS_EVPORT
-          case BPOLL_M_EVPORT:
+    /* For BPOLL_M_SIM, double the size of event array to allow for
+     * modifications to be cached at the same time that results are processed.*/
+    const unsigned int limit = bpollset->queue_sz;
+    const unsigned int n = limit << 1; /*half for changes, half for result set*/
+    struct bpoll_sim *sim;
+    bpollset->mech = BPOLL_M_SIM;
+    if (limit > INT_MAX
+        || n > (UINT_MAX - sizeof(struct bpoll_sim))
+               / sizeof(struct bpoll_sim_event))
+        return (errno = EINVAL);
+    sim = (struct bpoll_sim *)
+      bpollset->fn_mem_alloc(bpollset->vdata, sizeof(struct bpoll_sim)
+                                          + n*sizeof(struct bpoll_sim_event));
+    if (sim == NULL)
+        return errno;
+    sim->fds    = NULL;
+    sim->fds_sz = 0;
+    sim->head   = -1;
+    sim->tail   = -1;
+    sim->ready  = sim->changes+limit;
+    bpollset->sim = sim;
+    return bpoll_sim_fds_resize(bpollset, (bpollset->limit <= BPOLL_FD_THRESH)
+                                          ? BPOLL_FD_THRESH-1
+                                          : (BPOLL_FD_THRESH<<1)-1);
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static void
+bpoll_maint_sim (bpollset_t * const restrict bpollset);
+static void
+bpoll_maint_sim (bpollset_t * const restrict bpollset)
+{
+    /* remove from simulated interest set (readiness not yet returned is
+     * discarded; stale ready queue entry is skipped by bpoll_kernel_sim()) */
+    struct bpoll_sim * const restrict sim = bpollset->sim;
+    bpollelt_t ** const restrict rmlist = bpollset->rmlist;
+    const int rmidx = bpollset->rmidx;
+    for (int idx = 0; idx < rmidx; ++idx) {
+        const unsigned int fd = (unsigned int)rmlist[idx]->fd;
+        if (fd < sim->fds_sz && sim->fds[fd].ptr == rmlist[idx]) {
+            BPOLL_STATS_INC(bpollset, ctl_del);
+            sim->fds[fd].ptr     = NULL;
+            sim->fds[fd].events  = 0;
+            sim->fds[fd].mask    = 0;
+            sim->fds[fd].revents = 0;
+        }
+    }
+    bpoll_maint_default(bpollset);
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+__attribute_warn_unused_result__
+static int
+bpoll_commit_sim_impl (bpollset_t * const restrict bpollset,
+                       const struct bpoll_sim_event * const restrict changes,
+                       const int n);
+static int
+bpoll_commit_sim_impl (bpollset_t * const restrict bpollset,
+                       const struct bpoll_sim_event * const restrict changes,
+                       const int n)
+{
+    struct bpoll_sim * const restrict sim = bpollset->sim;
+    struct bpoll_sim_fd * restrict f;
+    bpollelt_t *bpollelt;
+
+    for (int i = 0; i < n; ++i) {
+        bpollelt = changes[i].ptr;
+        bpollelt->idx = ~0u;
+        if (bpollelt->flpriv & BPOLL_FL_CTL_DEL)
+            continue;
+      #if BPOLL_STATS
+        if (bpollelt->flpriv & BPOLL_FL_CTL_ADD)
+            BPOLL_STATS_INC(bpollset, ctl_add);
+        else
+            BPOLL_STATS_INC(bpollset, ctl_mod);
+      #endif
+        bpollelt->flpriv &= ~BPOLL_FL_CTL_ADD;
+        if (__builtin_expect( ((unsigned int)bpollelt->fd >= sim->fds_sz), 0)
+            && bpoll_sim_fds_resize(bpollset, bpollelt->fd) != 0)
+            return -1;  /* errno == ENOMEM */
+        f = sim->fds+bpollelt->fd;
+        f->ptr    = bpollelt;
+        f->events = changes[i].events;
+        f->mask   = changes[i].events | BPOLLERR | BPOLLHUP | BPOLLNVAL;
+        if (f->revents & f->mask)
+            bpoll_sim_enqueue(sim, bpollelt->fd);
+    }
+    return 0;
+}
+
+
+__attribute_nonnull__
+__attribute_warn_unused_result__
+static int  __attribute_regparm__((1))
+bpoll_commit_sim_events (bpollset_t * const restrict bpollset);
+static int  __attribute_regparm__((1))
+bpoll_commit_sim_events (bpollset_t * const restrict bpollset)
+{
+    const int rc = (BPOLL_COMMIT_NOTE(bpollset, (int)bpollset->idx),
+                    bpoll_commit_sim_impl(bpollset, bpollset->sim->changes,
+                                          (int)bpollset->idx));
+    if (__builtin_expect( (rc == 0), 1)) {
+        bpollset->idx = 0;
+        if (bpollset->rmidx != 0)
+            bpoll_maint_sim(bpollset);
+    }
+    return rc;
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_kernel_sim (bpollset_t * const restrict bpollset);
+static int
+bpoll_kernel_sim (bpollset_t * const restrict bpollset)
+{
+    struct bpoll_sim * const restrict sim = bpollset->sim;
+    struct bpoll_sim_event * const restrict ready = sim->ready;
+    struct bpoll_sim_fd * restrict f;
+    const int queue_sz = (int)bpollset->queue_sz;
+    int n = 0, fd;
+
+    /* write pending changes */
+    bpollset->nfound = -1; /* reset if chance of return before probe kernel */
+    if ((bpollset->idx != 0 || bpollset->rmidx != 0)
+        && bpoll_commit_sim_events(bpollset) != 0)
+        return -1;
+
+    /* dequeue ready fds (does not block; timeout is ignored)
+     * (revents returned are consumed; BPOLLDISPATCH disables until re-armed) */
+    while (n < queue_sz && (fd = sim->head) != -1) {
+        f = sim->fds+fd;
+        sim->head = f->next;
+        f->next = BPOLL_SIM_UNQUEUED;
+        if (f->revents & f->mask) {
+            ready[n].ptr    = f->ptr;
+            ready[n].events = f->revents & f->mask;
+            f->revents &= ~f->mask;
+            if (f->events & BPOLLDISPATCH)
+                f->mask = 0;
+            ++n;
+        }
+    }
+    if (sim->head == -1)
+        sim->tail = -1;
+
+    /* perform deferred bpollset maint after committing changes to kernel */
+    bpoll_maint_mem_block(bpollset);
+
+    return (bpollset->nfound = n);
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_process_sim (bpollset_t * const restrict bpollset);
+static int
+bpoll_process_sim (bpollset_t * const restrict bpollset)
+{
+    struct bpoll_sim_event * const restrict ready = bpollset->sim->ready;
+    bpollelt_t * restrict bpollelt;
+    bpollelt_t ** const restrict results = bpollset->results;
+    const int nfound = bpollset->nfound;
+
+    if (results != NULL) {
+        for (int i = 0; i < nfound; ++i) {
+            results[i] = bpollelt = ready[i].ptr;
+            BPOLL_ELT_REVENTS_SET(bpollelt, ready[i].events);
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
+            if (bpollelt->events & BPOLLDISPATCH)
+                bpollelt->flpriv |= BPOLL_FL_DISPATCHED;
+        }
+    }
+    else {
+        bpoll_fn_cb_event_t const fn_cb_event = bpollset->fn_cb_event;
+        for (int i = 0; i < nfound; ++i) {
+            bpollelt = ready[i].ptr;
+            BPOLL_ELT_REVENTS_SET(bpollelt, ready[i].events);
+            BPOLL_TRACE_ELT_READY(bpollset, bpollelt);
+            if (bpollelt->events & BPOLLDISPATCH)
+                bpollelt->flpriv |= BPOLL_FL_DISPATCHED;
+            BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, -1);
+            BPOLL_ELT_REVENTS_DONE(bpollelt);
+        }
+    }
+    return nfound;
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_elt_add_immed_sim (bpollset_t * const restrict bpollset,
+                         bpollelt_t ** const restrict bpollelt,
+                         int * const restrict nelts,
+                         const int events, const int flpriv);
+static int
+bpoll_elt_add_immed_sim (bpollset_t * const restrict bpollset,
+                         bpollelt_t ** const restrict bpollelt,
+                         int * const restrict nelts,
+                         const int events, const int flpriv)
+{
+    int i = 0, idx, rc;
+    const int n = *nelts;
+    struct bpoll_sim_event changes[BPOLL_IMMED_SZ];
+    while (i != n) {
+        for (idx=0; i < n && idx < BPOLL_IMMED_SZ; ++idx, ++i) {
+            changes[idx].ptr    = bpollelt[i];
+            changes[idx].events = events;
+            bpollelt[i]->events = events;
+            if (flpriv == BPOLL_FL_CTL_ADD) {
+                bpollelt[i]->revents = 0;
+                bpollelt[i]->flpriv |= BPOLL_FL_CTL_ADD;
+            }
+            else
+                bpollelt[i]->flpriv &= ~BPOLL_FL_DISPATCHED;
+        }
+        rc = bpoll_commit_sim_impl(bpollset, changes, idx);
+        if (__builtin_expect((rc != 0), 0)) {
+            *nelts = (i -= idx);
+            return rc;
+        }
+    }
+    return 0;
+}
+
+
+#define bpoll_prepidx_sim(bpollset)                                           \
+    __builtin_prefetch(bpollset->sim->changes+bpollset->idx, 1, 1),           \
+      (__builtin_expect( (bpollset->idx == bpollset->queue_sz), 0)            \
+       && (BPOLL_STATS_INC(bpollset, queue_full), 1)                          \
+       && __builtin_expect( (bpoll_commit_sim_events(bpollset) != 0), 0))     \
+
+
+__attribute_nonnull__
+static int  __attribute_regparm__((3))
+bpoll_elt_add_sim (bpollset_t * const restrict bpollset,
+                   bpollelt_t * const restrict bpollelt,
+                   const int events);
+static int  __attribute_regparm__((3))
+bpoll_elt_add_sim (bpollset_t * const restrict bpollset,
+                   bpollelt_t * const restrict bpollelt,
+                   const int events)
+{
+    unsigned int idx;
+    int rc;
+    if (bpoll_prepidx_sim(bpollset)) /* macro */
+        return errno;
+    rc = bpoll_fd_add(bpollset, bpollelt);
+    if (__builtin_expect((rc != 0), 0)) {
+        return rc;
+    }
+    idx = bpollset->idx++;
+    bpollset->sim->changes[idx].ptr    = bpollelt;
+    bpollset->sim->changes[idx].events = events;
+    bpollelt->events = events;
+    bpollelt->revents = 0;
+    bpollelt->idx = idx;
+    bpollelt->flpriv |= BPOLL_FL_CTL_ADD;
+    return 0;
+}
+
+
+__attribute_nonnull__
+static int  __attribute_regparm__((3))
+bpoll_elt_modify_sim (bpollset_t * const restrict bpollset,
+                      bpollelt_t * const restrict bpollelt,
+                      const int events);
+static int  __attribute_regparm__((3))
+bpoll_elt_modify_sim (bpollset_t * const restrict bpollset,
+                      bpollelt_t * const restrict bpollelt,
+                      const int events)
+{
+    unsigned int idx = bpollelt->idx;
+    if (idx >= bpollset->idx) {  /* ~0u if no pending change */
+        if (bpoll_prepidx_sim(bpollset)) /* macro */
+            return errno;
+        idx = bpollset->idx++;
+    }
+    bpollset->sim->changes[idx].ptr    = bpollelt;
+    bpollset->sim->changes[idx].events = events;
+    bpollelt->events = events;
+    bpollelt->flpriv &= ~BPOLL_FL_DISPATCHED;
+    bpollelt->idx = idx;
+    return 0;
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static int  __attribute_regparm__((3))
+bpoll_elt_rearm_immed_impl (bpollset_t * const restrict bpollset,
+                            bpollelt_t ** const restrict bpollelt,
+                            int * const restrict nelts,
+                            const int events, const int flpriv);
+static int  __attribute_regparm__((3))
+bpoll_elt_rearm_immed_impl (bpollset_t * const restrict bpollset,
+                            bpollelt_t ** const restrict bpollelt,
+                            int * const restrict nelts,
+                            const int events, const int flpriv)
+{
+    int rc;
+    const int n = *nelts;
+
+   #if HAS_KQUEUE
+    if (bpollset->mech == BPOLL_M_KQUEUE)
+        rc = bpoll_elt_add_immed_kqueue(bpollset, bpollelt, nelts,
+                                        events, flpriv);
+    else
+   #endif
+   #if HAS_EVPORT
+    if (bpollset->mech == BPOLL_M_EVPORT)
+        rc = bpoll_elt_add_immed_evport(bpollset, bpollelt, nelts,
+                                        events, flpriv);
+    else
+   #endif
+   #if HAS_POLLSET
+    if (bpollset->mech == BPOLL_M_POLLSET)
+        rc = bpoll_elt_add_immed_pollset(bpollset, bpollelt, nelts,
+                                         events, flpriv);
+    else
+   #endif
+   #if HAS_DEVPOLL
+    if (bpollset->mech == BPOLL_M_DEVPOLL)
+        rc = bpoll_elt_add_immed_devpoll(bpollset, bpollelt, nelts,
+                                         events, flpriv);
+    else
+   #endif
+   #if HAS_EPOLL
+    if (bpollset->mech == BPOLL_M_EPOLL)
+        rc = bpoll_elt_add_immed_epoll(bpollset, bpollelt, nelts,
+                                       events, flpriv);
+    else
+   #endif
+    if (bpollset->mech == BPOLL_M_SIM)
+        rc = bpoll_elt_add_immed_sim(bpollset, bpollelt, nelts,
+                                     events, flpriv);
+    else
+        /* BPOLL_M_POLL does not support immed add while another thread polls */
+        rc = (errno = EINVAL);
+
+  #if !HAS_KQUEUE && !HAS_EVPORT && !HAS_POLLSET && !HAS_DEVPOLL && !HAS_EPOLL
+    /* (quell compiler warnings for unused routines) */
+    (void)&bpoll_fd_add_thrsafe; (void)&bpoll_elt_abort;
+  #endif
+
+    /* some elements might have been added even if return value != 0 */
+    return __builtin_expect( (n == *nelts), 1)
+      ? rc
+      : rc != 0 ? rc : ((errno = ENOSPC), -1);
+}
+
+
+/*
+ * bpoll public interfaces
+ */
+
+
+unsigned int
+bpoll_mechanisms (void)
+{
+    return BPOLL_M_POLL
+       #if HAS_DEVPOLL
+         | BPOLL_M_DEVPOLL
+       #endif
+       #if HAS_EPOLL
+         | BPOLL_M_EPOLL
+       #endif
+       #if HAS_KQUEUE
+         | BPOLL_M_KQUEUE
+       #endif
+       #if HAS_EVPORT
+         | BPOLL_M_EVPORT
+       #endif
+       #if HAS_POLLSET
+         | BPOLL_M_POLLSET
+       #endif
+         ;
+}
+
+
+int
+bpoll_stats_get (const bpollset_t * const restrict bpollset,
+                 bpoll_stats_t * const restrict stats)
+{
+  #if BPOLL_STATS
+    *stats = bpollset->stats;
+    return 0;
+  #else
+    (void)bpollset;
+    memset(stats, 0, sizeof(*stats));
+    return (errno = ENOSYS);
+  #endif
+}
+
+
+#ifdef _THREAD_SAFE
+
+/* multi-producer, single-consumer ring of bpollelts to remove
+ * (bpoll_elt_remove_thrsafe() from any thread; swept by owning thread)
+ * (ring sized to power of 2 >= bpollset limit; each bpollelt is enqueued at
+ *  most once before it is swept, so ring can not overflow) */
+struct bpoll_rmq {
+    unsigned int mask;
+    unsigned int head;          /* owning thread */
+    unsigned int tail;          /* atomic; producers reserve slot */
+    unsigned int npending;      /* atomic; incremented after slot stored */
+    bpollelt_t *ring[];
+};
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static unsigned int  __attribute_regparm__((1))
+bpoll_rmq_sweep (bpollset_t * const restrict bpollset);
+static unsigned int  __attribute_regparm__((1))
+bpoll_rmq_sweep (bpollset_t * const restrict bpollset)
+{
+    /* (owning thread) bpoll_elt_remove() bpollelts queued by other threads
+     * (returns number of bpollelts left queued if sweep stopped early) */
+    struct bpoll_rmq * const restrict rmq = bpollset->rmq;
+    bpollelt_t *bpollelt;
+    unsigned int m, n = plasma_atomic_ld_nopt(&rmq->npending);
+    plasma_membar_ld_acq();
+    while (n != 0) {
+        for (m = 0; m < n; ++m, ++rmq->head) {
+            bpollelt_t ** const slot = &rmq->ring[rmq->head & rmq->mask];
+            /* (slot reserved but not yet stored by a producer preempted
+             *  between reserving and storing; npending counts stored slots,
+             *  which may lie beyond the unstored slot; resume here on next
+             *  sweep rather than wait on producer) */
+            bpollelt = plasma_atomic_ld_nopt(slot);
+            if (bpollelt == NULL)
+                break;
+            plasma_membar_ld_acq();
+            /* (ENOMEM growing rmlist; leave queued and retry next sweep) */
+            if (bpoll_elt_remove(bpollset, bpollelt) == ENOMEM)
+                break;
+            *slot = NULL;
+        }
+        if (m < n)
+            return plasma_atomic_fetch_sub_u32(&rmq->npending, m,
+                                               memory_order_acq_rel) - m;
+        n = plasma_atomic_fetch_sub_u32(&rmq->npending, n,
+                                        memory_order_acq_rel) - n;
+    }
+    return 0;
+}
+
+#endif /* _THREAD_SAFE */
+
+
+int  __attribute_regparm__((1))
+bpoll_flush_pending (bpollset_t * const restrict bpollset)
+{
+  #ifdef _THREAD_SAFE
+    if (bpollset->rmq != NULL
+        && plasma_atomic_ld_nopt(&bpollset->rmq->npending) != 0)
+        bpoll_rmq_sweep(bpollset);
+  #endif
+
+    if (bpollset->idx != 0 || bpollset->rmidx != 0) {
+        switch (bpollset->mech) {
+         #if HAS_KQUEUE
+          case BPOLL_M_KQUEUE:
+            if (0 == bpoll_commit_kevents(bpollset)) break;
+            return errno;
+         #endif
+         #if HAS_EVPORT
+          case BPOLL_M_EVPORT:
             if (0 == bpoll_commit_evport_events(bpollset)) break;
             return errno;
          #endif
@@ -3455,6 +4327,9 @@ bpoll_flush_pending (bpollset_t * const restrict bpollset)
             if (0 == bpoll_commit_epoll_events(bpollset)) break;
             return errno;
          #endif
+          case BPOLL_M_SIM:
+            if (0 == bpoll_commit_sim_events(bpollset)) break;
+            return errno;
           case BPOLL_M_POLL:
             break;
           default:
@@ -3462,43 +4337,719 @@ bpoll_flush_pending (bpollset_t * const restrict bpollset)
         }
     }
 
-    /* close() fds pending on rmlist and remove bpollelt from bpollset
-     * (Note: this should follow commit of any other pending changes to kernel;
-     *  pending lists might conceivably reference bpollelt elements of rmlist)*/
-    if (bpollset->rmidx != 0) {
-      #if HAS_EVPORT
-        if (bpollset->mech == BPOLL_M_EVPORT)
-            bpoll_maint_evport(bpollset);
-        else
-      #endif
-      #if HAS_EPOLL
-        if (bpollset->mech == BPOLL_M_EPOLL)
-            bpoll_maint_epoll(bpollset);
-        else
+    /* close() fds pending on rmlist and remove bpollelt from bpollset
+     * (Note: this should follow commit of any other pending changes to kernel;
+     *  pending lists might conceivably reference bpollelt elements of rmlist)*/
+    if (bpollset->rmidx != 0) {
+      #if HAS_EVPORT
+        if (bpollset->mech == BPOLL_M_EVPORT)
+            bpoll_maint_evport(bpollset);
+        else
+      #endif
+      #if HAS_EPOLL
+        if (bpollset->mech == BPOLL_M_EPOLL)
+            bpoll_maint_epoll(bpollset);
+        else
+      #endif
+        if (bpollset->mech == BPOLL_M_SIM)
+            bpoll_maint_sim(bpollset);
+        else
+            bpoll_maint_default(bpollset);
+    }
+
+    bpoll_maint_mem_block(bpollset);
+
+    return 0;
+}
+
+
+__attribute_cold__
+__attribute_nonnull__
+__attribute_unused__
+static int
+bpoll_pipe_nonblock (int * const restrict pipefds);
+static int
+bpoll_pipe_nonblock (int * const restrict pipefds)
+{
+    /* (returns 0 on success, else the value of errno) */
+    if (0 != pipe(pipefds))
+        return errno;
+    if (0 != fcntl(pipefds[0], F_SETFL, fcntl(pipefds[0],F_GETFL) | O_NONBLOCK)
+        || 0 != fcntl(pipefds[1],F_SETFL,fcntl(pipefds[1],F_GETFL) | O_NONBLOCK)
+        || 0 != fcntl(pipefds[0], F_SETFD, FD_CLOEXEC)
+        || 0 != fcntl(pipefds[1], F_SETFD, FD_CLOEXEC)) {
+        const int errnum = errno;
+        close(pipefds[0]);
+        close(pipefds[1]);
+        return (errno = errnum);
+    }
+    return 0;
+}
+
+
+static void
+bpoll_pipe_drain (const int fd);
+static void
+bpoll_pipe_drain (const int fd)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) == (ssize_t)sizeof(buf))
+        ;
+}
+
+
+#ifdef _THREAD_SAFE
+
+struct bpoll_vsignal {
+    bpollelt_t *bpollelt;
+    int revents;
+};
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static void  __attribute_regparm__((1))
+bpoll_vsig_drain (bpollset_t * const restrict bpollset);
+static void  __attribute_regparm__((1))
+bpoll_vsig_drain (bpollset_t * const restrict bpollset)
+{
+    /* (owning thread) move bpoll_elt_signal_thrsafe() queue to ready list */
+    struct bpoll_vsignal * restrict vsig;
+    int i, n;
+    if (__builtin_expect( (pthread_mutex_lock(&bpollset->mutex) != 0), 0))
+        return;
+    vsig = bpollset->vsig;
+    n = bpollset->vsig_idx;
+    for (i = 0; i < n; ++i) {
+        if (!(vsig[i].bpollelt->flpriv & BPOLL_FL_CTL_DEL))
+            bpoll_elt_signal(bpollset, vsig[i].bpollelt, vsig[i].revents);
+    }
+    bpollset->vsig_idx = 0;
+    pthread_mutex_unlock(&bpollset->mutex);
+}
+
+#endif /* _THREAD_SAFE */
+
+
+int  __attribute_regparm__((1))
+bpoll_enable_thrsafe_add(bpollset_t * const restrict bpollset)
+{
+  #ifdef _THREAD_SAFE
+    return (bpollset->mech != BPOLL_M_POLL
+            && bpollset->mech != BPOLL_M_SIM /*(sim interest set not locked)*/
+            && bpollset->bpollelts_sz > BPOLL_FD_THRESH)
+      ? (int)(bpollset->clr = 0u)
+      : (errno = EINVAL);
+  #else    /* avoid variable unused warning for bpollset */
+    return (errno = EINVAL) | (bpollset->mech == BPOLL_M_NOT_SET);
+  #endif
+}
+
+
+int  __attribute_regparm__((1))
+bpoll_enable_thrsafe_signal (bpollset_t * const restrict bpollset)
+{
+  #ifdef _THREAD_SAFE
+    bpollelt_t *bpollelt;
+    int pipefds[2];
+    int rc;
+    if (bpollset->vsig_elt != NULL)
+        return 0;
+    if (bpollset->mech == BPOLL_M_NOT_SET)
+        return (errno = EINVAL);
+    if (0 != (rc = bpoll_pipe_nonblock(pipefds)))
+        return rc;
+    bpollelt = bpoll_elt_init(bpollset, NULL, pipefds[0],
+                              BPOLL_FD_PIPE, BPOLL_FL_CLOSE);
+    if (__builtin_expect( (bpollelt == NULL), 0))
+        rc = errno;
+    else if (0 != (rc = bpoll_elt_add(bpollset, bpollelt, BPOLLIN)))
+        bpoll_elt_destroy(bpollset, bpollelt);
+    if (__builtin_expect( (rc != 0), 0)) {
+        close(pipefds[0]);
+        close(pipefds[1]);
+        return (errno = rc);
+    }
+    bpollelt->flpriv  |= BPOLL_FL_INTERNAL;
+    ++bpollset->nintern;
+    bpollset->vsig_fd  = pipefds[1];
+    bpollset->vsig_elt = bpollelt;
+    return 0;
+  #else    /* avoid variable unused warning for bpollset */
+    return (errno = EINVAL) | (bpollset->mech == BPOLL_M_NOT_SET);
+  #endif
+}
+
+
+int  __attribute_regparm__((1))
+bpoll_enable_thrsafe_remove (bpollset_t * const restrict bpollset)
+{
+  #ifdef _THREAD_SAFE
+    struct bpoll_rmq *rmq;
+    unsigned int sz = 16;
+    if (bpollset->rmq != NULL)
+        return 0;
+    if (bpollset->mech == BPOLL_M_NOT_SET || bpollset->limit > (1u << 30))
+        return (errno = EINVAL);
+    while (sz < bpollset->limit)
+        sz <<= 1;
+    rmq = (struct bpoll_rmq *)
+      bpollset->fn_mem_alloc(bpollset->vdata, sizeof(struct bpoll_rmq)
+                                              + sz * sizeof(bpollelt_t *));
+    if (__builtin_expect( (rmq == NULL), 0))
+        return (errno = ENOMEM);
+    memset(rmq, 0, sizeof(struct bpoll_rmq) + sz * sizeof(bpollelt_t *));
+    rmq->mask = sz - 1;
+    bpollset->rmq = rmq;
+    return 0;
+  #else    /* avoid variable unused warning for bpollset */
+    return (errno = EINVAL) | (bpollset->mech == BPOLL_M_NOT_SET);
+  #endif
+}
+
+
+struct bpoll_sigwatch {
+    sigset_t mask;
+    bpollelt_t *bpollelt;
+    int wfd;
+    bpoll_fn_cb_signal_t fn_cb_signal[BPOLL_NSIG];
+};
+
+
+#if !HAS_SIGNALFD
+/* (self-pipe; one bpollset per process may watch signals) */
+static volatile sig_atomic_t bpoll_sigwatch_wfd = -1;
+
+static void
+bpoll_sigwatch_handler (int signo);
+static void
+bpoll_sigwatch_handler (int signo)
+{
+    const int errnum = errno;
+    const unsigned char c = (unsigned char)signo;
+    const ssize_t wr = write(bpoll_sigwatch_wfd, &c, 1); /*(drop if pipe full)*/
+    (void)wr;
+    errno = errnum;
+}
+#endif
+
+
+__attribute_cold__
+static int
+bpoll_sigwatch_sigmask (const int how, const int signo);
+static int
+bpoll_sigwatch_sigmask (const int how, const int signo)
+{
+    /* (returns 0 on success, else the value of errno) */
+  #if HAS_SIGNALFD
+    sigset_t sigs;
+   #ifdef _THREAD_SAFE
+    int rc;
+   #endif
+    sigemptyset(&sigs);
+    sigaddset(&sigs, signo);
+   #ifdef _THREAD_SAFE
+    rc = pthread_sigmask(how, &sigs, NULL);
+    return (rc == 0) ? 0 : (errno = rc);
+   #else
+    return (0 == sigprocmask(how, &sigs, NULL)) ? 0 : errno;
+   #endif
+  #else
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = (how == SIG_BLOCK) ? bpoll_sigwatch_handler : SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    return (0 == sigaction(signo, &sa, NULL)) ? 0 : errno;
+  #endif
+}
+
+
+__attribute_cold__
+__attribute_nonnull__
+static int
+bpoll_sigwatch_elt (bpollset_t * const restrict bpollset,
+                    struct bpoll_sigwatch * const restrict sigwatch,
+                    const int fd);
+static int
+bpoll_sigwatch_elt (bpollset_t * const restrict bpollset,
+                    struct bpoll_sigwatch * const restrict sigwatch,
+                    const int fd)
+{
+    /* (caller closes fd on failure) */
+    bpollelt_t * const restrict bpollelt =
+      bpoll_elt_init(bpollset, NULL, fd, BPOLL_FD_SIGNAL, BPOLL_FL_CLOSE);
+    int rc;
+    if (__builtin_expect( (bpollelt == NULL), 0))
+        return errno;
+    if (0 != (rc = bpoll_elt_add(bpollset, bpollelt, BPOLLIN))) {
+        bpoll_elt_destroy(bpollset, bpollelt);
+        return (errno = rc);
+    }
+    bpollelt->flpriv |= BPOLL_FL_INTERNAL;
+    ++bpollset->nintern;
+    sigwatch->bpollelt = bpollelt;
+    return 0;
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static void  __attribute_regparm__((1))
+bpoll_sigwatch_process (bpollset_t * const restrict bpollset);
+static void  __attribute_regparm__((1))
+bpoll_sigwatch_process (bpollset_t * const restrict bpollset)
+{
+    /* (coalesce signals received since last poll; run callbacks in signo
+     *  order; callbacks may call bpoll_signal_watch()) */
+    struct bpoll_sigwatch * const restrict sigwatch = bpollset->sigwatch;
+    const int fd = sigwatch->bpollelt->fd;
+    sigset_t pending;
+    ssize_t rd;
+    int i, signo;
+  #if HAS_SIGNALFD
+    struct signalfd_siginfo ssi[16];
+  #else
+    unsigned char ssi[64];
+  #endif
+    sigemptyset(&pending);
+    do {
+        rd = read(fd, ssi, sizeof(ssi));
+        for (i = 0; i < (int)(rd / (ssize_t)sizeof(ssi[0])); ++i) {
+          #if HAS_SIGNALFD
+            signo = (int)ssi[i].ssi_signo;
+          #else
+            signo = (int)ssi[i];
+          #endif
+            if (signo > 0 && signo < BPOLL_NSIG)
+                sigaddset(&pending, signo);
+        }
+    } while (rd == (ssize_t)sizeof(ssi) || (rd == -1 && errno == EINTR));
+    for (signo = 1; signo < BPOLL_NSIG; ++signo) {
+        if (sigismember(&pending, signo) == 1
+            && sigwatch->fn_cb_signal[signo] != NULL)
+            sigwatch->fn_cb_signal[signo](bpollset, signo);
+    }
+}
+
+
+static void  __attribute_regparm__((2))
+bpoll_elt_internal (bpollset_t * const restrict bpollset,
+                    bpollelt_t * const restrict bpollelt)
+{
+    if (bpollelt->fdtype == BPOLL_FD_SIGNAL)
+        bpollset->sigready = 1;  /*(bpoll_signal_watch(); run after dispatch)*/
+    else                         /*(bpoll_elt_signal_thrsafe() wakeup)*/
+        bpoll_pipe_drain(bpollelt->fd);
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static int  __attribute_regparm__((2))
+bpoll_process_internal (bpollset_t * const restrict bpollset, int n);
+static int  __attribute_regparm__((2))
+bpoll_process_internal (bpollset_t * const restrict bpollset, int n)
+{
+    /* (after bpoll_process_mech() fast path; callbacks handled internal
+     *  bpollelts in bpoll_cb_event_slow(); results mode removes them here) */
+    bpollelt_t ** const restrict results = bpollset->results;
+    bpollelt_t * restrict bpollelt;
+    if (results != NULL) {
+        int i, j;
+        for (i = 0, j = 0; i < n; ++i) {
+            bpollelt = results[i];
+            if (bpollelt != NULL && (bpollelt->flpriv & BPOLL_FL_INTERNAL)) {
+                bpoll_elt_internal(bpollset, bpollelt);
+                bpollelt->revents = 0;
+            }
+            else
+                results[j++] = bpollelt;
+        }
+        n = j;
+    }
+    if (bpollset->sigready) {
+        bpollset->sigready = 0;
+        bpoll_sigwatch_process(bpollset);
+    }
+    return n;
+}
+
+
+static void  __attribute_regparm__((1))
+bpoll_sigwatch_cleanup (bpollset_t * const restrict bpollset)
+{
+    /* (signalfd or pipe read end already closed; BPOLL_FL_CLOSE) */
+    struct bpoll_sigwatch * const restrict sigwatch = bpollset->sigwatch;
+    int signo;
+    for (signo = 1; signo < BPOLL_NSIG; ++signo) {
+        if (sigismember(&sigwatch->mask, signo) == 1)
+            bpoll_sigwatch_sigmask(SIG_UNBLOCK, signo);
+    }
+  #if !HAS_SIGNALFD
+    if (sigwatch->wfd != -1) {
+        bpoll_sigwatch_wfd = -1;
+        close(sigwatch->wfd);
+    }
+  #endif
+    if (bpollset->fn_mem_free != NULL)
+        bpollset->fn_mem_free(bpollset->vdata, sigwatch);
+    bpollset->sigwatch = NULL;
+}
+
+
+int
+bpoll_signal_watch (bpollset_t * const restrict bpollset, const int signo,
+                    bpoll_fn_cb_signal_t const fn_cb_signal)
+{
+    struct bpoll_sigwatch * restrict sigwatch = bpollset->sigwatch;
+    int watched, rc;
+  #if HAS_SIGNALFD
+    sigset_t mask;
+    int fd;
+  #else
+    int pipefds[2];
+  #endif
+    if (signo <= 0 || signo >= BPOLL_NSIG
+        || bpollset->mech == BPOLL_M_NOT_SET)
+        return (errno = EINVAL);
+    watched = sigwatch != NULL && sigismember(&sigwatch->mask, signo) == 1;
+
+    if (fn_cb_signal == NULL) {
+        if (!watched)
+            return 0;
+        sigdelset(&sigwatch->mask, signo);
+        sigwatch->fn_cb_signal[signo] = NULL;
+      #if HAS_SIGNALFD
+        signalfd(sigwatch->bpollelt->fd, &sigwatch->mask,
+                 SFD_NONBLOCK | SFD_CLOEXEC);
+        if (bpollset->sigmaskp != NULL)
+            sigdelset(bpollset->sigmaskp, signo);
       #endif
-            bpoll_maint_default(bpollset);
+        return bpoll_sigwatch_sigmask(SIG_UNBLOCK, signo);
     }
 
-    bpoll_maint_mem_block(bpollset);
+    if (sigwatch == NULL) {
+        sigwatch = (struct bpoll_sigwatch *)
+          bpollset->fn_mem_alloc(bpollset->vdata, sizeof(*sigwatch));
+        if (__builtin_expect( (sigwatch == NULL), 0))
+            return (errno = ENOMEM);
+        memset(sigwatch, 0, sizeof(*sigwatch));
+        sigemptyset(&sigwatch->mask);
+        sigwatch->bpollelt = NULL;
+        sigwatch->wfd = -1;
+        bpollset->sigwatch = sigwatch;
+    }
+
+  #if HAS_SIGNALFD
+    if (!watched) {
+        if (0 != (rc = bpoll_sigwatch_sigmask(SIG_BLOCK, signo)))
+            return rc;
+        mask = sigwatch->mask;
+        sigaddset(&mask, signo);
+        fd = signalfd(sigwatch->bpollelt != NULL ? sigwatch->bpollelt->fd : -1,
+                      &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fd == -1)
+            rc = errno;
+        else if (sigwatch->bpollelt == NULL
+                 && 0 != (rc = bpoll_sigwatch_elt(bpollset, sigwatch, fd)))
+            close(fd);
+        if (__builtin_expect( (rc != 0), 0)) {
+            bpoll_sigwatch_sigmask(SIG_UNBLOCK, signo);
+            return (errno = rc);
+        }
+        if (bpollset->sigmaskp != NULL)
+            sigaddset(bpollset->sigmaskp, signo);
+    }
+  #else
+    if (sigwatch->bpollelt == NULL) {
+        if (bpoll_sigwatch_wfd != -1)
+            return (errno = EBUSY);
+        if (0 != (rc = bpoll_pipe_nonblock(pipefds)))
+            return rc;
+        if (0 != (rc = bpoll_sigwatch_elt(bpollset, sigwatch, pipefds[0]))) {
+            close(pipefds[0]);
+            close(pipefds[1]);
+            return rc;
+        }
+        bpoll_sigwatch_wfd = sigwatch->wfd = pipefds[1];
+    }
+    if (!watched && 0 != (rc = bpoll_sigwatch_sigmask(SIG_BLOCK, signo)))
+        return rc;
+  #endif
 
+    sigaddset(&sigwatch->mask, signo);
+    sigwatch->fn_cb_signal[signo] = fn_cb_signal;
     return 0;
 }
 
 
-int  __attribute_regparm__((1))
-bpoll_enable_thrsafe_add(bpollset_t * const restrict bpollset)
+#if HAS_PIDFD
+/*(pidfd_open() glibc wrapper is recent (glibc 2.36); invoke via syscall())*/
+#define bpoll_pidfd_open(pid) ((int)syscall(SYS_pidfd_open, (pid), 0))
+/*(P_PIDFD is idtype_t enum (not macro) in glibc 2.36+; <linux/wait.h> value)*/
+#define BPOLL_P_PIDFD ((idtype_t)3)
+#endif
+
+
+bpollelt_t *
+bpoll_child_adopt (bpollset_t * const restrict bpollset,
+                   bpollelt_t * const restrict bpollelt, const pid_t pid)
 {
-  #ifdef _THREAD_SAFE
-    return (bpollset->mech != BPOLL_M_POLL
-            && bpollset->bpollelts_sz > BPOLL_FD_THRESH)
-      ? (int)(bpollset->clr = 0u)
-      : (errno = EINVAL);
-  #else    /* avoid variable unused warning for bpollset */
-    return (errno = EINVAL) | (bpollset->mech == BPOLL_M_NOT_SET);
+  #if HAS_PIDFD
+    bpollelt_t * restrict elt;
+    int fd, rc;
+    if (pid <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    fd = bpoll_pidfd_open(pid);  /*(pidfd is O_CLOEXEC)*/
+    if (fd == -1)
+        return NULL;
+    elt = bpoll_elt_init(bpollset, bpollelt, fd, BPOLL_FD_PIDFD,
+                         BPOLL_FL_CLOSE);
+    if (__builtin_expect( (elt == NULL), 0))
+        rc = errno;
+    else if (0 != (rc = bpoll_elt_add(bpollset, elt, BPOLLIN)))
+        bpoll_elt_destroy(bpollset, elt);
+    if (__builtin_expect( (rc != 0), 0)) {
+        close(fd);
+        errno = rc;
+        return NULL;
+    }
+    return elt;
+  #else
+    (void)bpollset; (void)bpollelt; (void)pid;
+    errno = ENOSYS;
+    return NULL;
   #endif
 }
 
 
+bpollelt_t *
+bpoll_child_spawn (bpollset_t * const restrict bpollset,
+                   bpollelt_t * const restrict bpollelt,
+                   pid_t * const restrict pid,
+                   const char * const restrict path,
+                   char * const argv[], char * const envp[])
+{
+  #if HAS_PIDFD
+    bpollelt_t * restrict elt;
+    posix_spawnattr_t attr;
+    sigset_t sigs;
+    pid_t cpid;
+    int rc;
+
+    /* (child starts with empty signal mask and default disposition of
+     *  signals watched by bpoll_signal_watch(), which are blocked (signalfd)
+     *  or caught (self-pipe) in parent) */
+    if (0 != (rc = posix_spawnattr_init(&attr))) {
+        errno = rc;
+        return NULL;
+    }
+    sigemptyset(&sigs);
+    rc = posix_spawnattr_setsigmask(&attr, &sigs);
+    if (0 == rc && bpollset->sigwatch != NULL)
+        sigs = bpollset->sigwatch->mask;
+    if (0 == rc)
+        rc = posix_spawnattr_setsigdefault(&attr, &sigs);
+    if (0 == rc)
+        rc = posix_spawnattr_setflags(&attr,
+                                      POSIX_SPAWN_SETSIGMASK
+                                     |POSIX_SPAWN_SETSIGDEF);
+    if (0 == rc)
+        rc = posix_spawn(&cpid, path, NULL, &attr, argv,
+                         envp != NULL ? envp : environ);
+    posix_spawnattr_destroy(&attr);
+    if (0 != rc) {
+        errno = rc;
+        return NULL;
+    }
+    if (pid != NULL)
+        *pid = cpid;
+    elt = bpoll_child_adopt(bpollset, bpollelt, cpid);
+    if (__builtin_expect( (elt == NULL), 0)) {
+        rc = errno;
+        kill(cpid, SIGKILL);
+        while (-1 == waitpid(cpid, NULL, 0) && errno == EINTR)
+            ;
+        errno = rc;
+    }
+    return elt;
+  #else
+    (void)bpollset; (void)bpollelt; (void)pid;
+    (void)path; (void)argv; (void)envp;
+    errno = ENOSYS;
+    return NULL;
+  #endif
+}
+
+
+int
+bpoll_child_reap (bpollelt_t * const restrict bpollelt,
+                  int * const restrict status)
+{
+  #if HAS_PIDFD
+    siginfo_t info;
+    pid_t rc;
+    if (bpollelt->fdtype != BPOLL_FD_PIDFD)
+        return (errno = EINVAL);
+    /* (WNOWAIT: obtain pid from pidfd, then waitpid() for status in the
+     *  native format expected by WIFEXITED(), WEXITSTATUS(), etc.) */
+    info.si_pid = 0;
+    if (0 != waitid(BPOLL_P_PIDFD, (id_t)bpollelt->fd, &info,
+                    WEXITED | WNOHANG | WNOWAIT))
+        return errno;
+    if (info.si_pid == 0)
+        return (errno = EAGAIN);
+    do {
+        rc = waitpid(info.si_pid, status, WNOHANG);
+    } while (rc == -1 && errno == EINTR);
+    return (rc == info.si_pid) ? 0 : (rc == 0) ? (errno = EAGAIN) : errno;
+  #else
+    (void)bpollelt; (void)status;
+    return (errno = ENOSYS);
+  #endif
+}
+
+
+#ifndef BPOLL_ACCEPT_BATCH
+#define BPOLL_ACCEPT_BATCH 32  /* accepted bpollelts per bpoll_elt_add_immed() */
+#endif
+
+__attribute_nonnull__
+static void
+bpoll_accept_add (bpollset_t * const restrict bpollset,
+                  bpollelt_t ** const restrict elts,
+                  const int * const restrict events, const int n);
+static void
+bpoll_accept_add (bpollset_t * const restrict bpollset,
+                  bpollelt_t ** const restrict elts,
+                  const int * const restrict events, const int n)
+{
+    /* add runs of accepted bpollelts with same events in bulk
+     * (bpollelts not added (e.g. bpollset full) are closed and freed) */
+    int i, j, m;
+    if (bpollset->mech == BPOLL_M_POLL) {
+        /* (no immed add for BPOLL_M_POLL; bpoll_elt_add() makes no syscall) */
+        for (i = 0; i < n; ++i) {
+            if (0 != bpoll_elt_add(bpollset, elts[i], events[i])) {
+                bpoll_elt_close(bpollset, elts[i]);
+                bpoll_elt_free(bpollset, elts[i]);
+            }
+        }
+        return;
+    }
+    for (i = 0; i < n; i = j) {
+        for (j = i+1; j < n && events[j] == events[i]; ++j)
+            ;
+        m = j - i;
+        if (0 != bpoll_elt_add_immed(bpollset, elts+i, &m, events[i])
+            || m != j - i) {
+            for (m += i; m < j; ++m) {
+                bpoll_elt_close(bpollset, elts[m]);
+                bpoll_elt_free(bpollset, elts[m]);
+            }
+        }
+    }
+}
+
+
+int
+bpoll_accept_batch (bpollset_t * const restrict bpollset,
+                    bpollelt_t * const restrict listen_elt,
+                    const int max, bpoll_fn_cb_accept_t const fn_cb_accept)
+{
+    bpollelt_t *elts[BPOLL_ACCEPT_BATCH];
+    int events[BPOLL_ACCEPT_BATCH];
+    bpollelt_t *bpollelt;
+    int n = 0, naccepted = 0, fd, rc = 0;
+
+    while (naccepted < max) {
+      #if HAS_ACCEPT4
+        fd = accept4(listen_elt->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+      #else
+        fd = accept(listen_elt->fd, NULL, NULL);
+        if (fd != -1) {
+            (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+            (void)fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        }
+      #endif
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                rc = errno;  /*(e.g. EMFILE)*/
+            break;
+        }
+        ++naccepted;
+
+        bpollelt = bpoll_elt_init(bpollset, NULL, fd,
+                                  BPOLL_FD_SOCKET, BPOLL_FL_CLOSE);
+        if (__builtin_expect( (bpollelt == NULL), 0)) {
+            rc = errno;
+            while (close(fd) == -1 && errno == EINTR)
+                ;
+            break;
+        }
+        events[n] = fn_cb_accept(bpollset, listen_elt, bpollelt);
+        if (events[n] == 0) {  /*(handled by callback; close)*/
+            bpoll_elt_close(bpollset, bpollelt);
+            bpoll_elt_free(bpollset, bpollelt);
+            continue;
+        }
+        elts[n] = bpollelt;
+        if (++n == BPOLL_ACCEPT_BATCH) {
+            bpoll_accept_add(bpollset, elts, events, n);
+            n = 0;
+        }
+    }
+
+    if (n != 0)
+        bpoll_accept_add(bpollset, elts, events, n);
+    return (naccepted != 0 || rc == 0) ? naccepted : ((errno = rc), -1);
+}
+
+
+int
+bpoll_prio_budget_set (bpollset_t * const restrict bpollset,
+                       const int prio, const int budget)
+{
+    if ((unsigned int)prio >= BPOLL_PRIO_CLASSES)
+        return (errno = EINVAL);
+    bpollset->prio_budget[prio] = budget > 0 ? budget : INT_MAX;
+    bpollset->prio = 1;
+    return 0;
+}
+
+
+int
+bpoll_busy_poll_set (bpollset_t * const restrict bpollset,
+                     const unsigned int usec, const unsigned int napi_budget)
+{
+    /* (validate and configure kernel before enabling; unchanged on error) */
+    if (usec > INT_MAX / 1000)
+        return (errno = EINVAL);
+    if (napi_budget != 0) {
+      #if HAS_EPOLL && defined(EPIOCSPARAMS)
+        struct epoll_params params;
+        if (bpollset->mech != BPOLL_M_EPOLL || napi_budget > UINT16_MAX)
+            return (errno = EINVAL);
+        memset(&params, 0, sizeof(params));
+        params.busy_poll_usecs  = usec;
+        params.busy_poll_budget = (uint16_t)napi_budget;
+        params.prefer_busy_poll = 1;
+        if (0 != ioctl(bpollset->fd, EPIOCSPARAMS, &params))
+            return errno;
+      #else
+        return (errno = EINVAL);
+      #endif
+    }
+    bpollset->busy_poll_usec = usec;
+    return 0;
+}
+
+
 #if HAS_PSELECT || HAS_PPOLL || HAS_EPOLL_PWAIT
 sigset_t *  __attribute_regparm__((1))
 bpoll_sigmask_get (bpollset_t * const restrict bpollset, const int vivify)
@@ -3560,9 +5111,28 @@ bpoll_create (void * const vdata,
     bpollset->rmidx            = 0;
     bpollset->rmsz             = 0;
     bpollset->rmlist           = NULL;
+    bpollset->rdidx            = 0;
+    bpollset->rdsz             = 0;
+    bpollset->rdlist           = NULL;
+    bpollset->rddispsz         = 0;
+    bpollset->rddisp           = NULL;
+    bpollset->prio             = 0;
+    bpollset->rdbudget         = 0;
+    bpollset->nintern          = 0;
+    bpollset->sigready         = 0;
+    bpollset->sigmaskp         = NULL;
+    bpollset->sigwatch         = NULL;
+    bpollset->watchdog         = NULL;
+    bpollset->flight           = NULL;
+    bpollset->trace            = NULL;
+    bpollset->sim              = NULL;
+    bpollset->prio_budget[BPOLL_PRIO_NORMAL]  = INT_MAX;
+    bpollset->prio_budget[BPOLL_PRIO_CONTROL] = INT_MAX;
+    bpollset->prio_budget[BPOLL_PRIO_BULK]    = INT_MAX;
     bpollset->timeout          = -1;
     bpollset->ts.tv_sec        = 0;
     bpollset->ts.tv_nsec       = 0;
+    bpollset->busy_poll_usec   = 0;
     bpollset->fn_cb_event      = fn_cb_event;
     bpollset->fn_cb_close      = fn_cb_close;
     if (fn_mem_alloc == NULL) {
@@ -3579,8 +5149,17 @@ bpoll_create (void * const vdata,
     bpollset->mem_block_head   = NULL;
     bpollset->mem_block_sz     = ~0u;
     bpollset->mem_block_freed  = 0;
+  #if BPOLL_STATS
+    memset(&bpollset->stats, 0, sizeof(bpollset->stats));
+  #endif
   #ifdef _THREAD_SAFE
     memset(bpollset->bpollelts_used, 0, sizeof(bpollset->bpollelts_used));
+    bpollset->vsig             = NULL;
+    bpollset->vsig_elt         = NULL;
+    bpollset->vsig_fd          = -1;
+    bpollset->vsig_sz          = 0;
+    bpollset->vsig_idx         = 0;
+    bpollset->rmq              = NULL;
   #endif
     return bpollset;
 }
@@ -3625,9 +5204,10 @@ bpoll_init (bpollset_t * const restrict bpollset,
     /* basic validation of descriptor limit requested */
     if (__builtin_expect( (limit == 0), 0))
         return (errno = EINVAL);
-    if (limit > BPOLL_FD_THRESH) {
+    if (limit > BPOLL_FD_THRESH && flags != BPOLL_M_SIM) {
         /* do not incur overhead of getrlimit check if limit <= BPOLL_FD_THRESH;
-         * (still possible rlimits set this low and will error when exceeded) */
+         * (still possible rlimits set this low and will error when exceeded)
+         * (BPOLL_M_SIM fds need not be open descriptors) */
         struct rlimit rlim;
         do {
             rc = getrlimit(RLIMIT_NOFILE, &rlim);
@@ -3663,7 +5243,8 @@ bpoll_init (bpollset_t * const restrict bpollset,
     /* simplistic "choose poll mechanism for me"; if limit <= 16 use poll(),
      * (threshold (16) chosen via a brief and coarse benchmark; review further)
      * else prefer more advanced poll-type mechanism, if available.
-     * (order of 'if' statements in code below determines mechanism choice) */
+     * (order of 'if' statements in code below determines mechanism choice)
+     * (BPOLL_M_SIM is never chosen unless requested alone) */
     if (flags == BPOLL_M_NOT_SET)
         flags = limit <= 16 ? (unsigned int)BPOLL_M_POLL : ~0u;
 
@@ -3672,6 +5253,7 @@ bpoll_init (bpollset_t * const restrict bpollset,
     bpollset->limit        = limit;
     bpollset->nfound       = 0;
     bpollset->nelts        = 0;
+    bpollset->rdidx        = 0;
     bpollset->bpollelts_sz = 0;
     bpollset->results_sz   = 0;
     bpollset->queue_sz = queue_sz != 0 && queue_sz <= limit ? queue_sz : limit;
@@ -3696,6 +5278,7 @@ bpoll_init (bpollset_t * const restrict bpollset,
     if (flags & BPOLL_M_EPOLL)   rc = bpoll_init_epoll(bpollset);   else
   #endif
     if (flags & BPOLL_M_POLL)    rc = bpoll_init_pollfds(bpollset); else
+    if (flags == BPOLL_M_SIM)    rc = bpoll_init_sim(bpollset);     else
     /* else */ return (errno = EINVAL);
 
     if (rc != 0) {
@@ -3832,6 +5415,18 @@ bpoll_elt_add_immed (bpollset_t * const restrict bpollset,
     if (__builtin_expect( (m != *nelts), 0))
         bpoll_fd_remove_eltlist(bpollset, bpollelt + *nelts, m - *nelts);
 
+    if (__builtin_expect( (bpollset->flight != NULL), 0)) {
+        for (int i = 0; i < *nelts; ++i)
+            BPOLL_FLIGHT(bpollset, BPOLL_FLIGHT_ADD, bpollelt[i]->fdtype,
+                         bpollelt[i]->fd, events);
+    }
+    if (__builtin_expect( (bpollset->trace != NULL), 0)) {
+        for (int i = 0; i < *nelts; ++i)
+            BPOLL_TRACE(bpollset, BPOLL_TRACE_ADD, bpollelt[i]->fdtype,
+                        bpollelt[i]->fd, events);
+    }
+    BPOLL_SDT_PROBE2(bpoll, elt_add_immed, *nelts, events);
+
     /* some elements might have been added even if return value != 0 */
     return __builtin_expect( (n == *nelts), 1)
       ? rc
@@ -3839,11 +5434,74 @@ bpoll_elt_add_immed (bpollset_t * const restrict bpollset,
 }
 
 
+/* virtual bpollelts (BPOLL_FD_VIRTUAL) have no kernel descriptor and are not
+ * tracked in bpollset->bpollelts; ready virtual bpollelts are placed on the
+ * user-space ready list (rdlist) by bpoll_elt_signal() */
+
+__attribute_noinline__
+__attribute_nonnull__
+static int  __attribute_regparm__((3))
+bpoll_elt_modify_virtual (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt,
+                          const int events);
+static int  __attribute_regparm__((3))
+bpoll_elt_modify_virtual (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt,
+                          const int events)
+{
+    bpollelt->events = events;
+    if (bpollelt->flpriv & BPOLL_FL_DISPATCHED) {
+        bpollelt->flpriv &= ~BPOLL_FL_DISPATCHED;
+        if (bpollelt->flpriv & BPOLL_FL_VPEND) { /* re-arm with latched event */
+            bpollelt->flpriv &= ~BPOLL_FL_VPEND;
+            return bpoll_elt_signal(bpollset, bpollelt, bpollelt->revents);
+        }
+    }
+    return 0;
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static int  __attribute_regparm__((2))
+bpoll_elt_remove_virtual (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt);
+static int  __attribute_regparm__((2))
+bpoll_elt_remove_virtual (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt)
+{
+    /* defer free until next bpoll_process() (as with rmlist for fds), since
+     * bpollelt might be referenced later in current dispatch or results list;
+     * removed bpollelt is placed on ready list and skipped (and freed) there */
+    if (__builtin_expect( ((bpollelt->flpriv & BPOLL_FL_CTL_DEL) != 0), 0))
+        return (errno = EEXIST);
+    if (!(bpollelt->flpriv & BPOLL_FL_RDLIST)) {
+        if (__builtin_expect( (bpollset->rdidx == bpollset->rdsz), 0)
+            && bpoll_rdlist_resize(bpollset, (size_t)bpollset->rdidx+1) != 0)
+            return errno;
+        bpollset->rdlist[bpollset->rdidx++] = bpollelt;
+    }
+    bpollelt->events = 0;
+    bpollelt->flpriv = (bpollelt->flpriv & ~BPOLL_FL_VPEND)
+                     | BPOLL_FL_CTL_DEL | BPOLL_FL_RDLIST;
+    return 0;
+}
+
+
 int  __attribute_regparm__((3))
 bpoll_elt_add (bpollset_t * const restrict bpollset,
                bpollelt_t * const restrict bpollelt,
                const int events)
 {
+    if (__builtin_expect( (bpollelt->fdtype == BPOLL_FD_VIRTUAL), 0)) {
+        bpollelt->events = events;  /*(no kernel descriptor; not tracked)*/
+        return 0;
+    }
+    BPOLL_SDT_PROBE3(bpoll, elt_add, bpollelt->fd, bpollelt->fdtype, events);
+    BPOLL_FLIGHT(bpollset, BPOLL_FLIGHT_ADD, bpollelt->fdtype,
+                 bpollelt->fd, events);
+    BPOLL_TRACE(bpollset, BPOLL_TRACE_ADD, bpollelt->fdtype,
+                bpollelt->fd, events);
    #if HAS_KQUEUE
     if (bpollset->mech == BPOLL_M_KQUEUE)
         return bpoll_elt_add_kqueue(bpollset, bpollelt, events);
@@ -3871,6 +5529,9 @@ bpoll_elt_add (bpollset_t * const restrict bpollset,
    #endif
     if (bpollset->mech == BPOLL_M_POLL)
         return bpoll_elt_add_pollfds(bpollset, bpollelt, events);
+    else
+    if (bpollset->mech == BPOLL_M_SIM)
+        return bpoll_elt_add_sim(bpollset, bpollelt, events);
     else
         return (errno = EINVAL);
 }
@@ -3893,6 +5554,10 @@ bpoll_elt_modify (bpollset_t * const restrict bpollset,
     /* make sure bpollelt not already marked for removal */
     if (__builtin_expect( ((bpollelt->flpriv & BPOLL_FL_CTL_DEL) != 0), 0))
         return (errno = EINVAL);
+    if (__builtin_expect( (bpollelt->fdtype == BPOLL_FD_VIRTUAL), 0))
+        return bpoll_elt_modify_virtual(bpollset, bpollelt, events);
+    BPOLL_TRACE(bpollset, BPOLL_TRACE_MODIFY, bpollelt->fdtype,
+                bpollelt->fd, events);
 
   #if HAS_KQUEUE
     if (bpollset->mech == BPOLL_M_KQUEUE)
@@ -3921,6 +5586,9 @@ bpoll_elt_modify (bpollset_t * const restrict bpollset,
   #endif
     if (bpollset->mech == BPOLL_M_POLL)
         return bpoll_elt_modify_pollfds(bpollset, bpollelt, events);
+    else
+    if (bpollset->mech == BPOLL_M_SIM)
+        return bpoll_elt_modify_sim(bpollset, bpollelt, events);
     else
         return (errno = EINVAL);
 }
@@ -3934,6 +5602,8 @@ bpoll_elt_remove (bpollset_t * const restrict bpollset,
 
     if (__builtin_expect( (bpollelt == NULL), 0))
         return (errno = ENOENT);
+    if (__builtin_expect( (bpollelt->fdtype == BPOLL_FD_VIRTUAL), 0))
+        return bpoll_elt_remove_virtual(bpollset, bpollelt);
     /* make sure bpollelt is part of bpollset */
     if (__builtin_expect( (bpoll_elt_fetch(bpollset,bpollelt->fd)!=bpollelt),0))
         return 0;
@@ -3944,6 +5614,11 @@ bpoll_elt_remove (bpollset_t * const restrict bpollset,
     if (__builtin_expect( (bpollset->rmidx == bpollset->rmsz), 0)
         && bpoll_rmlist_resize(bpollset) != 0)
         return (errno = ENOMEM);
+    BPOLL_SDT_PROBE2(bpoll, elt_remove, bpollelt->fd, bpollelt->fdtype);
+    BPOLL_FLIGHT(bpollset, BPOLL_FLIGHT_REMOVE, bpollelt->fdtype,
+                 bpollelt->fd, 0);
+    BPOLL_TRACE(bpollset, BPOLL_TRACE_REMOVE, bpollelt->fdtype,
+                bpollelt->fd, 0);
 
   #if HAS_KQUEUE
     if (bpollset->mech == BPOLL_M_KQUEUE)
@@ -3972,6 +5647,9 @@ bpoll_elt_remove (bpollset_t * const restrict bpollset,
   #endif
     if (bpollset->mech == BPOLL_M_POLL)
         rc = bpoll_elt_remove_pollfds(bpollset, bpollelt);
+    else
+    if (bpollset->mech == BPOLL_M_SIM)
+        rc = (bpollelt->events = 0);  /*(removed from sim at commit)*/
     else
         rc = (errno = EINVAL);
 
@@ -3987,15 +5665,159 @@ int  __attribute_regparm__((2))
 bpoll_elt_destroy (bpollset_t * const restrict bpollset,
                    bpollelt_t * const restrict bpollelt)
 {
-    const int fd = bpollelt->fd;
-    if (bpoll_elt_fetch(bpollset, fd) == bpollelt)
-        return bpoll_elt_remove(bpollset, bpollelt);
-    else
-        bpoll_elt_free(bpollset, bpollelt);
+    const int fd = bpollelt->fd;
+    if (bpoll_elt_fetch(bpollset, fd) == bpollelt)
+        return bpoll_elt_remove(bpollset, bpollelt);
+    else
+        bpoll_elt_free(bpollset, bpollelt);
+    return 0;
+}
+
+
+int  __attribute_regparm__((3))
+bpoll_elt_mark_pending (bpollset_t * const restrict bpollset,
+                        bpollelt_t * const restrict bpollelt,
+                        const int revents)
+{
+    /* place bpollelt on user-space ready list to be dispatched again with
+     * revents on next bpoll_process() (without waiting for kernel event)
+     * (e.g. edge-triggered bpollelt not fully drained within budget) */
+    if (__builtin_expect( (bpollelt->flpriv & BPOLL_FL_CTL_DEL), 0))
+        return (errno = ENOENT);
+    if (bpollelt->flpriv & BPOLL_FL_RDLIST) {
+        bpollelt->revents |= revents;
+        return 0;
+    }
+    if (__builtin_expect( (bpollset->rdidx == bpollset->rdsz), 0)
+        && bpoll_rdlist_resize(bpollset, (size_t)bpollset->rdidx + 1) != 0)
+        return errno;
+    bpollelt->revents = revents;
+    bpollelt->flpriv |= BPOLL_FL_RDLIST;
+    bpollset->rdlist[bpollset->rdidx++] = bpollelt;
+    return 0;
+}
+
+int  __attribute_regparm__((3))
+bpoll_elt_signal (bpollset_t * const restrict bpollset,
+                  bpollelt_t * const restrict bpollelt,
+                  const int revents)
+{
+    /* make virtual bpollelt ready; dispatched from user-space ready list */
+    const int ev = revents & (bpollelt->events | BPOLLERR | BPOLLHUP)
+                           & ~(BPOLLDISPATCH | BPOLLET);
+    if (__builtin_expect( (bpollelt->fdtype != BPOLL_FD_VIRTUAL), 0))
+        return (errno = EINVAL);
+    if (ev == 0)
+        return 0;
+    if (bpollelt->flpriv & BPOLL_FL_DISPATCHED) {
+        /* latch revents until re-armed (bpoll_elt_modify()) */
+        if (!(bpollelt->flpriv & BPOLL_FL_VPEND)) {
+            bpollelt->flpriv |= BPOLL_FL_VPEND;
+            bpollelt->revents = 0;
+        }
+        bpollelt->revents |= ev;
+        return 0;
+    }
+    return bpoll_elt_mark_pending(bpollset, bpollelt, ev);
+}
+
+
+int  __attribute_regparm__((3))
+bpoll_elt_signal_thrsafe (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt,
+                          const int revents)
+{
+  #ifdef _THREAD_SAFE
+    int rc;
+    if (__builtin_expect( (bpollset->vsig_elt == NULL), 0)
+        || __builtin_expect( (bpollelt->fdtype != BPOLL_FD_VIRTUAL), 0))
+        return (errno = EINVAL);
+    rc = pthread_mutex_lock(&bpollset->mutex);
+    if (__builtin_expect( (rc != 0), 0))
+        return (errno = rc);
+    do {
+        if (__builtin_expect( (bpollset->vsig_idx == bpollset->vsig_sz), 0)) {
+            const int sz = bpollset->vsig_sz ? bpollset->vsig_sz << 1 : 16;
+            struct bpoll_vsignal * const vsig = (struct bpoll_vsignal *)
+              bpollset->fn_mem_alloc(bpollset->vdata,
+                                     (size_t)sz*sizeof(struct bpoll_vsignal));
+            if (__builtin_expect( (vsig == NULL), 0)) {
+                rc = (errno = ENOMEM);
+                break;
+            }
+            if (bpollset->vsig != NULL) {
+                memcpy(vsig, bpollset->vsig,
+                       (size_t)bpollset->vsig_idx*sizeof(struct bpoll_vsignal));
+                if (bpollset->fn_mem_free != NULL)
+                    bpollset->fn_mem_free(bpollset->vdata, bpollset->vsig);
+            }
+            bpollset->vsig = vsig;
+            bpollset->vsig_sz = sz;
+        }
+        bpollset->vsig[bpollset->vsig_idx].bpollelt = bpollelt;
+        bpollset->vsig[bpollset->vsig_idx].revents  = revents;
+        if (bpollset->vsig_idx++ == 0) {
+            /* wake owning thread (EAGAIN ok; pipe already non-empty) */
+            const ssize_t wr = write(bpollset->vsig_fd, "", 1);
+            (void)wr;
+        }
+    } while (0);
+    pthread_mutex_unlock(&bpollset->mutex);
+    return rc;
+  #else
+    (void)bpollelt;
+    (void)revents;
+    return (errno = EINVAL) | (bpollset->mech == BPOLL_M_NOT_SET);
+  #endif
+}
+
+
+int  __attribute_regparm__((2))
+bpoll_elt_remove_thrsafe (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt)
+{
+  #ifdef _THREAD_SAFE
+    struct bpoll_rmq * const restrict rmq = bpollset->rmq;
+    unsigned int idx;
+    if (__builtin_expect( (rmq == NULL), 0)
+        || __builtin_expect( (bpollelt->fdtype == BPOLL_FD_VIRTUAL), 0))
+        return (errno = EINVAL);
+    idx = plasma_atomic_fetch_add_u32(&rmq->tail, 1, memory_order_relaxed);
+    plasma_membar_st_rel();
+    plasma_atomic_st_nopt(&rmq->ring[idx & rmq->mask], bpollelt);
+    if (0 == plasma_atomic_fetch_add_u32(&rmq->npending, 1,
+                                         memory_order_acq_rel)
+        && bpollset->vsig_elt != NULL) {
+        /* wake owning thread (EAGAIN ok; pipe already non-empty) */
+        const ssize_t wr = write(bpollset->vsig_fd, "", 1);
+        (void)wr;
+    }
+    return 0;
+  #else
+    (void)bpollelt;
+    return (errno = EINVAL) | (bpollset->mech == BPOLL_M_NOT_SET);
+  #endif
+}
+
+
+int
+bpoll_sim_ready (bpollset_t * const restrict bpollset, const int fd,
+                 const int revents)
+{
+    struct bpoll_sim * const restrict sim = bpollset->sim;
+    if (__builtin_expect( (bpollset->mech != BPOLL_M_SIM), 0) || fd < 0)
+        return (errno = EINVAL);
+    if (__builtin_expect( ((unsigned int)fd >= sim->fds_sz), 0)
+        && bpoll_sim_fds_resize(bpollset, fd) != 0)
+        return errno;
+    sim->fds[fd].revents |= revents;
+    if (sim->fds[fd].revents & sim->fds[fd].mask)
+        bpoll_sim_enqueue(sim, fd);
     return 0;
 }
 
 
+
 struct timespec *  __attribute_regparm__((2))
 bpoll_timespec_set (bpollset_t * const bpollset,
                     const struct timespec * const timespec)
@@ -4016,11 +5838,14 @@ bpoll_timespec_set (bpollset_t * const bpollset,
                             /*(+999999 to round up to minimum precision)*/
       #ifdef __linux__
         /* libevent notes epoll limitation handling timeouts > 2147482 msec */
+        /*(epoll_pwait2() uses ts; msec timeout is used only for fallback)*/
         if (__builtin_expect( (bpollset->timeout > 2147482), 0)
             && bpollset->mech == BPOLL_M_EPOLL) {
             bpollset->timeout = 2147482;
+          #if !HAS_EPOLL_PWAIT2
             bpollset->ts.tv_sec  = 2147;
             bpollset->ts.tv_nsec = 482000;
+          #endif
         }
       #endif
         /* FreeBSD documents kqueue timeouts > 24 hours treated as 24 hours */
@@ -4033,6 +5858,573 @@ bpoll_timespec_set (bpollset_t * const bpollset,
     return &bpollset->ts;
 }
 
+__attribute_nonnull__
+static int  __attribute_regparm__((1))
+bpoll_kernel_mech (bpollset_t * const restrict bpollset);
+static int  __attribute_regparm__((1))
+bpoll_kernel_mech (bpollset_t * const restrict bpollset)
+{
+    int nfound;
+    BPOLL_SDT_PROBE2(bpoll, kernel_entry, bpollset->mech, bpollset->timeout);
+    BPOLL_TRACE(bpollset, BPOLL_TRACE_WAIT, 0, bpollset->timeout, 0);
+  #if HAS_KQUEUE
+    if (bpollset->mech == BPOLL_M_KQUEUE)
+        nfound = bpoll_kernel_kqueue(bpollset);
+    else
+  #endif
+  #if HAS_EVPORT
+    if (bpollset->mech == BPOLL_M_EVPORT)
+        nfound = bpoll_kernel_evport(bpollset);
+    else
+  #endif
+  #if HAS_POLLSET
+    if (bpollset->mech == BPOLL_M_POLLSET)
+        nfound = bpoll_kernel_pollset(bpollset);
+    else
+  #endif
+  #if HAS_DEVPOLL
+    if (bpollset->mech == BPOLL_M_DEVPOLL)
+        nfound = bpoll_kernel_devpoll(bpollset);
+    else
+  #endif
+  #if HAS_EPOLL
+    if (bpollset->mech == BPOLL_M_EPOLL)
+        nfound = bpoll_kernel_epoll(bpollset);
+    else
+  #endif
+    if (bpollset->mech == BPOLL_M_POLL)
+        nfound = bpoll_kernel_pollfds(bpollset);
+    else
+    if (bpollset->mech == BPOLL_M_SIM)
+        nfound = bpoll_kernel_sim(bpollset);
+    else  /* invalid bpollset->mech */
+        return (errno = EINVAL), -1;
+
+    BPOLL_SDT_PROBE2(bpoll, kernel_exit, nfound, nfound < 0 ? errno : 0);
+    BPOLL_TRACE(bpollset, BPOLL_TRACE_WAKE, 0,
+                nfound, nfound < 0 ? errno : 0);
+  #if BPOLL_STATS
+    BPOLL_STATS_INC(bpollset, kernel_waits);
+    if (nfound == 0)
+        BPOLL_STATS_INC(bpollset, kernel_empty);
+    if (nfound >= 0)
+        BPOLL_STATS_HIST(bpollset, kernel_nfound, nfound);
+  #endif
+    return nfound;
+}
+
+
+#ifdef CLOCK_MONOTONIC
+#define BPOLL_CLOCK_BUSY_POLL CLOCK_MONOTONIC
+#else
+#define BPOLL_CLOCK_BUSY_POLL CLOCK_REALTIME
+#endif
+
+
+/* slow-callback watchdog
+ * (cached clock: one clock reading per callback ends that callback and starts
+ *  the next; clock is read at start of bpoll_process() and after fn_cb_slow)*/
+struct bpoll_watchdog {
+    int64_t now;                /* cached clock (ns) */
+    uint64_t budget_ns;
+    bpoll_fn_cb_slow_t fn_cb_slow;
+    bpoll_fn_cb_class_t fn_cb_class;
+    bpoll_watchdog_stats_t stats[BPOLL_WATCHDOG_CLASSES];
+};
+
+/* flight recorder
+ * (single ring shared by owning thread and threads adding bpollelts
+ *  (bpoll_enable_thrsafe_add()); slot reserved with atomic increment of head,
+ *  and seq of entry is cleared before and set after entry is written, so that
+ *  bpoll_flight_dump() skips entries being written (seqlock)) */
+struct bpoll_flight {
+    uint64_t head;              /* entries recorded */
+    uint64_t mask;              /* ring size - 1 */
+    bpoll_flight_entry_t ring[];
+};
+
+
+static int64_t
+bpoll_clock_ns (void);
+static int64_t
+bpoll_clock_ns (void)
+{
+    struct timespec t;
+    if (__builtin_expect( (clock_gettime(BPOLL_CLOCK_BUSY_POLL, &t) != 0), 0))
+        return 0;
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+static void
+bpoll_flight_rec (struct bpoll_flight * const restrict flight, int64_t ns,
+                  const int type, const unsigned int fdtype,
+                  const int32_t arg, const uint32_t arg2)
+{
+    const uint64_t idx =
+      plasma_atomic_fetch_add_u64(&flight->head, 1, memory_order_relaxed);
+    bpoll_flight_entry_t * const restrict e = flight->ring+(idx & flight->mask);
+    if (ns == 0)
+        ns = bpoll_clock_ns();
+    plasma_atomic_st_nopt(&e->seq, 0);
+    plasma_membar_st_rel();
+    e->ns     = (uint64_t)ns;
+    e->type   = (uint16_t)type;
+    e->fdtype = (uint16_t)fdtype;
+    e->arg    = arg;
+    e->arg2   = arg2;
+    plasma_membar_st_rel();
+    plasma_atomic_st_nopt(&e->seq, (uint32_t)idx + 1);
+}
+
+
+static void
+bpoll_cb_event_slow (bpollset_t * const restrict bpollset,
+                     bpollelt_t * const restrict bpollelt, const int data)
+{
+    struct bpoll_watchdog * const restrict watchdog = bpollset->watchdog;
+    const int revents = bpollelt->revents;
+    const int fd = bpollelt->fd;
+    const unsigned int fdtype = bpollelt->fdtype;
+    bpoll_watchdog_stats_t * restrict stats;
+    unsigned int cls = fdtype;
+    int64_t t0, t1;
+    uint64_t ns, usec;
+    if (bpollelt->flpriv & BPOLL_FL_INTERNAL) {
+        bpoll_elt_internal(bpollset, bpollelt);
+        return;
+    }
+
+    if (watchdog != NULL) {
+        if (watchdog->fn_cb_class != NULL)
+            cls = watchdog->fn_cb_class(bpollelt);
+        t0 = watchdog->now;
+    }
+    else
+        t0 = bpoll_clock_ns();
+
+    bpollset->fn_cb_event(bpollset, bpollelt, data);
+
+    t1 = bpoll_clock_ns();
+    ns = (t1 >= t0) ? (uint64_t)(t1 - t0) : 0; /*(0 if clock_gettime() failed)*/
+    usec = ns / 1000;
+
+    if (bpollset->flight != NULL)
+        bpoll_flight_rec(bpollset->flight, t0, BPOLL_FLIGHT_CB, fdtype, fd,
+                         usec <= UINT32_MAX ? (uint32_t)usec : UINT32_MAX);
+
+    if (watchdog == NULL)
+        return;
+    watchdog->now = t1;
+    if (cls >= BPOLL_WATCHDOG_CLASSES)
+        cls = BPOLL_WATCHDOG_CLASSES-1;
+    stats = watchdog->stats+cls;
+    ++stats->ncalls;
+    stats->total_ns += ns;
+    if (stats->max_ns < ns)
+        stats->max_ns = ns;
+    ++stats->hist[usec == 0
+                  ? 0
+                  : usec >= (1u << (BPOLL_WATCHDOG_HIST_SZ-2))
+                    ? BPOLL_WATCHDOG_HIST_SZ-1
+                    : 32 - __builtin_clz((unsigned int)usec)];
+
+    if (__builtin_expect( (ns > watchdog->budget_ns), 0)
+        && watchdog->budget_ns != 0) {
+        ++stats->nslow;
+        if (watchdog->fn_cb_slow != NULL) {
+            watchdog->fn_cb_slow(bpollset, bpollelt, revents, ns);
+            watchdog->now = bpoll_clock_ns(); /*(exclude fn_cb_slow from next)*/
+        }
+    }
+}
+
+
+int
+bpoll_watchdog_enable (bpollset_t * const restrict bpollset,
+                       const unsigned int budget_usec,
+                       bpoll_fn_cb_slow_t const fn_cb_slow,
+                       bpoll_fn_cb_class_t const fn_cb_class)
+{
+    struct bpoll_watchdog *watchdog = bpollset->watchdog;
+    if (watchdog == NULL) {
+        watchdog = (struct bpoll_watchdog *)
+          bpollset->fn_mem_alloc(bpollset->vdata, sizeof(*watchdog));
+        if (watchdog == NULL)
+            return errno;
+        memset(watchdog, 0, sizeof(*watchdog));
+        watchdog->now = bpoll_clock_ns();
+    }
+    watchdog->budget_ns   = (uint64_t)budget_usec * 1000;
+    watchdog->fn_cb_slow  = fn_cb_slow;
+    watchdog->fn_cb_class = fn_cb_class;
+    bpollset->watchdog    = watchdog;
+    return 0;
+}
+
+
+void
+bpoll_watchdog_disable (bpollset_t * const restrict bpollset)
+{
+    if (bpollset->watchdog != NULL) {
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->watchdog);
+        bpollset->watchdog = NULL;
+    }
+}
+
+
+int
+bpoll_watchdog_stats_get (const bpollset_t * const restrict bpollset,
+                          const unsigned int cls,
+                          bpoll_watchdog_stats_t * const restrict stats)
+{
+    if (bpollset->watchdog == NULL || cls >= BPOLL_WATCHDOG_CLASSES)
+        return (errno = EINVAL);
+    *stats = bpollset->watchdog->stats[cls];
+    return 0;
+}
+
+
+int
+bpoll_flight_enable (bpollset_t * const restrict bpollset,
+                     const unsigned int nentries)
+{
+    struct bpoll_flight *flight;
+    uint64_t n = 1;
+    if (bpollset->flight != NULL)
+        return (errno = EBUSY);
+    if (nentries == 0 || nentries > (UINT_MAX >> 1))
+        return (errno = EINVAL);
+    while (n < nentries)
+        n <<= 1;
+    flight = (struct bpoll_flight *)
+      bpollset->fn_mem_alloc(bpollset->vdata, sizeof(struct bpoll_flight)
+                                              + n*sizeof(bpoll_flight_entry_t));
+    if (flight == NULL)
+        return errno;
+    memset(flight->ring, 0, n*sizeof(bpoll_flight_entry_t));
+    flight->head = 0;
+    flight->mask = n - 1;
+    bpollset->flight = flight;
+    return 0;
+}
+
+
+void
+bpoll_flight_disable (bpollset_t * const restrict bpollset)
+{
+    if (bpollset->flight != NULL) {
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, bpollset->flight);
+        bpollset->flight = NULL;
+    }
+}
+
+
+void
+bpoll_flight_note (bpollset_t * const restrict bpollset,
+                   const int32_t arg, const uint32_t arg2)
+{
+    BPOLL_FLIGHT(bpollset, BPOLL_FLIGHT_NOTE, 0, arg, arg2);
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_flight_write (const int fd, const void * const buf, const size_t sz);
+static int
+bpoll_flight_write (const int fd, const void * const buf, const size_t sz)
+{
+    ssize_t wr;
+    for (size_t off = 0; off < sz; off += (size_t)wr) {
+        wr = write(fd, (const char *)buf + off, sz - off);
+        if (__builtin_expect( (wr < 0), 0)) {
+            if (errno != EINTR)
+                return errno;
+            wr = 0;
+        }
+    }
+    return 0;
+}
+
+
+int
+bpoll_flight_dump (const bpollset_t * const restrict bpollset, const int fd)
+{
+    /* (async-signal-safe: atomic loads, memcpy(), write()) */
+    struct bpoll_flight * const flight = bpollset->flight;
+    bpoll_flight_hdr_t hdr;
+    bpoll_flight_entry_t buf[64];
+    uint64_t head, idx;
+    unsigned int n = 0;
+    int rc;
+
+    if (flight == NULL)
+        return (errno = EINVAL);
+    /* (fetch_add 0: atomic 64-bit load also on 32-bit platforms) */
+    head = plasma_atomic_fetch_add_u64(&flight->head, 0, memory_order_acquire);
+    memcpy(hdr.magic, "BPFLIGHT", sizeof(hdr.magic));
+    hdr.version   = 1;
+    hdr.entry_sz  = sizeof(bpoll_flight_entry_t);
+    hdr.nrecorded = head;
+    hdr.nentries  = flight->mask + 1;
+    if (0 != (rc = bpoll_flight_write(fd, &hdr, sizeof(hdr))))
+        return rc;
+
+    for (idx = head > flight->mask ? head - flight->mask - 1 : 0;
+         idx < head; ++idx) {
+        /* (skip entry if being written or overwritten during copy) */
+        const bpoll_flight_entry_t * const e = flight->ring+(idx&flight->mask);
+        const uint32_t seq = (uint32_t)idx + 1;
+        if (plasma_atomic_ld_nopt(&e->seq) != seq)
+            continue;
+        plasma_membar_ld_acq();
+        memcpy(buf+n, e, sizeof(*e));
+        plasma_membar_ld_acq();
+        if (plasma_atomic_ld_nopt(&e->seq) != seq)
+            continue;
+        if (++n == sizeof(buf)/sizeof(*buf)) {
+            if (0 != (rc = bpoll_flight_write(fd, buf, sizeof(buf))))
+                return rc;
+            n = 0;
+        }
+    }
+    return (n != 0) ? bpoll_flight_write(fd, buf, n*sizeof(*buf)) : 0;
+}
+
+
+/* trace
+ * (records buffered and written to fd when buffer is full; mutex serializes
+ *  records from threads adding bpollelts (bpoll_enable_thrsafe_add()))
+ * (recording stops after first failed write; error returned by flush) */
+#ifndef BPOLL_TRACE_BUFSZ
+#define BPOLL_TRACE_BUFSZ 4096  /* records (64 KB) */
+#endif
+
+struct bpoll_trace {
+  #ifdef _THREAD_SAFE
+    pthread_mutex_t mutex;
+  #endif
+    int fd;
+    int err;
+    unsigned int n;
+    int64_t ns;                 /* time of previous record */
+    bpoll_trace_rec_t buf[BPOLL_TRACE_BUFSZ];
+};
+
+
+__attribute_nonnull__
+static int
+bpoll_trace_flush_buf (struct bpoll_trace * const restrict trace);
+static int
+bpoll_trace_flush_buf (struct bpoll_trace * const restrict trace)
+{
+    if (trace->err == 0 && trace->n != 0)
+        trace->err = bpoll_flight_write(trace->fd, trace->buf,
+                                        trace->n * sizeof(bpoll_trace_rec_t));
+    trace->n = 0;
+    return trace->err;
+}
+
+
+static void
+bpoll_trace_rec (struct bpoll_trace * const restrict trace, const int type,
+                 const unsigned int fdtype, const int32_t fd,
+                 const uint32_t events)
+{
+    bpoll_trace_rec_t * restrict r;
+    int64_t ns, usec;
+    if (__builtin_expect( (pthread_mutex_lock(&trace->mutex) != 0), 0))
+        return;
+    if (trace->err == 0) {
+        ns = bpoll_clock_ns();
+        usec = ns > trace->ns ? (ns - trace->ns) / 1000 : 0;
+        trace->ns += usec * 1000;  /*(carry sub-usec remainder to next)*/
+        r = trace->buf + trace->n;
+        r->usec   = usec < UINT32_MAX ? (uint32_t)usec : UINT32_MAX;
+        r->type   = (uint16_t)type;
+        r->fdtype = (uint16_t)fdtype;
+        r->fd     = fd;
+        r->events = events;
+        if (++trace->n == BPOLL_TRACE_BUFSZ)
+            bpoll_trace_flush_buf(trace);
+    }
+    pthread_mutex_unlock(&trace->mutex);
+}
+
+
+int
+bpoll_trace_enable (bpollset_t * const restrict bpollset, const int fd)
+{
+    struct bpoll_trace *trace;
+    bpoll_trace_hdr_t hdr;
+    int rc;
+    if (bpollset->trace != NULL)
+        return (errno = EBUSY);
+    if (fd < 0)
+        return (errno = EBADF);
+    trace = (struct bpoll_trace *)
+      bpollset->fn_mem_alloc(bpollset->vdata, sizeof(struct bpoll_trace));
+    if (trace == NULL)
+        return errno;
+    if (0 != (rc = pthread_mutex_init(&trace->mutex, NULL))) {
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, trace);
+        return (errno = rc);
+    }
+    trace->fd  = fd;
+    trace->err = 0;
+    trace->n   = 0;
+    trace->ns  = bpoll_clock_ns();
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "BPTRACE", sizeof("BPTRACE"));
+    hdr.version  = 1;
+    hdr.rec_sz   = sizeof(bpoll_trace_rec_t);
+    hdr.mech     = bpollset->mech;
+    hdr.limit    = bpollset->limit;
+    hdr.queue_sz = bpollset->queue_sz;
+    hdr.ns       = (uint64_t)trace->ns;
+    if (0 != (rc = bpoll_flight_write(fd, &hdr, sizeof(hdr)))) {
+        (void)pthread_mutex_destroy(&trace->mutex);
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, trace);
+        return (errno = rc);
+    }
+    bpollset->trace = trace;
+    return 0;
+}
+
+
+int
+bpoll_trace_flush (bpollset_t * const restrict bpollset)
+{
+    struct bpoll_trace * const restrict trace = bpollset->trace;
+    int rc;
+    if (trace == NULL)
+        return (errno = EINVAL);
+    if (0 != (rc = pthread_mutex_lock(&trace->mutex)))
+        return (errno = rc);
+    rc = bpoll_trace_flush_buf(trace);
+    pthread_mutex_unlock(&trace->mutex);
+    return rc != 0 ? (errno = rc) : 0;
+}
+
+
+int
+bpoll_trace_disable (bpollset_t * const restrict bpollset)
+{
+    struct bpoll_trace * const restrict trace = bpollset->trace;
+    int rc;
+    if (trace == NULL)
+        return 0;
+    rc = bpoll_trace_flush(bpollset);
+    bpollset->trace = NULL;
+    (void)pthread_mutex_destroy(&trace->mutex);
+    if (bpollset->fn_mem_free != NULL)
+        bpollset->fn_mem_free(bpollset->vdata, trace);
+    return rc;
+}
+
+__attribute_noinline__
+__attribute_nonnull__
+static int
+bpoll_kernel_busy_poll (bpollset_t * const restrict bpollset);
+static int
+bpoll_kernel_busy_poll (bpollset_t * const restrict bpollset)
+{
+    /* spin with zero-timeout kernel polls for up to busy_poll_usec (or until
+     * timeout, if shorter), then block for remainder of timeout (if any).
+     * bpollset->ts and bpollset->timeout are restored before returning */
+    const int timeout = bpollset->timeout;
+    const struct timespec ts = bpollset->ts;
+    const int64_t tsns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    int64_t spin = (int64_t)bpollset->busy_poll_usec * 1000;
+    int64_t elapsed;
+    struct timespec t0, t;
+    int nfound;
+    if (timeout >= 0 && spin > tsns)
+        spin = tsns;
+    if (__builtin_expect( (clock_gettime(BPOLL_CLOCK_BUSY_POLL, &t0) != 0), 0))
+        return bpoll_kernel_mech(bpollset);
+
+    bpollset->timeout    = 0;
+    bpollset->ts.tv_sec  = 0;
+    bpollset->ts.tv_nsec = 0;
+    do {
+        nfound = bpoll_kernel_mech(bpollset);
+        if (nfound != 0)
+            break;
+        clock_gettime(BPOLL_CLOCK_BUSY_POLL, &t);
+        elapsed = (int64_t)(t.tv_sec - t0.tv_sec) * 1000000000
+                + (t.tv_nsec - t0.tv_nsec);
+    } while (elapsed < spin);
+
+    if (nfound == 0 && (timeout < 0 || elapsed < tsns)) {
+        if (timeout >= 0) {
+            t.tv_sec  = (time_t)((tsns - elapsed) / 1000000000);
+            t.tv_nsec = (long)((tsns - elapsed) % 1000000000);
+            bpoll_timespec_set(bpollset, &t);
+        }
+        else
+            bpollset->timeout = -1;
+        nfound = bpoll_kernel_mech(bpollset);
+    }
+
+    bpollset->timeout = timeout;
+    bpollset->ts      = ts;
+    return nfound;
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static int
+bpoll_kernel_nowait (bpollset_t * const restrict bpollset);
+static int
+bpoll_kernel_nowait (bpollset_t * const restrict bpollset)
+{
+    /* zero-timeout kernel poll (bpollelts pending on user-space ready list)
+     * bpollset->ts and bpollset->timeout are restored before returning */
+    const int timeout = bpollset->timeout;
+    const struct timespec ts = bpollset->ts;
+    int nfound;
+    bpollset->timeout    = 0;
+    bpollset->ts.tv_sec  = 0;
+    bpollset->ts.tv_nsec = 0;
+    nfound = bpoll_kernel_mech(bpollset);
+    bpollset->timeout = timeout;
+    bpollset->ts      = ts;
+    return nfound;
+}
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static int
+bpoll_kernel_flight (bpollset_t * const restrict bpollset);
+static int
+bpoll_kernel_flight (bpollset_t * const restrict bpollset)
+{
+    /* (flight recorder: one WAIT and WAKE per bpoll_kernel(), with caller
+     *  timeout, not per zero-timeout kernel poll of busy-poll spin) */
+    int nfound;
+    BPOLL_FLIGHT(bpollset, BPOLL_FLIGHT_WAIT, 0, bpollset->timeout, 0);
+    if (__builtin_expect( (bpollset->rdidx != 0), 0)
+        && bpollset->timeout != 0)
+        nfound = bpoll_kernel_nowait(bpollset);
+    else if (__builtin_expect( (bpollset->busy_poll_usec != 0), 0)
+             && bpollset->timeout != 0)
+        nfound = bpoll_kernel_busy_poll(bpollset);
+    else
+        nfound = bpoll_kernel_mech(bpollset);
+    BPOLL_FLIGHT(bpollset, BPOLL_FLIGHT_WAKE, 0,
+                 nfound, nfound < 0 ? errno : 0);
+    return nfound;
+}
+
+
 /* This routine has return values similar to poll()
  * -1 on error, 0 on timeout, else number of descriptors with pending events
  * caller must handle EINTR, because timeout < 0 can only be interrupted by a
@@ -4046,38 +6438,205 @@ bpoll_kernel (bpollset_t * const restrict bpollset,
     if (__builtin_expect( (timespec != &bpollset->ts), 0))
         bpoll_timespec_set(bpollset, timespec);
 
+  #ifdef _THREAD_SAFE
+    if (__builtin_expect( (bpollset->vsig_idx != 0), 0))
+        bpoll_vsig_drain(bpollset);
+    /* (sweep stopped early; producers write internal pipe only when ring
+     *  becomes non-empty, so do not block in kernel; sweep again next call) */
+    if (bpollset->rmq != NULL
+        && plasma_atomic_ld_nopt(&bpollset->rmq->npending) != 0
+        && bpoll_rmq_sweep(bpollset) != 0
+        && bpollset->timeout != 0)
+        return bpoll_kernel_nowait(bpollset);
+  #endif
+
+    if (__builtin_expect( (bpollset->flight != NULL), 0))
+        return bpoll_kernel_flight(bpollset);
+
+    if (__builtin_expect( (bpollset->rdidx != 0), 0)
+        && bpollset->timeout != 0)
+        return bpoll_kernel_nowait(bpollset);
+
+    if (__builtin_expect( (bpollset->busy_poll_usec != 0), 0)
+        && bpollset->timeout != 0)
+        return bpoll_kernel_busy_poll(bpollset);
+
+    return bpoll_kernel_mech(bpollset);
+}
+
+
+__attribute_nonnull__
+static int  __attribute_regparm__((1))
+bpoll_process_mech (bpollset_t * const restrict bpollset);
+static int  __attribute_regparm__((1))
+bpoll_process_mech (bpollset_t * const restrict bpollset)
+{
   #if HAS_KQUEUE
     if (bpollset->mech == BPOLL_M_KQUEUE)
-        return bpoll_kernel_kqueue(bpollset);
-    else
-  #endif
-  #if HAS_EVPORT
-    if (bpollset->mech == BPOLL_M_EVPORT)
-        return bpoll_kernel_evport(bpollset);
+        return bpoll_process_kqueue(bpollset);
     else
   #endif
-  #if HAS_POLLSET
-    if (bpollset->mech == BPOLL_M_POLLSET)
-        return bpoll_kernel_pollset(bpollset);
+  #if HAS_EVPORT
+    if (bpollset->mech == BPOLL_M_EVPORT)
+        return bpoll_process_evport(bpollset);
     else
   #endif
+  #if HAS_DEVPOLL || HAS_POLLSET
   #if HAS_DEVPOLL
     if (bpollset->mech == BPOLL_M_DEVPOLL)
-        return bpoll_kernel_devpoll(bpollset);
-    else
+  #elif HAS_POLLSET
+    if (bpollset->mech == BPOLL_M_POLLSET)
   #endif
+        return bpoll_process_devpollset(bpollset);
+    else
+  #endif /* HAS_DEVPOLL || HAS_POLLSET */
   #if HAS_EPOLL
     if (bpollset->mech == BPOLL_M_EPOLL)
-        return bpoll_kernel_epoll(bpollset);
+        return bpoll_process_epoll(bpollset);
     else
   #endif
     if (bpollset->mech == BPOLL_M_POLL)
-        return bpoll_kernel_pollfds(bpollset);
+        return bpoll_process_pollfds(bpollset);
+    else
+    if (bpollset->mech == BPOLL_M_SIM)
+        return bpoll_process_sim(bpollset);
     else  /* invalid bpollset->mech */
         return (errno = EINVAL), -1;
 }
 
 
+__attribute_noinline__
+__attribute_nonnull__
+static int
+bpoll_process_rdlist (bpollset_t * const restrict bpollset);
+static int
+bpoll_process_rdlist (bpollset_t * const restrict bpollset)
+{
+    /* collect ready bpollelts from kernel after those on user-space ready list
+     * (rdlist), then dispatch in order of priority class (control, normal,
+     * bulk) up to per-class budget, retaining remainder on rdlist.
+     * rdlist is sized to hold collected bpollelts:
+     *   rdlist[0,rdidx)        bpollelts retained from previous iteration
+     *   rdlist[rdidx,n)        bpollelts returned by kernel (this iteration)
+     * bpollelts to dispatch are ordered into results (results mode) or rddisp
+     * (callback mode; callbacks may bpoll_elt_mark_pending() onto rdlist)
+     * (kernel results collected in results mode; data param to callback is -1)
+     * (bpollelts on rdlist retain revents; level-triggered bpollelts returned
+     *  again by kernel are not duplicated) */
+    bpollelt_t ** restrict rdlist;
+    bpollelt_t ** restrict dispatch;
+    bpollelt_t * restrict bpollelt;
+    bpollelt_t ** const results = bpollset->results;
+    bpoll_fn_cb_event_t const fn_cb_event = bpollset->fn_cb_event;
+  #ifdef _THREAD_SAFE
+    int rdidx;
+  #else
+    const int rdidx = bpollset->rdidx;
+  #endif
+    const int nfound = bpollset->nfound > 0 ? bpollset->nfound : 0;
+    int cnt[BPOLL_PRIO_CLASSES] = { 0, 0, 0 };
+    int off[BPOLL_PRIO_CLASSES];
+    int i, n, ndispatch, nrd, prio;
+
+  #ifdef _THREAD_SAFE
+    if (bpollset->vsig_idx != 0)
+        bpoll_vsig_drain(bpollset);
+    rdidx = bpollset->rdidx;
+  #endif
+    if (bpollset->nfound < 0)
+        return bpollset->nfound;
+    n = rdidx + nfound;
+    if (bpollset->rdsz < n
+        && bpoll_rdlist_resize(bpollset, (size_t)n) != 0)
+        return -1;
+    if (results != NULL && bpollset->results_sz < (unsigned int)n
+        && bpoll_results_resize(bpollset, (size_t)n) != 0)
+        return -1;
+    if (results == NULL && bpollset->rddispsz < n
+        && bpoll_rddisp_resize(bpollset, (size_t)n) != 0)
+        return -1;
+    rdlist = bpollset->rdlist;
+
+    if (nfound != 0) {
+        /* collect kernel results (results mode) after rdlist elements */
+        memset(rdlist+rdidx, 0, (size_t)nfound * sizeof(bpollelt_t *));
+        bpollset->results = rdlist+rdidx;
+        n = bpoll_process_mech(bpollset);
+        bpollset->results = results;
+        if (__builtin_expect( (n < 0), 0))
+            return n;
+        n += rdidx;
+    }
+    else
+        n = rdidx;
+
+    /* count bpollelts per priority class (skip duplicates and removed elts) */
+    for (i = 0; i < n; ++i) {
+        bpollelt = rdlist[i];
+        if (bpollelt == NULL
+            || (i >= rdidx && (bpollelt->flpriv & BPOLL_FL_RDLIST))
+            || (bpollelt->flpriv & BPOLL_FL_CTL_DEL)) {
+            if (bpollelt != NULL && i < rdidx
+                && bpollelt->fdtype == BPOLL_FD_VIRTUAL) {
+                bpollelt->flpriv &= ~BPOLL_FL_RDLIST;
+                bpoll_elt_free(bpollset, bpollelt); /*bpoll_elt_remove_virtual*/
+            }
+            rdlist[i] = NULL;
+            continue;
+        }
+        if (bpollelt->flpriv & BPOLL_FL_INTERNAL) {
+            bpoll_elt_internal(bpollset, bpollelt);
+            bpollelt->revents = 0;
+            rdlist[i] = NULL;
+            continue;
+        }
+        ++cnt[bpoll_elt_get_prio(bpollelt)];
+    }
+    for (prio = 0; prio < BPOLL_PRIO_CLASSES; ++prio) {
+        if (cnt[prio] > bpollset->prio_budget[prio])
+            cnt[prio] = bpollset->prio_budget[prio];
+    }
+    off[BPOLL_PRIO_CONTROL] = 0;
+    off[BPOLL_PRIO_NORMAL]  = cnt[BPOLL_PRIO_CONTROL];
+    off[BPOLL_PRIO_BULK]    = cnt[BPOLL_PRIO_CONTROL]+cnt[BPOLL_PRIO_NORMAL];
+    ndispatch = off[BPOLL_PRIO_BULK] + cnt[BPOLL_PRIO_BULK];
+
+    /* order bpollelts for dispatch; retain remainder on rdlist (in order) */
+    dispatch = (results != NULL) ? results : bpollset->rddisp;
+    for (i = 0, nrd = 0; i < n; ++i) {
+        if ((bpollelt = rdlist[i]) == NULL)
+            continue;
+        prio = bpoll_elt_get_prio(bpollelt);
+        if (cnt[prio] != 0) {
+            --cnt[prio];
+            bpollelt->flpriv &= ~BPOLL_FL_RDLIST;
+            if (bpollelt->fdtype == BPOLL_FD_VIRTUAL
+                && (bpollelt->events & BPOLLDISPATCH))
+                bpollelt->flpriv |= BPOLL_FL_DISPATCHED;
+            dispatch[off[prio]++] = bpollelt;
+        }
+        else {
+            bpollelt->flpriv |= BPOLL_FL_RDLIST;
+            rdlist[nrd++] = bpollelt;
+        }
+    }
+    bpollset->rdidx = nrd;
+
+    if (dispatch != results) {
+        for (i = 0; i < ndispatch; ++i) {
+            bpollelt = dispatch[i];
+            BPOLL_CB_EVENT(fn_cb_event, bpollset, bpollelt, -1);
+            BPOLL_ELT_REVENTS_DONE(bpollelt);
+        }
+    }
+    if (bpollset->sigready) {
+        bpollset->sigready = 0;
+        bpoll_sigwatch_process(bpollset);
+    }
+    return ndispatch;
+}
+
+
 /* process each bpollelt with pending event(s) (e.g. run callback routine)
  * (intended to be called following bpoll_kernel())
  * Return value is same as bpoll_kernel()
@@ -4088,6 +6647,15 @@ int  __attribute_regparm__((1))
 bpoll_process (bpollset_t * const restrict bpollset)
 {
     const int nfound = bpollset->nfound;
+    if (__builtin_expect( (bpollset->watchdog != NULL), 0))
+        bpollset->watchdog->now = bpoll_clock_ns();
+    if (__builtin_expect( (bpollset->prio != 0), 0)
+        || __builtin_expect( (bpollset->rdidx != 0), 0))
+        return bpoll_process_rdlist(bpollset);
+  #ifdef _THREAD_SAFE
+    if (__builtin_expect( (bpollset->vsig_idx != 0), 0))
+        return bpoll_process_rdlist(bpollset);
+  #endif
     if (nfound <= 0)
         return nfound;
     if (bpollset->results_sz != 0
@@ -4096,34 +6664,9 @@ bpoll_process (bpollset_t * const restrict bpollset)
                                                    (size_t)nfound) != 0), 0))
         return -1;
 
-  #if HAS_KQUEUE
-    if (bpollset->mech == BPOLL_M_KQUEUE)
-        return bpoll_process_kqueue(bpollset);
-    else
-  #endif
-  #if HAS_EVPORT
-    if (bpollset->mech == BPOLL_M_EVPORT)
-        return bpoll_process_evport(bpollset);
-    else
-  #endif
-  #if HAS_DEVPOLL || HAS_POLLSET
-  #if HAS_DEVPOLL
-    if (bpollset->mech == BPOLL_M_DEVPOLL)
-  #elif HAS_POLLSET
-    if (bpollset->mech == BPOLL_M_POLLSET)
-  #endif
-        return bpoll_process_devpollset(bpollset);
-    else
-  #endif /* HAS_DEVPOLL || HAS_POLLSET */
-  #if HAS_EPOLL
-    if (bpollset->mech == BPOLL_M_EPOLL)
-        return bpoll_process_epoll(bpollset);
-    else
-  #endif
-    if (bpollset->mech == BPOLL_M_POLL)
-        return bpoll_process_pollfds(bpollset);
-    else  /* invalid bpollset->mech */
-        return (errno = EINVAL), -1;
+    return __builtin_expect( (bpollset->nintern == 0), 1)
+      ? bpoll_process_mech(bpollset)
+      : bpoll_process_internal(bpollset, bpoll_process_mech(bpollset));
 }
 
 
@@ -4137,9 +6680,593 @@ bpoll_poll (bpollset_t * const restrict bpollset,
             const struct timespec * const timespec)
 {
     const int rc = bpoll_kernel(bpollset, timespec);
-    return (__builtin_expect( (rc > 0), 1)) ? bpoll_process(bpollset) : rc;
+    return (__builtin_expect( (rc > 0), 1)
+            || (rc == 0 && bpollset->rdidx != 0))
+      ? bpoll_process(bpollset)
+      : rc;
+}
+
+
+#ifndef BPOLL_BATCH_SLICES
+#define BPOLL_BATCH_SLICES 8
+#endif
+
+__attribute_noinline__
+__attribute_nonnull__
+static int
+bpoll_kernel_coalesce (bpollset_t * const restrict bpollset,
+                       const int min_events, const struct timespec * const t0);
+static int
+bpoll_kernel_coalesce (bpollset_t * const restrict bpollset,
+                       const int min_events, const struct timespec * const t0)
+{
+    /* sleep in slices and re-poll kernel (zero timeout) until min_events ready
+     * or max_wait (bpollset->ts) elapses.  Sleep instead of blocking in kernel
+     * since level-triggered events already returned would cause kernel poll
+     * to return immediately.  bpollset->ts, timeout restored before return */
+    const int timeout = bpollset->timeout;
+    const struct timespec ts = bpollset->ts;
+    const int64_t tsns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    const int64_t slice = tsns >= BPOLL_BATCH_SLICES
+                        ? tsns / BPOLL_BATCH_SLICES
+                        : 1;
+    const int limit = (int)bpollset->queue_sz;
+    int64_t remain;
+    struct timespec t;
+    int nfound = bpollset->nfound;
+
+    bpollset->timeout    = 0;
+    bpollset->ts.tv_sec  = 0;
+    bpollset->ts.tv_nsec = 0;
+    while (nfound > 0 && nfound < min_events && nfound < limit) {
+        if (0 != clock_gettime(BPOLL_CLOCK_BUSY_POLL, &t))
+            break;
+        remain = tsns - ((int64_t)(t.tv_sec - t0->tv_sec) * 1000000000
+                         + (t.tv_nsec - t0->tv_nsec));
+        if (remain <= 0)
+            break;
+        if (remain > slice)
+            remain = slice;
+        t.tv_sec  = (time_t)(remain / 1000000000);
+        t.tv_nsec = (long)(remain % 1000000000);
+        if (0 != nanosleep(&t, NULL))
+            break;  /*(EINTR; return events collected so far)*/
+      #if HAS_EPOLL
+        if (bpollset->mech == BPOLL_M_EPOLL)
+            nfound = bpoll_kernel_epoll_append(bpollset);
+        else
+      #endif
+        if (bpollset->mech & (BPOLL_M_POLL|BPOLL_M_DEVPOLL|BPOLL_M_POLLSET))
+            /*(level-triggered only; new snapshot includes previous events)*/
+            nfound = bpoll_kernel_mech(bpollset);
+        else
+            break;  /*(BPOLL_M_KQUEUE, BPOLL_M_EVPORT: not coalesced)*/
+    }
+
+    bpollset->timeout = timeout;
+    bpollset->ts      = ts;
+    return nfound;
+}
+
+
+/* (convenience routine; see notes in bpoll.h)
+ * poll kernel and process events, coalescing until min_events or max_wait
+ */
+int
+bpoll_poll_batch (bpollset_t * const restrict bpollset, const int min_events,
+                  const struct timespec * const max_wait)
+{
+    struct timespec t0;
+    int rc;
+    if (max_wait == NULL || min_events <= 1
+        || 0 != clock_gettime(BPOLL_CLOCK_BUSY_POLL, &t0))
+        return bpoll_poll(bpollset, max_wait);
+    rc = bpoll_kernel(bpollset, max_wait);
+    if (rc > 0 && rc < min_events && bpollset->timeout > 0)
+        rc = bpoll_kernel_coalesce(bpollset, min_events, &t0);
+    return (__builtin_expect( (rc > 0), 1)
+            || (rc == 0 && bpollset->rdidx != 0))
+      ? bpoll_process(bpollset)
+      : rc;
+}
+
+
+#ifdef _THREAD_SAFE
+
+/* dispatch pool
+ * Polling thread pushes ready bpollelts into per-worker single-producer,
+ * single-consumer (SPSC) inbox rings.  Each worker moves its inbox into its
+ * own Chase-Lev deque, takes from bottom of its deque, and steals from top of
+ * other workers' deques when idle.  Completed bpollelts and events with which
+ * to re-arm are pushed into per-worker SPSC outbox rings, which the polling
+ * thread drains before polling kernel.  (Chase-Lev deque memory orderings are
+ * from Le, Pop, Cohen, Zappa Nardelli, "Correct and Efficient Work-Stealing
+ * for Weak Memory Models", PPoPP 2013.)  Rings and deques are sized to the
+ * max number of bpollelts in flight and therefore can not overflow.
+ * (deque indices are unsigned int and compared by signed difference, so that
+ *  wraparound is harmless and 64-bit atomics are not needed)
+ */
+
+struct bpoll_dispatch_rearm {
+    bpollelt_t *bpollelt;
+    int events;
+};
+
+struct bpoll_dispatch_worker {
+    /* Chase-Lev deque (owner: worker; thieves: other workers) */
+    unsigned int top;
+    unsigned int bottom;
+    bpollelt_t **deque;
+    /* inbox (producer: polling thread; consumer: worker) */
+    bpollelt_t **inbox;
+    unsigned int in_head;
+    unsigned int in_tail;
+    /* outbox (producer: worker; consumer: polling thread) */
+    struct bpoll_dispatch_rearm *outbox;
+    unsigned int out_head;
+    unsigned int out_tail;
+    bpoll_dispatch_pool_t *pool;
+    unsigned int id;
+    pthread_t thread;
+    char pad[64];  /* (separate cache lines of adjacent workers) */
+};
+
+struct bpoll_dispatch_pool {
+    bpollset_t *bpollset;
+    bpoll_fn_cb_dispatch_t fn_cb_dispatch;
+    void *vdata;
+    struct bpoll_dispatch_worker *workers;
+    unsigned int nthreads;
+    unsigned int nstarted;
+    unsigned int mask;      /* (ring and deque size - 1) */
+    unsigned int limit;     /* (max inflight; <= mask + 1) */
+    unsigned int inflight;
+    unsigned int next;      /* (round-robin worker for next inbox push) */
+    /* backlog (polling thread) of ready bpollelts exceeding inflight limit */
+    bpollelt_t **backlog;
+    unsigned int bl_mask;
+    unsigned int bl_head;
+    unsigned int bl_count;
+    bpollelt_t *wakeelt;    /* (read end of wakeup pipe) */
+    int wakefd;             /* (write end of wakeup pipe) */
+    unsigned int notified;
+    unsigned int shutdown;
+    unsigned int sleepers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+
+__attribute_nonnull__
+static void
+bpoll_dispatch_deque_push (struct bpoll_dispatch_worker * const restrict w,
+                           bpollelt_t * const restrict bpollelt,
+                           const unsigned int mask);
+static void
+bpoll_dispatch_deque_push (struct bpoll_dispatch_worker * const restrict w,
+                           bpollelt_t * const restrict bpollelt,
+                           const unsigned int mask)
+{
+    /* (owner only) (deque can not overflow; sized to inflight limit) */
+    const unsigned int b = plasma_atomic_ld_nopt(&w->bottom);
+    plasma_atomic_st_nopt(&w->deque[b & mask], bpollelt);
+    plasma_membar_st_rel();
+    plasma_atomic_st_nopt(&w->bottom, b+1);
+}
+
+
+__attribute_nonnull__
+static bpollelt_t *
+bpoll_dispatch_deque_take (struct bpoll_dispatch_worker * const restrict w,
+                           const unsigned int mask);
+static bpollelt_t *
+bpoll_dispatch_deque_take (struct bpoll_dispatch_worker * const restrict w,
+                           const unsigned int mask)
+{
+    /* (owner only) */
+    const unsigned int b = plasma_atomic_ld_nopt(&w->bottom) - 1;
+    unsigned int t;
+    bpollelt_t *bpollelt = NULL;
+    plasma_atomic_st_nopt(&w->bottom, b);
+    plasma_membar_StoreLoad();
+    t = plasma_atomic_ld_nopt(&w->top);
+    if ((int)(b - t) >= 0) {
+        bpollelt = plasma_atomic_ld_nopt(&w->deque[b & mask]);
+        if (t == b) {  /* last element; race with thieves */
+            if (!plasma_atomic_CAS_32(&w->top, t, t+1))
+                bpollelt = NULL;
+            plasma_atomic_st_nopt(&w->bottom, b+1);
+        }
+    }
+    else
+        plasma_atomic_st_nopt(&w->bottom, b+1);
+    return bpollelt;
+}
+
+
+__attribute_nonnull__
+static bpollelt_t *
+bpoll_dispatch_deque_steal (struct bpoll_dispatch_worker * const restrict w,
+                            const unsigned int mask);
+static bpollelt_t *
+bpoll_dispatch_deque_steal (struct bpoll_dispatch_worker * const restrict w,
+                            const unsigned int mask)
+{
+    /* (thieves) (retry if lost race; another thread made progress) */
+    unsigned int t, b;
+    bpollelt_t *bpollelt;
+    do {
+        t = plasma_atomic_ld_nopt(&w->top);
+        plasma_membar_StoreLoad();
+        b = plasma_atomic_ld_nopt(&w->bottom);
+        plasma_membar_ld_acq();
+        if ((int)(b - t) <= 0)
+            return NULL;
+        bpollelt = plasma_atomic_ld_nopt(&w->deque[t & mask]);
+    } while (!plasma_atomic_CAS_32(&w->top, t, t+1));
+    return bpollelt;
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_dispatch_work_visible (const bpoll_dispatch_pool_t * const restrict pool,
+                             struct bpoll_dispatch_worker * const restrict w);
+static int
+bpoll_dispatch_work_visible (const bpoll_dispatch_pool_t * const restrict pool,
+                             struct bpoll_dispatch_worker * const restrict w)
+{
+    unsigned int i, t;
+    if (plasma_atomic_ld_nopt(&w->in_head)
+        != plasma_atomic_ld_nopt(&w->in_tail))
+        return 1;
+    for (i = 0; i < pool->nthreads; ++i) {
+        t = plasma_atomic_ld_nopt(&pool->workers[i].top);
+        if ((int)(plasma_atomic_ld_nopt(&pool->workers[i].bottom) - t) > 0)
+            return 1;
+    }
+    return 0;
+}
+
+
+__attribute_nonnull__
+static void
+bpoll_dispatch_wake_workers (bpoll_dispatch_pool_t * const restrict pool);
+static void
+bpoll_dispatch_wake_workers (bpoll_dispatch_pool_t * const restrict pool)
+{
+    /* (pairs with seq_cst increment of sleepers in bpoll_dispatch_worker()) */
+    plasma_membar_StoreLoad();
+    if (plasma_atomic_ld_nopt(&pool->sleepers) != 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+
+__attribute_nonnull__
+static void *
+bpoll_dispatch_worker (void * const arg);
+static void *
+bpoll_dispatch_worker (void * const arg)
+{
+    struct bpoll_dispatch_worker * const restrict w =
+      (struct bpoll_dispatch_worker *)arg;
+    bpoll_dispatch_pool_t * const restrict pool = w->pool;
+    const unsigned int mask = pool->mask;
+    const unsigned int nthreads = pool->nthreads;
+    bpollelt_t *bpollelt;
+    unsigned int i, head, tail, out;
+    int events;
+
+    while (!plasma_atomic_ld_nopt(&pool->shutdown)) {
+
+        /* move inbox into deque so that other workers can steal */
+        head = plasma_atomic_ld_nopt(&w->in_head);
+        tail = plasma_atomic_ld_nopt(&w->in_tail);
+        plasma_membar_ld_acq();
+        if (head != tail) {
+            for (i = head; i != tail; ++i)
+                bpoll_dispatch_deque_push(w, w->inbox[i & mask], mask);
+            plasma_membar_st_rel();
+            plasma_atomic_st_nopt(&w->in_head, tail);
+            if (tail - head > 1)
+                bpoll_dispatch_wake_workers(pool);
+        }
+
+        bpollelt = bpoll_dispatch_deque_take(w, mask);
+        for (i = 1; bpollelt == NULL && i < nthreads; ++i)
+            bpollelt = bpoll_dispatch_deque_steal(
+                         &pool->workers[(w->id + i) % nthreads], mask);
+
+        if (bpollelt == NULL) {
+            pthread_mutex_lock(&pool->mutex);
+            plasma_atomic_fetch_add_u32(&pool->sleepers, 1,
+                                        memory_order_seq_cst);
+            plasma_membar_StoreLoad();
+            if (!plasma_atomic_ld_nopt(&pool->shutdown)
+                && !bpoll_dispatch_work_visible(pool, w))
+                pthread_cond_wait(&pool->cond, &pool->mutex);
+            plasma_atomic_fetch_sub_u32(&pool->sleepers, 1,
+                                        memory_order_relaxed);
+            pthread_mutex_unlock(&pool->mutex);
+            continue;
+        }
+
+        events = pool->fn_cb_dispatch(pool, bpollelt, pool->vdata);
+
+        /* pass bpollelt back to polling thread; wake it if not yet notified */
+        /* (CAS is full barrier; pairs with bpoll_dispatch_pool_rearm()) */
+        out = plasma_atomic_ld_nopt(&w->out_tail);
+        w->outbox[out & mask].bpollelt = bpollelt;
+        w->outbox[out & mask].events   = events;
+        plasma_membar_st_rel();
+        plasma_atomic_st_nopt(&w->out_tail, out+1);
+        if (plasma_atomic_CAS_32(&pool->notified, 0, 1)) {
+            const ssize_t wr = write(pool->wakefd, "", 1);
+            (void)wr; /* (EAGAIN ok; pipe already non-empty) */
+        }
+    }
+
+    return NULL;
+}
+
+
+__attribute_nonnull__
+static void
+bpoll_dispatch_pool_rearm (bpoll_dispatch_pool_t * const restrict pool);
+static void
+bpoll_dispatch_pool_rearm (bpoll_dispatch_pool_t * const restrict pool)
+{
+    /* (polling thread) re-arm or remove bpollelts returned by workers */
+    bpollset_t * const restrict bpollset = pool->bpollset;
+    const unsigned int mask = pool->mask;
+    struct bpoll_dispatch_worker *w;
+    struct bpoll_dispatch_rearm *r;
+    unsigned int i, head, tail;
+    /* (clear notified before reading outboxes; worker that finds notified
+     *  set has stored its outbox entry before CAS) */
+    plasma_atomic_st_nopt(&pool->notified, 0);
+    plasma_membar_StoreLoad();
+    for (i = 0; i < pool->nthreads; ++i) {
+        w    = &pool->workers[i];
+        head = plasma_atomic_ld_nopt(&w->out_head);
+        tail = plasma_atomic_ld_nopt(&w->out_tail);
+        plasma_membar_ld_acq();
+        for (; head != tail; ++head) {
+            r = &w->outbox[head & mask];
+            if (r->events != 0)
+                bpoll_elt_modify(bpollset, r->bpollelt,
+                                 r->events | BPOLLDISPATCH);
+            else
+                bpoll_elt_remove(bpollset, r->bpollelt);
+            --pool->inflight;
+        }
+        plasma_membar_st_rel();
+        plasma_atomic_st_nopt(&w->out_head, tail);
+    }
+}
+
+
+__attribute_nonnull__
+static void
+bpoll_dispatch_pool_push (bpoll_dispatch_pool_t * const restrict pool,
+                          bpollelt_t * const restrict bpollelt);
+static void
+bpoll_dispatch_pool_push (bpoll_dispatch_pool_t * const restrict pool,
+                          bpollelt_t * const restrict bpollelt)
+{
+    /* (polling thread) */
+    struct bpoll_dispatch_worker * const restrict w =
+      &pool->workers[pool->next];
+    const unsigned int tail = plasma_atomic_ld_nopt(&w->in_tail);
+    w->inbox[tail & pool->mask] = bpollelt;
+    plasma_membar_st_rel();
+    plasma_atomic_st_nopt(&w->in_tail, tail+1);
+    if (++pool->next == pool->nthreads)
+        pool->next = 0;
+    ++pool->inflight;
+}
+
+
+int
+bpoll_dispatch_pool_poll (bpoll_dispatch_pool_t * const restrict pool,
+                          const struct timespec * const timespec)
+{
+    bpollset_t * const restrict bpollset = pool->bpollset;
+    const unsigned int limit = pool->limit;
+    bpollelt_t **results;
+    bpollelt_t *bpollelt;
+    unsigned int pushed = 0;
+    int i, n;
+
+    bpoll_dispatch_pool_rearm(pool);
+    for (; pool->bl_count != 0 && pool->inflight < limit; ++pushed) {
+        bpoll_dispatch_pool_push(pool, pool->backlog[pool->bl_head]);
+        pool->bl_head = (pool->bl_head + 1) & pool->bl_mask;
+        --pool->bl_count;
+    }
+
+    n = bpoll_poll(bpollset, timespec);
+    results = bpollset->results;
+    for (i = 0; i < n; ++i) {
+        bpollelt = results[i];
+        if (bpollelt == pool->wakeelt)
+            bpoll_pipe_drain(bpollelt->fd);
+        else if (__builtin_expect( !(bpollelt->events & BPOLLDISPATCH), 0)
+                 || __builtin_expect( (pool->bl_count > pool->bl_mask), 0)) {
+            /* (not queued: bpollelt without BPOLLDISPATCH might be returned
+             *  again while in flight or in backlog, and so might overrun
+             *  rings sized to one entry per bpollelt.  Re-arm bpollelt with
+             *  BPOLLDISPATCH; it is dispatched when next returned by kernel)
+             * (backlog full is not expected once all are BPOLLDISPATCH) */
+            bpoll_elt_modify(bpollset, bpollelt,
+                             bpollelt->events | BPOLLDISPATCH);
+        }
+        else if (pool->inflight < limit) {
+            bpoll_dispatch_pool_push(pool, bpollelt);
+            ++pushed;
+        }
+        else {  /* (backlog sized to bpollset limit; one entry per bpollelt) */
+            pool->backlog[(pool->bl_head + pool->bl_count++) & pool->bl_mask] =
+              bpollelt;
+        }
+    }
+
+    if (pushed)
+        bpoll_dispatch_wake_workers(pool);
+    return n;
+}
+
+
+void
+bpoll_dispatch_pool_destroy (bpoll_dispatch_pool_t * const restrict pool)
+{
+    bpollset_t *bpollset;
+    unsigned int i;
+    if (pool == NULL)
+        return;
+    bpollset = pool->bpollset;
+    pthread_mutex_lock(&pool->mutex);
+    plasma_atomic_st_nopt(&pool->shutdown, 1);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i = 0; i < pool->nstarted; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    if (pool->wakeelt != NULL)
+        bpoll_elt_remove(bpollset, pool->wakeelt);  /* (BPOLL_FL_CLOSE) */
+    if (pool->wakefd != -1)
+        close(pool->wakefd);
+    if (bpollset->fn_mem_free != NULL)
+        bpollset->fn_mem_free(bpollset->vdata, pool);
+}
+
+
+bpoll_dispatch_pool_t *
+bpoll_dispatch_pool_create (bpollset_t * const restrict bpollset,
+                            const unsigned int nthreads,
+                            const unsigned int inflight,
+                            bpoll_fn_cb_dispatch_t const fn_cb_dispatch,
+                            void * const vdata)
+{
+    bpoll_dispatch_pool_t *pool;
+    struct bpoll_dispatch_worker *w;
+    unsigned int cap = 2, blcap = 2, i;
+    size_t sz;
+    char *p;
+    sigset_t sigs, osigs;
+    int pipefds[2];
+    int rc;
+
+    if (nthreads == 0 || nthreads > 1024 || inflight == 0
+        || inflight > (1u << 24) || bpollset->fn_cb_event != NULL
+        || bpollset->mech == BPOLL_M_NOT_SET) {
+        errno = EINVAL;
+        return NULL;
+    }
+    while (cap < inflight)
+        cap <<= 1;
+    while (blcap < bpollset->limit)
+        blcap <<= 1;
+
+    /* single allocation: pool, workers, per-worker rings and deques, backlog */
+    sz = sizeof(bpoll_dispatch_pool_t)
+       + nthreads * (sizeof(struct bpoll_dispatch_worker)
+                     + cap * (sizeof(bpollelt_t *)
+                              + sizeof(bpollelt_t *)
+                              + sizeof(struct bpoll_dispatch_rearm)))
+       + blcap * sizeof(bpollelt_t *);
+    pool = (bpoll_dispatch_pool_t *)
+      bpollset->fn_mem_alloc(bpollset->vdata, sz);
+    if (__builtin_expect( (pool == NULL), 0))
+        return NULL;
+    memset(pool, 0, sz);
+    p = (char *)(pool + 1);
+    pool->workers = w = (struct bpoll_dispatch_worker *)p;
+    p += nthreads * sizeof(struct bpoll_dispatch_worker);
+    for (i = 0; i < nthreads; ++i) {
+        w[i].outbox = (struct bpoll_dispatch_rearm *)p;
+        p += cap * sizeof(struct bpoll_dispatch_rearm);
+        w[i].deque = (bpollelt_t **)p;
+        p += cap * sizeof(bpollelt_t *);
+        w[i].inbox = (bpollelt_t **)p;
+        p += cap * sizeof(bpollelt_t *);
+        w[i].pool = pool;
+        w[i].id   = i;
+    }
+    pool->backlog        = (bpollelt_t **)p;
+    pool->bl_mask        = blcap - 1;
+    pool->bpollset       = bpollset;
+    pool->fn_cb_dispatch = fn_cb_dispatch;
+    pool->vdata          = vdata;
+    pool->nthreads       = nthreads;
+    pool->mask           = cap - 1;
+    pool->limit          = inflight;
+    pool->wakefd         = -1;
+
+    if (0 != (rc = pthread_mutex_init(&pool->mutex, NULL))) {
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, pool);
+        errno = rc;
+        return NULL;
+    }
+    if (0 != (rc = pthread_cond_init(&pool->cond, NULL))) {
+        pthread_mutex_destroy(&pool->mutex);
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, pool);
+        errno = rc;
+        return NULL;
+    }
+
+    /* wakeup pipe; workers write to notify polling thread of completions */
+    do {
+        if (0 != (rc = bpoll_pipe_nonblock(pipefds)))
+            break;
+        pool->wakefd = pipefds[1];
+        pool->wakeelt = bpoll_elt_init(bpollset, NULL, pipefds[0],
+                                       BPOLL_FD_PIPE, BPOLL_FL_CLOSE);
+        if (pool->wakeelt == NULL) {
+            rc = errno;
+            close(pipefds[0]);
+            break;
+        }
+        if (0 != (rc = bpoll_elt_add(bpollset, pool->wakeelt, BPOLLIN))) {
+            bpoll_elt_destroy(bpollset, pool->wakeelt);
+            pool->wakeelt = NULL;
+            close(pipefds[0]);
+            break;
+        }
+
+        /* (workers inherit signal mask; block signals in workers so that
+         *  signals, e.g. those watched by bpoll_signal_watch(), are delivered
+         *  to application threads; synchronous fault signals not blocked) */
+        sigfillset(&sigs);
+        sigdelset(&sigs, SIGBUS);
+        sigdelset(&sigs, SIGFPE);
+        sigdelset(&sigs, SIGILL);
+        sigdelset(&sigs, SIGSEGV);
+        pthread_sigmask(SIG_BLOCK, &sigs, &osigs);
+        for (; pool->nstarted < nthreads; ++pool->nstarted) {
+            rc = pthread_create(&w[pool->nstarted].thread, NULL,
+                                bpoll_dispatch_worker, &w[pool->nstarted]);
+            if (0 != rc)
+                break;
+        }
+        pthread_sigmask(SIG_SETMASK, &osigs, NULL);
+        if (pool->nstarted == nthreads)
+            return pool;
+    } while (0);
+
+    bpoll_dispatch_pool_destroy(pool);
+    errno = rc;
+    return NULL;
 }
 
+#endif /* _THREAD_SAFE */
+
 
 /* poll single descriptor (standalone, portable, convenience routine)
  * (overload sec == (time_t)-1 to mean infinite (no) timeout)
@@ -45,6 +45,9 @@
 #define HAS_PPOLL 1
 /* Linux kernel 2.6.19+ and glibc 2.6 has epoll_pwait() */
 #define HAS_EPOLL_PWAIT 1
+/* Linux kernel 5.11+ has epoll_pwait2() (timespec timeout; nsec precision)
+ * (invoked via syscall(); falls back to epoll_pwait() if kernel ENOSYS) */
+#define HAS_EPOLL_PWAIT2 1
 #endif
 #ifdef __sun
 #define HAVE_SYS_DEVPOLL_H 1
@@ -135,9 +138,13 @@ struct pollfd {
 # ifndef HAS_EPOLL_PWAIT
 # define HAS_EPOLL_PWAIT 0
 # endif
+# ifndef HAS_EPOLL_PWAIT2
+# define HAS_EPOLL_PWAIT2 0
+# endif
 #else
 # define HAS_EPOLL 0
 # define HAS_EPOLL_PWAIT 0
+# define HAS_EPOLL_PWAIT2 0
 #endif
 
 #ifdef HAVE_SYS_EVENT_H
@@ -164,6 +171,7 @@ struct pollfd {
 #endif
 
 #include <time.h>  /* struct timespec */
+#include <sys/types.h>  /* pid_t */
 
 #ifdef _REENTRANT
 #ifndef _THREAD_SAFE
@@ -276,7 +284,8 @@ enum {
     BPOLL_M_EPOLL   = 4,
     BPOLL_M_KQUEUE  = 8,
     BPOLL_M_EVPORT  = 16,
-    BPOLL_M_POLLSET = 32
+    BPOLL_M_POLLSET = 32,
+    BPOLL_M_SIM     = 64    /* user-space simulation; see bpoll_sim_ready() */
 };
 /** @} */
 
@@ -292,7 +301,9 @@ typedef enum {
     BPOLL_FD_EVENT,         /**< descriptor is eventfd */
     BPOLL_FD_SIGNAL,        /**< descriptor is signalfd */
     BPOLL_FD_TIMER,         /**< descriptor is timerfd */
-    BPOLL_FD_INOTIFY        /**< descriptor is inotify fd */
+    BPOLL_FD_INOTIFY,       /**< descriptor is inotify fd */
+    BPOLL_FD_VIRTUAL,       /**< no descriptor; user-space event source */
+    BPOLL_FD_PIDFD          /**< descriptor is pidfd (child process) */
 } bpoll_fdtype_e;
 /** @} */
 
@@ -306,16 +317,37 @@ typedef enum {
     /* flags */
     BPOLL_FL_ZERO       = 0, /**< zero (flag name for clarity) */
     BPOLL_FL_CLOSE      = 1, /**< close fd upon removal from bpollset */
+    BPOLL_FL_PRIO_CONTROL=2, /**< priority class: control (see BPOLL_PRIO_*) */
+    BPOLL_FL_PRIO_BULK  = 4, /**< priority class: bulk    (see BPOLL_PRIO_*) */
+    BPOLL_FL_PRIO_MASK  = 6, /**< priority class bits */
     /* flpriv (flags internal, private) */
     BPOLL_FL_MEM_BLOCK  = 1, /**< element allocated from bpollset mem chunk */
     BPOLL_FL_CTL_ADD    = 2, /**< element pending add */
     BPOLL_FL_CTL_DEL    = 4, /**< element pending delete */
     BPOLL_FL_DISPATCHED = 8, /**< element returned by kernel (BPOLLDISPATCH) */
     BPOLL_FL_DISP_KQRD  = 16,/**< element returned by kernel (BPOLLDISPATCH) */
-    BPOLL_FL_DISP_KQWR  = 32 /**< element returned by kernel (BPOLLDISPATCH) */
+    BPOLL_FL_DISP_KQWR  = 32,/**< element returned by kernel (BPOLLDISPATCH) */
+    BPOLL_FL_BATCHED    = 64,/**< element in batch (bpoll_poll_batch()) */
+    BPOLL_FL_RDLIST     = 128,/**< element on user-space ready list (rdlist) */
+    BPOLL_FL_VPEND      = 256,/**< virtual element signalled while dispatched */
+    BPOLL_FL_INTERNAL   = 512 /**< element internal to bpoll (wakeup, signal) */
 } bpoll_flags_e;
 /** @} */
 
+/**
+ * @defgroup bpoll element priority class
+ * (ready elements are dispatched in order: control, normal, bulk)
+ * (priority class is stored in bpollelt->flags; BPOLL_FL_PRIO_*)
+ * @{
+ */
+enum {
+    BPOLL_PRIO_NORMAL  = 0,
+    BPOLL_PRIO_CONTROL = 1,
+    BPOLL_PRIO_BULK    = 2,
+    BPOLL_PRIO_CLASSES = 3
+};
+/** @} */
+
 /** @see struct bpollelt_t */
 typedef struct bpollelt_t bpollelt_t;
 
@@ -342,6 +374,12 @@ typedef struct bpollset_t bpollset_t;
  * bpoll_fn_cb_close_t should not modify bpollset or call bpoll routines */
 typedef void (*bpoll_fn_cb_event_t)(bpollset_t *, bpollelt_t *, int data);
 typedef void (*bpoll_fn_cb_close_t)(bpollset_t *, bpollelt_t *);
+typedef void (*bpoll_fn_cb_signal_t)(bpollset_t *, int signo);
+typedef int  (*bpoll_fn_cb_accept_t)(bpollset_t *, bpollelt_t *listen_elt,
+                                     bpollelt_t *);
+typedef void (*bpoll_fn_cb_slow_t)(bpollset_t *, bpollelt_t *, int revents,
+                                   uint64_t nsec);
+typedef unsigned int (*bpoll_fn_cb_class_t)(const bpollelt_t *);
 typedef void * (*bpoll_fn_mem_alloc_t)(void *, size_t);
 typedef void (*bpoll_fn_mem_free_t)(void *, void *);
 
@@ -359,6 +397,132 @@ struct bpoll_mem_block {
 #endif
 typedef struct bpoll_mem_block bpoll_mem_block_t;
 
+/* statistics counters are compiled in with -DBPOLL_STATS=1
+ * (define for both library and application; changes struct bpollset_t) */
+#ifndef BPOLL_STATS
+#define BPOLL_STATS 0
+#endif
+
+/** histogram buckets: [0] 0, [1] 1, [2] 2-3, [3] 4-7, ... [15] >= 16384 */
+#define BPOLL_STATS_HIST_SZ 16
+
+/** @see struct bpoll_stats */
+typedef struct bpoll_stats bpoll_stats_t;
+
+/** bpollset statistics counters (@see bpoll_stats_get()) */
+struct bpoll_stats {
+    uint64_t kernel_waits;      /**< kernel polls (incl. zero timeout) */
+    uint64_t kernel_empty;      /**< kernel polls returning no events */
+    uint64_t kernel_nfound[BPOLL_STATS_HIST_SZ]; /**< events per kernel poll */
+    uint64_t ctl_add;           /**< epoll_ctl() EPOLL_CTL_ADD (epoll, sim) */
+    uint64_t ctl_mod;           /**< epoll_ctl() EPOLL_CTL_MOD (epoll, sim) */
+    uint64_t ctl_del;           /**< epoll_ctl() EPOLL_CTL_DEL (epoll, sim) */
+    uint64_t commit_sz[BPOLL_STATS_HIST_SZ]; /**< changes per commit to kernel*/
+    uint64_t queue_full;        /**< early commits (queue_sz changes pending) */
+    uint64_t rmlist_flush;      /**< flushes of deferred removals (rmlist) */
+    uint64_t mem_chunk_alloc;   /**< bpollelt memory chunks allocated */
+    uint64_t mem_block_reorder; /**< reorders of free bpollelt memory blocks */
+};
+
+/** watchdog callback classes (default class is bpollelt->fdtype) */
+#define BPOLL_WATCHDOG_CLASSES 16
+
+/** histogram buckets: [0] < 1us, [n] 2^(n-1) - 2^n us, ... [23] >= 4.2s */
+#define BPOLL_WATCHDOG_HIST_SZ 24
+
+/** @see struct bpoll_watchdog_stats */
+typedef struct bpoll_watchdog_stats bpoll_watchdog_stats_t;
+
+/** fn_cb_event latency per class (@see bpoll_watchdog_stats_get()) */
+struct bpoll_watchdog_stats {
+    uint64_t ncalls;            /**< fn_cb_event calls */
+    uint64_t nslow;             /**< fn_cb_event calls over budget */
+    uint64_t total_ns;          /**< sum of fn_cb_event run times */
+    uint64_t max_ns;            /**< longest fn_cb_event run time */
+    uint64_t hist[BPOLL_WATCHDOG_HIST_SZ]; /**< fn_cb_event calls by usec */
+};
+
+/**
+ * @defgroup bpoll flight recorder entry types
+ * @{
+ */
+enum {
+    BPOLL_FLIGHT_WAIT   = 1, /**< bpoll_kernel() start; arg: timeout ms (-1)*/
+    BPOLL_FLIGHT_WAKE   = 2, /**< bpoll_kernel() end; arg: nfound; arg2: errno*/
+    BPOLL_FLIGHT_COMMIT = 3, /**< changes committed to kernel; arg: count */
+    BPOLL_FLIGHT_ADD    = 4, /**< bpollelt added; arg: fd; arg2: events */
+    BPOLL_FLIGHT_REMOVE = 5, /**< bpollelt removed; arg: fd */
+    BPOLL_FLIGHT_CB     = 6, /**< fn_cb_event; arg: fd; arg2: usec run time */
+    BPOLL_FLIGHT_NOTE   = 7  /**< application (bpoll_flight_note()) */
+};
+/** @} */
+
+/** @see struct bpoll_flight_entry */
+typedef struct bpoll_flight_entry bpoll_flight_entry_t;
+
+/** flight recorder entry (binary; 24 bytes; host byte order) */
+struct bpoll_flight_entry {
+    uint64_t ns;                /**< CLOCK_MONOTONIC ns (CB: start time) */
+    uint32_t seq;               /**< entry number + 1 (low 32 bits) */
+    uint16_t type;              /**< BPOLL_FLIGHT_* */
+    uint16_t fdtype;            /**< bpollelt->fdtype (ADD, REMOVE, CB) */
+    int32_t  arg;
+    uint32_t arg2;
+};
+
+/** @see struct bpoll_flight_hdr */
+typedef struct bpoll_flight_hdr bpoll_flight_hdr_t;
+
+/** flight recorder dump header (followed by entries, oldest first) */
+struct bpoll_flight_hdr {
+    char magic[8];              /**< "BPFLIGHT" */
+    uint32_t version;           /**< 1 */
+    uint32_t entry_sz;          /**< sizeof(bpoll_flight_entry_t) */
+    uint64_t nrecorded;         /**< entries recorded since enabled */
+    uint64_t nentries;          /**< ring size (max entries dumped) */
+};
+
+/**
+ * @defgroup bpoll trace record types
+ * @{
+ */
+enum {
+    BPOLL_TRACE_ADD     = 1, /**< bpollelt added; fd, fdtype, events */
+    BPOLL_TRACE_MODIFY  = 2, /**< bpollelt modified; fd, fdtype, events */
+    BPOLL_TRACE_REMOVE  = 3, /**< bpollelt removed; fd, fdtype */
+    BPOLL_TRACE_WAIT    = 4, /**< kernel poll start; fd: timeout ms (-1) */
+    BPOLL_TRACE_WAKE    = 5, /**< kernel poll end; fd: nfound; events: errno */
+    BPOLL_TRACE_READY   = 6  /**< returned by kernel; fd, fdtype, revents */
+};
+/** @} */
+
+/** @see struct bpoll_trace_rec */
+typedef struct bpoll_trace_rec bpoll_trace_rec_t;
+
+/** trace record (binary; 16 bytes; host byte order) */
+struct bpoll_trace_rec {
+    uint32_t usec;              /**< usec since previous record (saturated) */
+    uint16_t type;              /**< BPOLL_TRACE_* */
+    uint16_t fdtype;            /**< bpollelt->fdtype */
+    int32_t  fd;
+    uint32_t events;
+};
+
+/** @see struct bpoll_trace_hdr */
+typedef struct bpoll_trace_hdr bpoll_trace_hdr_t;
+
+/** trace header (followed by records until end of trace) */
+struct bpoll_trace_hdr {
+    char magic[8];              /**< "BPTRACE" */
+    uint32_t version;           /**< 1 */
+    uint32_t rec_sz;            /**< sizeof(bpoll_trace_rec_t) */
+    uint32_t mech;              /**< bpollset->mech */
+    uint32_t limit;             /**< bpollset->limit */
+    uint32_t queue_sz;          /**< bpollset->queue_sz */
+    uint32_t reserved;
+    uint64_t ns;                /**< CLOCK_MONOTONIC ns when trace started */
+};
+
 /** bpoll set of bpoll elements, bpoll poll mechanism, and state */
 struct bpollset_t {
     unsigned int mech;
@@ -374,6 +538,16 @@ struct bpollset_t {
     bpollelt_t **rmlist;
     int rmsz;
     int rmidx;
+    bpollelt_t **rdlist;
+    int rdsz;
+    int rdidx;
+    bpollelt_t **rddisp;        /* rdlist bpollelts being dispatched */
+    int rddispsz;
+    int prio;
+    int prio_budget[BPOLL_PRIO_CLASSES];
+    int rdbudget;
+    int nintern;        /* internal bpollelts (signal watch, wakeup pipe) */
+    int sigready;       /* signal watch ready; run after dispatch */
     struct pollfd *pollfds;
     struct pollfd *pfd_ready;
   #if HAS_KQUEUE
@@ -392,6 +566,11 @@ struct bpollset_t {
     struct poll_ctl *pollset_events;
   #endif
     sigset_t *sigmaskp;
+    struct bpoll_sigwatch *sigwatch;
+    struct bpoll_watchdog *watchdog;
+    struct bpoll_flight *flight;
+    struct bpoll_trace *trace;
+    struct bpoll_sim *sim;      /* BPOLL_M_SIM interest and readiness */
 
   #if !HAS_POLLSET  /* kqueue, evport, devpoll, epoll */
     int fd;
@@ -399,7 +578,8 @@ struct bpollset_t {
     pollset_t fd;
   #endif
     int timeout;
-    struct timespec ts; /*significant only for HAS_KQUEUE HAS_EVPORT HAS_PPOLL*/
+    struct timespec ts; /*significant: KQUEUE EVPORT PPOLL EPOLL_PWAIT2*/
+    unsigned int busy_poll_usec; /*spin zero-timeout polls before blocking*/
 
     bpoll_fn_cb_event_t fn_cb_event;
     bpoll_fn_cb_close_t fn_cb_close;
@@ -429,9 +609,19 @@ struct bpollset_t {
     void *bpollelts_used[16];
     pthread_mutex_t mutex;
     volatile int nelts;
+    struct bpoll_vsignal *vsig; /* MPSC queue; bpoll_elt_signal_thrsafe() */
+    bpollelt_t *vsig_elt;       /* wakeup pipe (read end) */
+    int vsig_fd;                /* wakeup pipe (write end) */
+    int vsig_sz;
+    volatile int vsig_idx;
+    struct bpoll_rmq *rmq;      /* MPSC ring; bpoll_elt_remove_thrsafe() */
   #else  /* !_THREAD_SAFE */
     int nelts;
   #endif /* !_THREAD_SAFE */
+
+  #if BPOLL_STATS  /*(last; offsets of other members do not depend on it)*/
+    bpoll_stats_t stats;
+  #endif
 };
 
 
@@ -449,6 +639,15 @@ __attribute_warn_unused_result__
 EXPORT extern unsigned int
 bpoll_mechanisms (void);
 
+/* copy statistics counters of bpollset to stats (counters are cumulative;
+ * caller computes rates from successive snapshots)
+ * (counters are updated without atomics; snapshot from owning thread)
+ * (returns 0 on success, else ENOSYS if library built without BPOLL_STATS) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_stats_get (const bpollset_t * const restrict bpollset,
+                 bpoll_stats_t * const restrict stats);
+
 /* optional interface for consumer to flush pending events, e.g. fd removal,
  * prior to bpoll_poll() or bpoll_kernel() (which calls this if no error)*/
 __attribute_noinline__
@@ -461,6 +660,142 @@ __attribute_nonnull__
 EXPORT extern int  __attribute_regparm__((1))
 bpoll_enable_thrsafe_add(bpollset_t * const restrict bpollset);
 
+/* enable bpoll_elt_remove_thrsafe() on bpollset (call from owning thread,
+ * after bpoll_init() and before other threads remove)
+ * (allocates lock-free ring of limit (rounded up to power of 2) pointers)
+ * (returns 0 on success, else the value of errno) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int  __attribute_regparm__((1))
+bpoll_enable_thrsafe_remove (bpollset_t * const restrict bpollset);
+
+/* priority classes: set budget (max ready bpollelts dispatched per call to
+ * bpoll_process()) for priority class prio (BPOLL_PRIO_*) and enable ordering
+ * of ready bpollelts by priority class (control, normal, bulk).
+ * (budget <= 0 is unlimited)  Ready bpollelts exceeding the budget for their
+ * class are retained on a user-space ready list and dispatched (ahead of new
+ * ready bpollelts of the same class) on a later bpoll_process(); bpoll_kernel()
+ * does not block while the ready list is not empty.
+ * (fn_cb_event data param is -1 while ordering is enabled; kqueue filter data
+ *  is not retained for bpollelts dispatched through the ready list)
+ * (returns 0 on success, else the value of errno) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int
+bpoll_prio_budget_set (bpollset_t * const restrict bpollset,
+                       const int prio, const int budget);
+
+/* hybrid busy-poll: bpoll_kernel() repeats zero-timeout kernel polls for up to
+ * usec microseconds (or until timeout, if shorter) before blocking for the
+ * remainder of the timeout.  (usec 0 disables; default)  Trades CPU for lower
+ * wakeup latency; intended only for selected latency-sensitive bpollsets.
+ * If napi_budget != 0, also configure kernel epoll busy-poll parameters
+ * (Linux EPIOCSPARAMS) for BPOLL_M_EPOLL; must be called after bpoll_init().
+ * (returns 0 on success, else the value of errno; busy-poll is unchanged
+ *  on error) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int
+bpoll_busy_poll_set (bpollset_t * const restrict bpollset,
+                     const unsigned int usec, const unsigned int napi_budget);
+
+/* slow-callback watchdog: time each fn_cb_event run by bpoll_process() and
+ * account run time per class (fn_cb_class(bpollelt), or bpollelt->fdtype if
+ * fn_cb_class is NULL; classes >= BPOLL_WATCHDOG_CLASSES share last class).
+ * If budget_usec != 0 and fn_cb_slow != NULL, fn_cb_slow(bpollset, bpollelt,
+ * revents, nsec) is called after any fn_cb_event that ran over budget_usec.
+ * (bpollelt might have been removed by fn_cb_event; do not modify bpollelt)
+ * Clock is read once per callback; each reading ends one callback and starts
+ * the next.  (not applicable if bpollset created without fn_cb_event)
+ * Calling again changes budget and callbacks and keeps accumulated stats.
+ * (returns 0 on success, else the value of errno) */
+__attribute_cold__
+__attribute_nonnull_x__((1))
+EXPORT extern int
+bpoll_watchdog_enable (bpollset_t * const restrict bpollset,
+                       const unsigned int budget_usec,
+                       bpoll_fn_cb_slow_t const fn_cb_slow,
+                       bpoll_fn_cb_class_t const fn_cb_class);
+
+/* disable slow-callback watchdog and discard stats */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern void
+bpoll_watchdog_disable (bpollset_t * const restrict bpollset);
+
+/* copy watchdog stats of class cls to stats
+ * (returns 0 on success, else EINVAL if watchdog not enabled or cls invalid)*/
+__attribute_nonnull__
+EXPORT extern int
+bpoll_watchdog_stats_get (const bpollset_t * const restrict bpollset,
+                          const unsigned int cls,
+                          bpoll_watchdog_stats_t * const restrict stats);
+
+/* flight recorder: record compact entries (kernel poll start and end, commits
+ * to kernel, bpollelt add and remove, fn_cb_event run time) in a fixed-size
+ * lock-free ring of nentries (rounded up to power of 2), overwriting oldest.
+ * (returns 0 on success, else the value of errno; EBUSY if already enabled)*/
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int
+bpoll_flight_enable (bpollset_t * const restrict bpollset,
+                     const unsigned int nentries);
+
+/* disable flight recorder and free ring
+ * (caller must ensure bpoll_flight_dump() is not running concurrently) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern void
+bpoll_flight_disable (bpollset_t * const restrict bpollset);
+
+/* record application entry (BPOLL_FLIGHT_NOTE) if flight recorder enabled */
+__attribute_nonnull__
+EXPORT extern void
+bpoll_flight_note (bpollset_t * const restrict bpollset,
+                   const int32_t arg, const uint32_t arg2);
+
+/* write header and entries in ring (oldest first) to fd
+ * (async-signal-safe and lock-free: may be called from a signal handler or
+ *  from another thread while bpollset is in use; entries being overwritten
+ *  during the dump are skipped) (decoder: contrib/flight/flightdecode)
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_flight_dump (const bpollset_t * const restrict bpollset, const int fd);
+
+/* trace: write every bpollelt add, modify, and remove, each kernel poll start
+ * and end, and each bpollelt returned by kernel (with revents) to fd, as
+ * compact binary records (buffered), for deterministic replay of the pattern
+ * against any mechanism (contrib/trace/tracereplay).
+ * (fd is not closed by bpoll; call bpoll_trace_disable() before close(fd))
+ * (returns 0 on success, else the value of errno; EBUSY if already enabled)*/
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int
+bpoll_trace_enable (bpollset_t * const restrict bpollset, const int fd);
+
+/* write buffered trace records to fd
+ * (returns 0 on success, else the value of errno of first failed write) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_trace_flush (bpollset_t * const restrict bpollset);
+
+/* flush and disable trace (also done by bpoll_destroy())
+ * (returns value of bpoll_trace_flush(); 0 if trace not enabled) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int
+bpoll_trace_disable (bpollset_t * const restrict bpollset);
+
+/* enable bpoll_elt_signal_thrsafe() on bpollset (call from owning thread)
+ * (adds internal wakeup pipe to bpollset; bpollelts signalled from other
+ *  threads are dispatched through user-space ready list (rdlist))
+ * (returns 0 on success, else the value of errno) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int  __attribute_regparm__((1))
+bpoll_enable_thrsafe_signal (bpollset_t * const restrict bpollset);
+
 /* (separate routine from bpoll_init() so that a cleanup can be registered
  *  (i.e. bpoll_destroy()) before opening /dev/poll, kqueue, epoll, etc.)
  */
@@ -497,12 +832,24 @@ bpoll_elt_get (bpollset_t * const restrict bpollset, const int fd);
 #define bpoll_elt_get_udata(bpollelt)         ((bpollelt)->udata)
 #define bpoll_elt_set_udata(bpollelt, vdata)  ((bpollelt)->udata = (vdata))
 #define bpoll_elt_clear_revents(bpollelt)     ((bpollelt)->revents = 0)
+/* (BPOLL_FL_PRIO_CONTROL|BPOLL_FL_PRIO_BULK, e.g. from invalid prio passed to
+ *  bpoll_elt_set_prio(), is treated as BPOLL_PRIO_BULK; nibble lookup maps
+ *  flag bits 0,2,4,6 to class 0,1,2,2) */
+#define bpoll_elt_get_prio(bpollelt) \
+  ((0x2210 >> (((bpollelt)->flags & BPOLL_FL_PRIO_MASK) << 1)) & 3)
+#define bpoll_elt_set_prio(bpollelt, prio) \
+  ((bpollelt)->flags = ((bpollelt)->flags & ~BPOLL_FL_PRIO_MASK) \
+                     | (((prio) << 1) & BPOLL_FL_PRIO_MASK))
 
 #define bpoll_get_nelts(bpollset)             ((bpollset)->nelts)
 #define bpoll_get_nfound(bpollset)            ((bpollset)->nfound)
 #define bpoll_get_results(bpollset)           ((bpollset)->results)
 #define bpoll_get_vdata(bpollset)             ((bpollset)->vdata)
 #define bpoll_set_vdata(bpollset, udata)      ((bpollset)->vdata = (udata))
+/* per-element budget (bytes or operations) per dispatch; 0 none
+ * (bytes read per bpoll_stream_event() on BPOLLET bpollelt; else advisory) */
+#define bpoll_get_elt_budget(bpollset)        ((bpollset)->rdbudget)
+#define bpoll_set_elt_budget(bpollset, n)     ((bpollset)->rdbudget = (n))
 
 /* for use only to re-init fd before bpollelt added to bpollset,
  * i.e. when struct sockaddr_storage is part of bpollelt->udata
@@ -567,6 +914,11 @@ bpoll_elt_modify (bpollset_t * const restrict bpollset,
                   bpollelt_t * const restrict bpollelt,
                   const int events);
 
+/* (convenience) set priority class (BPOLL_PRIO_*) and add to bpollset */
+#define bpoll_elt_add_prio( bpollset, bpollelt, events, prio ) \
+        (bpoll_elt_set_prio((bpollelt),(prio)), \
+         bpoll_elt_add((bpollset),(bpollelt),(events)))
+
 #define bpoll_elt_modify_by_fd( bpollset, fd, events ) \
         bpoll_elt_modify((bpollset), bpoll_elt_get((bpollset),(fd)), (events))
 
@@ -578,11 +930,168 @@ bpoll_elt_remove (bpollset_t * const restrict bpollset,
 #define bpoll_elt_remove_by_fd( bpollset, fd ) \
         bpoll_elt_remove((bpollset), bpoll_elt_get((bpollset),(fd)))
 
+/* remove bpollelt from bpollset from any thread, without locks
+ * (requires bpoll_enable_thrsafe_remove())  Intended for a thread holding a
+ * bpollelt returned with BPOLLDISPATCH and not re-armed, so that it can
+ * retire the bpollelt without handing it back to the owning thread.  Caller
+ * must not otherwise access bpollelt after the call, and must call at most
+ * once per bpollelt (ring is sized so that it can not overflow).  bpollelt
+ * is removed (bpoll_elt_remove()) by owning thread at start of bpoll_kernel()
+ * (and bpoll_poll()) or in bpoll_flush_pending(), and fd closed as usual if
+ * BPOLL_FL_CLOSE.  Owning thread is woken if bpoll_enable_thrsafe_signal().
+ * (returns 0 on success, else the value of errno)
+ * (EINVAL if not enabled, or if bpollelt is BPOLL_FD_VIRTUAL) */
+__attribute_nonnull__
+EXPORT extern int  __attribute_regparm__((2))
+bpoll_elt_remove_thrsafe (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt);
+
 __attribute_nonnull__
 EXPORT int  __attribute_regparm__((2))
 bpoll_elt_destroy (bpollset_t * const restrict bpollset,
                    bpollelt_t * const restrict bpollelt);
 
+/* place bpollelt on user-space ready list; bpollelt is dispatched again with
+ * revents on next bpoll_process() without waiting for a new kernel event, and
+ * bpoll_kernel() does not block while the ready list is not empty.
+ * Intended for edge-triggered (BPOLLET) bpollelts not fully drained, e.g.
+ * after handler has consumed bpoll_get_elt_budget() bytes or operations, so
+ * that one busy bpollelt does not starve others.  May be called from callback.
+ * Pending bpollelts are dispatched ahead of newly ready bpollelts of their
+ * priority class (all bpollelts ready in the current iteration have had their
+ * turn).  If kernel returns bpollelt again while it is pending, its revents
+ * are combined with pending revents.  fn_cb_event data param is -1 for
+ * bpollelts dispatched from the ready list.
+ * (bpoll_stream_event() marks BPOLLET bpollelts pending when budget reached)
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull__
+EXPORT extern int  __attribute_regparm__((3))
+bpoll_elt_mark_pending (bpollset_t * const restrict bpollset,
+                        bpollelt_t * const restrict bpollelt,
+                        const int revents);
+
+/* make virtual bpollelt (BPOLL_FD_VIRTUAL) ready with revents (owning thread)
+ * Virtual bpollelts have no kernel descriptor; they are initialized with
+ * bpoll_elt_init() (fd is not used by bpoll and may be -1), added, modified,
+ * and removed like other bpollelts, but are not tracked by fd (bpoll_elt_get())
+ * and do not count towards bpollset limit.  Ready virtual bpollelts are
+ * merged into results (or callbacks) by bpoll_process() without a syscall.
+ * revents is masked by bpollelt events interest (BPOLLERR, BPOLLHUP always
+ * delivered) and accumulates until dispatched.  If bpollelt was added with
+ * BPOLLDISPATCH and has been dispatched, revents is latched until bpollelt is
+ * re-armed with bpoll_elt_modify().
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull__
+EXPORT extern int  __attribute_regparm__((3))
+bpoll_elt_signal (bpollset_t * const restrict bpollset,
+                  bpollelt_t * const restrict bpollelt,
+                  const int revents);
+
+/* make fd ready with revents in simulated kernel (BPOLL_M_SIM) (owning thread)
+ * BPOLL_M_SIM keeps interest set and readiness in user space, behaving like
+ * epoll (changes queued and committed by bpoll_kernel() or
+ * bpoll_flush_pending(); BPOLLDISPATCH disables interest until re-armed), so
+ * that cost of bpoll bookkeeping can be measured without syscalls.  fds are
+ * never read, written, or polled and need not be open descriptors (do not use
+ * BPOLL_FL_CLOSE unless they are); bpoll_init() does not check RLIMIT_NOFILE.
+ * revents accumulates on fd (whether or not bpollelt has been added) and is
+ * returned by the next bpoll_kernel() once masked by committed interest
+ * (BPOLLERR, BPOLLHUP always returned); revents returned are consumed, as if
+ * drained by the callback.  Ready fds are returned in the order made ready.
+ * bpoll_kernel() does not block; it returns 0 if nothing is ready.
+ * BPOLL_M_SIM is not chosen by default and is not in bpoll_mechanisms(); pass
+ * flags BPOLL_M_SIM (alone) to bpoll_init().  Not thread-safe.
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_sim_ready (bpollset_t * const restrict bpollset, const int fd,
+                 const int revents);
+
+/* watch signal signo; fn_cb_signal is run from bpoll_process() (after ready
+ * bpollelts are dispatched) when signo has been received.  Signals are
+ * delivered as ordinary ready events on an internal descriptor, so a signal
+ * received just before bpoll_kernel() blocks is not missed, and no sigaction
+ * handler or EINTR is needed.  Multiple receipt of same signo between polls
+ * is coalesced into a single callback.  (fn_cb_signal NULL stops watching
+ * signo and restores default disposition.)
+ * Linux: signalfd; signo is blocked in calling thread (and added to
+ * bpollset sigmask, if set, so it stays blocked while polling); other
+ * threads should also block signo, e.g. by watching before creating threads.
+ * Elsewhere: self-pipe written by sigaction handler; only one bpollset in
+ * the process may watch signals.
+ * (returns 0 on success, else the value of errno) */
+__attribute_cold__
+__attribute_nonnull_x__((1))
+EXPORT extern int
+bpoll_signal_watch (bpollset_t * const restrict bpollset, const int signo,
+                    bpoll_fn_cb_signal_t const fn_cb_signal);
+
+/* watch child process pid; pidfd bpollelt (BPOLL_FD_PIDFD, BPOLL_FL_CLOSE)
+ * is added to bpollset with BPOLLIN and becomes ready when child terminates.
+ * bpollelt is initialized (allocated from bpollset if bpollelt is NULL).
+ * Upon ready event, call bpoll_child_reap() and then bpoll_elt_remove().
+ * SIGCHLD must not be ignored (SIG_IGN), or else exit status is discarded.
+ * (Linux 5.4+ pidfd_open())
+ * (returns pointer to bpollelt on success, NULL on failure and errno set) */
+__attribute_cold__
+__attribute_nonnull_x__((1))
+EXPORT extern bpollelt_t *
+bpoll_child_adopt (bpollset_t * const restrict bpollset,
+                   bpollelt_t * const restrict bpollelt, const pid_t pid);
+
+/* posix_spawn() path with argv and envp (environ if NULL) and watch child;
+ * pid (if not NULL) receives child pid; see bpoll_child_adopt().
+ * (child signal mask is empty; signals watched by bpoll_signal_watch() are
+ *  restored to default disposition in child)
+ * (child is killed and reaped if it can not be added to bpollset)
+ * (returns pointer to bpollelt on success, NULL on failure and errno set) */
+__attribute_cold__
+__attribute_nonnull_x__((1,4,5))
+EXPORT extern bpollelt_t *
+bpoll_child_spawn (bpollset_t * const restrict bpollset,
+                   bpollelt_t * const restrict bpollelt,
+                   pid_t * const restrict pid,
+                   const char * const restrict path,
+                   char * const argv[], char * const envp[]);
+
+/* reap terminated child of BPOLL_FD_PIDFD bpollelt without blocking;
+ * status receives exit status as from waitpid() (WIFEXITED(), etc.)
+ * (returns 0 on success, EAGAIN if child still running, else errno) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_child_reap (bpollelt_t * const restrict bpollelt,
+                  int * const restrict status);
+
+/* accept up to max connections on listen_elt (O_NONBLOCK listen socket);
+ * each is accepted with accept4(SOCK_NONBLOCK|SOCK_CLOEXEC) (Linux; else
+ * accept() and fcntl()) into a bpollelt (BPOLL_FD_SOCKET, BPOLL_FL_CLOSE),
+ * and fn_cb_accept(bpollset, listen_elt, bpollelt) is called before bpollelt
+ * is added, e.g. to fetch peer credentials, initialize bpollelt->udata, and
+ * speculatively recv() request data that often arrives with the connection.
+ * fn_cb_accept returns events with which to add bpollelt, or 0 if bpollelt
+ * is to be closed (e.g. request handled or rejected).  bpollelts are added in
+ * bulk with bpoll_elt_add_immed(); any not added (bpollset full) are closed.
+ * (bounded by max to avoid starving other bpollelts when under load)
+ * (returns number of connections accepted; less than max if listen queue is
+ *  drained or on error (e.g. EMFILE), and -1 with errno set if error occurs
+ *  before any connection is accepted) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_accept_batch (bpollset_t * const restrict bpollset,
+                    bpollelt_t * const restrict listen_elt,
+                    const int max, bpoll_fn_cb_accept_t const fn_cb_accept);
+
+/* make virtual bpollelt ready with revents (any thread)
+ * (multi-producer queue to owning thread; requires
+ *  bpoll_enable_thrsafe_signal())  Caller must ensure bpollelt is not removed
+ * from bpollset by owning thread while call is in progress.
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull__
+EXPORT extern int  __attribute_regparm__((3))
+bpoll_elt_signal_thrsafe (bpollset_t * const restrict bpollset,
+                          bpollelt_t * const restrict bpollelt,
+                          const int revents);
+
 
 #define bpoll_timespec_from_sec_nsec(bpollset, sec, nsec)              \
   ((bpollset)->timeout    = 0, /* filled in by bpoll_timespec_set() */ \
@@ -686,6 +1195,71 @@ EXPORT extern int  __attribute_regparm__((2))
 bpoll_poll (bpollset_t * const restrict bpollset,
             const struct timespec * const timespec);
 
+/* (convenience routine) wakeup moderation
+ * poll kernel and process events, coalescing readiness until at least
+ * min_events are ready or max_wait elapses (similar to NIC interrupt
+ * moderation) so that fixed per-iteration costs are amortized over more events.
+ * After the first ready event, the kernel is re-polled (zero timeout) at
+ * intervals of max_wait/BPOLL_BATCH_SLICES until the threshold is reached.
+ * max_wait is the total time to wait, not the time after the first event.
+ * If max_wait is NULL, behaves as bpoll_poll() with infinite timeout.
+ * (BPOLL_M_KQUEUE and BPOLL_M_EVPORT return after first non-empty wait)
+ * Return value is same as bpoll_poll().
+ */
+__attribute_nonnull_x__((1))
+EXPORT extern int
+bpoll_poll_batch (bpollset_t * const restrict bpollset, const int min_events,
+                  const struct timespec * const max_wait);
+
+#ifdef _THREAD_SAFE
+
+/* dispatch pool: ready bpollelts are handed to a pool of worker threads while
+ * a single thread continues to poll.  bpollelts must be added with
+ * BPOLLDISPATCH so that each bpollelt is owned by exactly one worker until
+ * re-armed.  (A ready bpollelt without BPOLLDISPATCH is not dispatched; it is
+ * re-armed with BPOLLDISPATCH added and dispatched when next returned ready.)
+ * The polling thread distributes ready bpollelts to per-worker
+ * (Chase-Lev) work-stealing deques; idle workers steal from busy workers.
+ * Handler return value is passed back to the polling thread through per-worker
+ * lock-free queues: events with which to re-arm bpollelt (BPOLLDISPATCH is
+ * implied), or 0 to have bpollelt removed from bpollset (bpoll_elt_remove()).
+ * Handler must not call other bpoll routines on bpollset.
+ * (bpollset must be initialized (bpoll_init()) with fn_cb_event NULL and must
+ *  be used only by the polling thread; destroy pool before bpoll_destroy())
+ */
+typedef struct bpoll_dispatch_pool bpoll_dispatch_pool_t;
+typedef int (*bpoll_fn_cb_dispatch_t)(bpoll_dispatch_pool_t *,
+                                      bpollelt_t *, void *);
+
+/* (returns NULL and sets errno on error)
+ * (inflight is max bpollelts dispatched to workers and not yet re-armed
+ *  (exact; rings are sized to next power of 2); additional ready bpollelts
+ *  are held by polling thread until under limit) */
+__attribute_cold__
+__attribute_nonnull_x__((1,4))
+__attribute_warn_unused_result__
+EXPORT extern bpoll_dispatch_pool_t *
+bpoll_dispatch_pool_create (bpollset_t * const restrict bpollset,
+                            const unsigned int nthreads,
+                            const unsigned int inflight,
+                            bpoll_fn_cb_dispatch_t const fn_cb_dispatch,
+                            void * const vdata);
+
+/* (polling thread) re-arm bpollelts returned by workers, poll kernel, process
+ * events, and dispatch ready bpollelts to workers.
+ * Return value is same as bpoll_poll() (includes pool-internal wakeups) */
+__attribute_nonnull_x__((1))
+EXPORT extern int
+bpoll_dispatch_pool_poll (bpoll_dispatch_pool_t * const restrict pool,
+                          const struct timespec * const timespec);
+
+/* (stops and joins workers; bpollelts in flight are not re-armed) */
+__attribute_cold__
+EXPORT extern void
+bpoll_dispatch_pool_destroy (bpoll_dispatch_pool_t * const restrict pool);
+
+#endif /* _THREAD_SAFE */
+
 /* poll single descriptor (standalone, portable, convenience routine)
  * (overload sec == (time_t)-1 to mean infinite (no) timeout)
  * (overload fdtype to use empty sigmask if (fdtype & BPOLL_FD_SIGMASK))
@@ -0,0 +1,206 @@
+/*
+ * bpoll_admit - adaptive admission control for a listening bpollelt
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_ADMIT_C
+#define INCLUDED_BPOLL_ADMIT_C
+
+#include "bpoll_admit.h"
+
+#include <plasma/plasma_attr.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>          /* clock_gettime() */
+
+#ifdef CLOCK_MONOTONIC
+#define BPOLL_ADMIT_CLOCK CLOCK_MONOTONIC
+#else
+#define BPOLL_ADMIT_CLOCK CLOCK_REALTIME
+#endif
+
+/* (EWMA weight of new sample is 1/(1<<BPOLL_ADMIT_EWMA_SHIFT)) */
+#ifndef BPOLL_ADMIT_EWMA_SHIFT
+#define BPOLL_ADMIT_EWMA_SHIFT 2
+#endif
+
+/* (EWMA kept in fixed-point with BPOLL_ADMIT_FP_SHIFT fraction bits, so that
+ *  it decays to 0 instead of stalling on integer division remainder) */
+#define BPOLL_ADMIT_FP_SHIFT 8
+
+/* (min re-probe interval while listen_elt disarmed) */
+#ifndef BPOLL_ADMIT_REPROBE_MIN_USEC
+#define BPOLL_ADMIT_REPROBE_MIN_USEC 1000
+#endif
+
+
+__attribute_nonnull__
+static void
+bpoll_admit_arm (bpoll_admit_t * const restrict admit, const int arm);
+static void
+bpoll_admit_arm (bpoll_admit_t * const restrict admit, const int arm)
+{
+    /* (listen_elt disarmed by clearing events; connections queue in kernel
+     *  listen backlog until re-armed) */
+    bpollelt_t * const restrict listen_elt = admit->listen_elt;
+    if (arm) {
+        admit->disarmed = 0;
+        admit->budget = 1;
+        bpoll_elt_modify(admit->bpollset, listen_elt,
+                         listen_elt->events | admit->listen_events);
+    }
+    else {
+        admit->disarmed = 1;
+        ++admit->ndisarm;
+        bpoll_elt_modify(admit->bpollset, listen_elt,
+                         listen_elt->events & ~admit->listen_events);
+    }
+}
+
+
+void
+bpoll_admit_init (bpoll_admit_t * const restrict admit,
+                  bpollset_t * const restrict bpollset,
+                  bpollelt_t * const restrict listen_elt,
+                  const int listen_events,
+                  const unsigned int target_usec, const int budget_max)
+{
+    admit->bpollset      = bpollset;
+    admit->listen_elt    = listen_elt;
+    admit->listen_events = listen_events;
+    admit->budget_max    = budget_max > 0 ? budget_max : 1;
+    admit->budget        = admit->budget_max;
+    admit->disarmed      = 0;
+    admit->saturated     = 0;
+    admit->target_usec   = target_usec != 0 ? target_usec : 1;
+    admit->busy_usec     = 0;
+    admit->busy_fp       = 0;
+    admit->ndisarm       = 0;
+    admit->t0.tv_sec     = 0;
+    admit->t0.tv_nsec    = 0;
+    {
+        uint64_t usec = (uint64_t)admit->target_usec << 2;
+        if (usec < BPOLL_ADMIT_REPROBE_MIN_USEC)
+            usec = BPOLL_ADMIT_REPROBE_MIN_USEC;
+        admit->reprobe.tv_sec  = (time_t)(usec / 1000000);
+        admit->reprobe.tv_nsec = (long)(usec % 1000000) * 1000;
+    }
+}
+
+
+const struct timespec *
+bpoll_admit_timeout (bpoll_admit_t * const restrict admit,
+                     const struct timespec * const timespec)
+{
+    /* (disarmed listen_elt is not polled, so loop would not wake to re-arm
+     *  it if otherwise idle) */
+    if (!admit->disarmed)
+        return timespec;
+    if (timespec == NULL
+        || timespec->tv_sec > admit->reprobe.tv_sec
+        || (timespec->tv_sec == admit->reprobe.tv_sec
+            && timespec->tv_nsec > admit->reprobe.tv_nsec))
+        return &admit->reprobe;
+    return timespec;
+}
+
+
+void
+bpoll_admit_begin (bpoll_admit_t * const restrict admit, const int nfound)
+{
+    /* (queue_sz events harvested: more events might be ready in kernel) */
+    admit->saturated = (nfound > 0
+                        && (unsigned int)nfound >= admit->bpollset->queue_sz);
+    clock_gettime(BPOLL_ADMIT_CLOCK, &admit->t0);
+}
+
+
+void
+bpoll_admit_end (bpoll_admit_t * const restrict admit)
+{
+    struct timespec t1;
+    int64_t busy, d;
+    int overloaded;
+
+    clock_gettime(BPOLL_ADMIT_CLOCK, &t1);
+    busy = (int64_t)(t1.tv_sec - admit->t0.tv_sec) * 1000000
+         + (t1.tv_nsec - admit->t0.tv_nsec) / 1000;
+    if (busy > UINT32_MAX)
+        busy = UINT32_MAX;
+    else if (busy < 0)
+        busy = 0;
+    /* (difference rounded to nearest when scaled by EWMA weight) */
+    d = busy * (1 << BPOLL_ADMIT_FP_SHIFT) - admit->busy_fp;
+    d += (d >= 0)
+      ?  (1 << BPOLL_ADMIT_EWMA_SHIFT >> 1)
+      : -(1 << BPOLL_ADMIT_EWMA_SHIFT >> 1);
+    admit->busy_fp += d / (1 << BPOLL_ADMIT_EWMA_SHIFT);
+    admit->busy_usec = (unsigned int)
+      ((admit->busy_fp + (1 << BPOLL_ADMIT_FP_SHIFT >> 1))
+       >> BPOLL_ADMIT_FP_SHIFT);
+
+    /* (saturated results list alone is not overload if events are handled
+     *  quickly, but budget is not grown and listen_elt is not re-armed) */
+    overloaded = admit->busy_usec > admit->target_usec
+              || bpoll_get_is_full(admit->bpollset);
+
+    if (overloaded) {
+        /* multiplicative decrease; disarm listen_elt if already minimal */
+        if (admit->budget > 1)
+            admit->budget >>= 1;
+        else if (!admit->disarmed)
+            bpoll_admit_arm(admit, 0);
+    }
+    else if (admit->busy_usec < (admit->target_usec >> 1)
+             && !admit->saturated) {
+        /* (hysteresis: re-arm or grow only when well under target) */
+        if (admit->disarmed)
+            bpoll_admit_arm(admit, 1);
+        else if (admit->budget < admit->budget_max) {
+            admit->budget += (admit->budget >> 2) + 1;
+            if (admit->budget > admit->budget_max)
+                admit->budget = admit->budget_max;
+        }
+    }
+}
+
+
+int
+bpoll_admit_accept (bpoll_admit_t * const restrict admit,
+                    bpoll_fn_cb_accept_t const fn_cb_accept)
+{
+    int n = bpoll_get_nelts_avail(admit->bpollset);
+    if (n > admit->budget)
+        n = admit->budget;
+    if (admit->disarmed || n <= 0)
+        return 0;
+    n = bpoll_accept_batch(admit->bpollset, admit->listen_elt, n, fn_cb_accept);
+    if (n == -1 && (errno == EMFILE || errno == ENFILE)) {
+        const int errnum = errno;
+        admit->budget = 1;
+        if (!admit->disarmed)
+            bpoll_admit_arm(admit, 0);
+        errno = errnum;
+    }
+    return n;
+}
+
+
+#endif /* INCLUDED_BPOLL_ADMIT_C */
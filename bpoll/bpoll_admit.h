@@ -0,0 +1,122 @@
+/*
+ * bpoll_admit - adaptive admission control for a listening bpollelt
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_ADMIT_H
+#define INCLUDED_BPOLL_ADMIT_H
+
+#include "bpoll.h"
+
+#include <time.h>       /* struct timespec */
+
+/**
+ * @file bpoll_admit.h
+ * @brief adaptive admission control for a listening bpollelt
+ *
+ * Protects a bpoll loop from receive livelock (see NOTES "Overload").  Time
+ * spent handling events in each loop iteration is measured and smoothed, and
+ * the number of connections accepted per iteration (accept budget) is
+ * adjusted: halved while the loop is over its target iteration time, and
+ * grown again while the loop is well under target and not saturated (i.e.
+ * bpoll_kernel() did not return a full queue_sz of events).  When the budget
+ * is already minimal and the loop is still over target (or bpollset is full,
+ * or accept() fails with EMFILE or ENFILE), the listening bpollelt is
+ * disarmed, so that the kernel listen backlog absorbs the burst (and, when
+ * full, pushes back on clients) while existing connections make progress.
+ * The listener is re-armed once the loop is under half of its target
+ * iteration time and not saturated.  While the listener is disarmed, the
+ * caller's bpoll_kernel() timeout must be capped with bpoll_admit_timeout(),
+ * since an idle loop would otherwise block indefinitely (with no listener
+ * events to wake it) and never run bpoll_admit_end() to re-arm it.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** @see struct bpoll_admit */
+typedef struct bpoll_admit bpoll_admit_t;
+
+/** admission controller for listen_elt */
+struct bpoll_admit {
+    bpollset_t *bpollset;
+    bpollelt_t *listen_elt;
+    int listen_events;          /**< listen_elt events when armed */
+    int budget;                 /**< accepts allowed this iteration */
+    int budget_max;             /**< accept budget when not loaded */
+    int disarmed;               /**< listen_elt disarmed (overload) */
+    int saturated;              /**< queue_sz events this iteration */
+    unsigned int target_usec;   /**< target busy time per iteration */
+    unsigned int busy_usec;     /**< busy time per iteration (EWMA) */
+    int64_t busy_fp;            /**< busy_usec EWMA (fixed-point) */
+    unsigned long ndisarm;      /**< number of times listen_elt disarmed */
+    struct timespec t0;         /**< start of current iteration */
+    struct timespec reprobe;    /**< max timeout while disarmed */
+};
+
+
+/* initialize admission control for listen_elt (already added to bpollset
+ * with listen_events; O_NONBLOCK listen socket)
+ * target_usec is target time spent handling events per loop iteration
+ * budget_max is max connections accepted per iteration when not loaded */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern void
+bpoll_admit_init (bpoll_admit_t * const restrict admit,
+                  bpollset_t * const restrict bpollset,
+                  bpollelt_t * const restrict listen_elt,
+                  const int listen_events,
+                  const unsigned int target_usec, const int budget_max);
+
+/* start of loop iteration (call with nfound returned by bpoll_kernel(),
+ * before bpoll_process() or other handling of events) */
+__attribute_nonnull__
+EXPORT extern void
+bpoll_admit_begin (bpoll_admit_t * const restrict admit, const int nfound);
+
+/* end of loop iteration (call after events handled, before next bpoll_kernel())
+ * adjusts accept budget and disarms or re-arms listen_elt */
+__attribute_nonnull__
+EXPORT extern void
+bpoll_admit_end (bpoll_admit_t * const restrict admit);
+
+/* timeout for next bpoll_kernel() (call before bpoll_kernel())
+ * (returns timespec, or, while listen_elt is disarmed, re-probe interval if
+ *  timespec is NULL (infinite) or longer; re-probe interval is 4 * target_usec,
+ *  and at least 1 ms) */
+__attribute_nonnull_x__((1))
+EXPORT extern const struct timespec *
+bpoll_admit_timeout (bpoll_admit_t * const restrict admit,
+                     const struct timespec * const timespec);
+
+/* accept connections within budget with bpoll_accept_batch()
+ * (call when listen_elt is ready; EMFILE or ENFILE disarms listen_elt)
+ * (returns value of bpoll_accept_batch(), or 0 if no budget) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_admit_accept (bpoll_admit_t * const restrict admit,
+                    bpoll_fn_cb_accept_t const fn_cb_accept);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* ! INCLUDED_BPOLL_ADMIT_H */
@@ -0,0 +1,408 @@
+/*
+ * bpoll_aio - blocking file I/O offloaded to worker threads
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_AIO_C
+#define INCLUDED_BPOLL_AIO_C
+
+#include "bpoll_aio.h"
+
+#include <plasma/plasma_attr.h>
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>         /* open() O_CLOEXEC */
+#include <stddef.h>
+#include <unistd.h>        /* pread(), pwrite(), fsync(), close() */
+
+#ifdef _THREAD_SAFE
+#define BPOLL_AIO_POOL 1
+#include <pthread.h>
+#include <signal.h>        /* pthread_sigmask() */
+/* attempt to avoid explosing plasma_* symbols when bpoll.o included in .so */
+#ifdef __GNUC__
+#pragma GCC visibility push(hidden)
+#endif
+#include <plasma/plasma_atomic.h>
+#include <plasma/plasma_membar.h>
+#ifdef __GNUC__
+#pragma GCC visibility pop
+#endif
+#else
+#define BPOLL_AIO_POOL 0
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#if BPOLL_AIO_POOL
+
+struct bpoll_aio {
+    bpollset_t *bpollset;
+    bpollelt_t *bpollelt;       /* virtual; signalled per completion batch */
+    bpoll_aio_op_t *cq;         /* completed ops (LIFO; workers push; CAS) */
+    unsigned int resignal;      /* wakeup failed; next completion signals */
+    char pad[64];  /* (separate cache line for submission queue) */
+    bpoll_aio_op_t *sq_head;    /* submitted ops (FIFO; mutex) */
+    bpoll_aio_op_t *sq_tail;
+    unsigned int nthreads;
+    unsigned int nstarted;
+    unsigned int idle;          /* workers waiting on cond (mutex) */
+    int shutdown;               /* (mutex) */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+  #if !defined(__GNUC__) || __GNUC__-0 >= 3
+    pthread_t threads[];  /* C99 VLA */
+  #else
+    pthread_t threads[0];
+  #endif
+};
+
+
+__attribute_nonnull__
+static void
+bpoll_aio_run (bpoll_aio_op_t * const restrict op);
+static void
+bpoll_aio_run (bpoll_aio_op_t * const restrict op)
+{
+    /* (worker thread) perform blocking operation */
+    ssize_t n = 0;
+    switch (op->opcode) {
+      case BPOLL_AIO_PREAD:
+      case BPOLL_AIO_PWRITE: {
+        /* (loop on short transfer; regular files short only at EOF/ENOSPC)
+         * (partial transfer followed by error returns bytes transferred) */
+        char * const buf = (char *)op->buf;
+        size_t done = 0;
+        while (done < op->len) {
+            n = (op->opcode == BPOLL_AIO_PREAD)
+              ? pread(op->fd, buf+done, op->len-done, op->offset+(off_t)done)
+              : pwrite(op->fd, buf+done, op->len-done, op->offset+(off_t)done);
+            if (n > 0)
+                done += (size_t)n;
+            else if (n == -1 && errno == EINTR)
+                continue;
+            else
+                break;  /*(EOF or error)*/
+        }
+        n = (n == -1 && done == 0) ? -1 : (ssize_t)done;
+        break;
+      }
+      case BPOLL_AIO_FSYNC:
+        n = fsync(op->fd);
+        break;
+      case BPOLL_AIO_FDATASYNC:
+      #if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO-0 > 0
+        n = fdatasync(op->fd);
+      #else
+        n = fsync(op->fd);
+      #endif
+        break;
+      case BPOLL_AIO_OPEN:
+        do {
+            n = open(op->path, op->flags | O_CLOEXEC, op->mode);
+        } while (n == -1 && errno == EINTR);
+        break;
+      case BPOLL_AIO_CLOSE:
+        n = close(op->fd);  /*(not retried on EINTR; fd state unspecified)*/
+        break;
+      default:
+        n = -1;
+        errno = EINVAL;
+        break;
+    }
+    op->err = (n == -1) ? errno : 0;
+    op->res = n;
+}
+
+
+__attribute_nonnull__
+static void
+bpoll_aio_complete (bpoll_aio_t * const restrict aio,
+                    bpoll_aio_op_t * const restrict op);
+static void
+bpoll_aio_complete (bpoll_aio_t * const restrict aio,
+                    bpoll_aio_op_t * const restrict op)
+{
+    /* (worker thread) push op onto completion list; wake owning thread only
+     * if list was empty (owning thread takes entire list when woken) */
+    bpoll_aio_op_t *head;
+    do {
+        head = plasma_atomic_ld_nopt(&aio->cq);
+        op->next = head;
+    } while (!plasma_atomic_CAS_ptr_vcast(&aio->cq, head, op));
+    /* (if wakeup fails (ENOMEM), leave flag so that next completion signals,
+     *  even though it does not find list empty) */
+    if (head == NULL
+        || (plasma_atomic_ld_nopt(&aio->resignal)
+            && plasma_atomic_CAS_32(&aio->resignal, 1, 0))) {
+        if (0 != bpoll_elt_signal_thrsafe(aio->bpollset, aio->bpollelt,
+                                          BPOLLIN))
+            plasma_atomic_st_nopt(&aio->resignal, 1);
+    }
+}
+
+
+static void *
+bpoll_aio_worker (void * const arg);
+static void *
+bpoll_aio_worker (void * const arg)
+{
+    bpoll_aio_t * const restrict aio = (bpoll_aio_t *)arg;
+    bpoll_aio_op_t *op;
+    pthread_mutex_lock(&aio->mutex);
+    for (;;) {
+        while (NULL == (op = aio->sq_head) && !aio->shutdown) {
+            ++aio->idle;
+            pthread_cond_wait(&aio->cond, &aio->mutex);
+            --aio->idle;
+        }
+        if (op == NULL)  /*(shutdown and submission queue drained)*/
+            break;
+        if (NULL == (aio->sq_head = op->next))
+            aio->sq_tail = NULL;
+        pthread_mutex_unlock(&aio->mutex);
+
+        bpoll_aio_run(op);
+        bpoll_aio_complete(aio, op);
+
+        pthread_mutex_lock(&aio->mutex);
+    }
+    pthread_mutex_unlock(&aio->mutex);
+    return NULL;
+}
+
+
+bpollelt_t *
+bpoll_aio_bpollelt (const bpoll_aio_t * const restrict aio)
+{
+    return aio->bpollelt;
+}
+
+
+int
+bpoll_aio_submit (bpoll_aio_t * const restrict aio,
+                  bpoll_aio_op_t * const restrict op,
+                  bpoll_aio_fn_cb_t const fn_cb)
+{
+    int rc;
+    if (__builtin_expect( ((unsigned int)op->opcode > BPOLL_AIO_CLOSE), 0))
+        return (errno = EINVAL);
+    op->fn_cb = fn_cb;
+    op->next  = NULL;
+    op->res   = -1;
+    op->err   = 0;
+    if (__builtin_expect( (0 != (rc = pthread_mutex_lock(&aio->mutex))), 0))
+        return (errno = rc);
+    if (__builtin_expect( (aio->shutdown), 0))
+        rc = (errno = ECANCELED);
+    else {
+        if (aio->sq_tail != NULL)
+            aio->sq_tail->next = op;
+        else
+            aio->sq_head = op;
+        aio->sq_tail = op;
+        if (aio->idle)
+            pthread_cond_signal(&aio->cond);
+    }
+    pthread_mutex_unlock(&aio->mutex);
+    return rc;
+}
+
+
+int
+bpoll_aio_event (bpoll_aio_t * const restrict aio)
+{
+    /* take entire completion list and reverse into order of completion */
+    /* (single consumer; op can not be popped and re-pushed (ABA) meanwhile) */
+    bpoll_aio_op_t *op, *fifo = NULL, *next;
+    int n = 0;
+    do {
+        op = plasma_atomic_ld_nopt(&aio->cq);
+    } while (op != NULL && !plasma_atomic_CAS_ptr_vcast(&aio->cq, op, NULL));
+    for (; op != NULL; op = next) {
+        next = op->next;
+        op->next = fifo;
+        fifo = op;
+    }
+    for (op = fifo; op != NULL; op = next, ++n) {
+        next = op->next;
+        op->next = NULL;
+        if (op->fn_cb != NULL)
+            op->fn_cb(aio->bpollset, op);
+    }
+    return n;
+}
+
+
+void
+bpoll_aio_destroy (bpoll_aio_t * const restrict aio)
+{
+    bpollset_t *bpollset;
+    unsigned int i;
+    if (aio == NULL)
+        return;
+    bpollset = aio->bpollset;
+    pthread_mutex_lock(&aio->mutex);
+    aio->shutdown = 1;
+    pthread_cond_broadcast(&aio->cond);
+    pthread_mutex_unlock(&aio->mutex);
+    for (i = 0; i < aio->nstarted; ++i)
+        pthread_join(aio->threads[i], NULL);
+    bpoll_aio_event(aio);  /* run callbacks for ops completed during shutdown */
+    pthread_cond_destroy(&aio->cond);
+    pthread_mutex_destroy(&aio->mutex);
+    if (aio->bpollelt != NULL)
+        bpoll_elt_remove(bpollset, aio->bpollelt);
+    if (bpollset->fn_mem_free != NULL)
+        bpollset->fn_mem_free(bpollset->vdata, aio);
+}
+
+
+bpoll_aio_t *
+bpoll_aio_create (bpollset_t * const restrict bpollset,
+                  const unsigned int nthreads)
+{
+    bpoll_aio_t *aio;
+    sigset_t sigs, osigs;
+    int rc;
+
+    if (nthreads == 0 || nthreads > 1024
+        || bpollset->mech == BPOLL_M_NOT_SET
+        || bpollset->fn_mem_alloc == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (0 != bpoll_enable_thrsafe_signal(bpollset))
+        return NULL;
+
+    aio = (bpoll_aio_t *)
+      bpollset->fn_mem_alloc(bpollset->vdata,
+                             sizeof(bpoll_aio_t)+nthreads*sizeof(pthread_t));
+    if (__builtin_expect( (aio == NULL), 0)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    aio->bpollset = bpollset;
+    aio->bpollelt = NULL;
+    aio->cq       = NULL;
+    aio->resignal = 0;
+    aio->sq_head  = NULL;
+    aio->sq_tail  = NULL;
+    aio->nthreads = nthreads;
+    aio->nstarted = 0;
+    aio->idle     = 0;
+    aio->shutdown = 0;
+
+    if (0 != (rc = pthread_mutex_init(&aio->mutex, NULL))) {
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, aio);
+        errno = rc;
+        return NULL;
+    }
+    if (0 != (rc = pthread_cond_init(&aio->cond, NULL))) {
+        pthread_mutex_destroy(&aio->mutex);
+        if (bpollset->fn_mem_free != NULL)
+            bpollset->fn_mem_free(bpollset->vdata, aio);
+        errno = rc;
+        return NULL;
+    }
+
+    do {
+        aio->bpollelt = bpoll_elt_init(bpollset, NULL, -1,
+                                       BPOLL_FD_VIRTUAL, 0);
+        if (aio->bpollelt == NULL) {
+            rc = errno;
+            break;
+        }
+        aio->bpollelt->udata = aio;
+        if (0 != (rc = bpoll_elt_add(bpollset, aio->bpollelt, BPOLLIN))) {
+            bpoll_elt_destroy(bpollset, aio->bpollelt);
+            aio->bpollelt = NULL;
+            break;
+        }
+
+        /* (block signals in workers; see bpoll_dispatch_pool_create()) */
+        sigfillset(&sigs);
+        sigdelset(&sigs, SIGBUS);
+        sigdelset(&sigs, SIGFPE);
+        sigdelset(&sigs, SIGILL);
+        sigdelset(&sigs, SIGSEGV);
+        pthread_sigmask(SIG_BLOCK, &sigs, &osigs);
+        for (; aio->nstarted < nthreads; ++aio->nstarted) {
+            rc = pthread_create(&aio->threads[aio->nstarted], NULL,
+                                bpoll_aio_worker, aio);
+            if (0 != rc)
+                break;
+        }
+        pthread_sigmask(SIG_SETMASK, &osigs, NULL);
+        if (aio->nstarted == nthreads)
+            return aio;
+    } while (0);
+
+    bpoll_aio_destroy(aio);
+    errno = rc;
+    return NULL;
+}
+
+
+#else  /* !BPOLL_AIO_POOL */
+
+
+bpoll_aio_t *
+bpoll_aio_create (bpollset_t * const restrict bpollset __attribute_unused__,
+                  const unsigned int nthreads __attribute_unused__)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void
+bpoll_aio_destroy (bpoll_aio_t * const restrict aio __attribute_unused__)
+{
+}
+
+bpollelt_t *
+bpoll_aio_bpollelt (const bpoll_aio_t * const restrict aio
+                      __attribute_unused__)
+{
+    return NULL;
+}
+
+int
+bpoll_aio_submit (bpoll_aio_t * const restrict aio __attribute_unused__,
+                  bpoll_aio_op_t * const restrict op __attribute_unused__,
+                  bpoll_aio_fn_cb_t const fn_cb __attribute_unused__)
+{
+    return (errno = ENOSYS);
+}
+
+int
+bpoll_aio_event (bpoll_aio_t * const restrict aio __attribute_unused__)
+{
+    return 0;
+}
+
+
+#endif /* !BPOLL_AIO_POOL */
+
+
+#endif /* INCLUDED_BPOLL_AIO_C */
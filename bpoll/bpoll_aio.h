@@ -0,0 +1,136 @@
+/*
+ * bpoll_aio - blocking file I/O offloaded to worker threads
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_AIO_H
+#define INCLUDED_BPOLL_AIO_H
+
+#include "bpoll.h"
+
+#include <stddef.h>     /* size_t */
+#include <sys/types.h>  /* off_t, ssize_t, mode_t */
+
+/**
+ * @file bpoll_aio.h
+ * @brief blocking file I/O offloaded to worker threads
+ *
+ * Regular files are always "ready" to poll(), so pread(), pwrite(), fsync()
+ * and open() on a slow or busy disk (or NFS) block the thread running the
+ * bpoll loop, and every bpollelt waits.  bpoll_aio runs these operations on a
+ * small pool of worker threads.  Completed operations are collected on a
+ * lock-free list and the bpollset is woken through a virtual bpollelt
+ * (bpoll_elt_signal_thrsafe()) only when the list goes from empty to non-empty,
+ * i.e. once per batch of completions, not once per operation.  Completion
+ * callbacks are run in the bpollset owning thread from bpoll_aio_event().
+ * (requires _THREAD_SAFE; otherwise bpoll_aio_create() returns ENOSYS)
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** @see struct bpoll_aio (opaque) */
+typedef struct bpoll_aio bpoll_aio_t;
+
+/** @see struct bpoll_aio_op */
+typedef struct bpoll_aio_op bpoll_aio_op_t;
+
+/** completion callback (run in bpollset owning thread) */
+typedef void (*bpoll_aio_fn_cb_t)(bpollset_t *, bpoll_aio_op_t *);
+
+/**
+ * @defgroup bpoll aio operations
+ * @{
+ */
+enum {
+    BPOLL_AIO_PREAD     = 0, /**< pread(fd, buf, len, offset) until len/EOF */
+    BPOLL_AIO_PWRITE    = 1, /**< pwrite(fd, buf, len, offset) until len */
+    BPOLL_AIO_FSYNC     = 2, /**< fsync(fd) */
+    BPOLL_AIO_FDATASYNC = 3, /**< fdatasync(fd) (fsync() if unavailable) */
+    BPOLL_AIO_OPEN      = 4, /**< open(path, flags, mode) */
+    BPOLL_AIO_CLOSE     = 5  /**< close(fd) (e.g. after write on NFS) */
+};
+/** @} */
+
+/** operation; owned by caller from submit until completion callback
+ *  (e.g. embed in request context and recover it with offsetof) */
+struct bpoll_aio_op {
+    bpoll_aio_op_t *next;       /**< (private) */
+    bpoll_aio_fn_cb_t fn_cb;    /**< (set by bpoll_aio_submit()) */
+    void *udata;                /**< user data */
+    void *buf;                  /**< PREAD, PWRITE */
+    size_t len;                 /**< PREAD, PWRITE */
+    off_t offset;               /**< PREAD, PWRITE */
+    const char *path;           /**< OPEN */
+    int opcode;                 /**< BPOLL_AIO_* */
+    int fd;                     /**< all but OPEN */
+    int flags;                  /**< OPEN (O_CLOEXEC is added) */
+    mode_t mode;                /**< OPEN */
+    ssize_t res;                /**< result: bytes, fd (OPEN), 0; -1 error */
+    int err;                    /**< errno if res == -1 */
+};
+
+
+/* create pool of nthreads workers for blocking file I/O for bpollset
+ * (adds virtual bpollelt to bpollset; bpoll_enable_thrsafe_signal() is called)
+ * (workers block all signals but SIGBUS, SIGFPE, SIGILL, SIGSEGV)
+ * (returns pointer to pool on success, NULL on failure and errno set) */
+__attribute_cold__
+__attribute_nonnull__
+__attribute_warn_unused_result__
+EXPORT extern bpoll_aio_t *
+bpoll_aio_create (bpollset_t * const restrict bpollset,
+                  const unsigned int nthreads);
+
+/* stop and join workers after queued operations complete, run remaining
+ * completion callbacks, and remove virtual bpollelt */
+__attribute_cold__
+EXPORT extern void
+bpoll_aio_destroy (bpoll_aio_t * const restrict aio);
+
+/* virtual bpollelt of pool; when ready, call bpoll_aio_event()
+ * (bpollelt->udata is aio) */
+__attribute_nonnull__
+__attribute_pure__
+EXPORT extern bpollelt_t *
+bpoll_aio_bpollelt (const bpoll_aio_t * const restrict aio);
+
+/* queue op to run on worker thread; fn_cb(bpollset, op) is called from
+ * bpoll_aio_event() in bpollset owning thread when op completes
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_aio_submit (bpoll_aio_t * const restrict aio,
+                  bpoll_aio_op_t * const restrict op,
+                  bpoll_aio_fn_cb_t const fn_cb);
+
+/* run completion callbacks for completed ops (in order of completion)
+ * (call from fn_cb_event or results loop when bpoll_aio_bpollelt() is ready)
+ * (returns number of completions) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_aio_event (bpoll_aio_t * const restrict aio);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* ! INCLUDED_BPOLL_AIO_H */
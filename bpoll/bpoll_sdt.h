@@ -0,0 +1,76 @@
+/*
+ * bpoll_sdt - USDT (user-level statically defined tracing) probe macros
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_SDT_H
+#define INCLUDED_BPOLL_SDT_H
+
+/**
+ * @file bpoll_sdt.h
+ * @brief USDT probe macros (internal; not installed)
+ *
+ * Probes use <sys/sdt.h> (systemtap-sdt-dev, systemtap-sdt-devel), which
+ * emits a single nop instruction at each probe site and an ELF note
+ * describing the probe and the locations of its arguments.  A probe is
+ * enabled only while a tracer (bpftrace, perf, stap) is attached, and so
+ * costs effectively nothing when unused.  Without <sys/sdt.h>, or when
+ * built with -DBPOLL_NO_SDT, probes compile to nothing.
+ *
+ * Probe macros are expressions (of type void) so that they may be used
+ * within other expression macros.  Probe arguments should be integral
+ * values already at hand; arguments are evaluated even if no tracer is
+ * attached.
+ */
+
+#if !defined(BPOLL_NO_SDT) && defined(__GNUC__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BPOLL_SDT 1
+#endif
+#endif
+
+#ifndef BPOLL_SDT
+#define BPOLL_SDT 0
+#endif
+
+#if BPOLL_SDT
+
+#define BPOLL_SDT_PROBE0(provider, name) \
+  (__extension__ ({ DTRACE_PROBE(provider, name); }))
+#define BPOLL_SDT_PROBE1(provider, name, a1) \
+  (__extension__ ({ DTRACE_PROBE1(provider, name, a1); }))
+#define BPOLL_SDT_PROBE2(provider, name, a1, a2) \
+  (__extension__ ({ DTRACE_PROBE2(provider, name, a1, a2); }))
+#define BPOLL_SDT_PROBE3(provider, name, a1, a2, a3) \
+  (__extension__ ({ DTRACE_PROBE3(provider, name, a1, a2, a3); }))
+#define BPOLL_SDT_PROBE4(provider, name, a1, a2, a3, a4) \
+  (__extension__ ({ DTRACE_PROBE4(provider, name, a1, a2, a3, a4); }))
+
+#else
+
+#define BPOLL_SDT_PROBE0(provider, name)                 ((void)0)
+#define BPOLL_SDT_PROBE1(provider, name, a1)             ((void)0)
+#define BPOLL_SDT_PROBE2(provider, name, a1, a2)         ((void)0)
+#define BPOLL_SDT_PROBE3(provider, name, a1, a2, a3)     ((void)0)
+#define BPOLL_SDT_PROBE4(provider, name, a1, a2, a3, a4) ((void)0)
+
+#endif
+
+#endif  /* ! INCLUDED_BPOLL_SDT_H */
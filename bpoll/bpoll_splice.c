@@ -0,0 +1,282 @@
+/*
+ * bpoll_splice - zero-copy relay between two bpollelts (Linux splice())
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_SPLICE_C
+#define INCLUDED_BPOLL_SPLICE_C
+
+#ifdef __linux__  /* define _GNU_SOURCE prior to #include <fcntl.h> */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "bpoll_splice.h"
+
+#include <plasma/plasma_attr.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>    /* shutdown() */
+#include <errno.h>
+#include <fcntl.h>         /* splice() pipe2() F_SETPIPE_SZ */
+#include <limits.h>        /* INT_MAX */
+#include <unistd.h>        /* close() */
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+#define HAS_SPLICE 1
+#else
+#define HAS_SPLICE 0
+#endif
+
+#if HAS_SPLICE
+
+#ifndef BPOLL_SPLICE_PIPE_SZ
+#define BPOLL_SPLICE_PIPE_SZ 65536  /* Linux default pipe capacity */
+#endif
+
+
+__attribute_nonnull__
+static int
+bpoll_splice_pump (struct bpoll_splice_dir * const restrict dir,
+                   const size_t pipe_sz);
+static int
+bpoll_splice_pump (struct bpoll_splice_dir * const restrict dir,
+                   const size_t pipe_sz)
+{
+    /* move src -> pipe -> dst until no progress
+     * (stop when dst would block; pipe then holds data and dst is polled for
+     *  BPOLLOUT, while src is not polled for BPOLLIN until pipe is drained)
+     * (returns 0 on success, else the value of errno) */
+    ssize_t n;
+    int progress;
+    do {
+        progress = 0;
+        if (!dir->eof && dir->inpipe < pipe_sz) {
+            n = splice(dir->src->fd, NULL, dir->pipefds[1], NULL,
+                       pipe_sz - dir->inpipe,
+                       SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if (n > 0) {
+                dir->inpipe += (size_t)n;
+                progress = 1;
+            }
+            else if (n == 0)
+                dir->eof = 1;
+            else if (errno == EINTR)
+                progress = 1;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return errno;
+        }
+        if (dir->inpipe != 0) {
+            n = splice(dir->pipefds[0], NULL, dir->dst->fd, NULL, dir->inpipe,
+                       SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if (n > 0) {
+                dir->inpipe -= (size_t)n;
+                progress = 1;
+            }
+            else if (n == -1 && errno == EINTR)
+                progress = 1;
+            else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            else
+                return n == -1 ? errno : EIO;
+        }
+    } while (progress);
+
+    if (dir->eof == 1 && dir->inpipe == 0) {  /* propagate EOF to dst */
+        if (0 != shutdown(dir->dst->fd, SHUT_WR) && errno != ENOTCONN)
+            return errno;
+        dir->eof = 2;
+    }
+    return 0;
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_splice_rearm (bpoll_splice_pair_t * const restrict pair,
+                    bpollelt_t * const restrict bpollelt,
+                    const struct bpoll_splice_dir * const restrict src,
+                    const struct bpoll_splice_dir * const restrict dst);
+static int
+bpoll_splice_rearm (bpoll_splice_pair_t * const restrict pair,
+                    bpollelt_t * const restrict bpollelt,
+                    const struct bpoll_splice_dir * const restrict src,
+                    const struct bpoll_splice_dir * const restrict dst)
+{
+    /* (bpollelt is src of one direction and dst of other direction)
+     * (see bpoll_stream_rearm()) */
+    int events = bpollelt->events & ~(BPOLLIN | BPOLLOUT);
+    if (pair->err == 0) {
+        if (!src->eof && src->inpipe == 0)
+            events |= BPOLLIN;
+        if (dst->inpipe != 0)
+            events |= BPOLLOUT;
+    }
+    return bpoll_elt_modify(pair->bpollset, bpollelt, events);
+}
+
+
+int
+bpoll_splice_pair_init (bpoll_splice_pair_t * const restrict pair,
+                        bpollset_t * const restrict bpollset,
+                        bpollelt_t * const restrict a,
+                        bpollelt_t * const restrict b,
+                        const size_t pipe_sz)
+{
+    int sz;
+    pair->bpollset = bpollset;
+    pair->ab.src = pair->ba.dst = a;
+    pair->ab.dst = pair->ba.src = b;
+    pair->ab.inpipe = pair->ba.inpipe = 0;
+    pair->ab.eof = pair->ba.eof = 0;
+    pair->ab.pipefds[0] = pair->ab.pipefds[1] = -1;
+    pair->ba.pipefds[0] = pair->ba.pipefds[1] = -1;
+    pair->err = 0;
+    if (0 != pipe2(pair->ab.pipefds, O_NONBLOCK | O_CLOEXEC))
+        return errno;
+    if (0 != pipe2(pair->ba.pipefds, O_NONBLOCK | O_CLOEXEC)) {
+        const int errnum = errno;
+        bpoll_splice_pair_destroy(pair);
+        return (errno = errnum);
+    }
+
+    /* (F_SETPIPE_SZ might be limited by /proc/sys/fs/pipe-max-size for
+     *  unprivileged processes, so use pipe capacity actually obtained) */
+  #ifdef F_SETPIPE_SZ
+    if (pipe_sz != 0 && pipe_sz <= INT_MAX) {
+        (void)fcntl(pair->ab.pipefds[1], F_SETPIPE_SZ, (int)pipe_sz);
+        (void)fcntl(pair->ba.pipefds[1], F_SETPIPE_SZ, (int)pipe_sz);
+    }
+  #endif
+  #ifdef F_GETPIPE_SZ
+    sz = fcntl(pair->ab.pipefds[1], F_GETPIPE_SZ);
+    {
+        const int sz2 = fcntl(pair->ba.pipefds[1], F_GETPIPE_SZ);
+        if (sz2 < sz)
+            sz = sz2;
+    }
+  #else
+    sz = -1;
+  #endif
+    pair->pipe_sz = (sz > 0) ? (size_t)sz : BPOLL_SPLICE_PIPE_SZ;
+
+    if (0 != bpoll_splice_rearm(pair, a, &pair->ab, &pair->ba)
+        || 0 != bpoll_splice_rearm(pair, b, &pair->ba, &pair->ab)) {
+        const int errnum = errno;
+        bpoll_splice_pair_destroy(pair);
+        return (errno = errnum);
+    }
+    return 0;
+}
+
+
+int
+bpoll_splice_pair_event (bpoll_splice_pair_t * const restrict pair,
+                         bpollelt_t * const restrict bpollelt)
+{
+    const int revents = bpollelt->revents;
+    struct bpoll_splice_dir * const restrict src =
+      (bpollelt == pair->ab.src) ? &pair->ab : &pair->ba;
+    struct bpoll_splice_dir * const restrict dst =
+      (bpollelt == pair->ab.src) ? &pair->ba : &pair->ab;
+    int rc = 0;
+
+    if (__builtin_expect( (pair->err != 0), 0))
+        return BPOLL_SPLICE_ERR;
+
+    /* bpollelt readable: move data toward other side
+     * bpollelt writable: move data pending in pipe toward bpollelt
+     * (BPOLLHUP and BPOLLERR are handled as both; splice() reports error) */
+    if (revents & (BPOLLIN | BPOLLHUP | BPOLLERR))
+        rc = bpoll_splice_pump(src, pair->pipe_sz);
+    if (rc == 0 && (revents & (BPOLLOUT | BPOLLHUP | BPOLLERR)))
+        rc = bpoll_splice_pump(dst, pair->pipe_sz);
+    if (rc == 0 && (revents & BPOLLERR)
+        && src->eof != 2 && dst->eof != 2)
+        rc = EIO;  /*(not surfaced by splice())*/
+
+    if (__builtin_expect( (rc != 0), 0))
+        pair->err = rc;
+    bpoll_splice_rearm(pair, pair->ab.src, &pair->ab, &pair->ba);
+    bpoll_splice_rearm(pair, pair->ba.src, &pair->ba, &pair->ab);
+
+    return (pair->err != 0)
+      ? BPOLL_SPLICE_ERR
+      : (pair->ab.eof == 2 && pair->ba.eof == 2)
+        ? BPOLL_SPLICE_DONE
+        : 0;
+}
+
+
+void
+bpoll_splice_pair_destroy (bpoll_splice_pair_t * const restrict pair)
+{
+    int i;
+    for (i = 0; i < 2; ++i) {
+        if (pair->ab.pipefds[i] != -1) {
+            close(pair->ab.pipefds[i]);
+            pair->ab.pipefds[i] = -1;
+        }
+        if (pair->ba.pipefds[i] != -1) {
+            close(pair->ba.pipefds[i]);
+            pair->ba.pipefds[i] = -1;
+        }
+    }
+}
+
+
+#else  /* !HAS_SPLICE */
+
+
+int
+bpoll_splice_pair_init (bpoll_splice_pair_t * const restrict pair,
+                        bpollset_t * const restrict bpollset,
+                        bpollelt_t * const restrict a,
+                        bpollelt_t * const restrict b,
+                        const size_t pipe_sz)
+{
+    (void)bpollset; (void)a; (void)b; (void)pipe_sz;
+    pair->ab.pipefds[0] = pair->ab.pipefds[1] = -1;
+    pair->ba.pipefds[0] = pair->ba.pipefds[1] = -1;
+    return (errno = ENOSYS);
+}
+
+
+int
+bpoll_splice_pair_event (bpoll_splice_pair_t * const restrict pair,
+                         bpollelt_t * const restrict bpollelt)
+{
+    (void)bpollelt;
+    pair->err = ENOSYS;
+    return BPOLL_SPLICE_ERR;
+}
+
+
+void
+bpoll_splice_pair_destroy (bpoll_splice_pair_t * const restrict pair)
+{
+    (void)pair;
+}
+
+
+#endif /* !HAS_SPLICE */
+
+
+#endif /* INCLUDED_BPOLL_SPLICE_C */
@@ -0,0 +1,115 @@
+/*
+ * bpoll_splice - zero-copy relay between two bpollelts (Linux splice())
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_SPLICE_H
+#define INCLUDED_BPOLL_SPLICE_H
+
+#include "bpoll.h"
+
+#include <stddef.h>     /* size_t */
+
+/**
+ * @file bpoll_splice.h
+ * @brief zero-copy relay between two bpollelts (Linux splice())
+ *
+ * Data is moved socket -> pipe -> socket in each direction with splice()
+ * (SPLICE_F_NONBLOCK | SPLICE_F_MOVE) and is never copied into user space.
+ * Each direction has its own pipe.  A source is polled for BPOLLIN only while
+ * its pipe is empty, and a destination is polled for BPOLLOUT only while its
+ * pipe holds data that could not be written immediately, so a slow side exerts
+ * backpressure on the fast side through the bpollset.  (Pipe capacity is
+ * counted in pages, not bytes, so a readable source with a partly filled pipe
+ * might not be spliced; it is polled again once the pipe is drained.)  EOF from
+ * a source is propagated as shutdown(SHUT_WR) on the destination after the
+ * pipe drains.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** one direction of a bpoll_splice_pair (src -> pipe -> dst) */
+struct bpoll_splice_dir {
+    bpollelt_t *src;
+    bpollelt_t *dst;
+    int pipefds[2];
+    size_t inpipe;              /**< bytes in pipe */
+    int eof;                    /**< src EOF (1); dst shut down (2) */
+};
+
+/** @see struct bpoll_splice_pair */
+typedef struct bpoll_splice_pair bpoll_splice_pair_t;
+
+/** zero-copy relay between bpollelts a and b */
+struct bpoll_splice_pair {
+    bpollset_t *bpollset;
+    struct bpoll_splice_dir ab;
+    struct bpoll_splice_dir ba;
+    size_t pipe_sz;             /**< pipe capacity */
+    int err;                    /**< errno if BPOLL_SPLICE_ERR */
+};
+
+/**
+ * @defgroup bpoll splice pair events (returned by bpoll_splice_pair_event())
+ * @{
+ */
+enum {
+    BPOLL_SPLICE_DONE = 1,   /**< both directions reached EOF and drained */
+    BPOLL_SPLICE_ERR  = 2    /**< error (pair->err); relay disarmed */
+};
+/** @} */
+
+
+/* initialize relay between bpollelts a and b (stream sockets, already added
+ * to bpollset, O_NONBLOCK) and arm BPOLLIN on both
+ * pipe_sz is requested pipe capacity (F_SETPIPE_SZ; 0 for default)
+ * (returns 0 on success, else the value of errno; ENOSYS if not Linux) */
+__attribute_cold__
+__attribute_nonnull__
+__attribute_warn_unused_result__
+EXPORT extern int
+bpoll_splice_pair_init (bpoll_splice_pair_t * const restrict pair,
+                        bpollset_t * const restrict bpollset,
+                        bpollelt_t * const restrict a,
+                        bpollelt_t * const restrict b,
+                        const size_t pipe_sz);
+
+/* handle revents (bpollelt->revents) for bpollelt a or b of relay
+ * (call from fn_cb_event or results loop when bpollelt belongs to relay)
+ * (returns 0 while relay active, else BPOLL_SPLICE_DONE or BPOLL_SPLICE_ERR;
+ *  then caller bpoll_elt_remove() a and b and bpoll_splice_pair_destroy()) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_splice_pair_event (bpoll_splice_pair_t * const restrict pair,
+                         bpollelt_t * const restrict bpollelt);
+
+/* close relay pipes (does not remove or close a or b) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern void
+bpoll_splice_pair_destroy (bpoll_splice_pair_t * const restrict pair);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* ! INCLUDED_BPOLL_SPLICE_H */
@@ -0,0 +1,956 @@
+/*
+ * bpoll_stream - buffered non-blocking stream I/O layered on bpoll
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_STREAM_C
+#define INCLUDED_BPOLL_STREAM_C
+
+#ifdef __linux__  /* define _GNU_SOURCE prior to #include <netinet/in.h> */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* IP_RECVERR */
+#endif
+#endif
+
+#include "bpoll_stream.h"
+
+#include <plasma/plasma_attr.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>    /* sendmsg() MSG_NOSIGNAL */
+#include <sys/uio.h>       /* readv(), writev() */
+#include <errno.h>
+#include <limits.h>        /* IOV_MAX */
+#include <stdint.h>
+#include <string.h>        /* memcpy(), memset() */
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>  /* sendfile() */
+#include <netinet/in.h>    /* IP_RECVERR IPV6_RECVERR */
+#include <linux/errqueue.h>/* struct sock_extended_err */
+#define HAS_SENDFILE 1
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) \
+ && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAS_ZEROCOPY 1
+#endif
+#endif
+
+#ifndef HAS_SENDFILE
+#define HAS_SENDFILE 0
+#endif
+#ifndef HAS_ZEROCOPY
+#define HAS_ZEROCOPY 0
+#endif
+
+/* (MSG_ZEROCOPY page pinning and completion notification cost more than copy
+ *  for small sends; smaller buffers are sent by reference without it) */
+#ifndef BPOLL_STREAM_ZC_MIN
+#define BPOLL_STREAM_ZC_MIN 16384
+#endif
+
+/* (max segments per writev(); IOV_MAX is at least 16 (_XOPEN_IOV_MAX)) */
+#ifndef BPOLL_STREAM_IOV
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define BPOLL_STREAM_IOV IOV_MAX
+#else
+#define BPOLL_STREAM_IOV 64
+#endif
+#endif
+
+/* (max new segments per readv(); in addition to space remaining in tail) */
+#ifndef BPOLL_STREAM_IOV_RD
+#define BPOLL_STREAM_IOV_RD 4
+#endif
+
+#ifndef BPOLL_STREAM_HIWAT
+#define BPOLL_STREAM_HIWAT 65536
+#endif
+
+
+/* (chunk of segments: chunk link, followed by slab->chunk_nsegs segments) */
+struct bpoll_stream_chunk {
+    struct bpoll_stream_chunk *next;
+};
+
+
+__attribute_noinline__
+__attribute_nonnull__
+static int
+bpoll_stream_slab_grow (bpoll_stream_slab_t * const restrict slab);
+static int
+bpoll_stream_slab_grow (bpoll_stream_slab_t * const restrict slab)
+{
+    bpollset_t * const restrict bpollset = slab->bpollset;
+    struct bpoll_stream_chunk * const restrict chunk =
+      bpollset->fn_mem_alloc(bpollset->vdata,
+                             sizeof(struct bpoll_stream_chunk)
+                             + slab->stride * slab->chunk_nsegs);
+    char *p;
+    uint32_t i;
+    if (__builtin_expect( (chunk == NULL), 0))
+        return (errno = ENOMEM);
+    chunk->next = (struct bpoll_stream_chunk *)slab->chunks;
+    slab->chunks = chunk;
+    p = (char *)(chunk+1) + slab->stride * slab->chunk_nsegs;
+    for (i = 0; i < slab->chunk_nsegs; ++i) {
+        bpoll_stream_seg_t * const restrict seg =
+          (bpoll_stream_seg_t *)(p -= slab->stride);
+        seg->next = slab->free;
+        slab->free = seg;
+    }
+    slab->nfree += slab->chunk_nsegs;
+    slab->nsegs += slab->chunk_nsegs;
+    return 0;
+}
+
+
+__attribute_nonnull__
+static inline bpoll_stream_seg_t *
+bpoll_stream_seg_alloc (bpoll_stream_slab_t * const restrict slab);
+static inline bpoll_stream_seg_t *
+bpoll_stream_seg_alloc (bpoll_stream_slab_t * const restrict slab)
+{
+    bpoll_stream_seg_t * restrict seg = slab->free;
+    if (__builtin_expect( (seg == NULL), 0)) {
+        if (0 != bpoll_stream_slab_grow(slab))
+            return NULL;
+        seg = slab->free;
+    }
+    slab->free = seg->next;
+    --slab->nfree;
+    seg->next = NULL;
+    seg->off  = 0;
+    seg->len  = 0;
+    seg->kind = BPOLL_STREAM_SEG_DATA;
+    return seg;
+}
+
+
+__attribute_nonnull__
+static inline void
+bpoll_stream_seg_free (bpoll_stream_slab_t * const restrict slab,
+                       bpoll_stream_seg_t * const restrict seg);
+static inline void
+bpoll_stream_seg_free (bpoll_stream_slab_t * const restrict slab,
+                       bpoll_stream_seg_t * const restrict seg)
+{
+    seg->next = slab->free;
+    slab->free = seg;
+    ++slab->nfree;
+}
+
+
+__attribute_nonnull__
+static void
+bpoll_stream_chain_consume (bpoll_stream_slab_t * const restrict slab,
+                            struct bpoll_stream_chain * const restrict chain,
+                            size_t len);
+static void
+bpoll_stream_chain_consume (bpoll_stream_slab_t * const restrict slab,
+                            struct bpoll_stream_chain * const restrict chain,
+                            size_t len)
+{
+    bpoll_stream_seg_t * restrict seg;
+    if (len > chain->bytes)
+        len = chain->bytes;
+    chain->bytes -= len;
+    while (NULL != (seg = chain->head)) {
+        const size_t avail = seg->len - seg->off;
+        if (len < avail) {
+            seg->off += (uint32_t)len;
+            break;
+        }
+        len -= avail;
+        if (NULL == (chain->head = seg->next))
+            chain->tail = NULL;
+        bpoll_stream_seg_free(slab, seg);
+    }
+}
+
+
+#define bpoll_stream_seg_ref(seg) \
+  ((struct bpoll_stream_ref *)(void *)(seg)->data)
+
+
+__attribute_nonnull__
+static void
+bpoll_stream_chain_release (bpoll_stream_t * const restrict stream,
+                            struct bpoll_stream_chain * const restrict chain);
+static void
+bpoll_stream_chain_release (bpoll_stream_t * const restrict stream,
+                            struct bpoll_stream_chain * const restrict chain)
+{
+    /* free all segments in chain, calling fn_release() for referenced data */
+    bpoll_stream_seg_t * restrict seg;
+    while (NULL != (seg = chain->head)) {
+        chain->head = seg->next;
+        if (seg->kind != BPOLL_STREAM_SEG_DATA) {
+            const struct bpoll_stream_ref * const ref =
+              bpoll_stream_seg_ref(seg);
+            if (ref->fn_release != NULL)
+                ref->fn_release(stream, ref->arg);
+        }
+        bpoll_stream_seg_free(stream->slab, seg);
+    }
+    chain->tail = NULL;
+    chain->bytes = 0;
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_stream_rearm (bpoll_stream_t * const restrict stream);
+static int
+bpoll_stream_rearm (bpoll_stream_t * const restrict stream)
+{
+    /* (BPOLLIN while below rd_hiwat; BPOLLOUT only while output is pending)
+     * (bpoll_elt_modify() returns immediately if interest is unchanged) */
+    bpollelt_t * const restrict bpollelt = stream->bpollelt;
+    int events = bpollelt->events & ~(BPOLLIN | BPOLLOUT);
+    if (!(stream->state & BPOLL_STREAM_ERR)) {
+        if (!(stream->state & BPOLL_STREAM_EOF)
+            && stream->rd.bytes < stream->rd_hiwat)
+            events |= BPOLLIN;
+        if (stream->wr.bytes != 0)
+            events |= BPOLLOUT;
+    }
+    return bpoll_elt_modify(stream->slab->bpollset, bpollelt, events);
+}
+
+
+__attribute_nonnull__
+static void
+bpoll_stream_fill (bpoll_stream_t * const restrict stream);
+static void
+bpoll_stream_fill (bpoll_stream_t * const restrict stream)
+{
+    /* readv() into space remaining in tail segment plus new segments
+     * until EAGAIN, EOF, error, or rd_hiwat reached
+     * (edge-triggered (BPOLLET) bpollelt: also stop after reading
+     *  bpoll_get_elt_budget() bytes, if > 0, and place bpollelt on user-space
+     *  ready list (bpoll_elt_mark_pending()) so that one busy stream does not
+     *  starve others and remaining input is read on next bpoll_process()) */
+    bpoll_stream_slab_t * const restrict slab = stream->slab;
+    struct bpoll_stream_chain * const restrict rd = &stream->rd;
+    bpollelt_t * const restrict bpollelt = stream->bpollelt;
+    const int fd = bpollelt->fd;
+    const uint32_t seg_sz = slab->seg_sz;
+    const size_t budget = (bpollelt->events & BPOLLET)
+                       && bpoll_get_elt_budget(slab->bpollset) > 0
+      ? (size_t)bpoll_get_elt_budget(slab->bpollset)
+      : SIZE_MAX;
+    bpoll_stream_seg_t *segs[BPOLL_STREAM_IOV_RD];
+    struct iovec iov[BPOLL_STREAM_IOV_RD+1];
+    bpoll_stream_seg_t * restrict tail;
+    size_t total, rem, want, nread = 0;
+    ssize_t n;
+    int i, nseg, iovcnt;
+
+    do {
+        iovcnt = 0;
+        total = 0;
+        tail = rd->tail;
+        if (tail != NULL && tail->len < seg_sz) {
+            iov[0].iov_base = tail->data + tail->len;
+            iov[0].iov_len  = seg_sz - tail->len;
+            total = iov[0].iov_len;
+            iovcnt = 1;
+        }
+        else
+            tail = NULL;
+        /* (new segments only as needed to reach rd_hiwat; at least one) */
+        want = stream->rd_hiwat - rd->bytes;
+        for (nseg = 0; nseg < BPOLL_STREAM_IOV_RD
+                       && (nseg == 0 || total < want); ++nseg) {
+            if (NULL == (segs[nseg] = bpoll_stream_seg_alloc(slab)))
+                break;
+            iov[iovcnt].iov_base = segs[nseg]->data;
+            iov[iovcnt].iov_len  = seg_sz;
+            total += seg_sz;
+            ++iovcnt;
+        }
+        if (__builtin_expect( (iovcnt == 0), 0)) {
+            stream->state |= BPOLL_STREAM_ERR;
+            stream->err = ENOMEM;
+            return;
+        }
+
+        do {
+            n = readv(fd, iov, iovcnt);
+        } while (n == -1 && errno == EINTR);
+
+        rem = n > 0 ? (size_t)n : 0;
+        if (tail != NULL) {
+            const size_t take = rem < iov[0].iov_len ? rem : iov[0].iov_len;
+            tail->len += (uint32_t)take;
+            rem -= take;
+        }
+        for (i = 0; i < nseg; ++i) {
+            bpoll_stream_seg_t * const restrict seg = segs[i];
+            if (rem != 0) {
+                seg->len = (uint32_t)(rem < seg_sz ? rem : seg_sz);
+                rem -= seg->len;
+                if (rd->tail != NULL)
+                    rd->tail->next = seg;
+                else
+                    rd->head = seg;
+                rd->tail = seg;
+            }
+            else
+                bpoll_stream_seg_free(slab, seg);
+        }
+
+        if (n > 0) {
+            rd->bytes += (size_t)n;
+            nread += (size_t)n;
+        }
+        else if (n == 0)
+            stream->state |= BPOLL_STREAM_EOF;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            stream->state |= BPOLL_STREAM_ERR;
+            stream->err = errno;
+        }
+    } while ((size_t)n == total && rd->bytes < stream->rd_hiwat
+             && nread < budget);
+
+    if ((size_t)n == total && rd->bytes < stream->rd_hiwat && nread >= budget)
+        bpoll_elt_mark_pending(slab->bpollset, bpollelt, BPOLLIN);
+}
+
+
+#if HAS_ZEROCOPY
+
+__attribute_noinline__
+__attribute_nonnull__
+static void
+bpoll_stream_zc_complete (bpoll_stream_t * const restrict stream);
+static void
+bpoll_stream_zc_complete (bpoll_stream_t * const restrict stream)
+{
+    /* read MSG_ZEROCOPY completions (and other errors) from socket error queue
+     * (ee_info..ee_data is inclusive range of completed send sequence numbers;
+     *  TCP completes in order, so release sent buffers up to ee_data) */
+    struct bpoll_stream_chain * const restrict zc = &stream->zc;
+    const int fd = stream->bpollelt->fd;
+    union {  /*(aligned for struct cmsghdr)*/
+        struct cmsghdr cmsg;
+        char buf[CMSG_SPACE(sizeof(struct sock_extended_err))
+                 + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    bpoll_stream_seg_t * restrict seg;
+    const struct sock_extended_err *serr;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        if (-1 == recvmsg(fd, &msg, MSG_ERRQUEUE)) {
+            if (errno == EINTR)
+                continue;
+            break;  /*(EAGAIN: error queue empty)*/
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg,cmsg)) {
+            if (!((cmsg->cmsg_level == IPPROTO_IP
+                   && cmsg->cmsg_type == IP_RECVERR)
+                  || (cmsg->cmsg_level == IPPROTO_IPV6
+                      && cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+            serr = (const struct sock_extended_err *)(void *)CMSG_DATA(cmsg);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                if (serr->ee_errno != 0 && !(stream->state&BPOLL_STREAM_ERR)) {
+                    stream->state |= BPOLL_STREAM_ERR;
+                    stream->err = (int)serr->ee_errno;
+                }
+                continue;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                stream->zerocopy = 2; /*(kernel copied; stop MSG_ZEROCOPY)*/
+            while (NULL != (seg = zc->head)
+                   && (int32_t)(bpoll_stream_seg_ref(seg)->zc_seq
+                                - serr->ee_data) <= 0) {
+                const struct bpoll_stream_ref * const ref =
+                  bpoll_stream_seg_ref(seg);
+                if (NULL == (zc->head = seg->next))
+                    zc->tail = NULL;
+                zc->bytes -= seg->len;
+                if (ref->fn_release != NULL)
+                    ref->fn_release(stream, ref->arg);
+                bpoll_stream_seg_free(stream->slab, seg);
+            }
+        }
+    }
+}
+
+#endif /* HAS_ZEROCOPY */
+
+
+__attribute_nonnull__
+static ssize_t
+bpoll_stream_send_ref (bpoll_stream_t * const restrict stream,
+                       bpoll_stream_seg_t * const restrict seg,
+                       const int is_sock);
+static ssize_t
+bpoll_stream_send_ref (bpoll_stream_t * const restrict stream,
+                       bpoll_stream_seg_t * const restrict seg,
+                       const int is_sock)
+{
+    /* send from referenced file range or application buffer (no copy)
+     * (returns bytes sent, or -1 and errno set) */
+    struct bpoll_stream_ref * const restrict ref = bpoll_stream_seg_ref(seg);
+    const int fd = stream->bpollelt->fd;
+    const size_t len = seg->len - seg->off;
+    ssize_t n;
+
+    if (seg->kind == BPOLL_STREAM_SEG_FILE) {
+      #if HAS_SENDFILE
+        off_t offset = ref->offset;
+        n = sendfile(fd, ref->fd, &offset, len);
+        (void)is_sock;
+      #else
+        char buf[8192];  /*(fallback: pread() into stack buffer)*/
+        n = pread(ref->fd, buf, len < sizeof(buf) ? len : sizeof(buf),
+                  ref->offset);
+        if (n > 0) {
+          #ifdef MSG_NOSIGNAL
+            n = is_sock
+              ? send(fd, buf, (size_t)n, MSG_NOSIGNAL)
+              : write(fd, buf, (size_t)n);
+          #else
+            n = write(fd, buf, (size_t)n);
+          #endif
+        }
+      #endif
+        if (n > 0)
+            ref->offset += n;
+        else if (n == 0) {
+            n = -1;
+            errno = EIO;  /*(file truncated)*/
+        }
+        return n;
+    }
+
+  #if HAS_ZEROCOPY
+    if (stream->zerocopy == 1 && len >= BPOLL_STREAM_ZC_MIN) {
+        n = send(fd, ref->buf + seg->off, len, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if (n >= 0) { /*(kernel numbers each successful MSG_ZEROCOPY send)*/
+            ref->zc_seq = stream->zc_seq++;
+            ref->zerocopy = 1;
+        }
+        return n;
+    }
+  #endif
+  #ifdef MSG_NOSIGNAL
+    if (is_sock)
+        return send(fd, ref->buf + seg->off, len, MSG_NOSIGNAL);
+  #else
+    (void)is_sock;
+  #endif
+    return write(fd, ref->buf + seg->off, len);
+}
+
+
+__attribute_nonnull__
+static int
+bpoll_stream_drain (bpoll_stream_t * const restrict stream);
+static int
+bpoll_stream_drain (bpoll_stream_t * const restrict stream)
+{
+    /* writev() pending output (up to BPOLL_STREAM_IOV segments per call)
+     * (referenced output is sent separately, in order, by send_ref)
+     * (returns 0 if drained, EAGAIN if output remains, else errno) */
+    struct bpoll_stream_chain * const restrict wr = &stream->wr;
+    const int fd = stream->bpollelt->fd;
+    const int is_sock = (stream->bpollelt->fdtype == BPOLL_FD_SOCKET);
+  #ifdef MSG_NOSIGNAL
+    struct msghdr msg;
+  #endif
+    struct iovec iov[BPOLL_STREAM_IOV];
+    bpoll_stream_seg_t * restrict seg;
+    size_t total;
+    ssize_t n;
+    int iovcnt;
+
+    while (wr->bytes != 0) {
+        seg = wr->head;
+        if (seg->kind != BPOLL_STREAM_SEG_DATA) {
+            total = seg->len - seg->off;
+            n = bpoll_stream_send_ref(stream, seg, is_sock);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return EAGAIN;
+                stream->state |= BPOLL_STREAM_ERR;
+                return (stream->err = errno);
+            }
+            seg->off += (uint32_t)n;
+            wr->bytes -= (size_t)n;
+            if ((size_t)n < total) {
+                /*(short file send need not mean socket buffer is full)*/
+                if (seg->kind == BPOLL_STREAM_SEG_FILE)
+                    continue;
+                return EAGAIN;
+            }
+            if (NULL == (wr->head = seg->next))
+                wr->tail = NULL;
+            seg->next = NULL;
+            if (bpoll_stream_seg_ref(seg)->zerocopy) {
+                /* hold until completion; kernel might still reference buf */
+                if (stream->zc.tail != NULL)
+                    stream->zc.tail->next = seg;
+                else
+                    stream->zc.head = seg;
+                stream->zc.tail = seg;
+                stream->zc.bytes += seg->len;
+            }
+            else {
+                const struct bpoll_stream_ref * const ref =
+                  bpoll_stream_seg_ref(seg);
+                if (ref->fn_release != NULL)
+                    ref->fn_release(stream, ref->arg);
+                bpoll_stream_seg_free(stream->slab, seg);
+            }
+            continue;   /*(seg retired; restart from new wr->head)*/
+        }
+        total = 0;
+        for (iovcnt = 0;
+             seg != NULL && iovcnt < BPOLL_STREAM_IOV
+               && seg->kind == BPOLL_STREAM_SEG_DATA;
+             ++iovcnt, seg = seg->next) {
+            iov[iovcnt].iov_base = seg->data + seg->off;
+            iov[iovcnt].iov_len  = seg->len  - seg->off;
+            total += iov[iovcnt].iov_len;
+        }
+      #ifdef MSG_NOSIGNAL
+        if (is_sock) {  /*(sendmsg() MSG_NOSIGNAL: EPIPE instead of SIGPIPE)*/
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        }
+        else
+      #endif
+            n = writev(fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return EAGAIN;
+            stream->state |= BPOLL_STREAM_ERR;
+            return (stream->err = errno);
+        }
+        bpoll_stream_chain_consume(stream->slab, wr, (size_t)n);
+        if ((size_t)n < total)  /*(short write; socket buffer is full)*/
+            return wr->bytes != 0 ? EAGAIN : 0;
+    }
+    return 0;
+}
+
+
+bpoll_stream_slab_t *
+bpoll_stream_slab_create (bpollset_t * const restrict bpollset,
+                          const size_t seg_sz, const unsigned int chunk_nsegs)
+{
+    bpoll_stream_slab_t * restrict slab;
+    const size_t stride =
+      (sizeof(bpoll_stream_seg_t) + seg_sz + (sizeof(void *)-1))
+      & ~(sizeof(void *)-1);
+    if (seg_sz < sizeof(struct bpoll_stream_ref) || seg_sz > INT32_MAX
+        || chunk_nsegs == 0
+        || chunk_nsegs > (SIZE_MAX - sizeof(struct bpoll_stream_chunk))/stride
+        || bpollset->fn_mem_alloc == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    slab = bpollset->fn_mem_alloc(bpollset->vdata, sizeof(*slab));
+    if (__builtin_expect( (slab == NULL), 0)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    slab->bpollset    = bpollset;
+    slab->free        = NULL;
+    slab->chunks      = NULL;
+    slab->stride      = stride;
+    slab->seg_sz      = (uint32_t)seg_sz;
+    slab->chunk_nsegs = (uint32_t)chunk_nsegs;
+    slab->nfree       = 0;
+    slab->nsegs       = 0;
+    return slab;
+}
+
+
+void
+bpoll_stream_slab_destroy (bpoll_stream_slab_t * const restrict slab)
+{
+    bpollset_t * const restrict bpollset = slab->bpollset;
+    struct bpoll_stream_chunk *chunk, *next;
+    if (bpollset->fn_mem_free == NULL)
+        return;
+    for (chunk = slab->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        bpollset->fn_mem_free(bpollset->vdata, chunk);
+    }
+    bpollset->fn_mem_free(bpollset->vdata, slab);
+}
+
+
+void
+bpoll_stream_init (bpoll_stream_t * const restrict stream,
+                   bpoll_stream_slab_t * const restrict slab,
+                   bpollelt_t * const restrict bpollelt)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->bpollelt = bpollelt;
+    stream->slab     = slab;
+    stream->rd_hiwat = BPOLL_STREAM_HIWAT;
+    stream->wr_lowat = 0;
+    stream->wr_hiwat = BPOLL_STREAM_HIWAT;
+}
+
+
+void
+bpoll_stream_clear (bpoll_stream_t * const restrict stream)
+{
+    /* (buffers awaiting MSG_ZEROCOPY completion are released, too; caller is
+     *  closing socket, and data still referenced would be sent, if at all, as
+     *  it is at that time) */
+    bpoll_stream_chain_consume(stream->slab, &stream->rd, stream->rd.bytes);
+    bpoll_stream_chain_release(stream, &stream->wr);
+    bpoll_stream_chain_release(stream, &stream->zc);
+}
+
+
+void
+bpoll_stream_watermarks (bpoll_stream_t * const restrict stream,
+                         const size_t rd_hiwat,
+                         const size_t wr_lowat, const size_t wr_hiwat)
+{
+    stream->rd_hiwat = rd_hiwat != 0 ? rd_hiwat : SIZE_MAX;
+    stream->wr_lowat = wr_lowat;
+    stream->wr_hiwat = wr_hiwat != 0 ? wr_hiwat : SIZE_MAX;
+}
+
+
+int
+bpoll_stream_event (bpoll_stream_t * const restrict stream, const int revents)
+{
+    int ev = 0;
+    int rev = revents;
+    if (__builtin_expect( (stream->state & BPOLL_STREAM_ERR), 0))
+        return stream->state & (BPOLL_STREAM_EOF | BPOLL_STREAM_ERR);
+
+  #if HAS_ZEROCOPY
+    /* (BPOLLERR is also raised for MSG_ZEROCOPY completions in error queue;
+     *  report socket error only if SO_ERROR remains after error queue read) */
+    if ((rev & BPOLLERR) && stream->zerocopy != 0) {
+        int errnum = 0;
+        socklen_t errlen = sizeof(errnum);
+        bpoll_stream_zc_complete(stream);
+        if (!(stream->state & BPOLL_STREAM_ERR)
+            && 0 == getsockopt(stream->bpollelt->fd, SOL_SOCKET, SO_ERROR,
+                               &errnum, &errlen)
+            && errnum == 0)
+            rev &= ~BPOLLERR;
+        else if (!(stream->state & BPOLL_STREAM_ERR) && errnum != 0) {
+            stream->state |= BPOLL_STREAM_ERR;
+            stream->err = errnum;
+        }
+    }
+  #endif
+
+    if ((rev & (BPOLLIN | BPOLLHUP | BPOLLERR))
+        && !(stream->state & (BPOLL_STREAM_EOF | BPOLL_STREAM_ERR))
+        && stream->rd.bytes < stream->rd_hiwat)
+        bpoll_stream_fill(stream);
+
+    if ((rev & (BPOLLOUT | BPOLLERR)) && stream->wr.bytes != 0
+        && !(stream->state & BPOLL_STREAM_ERR))
+        bpoll_stream_drain(stream);
+
+    if ((rev & BPOLLERR) && !(stream->state & BPOLL_STREAM_ERR)) {
+        stream->state |= BPOLL_STREAM_ERR;  /*(not surfaced by read or write)*/
+        stream->err = EIO;
+    }
+
+    if ((stream->state & BPOLL_STREAM_WRFULL)
+        && stream->wr.bytes <= stream->wr_lowat) {
+        stream->state &= ~BPOLL_STREAM_WRFULL;
+        ev |= BPOLL_STREAM_WR;
+    }
+
+    if (stream->rd.bytes != 0)
+        ev |= BPOLL_STREAM_RD;
+    ev |= stream->state & (BPOLL_STREAM_EOF | BPOLL_STREAM_ERR);
+
+    bpoll_stream_rearm(stream);
+    return ev;
+}
+
+
+size_t
+bpoll_stream_read (bpoll_stream_t * const restrict stream,
+                   void * const restrict buf, const size_t len)
+{
+    const bpoll_stream_seg_t * restrict seg = stream->rd.head;
+    char * restrict p = (char *)buf;
+    size_t rem = len < stream->rd.bytes ? len : stream->rd.bytes;
+    const size_t n = rem;
+    for (; rem != 0; seg = seg->next) {
+        size_t avail = seg->len - seg->off;
+        if (avail > rem)
+            avail = rem;
+        memcpy(p, seg->data + seg->off, avail);
+        p += avail;
+        rem -= avail;
+    }
+    bpoll_stream_consume(stream, n);
+    return n;
+}
+
+
+int
+bpoll_stream_peek (bpoll_stream_t * const restrict stream,
+                   struct iovec * const restrict iov, const int iovcnt)
+{
+    const bpoll_stream_seg_t * restrict seg = stream->rd.head;
+    int i;
+    for (i = 0; i < iovcnt && seg != NULL; seg = seg->next) {
+        if (seg->len == seg->off)
+            continue;
+        iov[i].iov_base = (void *)(uintptr_t)(seg->data + seg->off);
+        iov[i].iov_len  = seg->len - seg->off;
+        ++i;
+    }
+    return i;
+}
+
+
+void
+bpoll_stream_consume (bpoll_stream_t * const restrict stream, size_t len)
+{
+    const int was_full = (stream->rd.bytes >= stream->rd_hiwat);
+    bpoll_stream_chain_consume(stream->slab, &stream->rd, len);
+    if (was_full && stream->rd.bytes < stream->rd_hiwat)
+        bpoll_stream_rearm(stream);  /* resume reading */
+}
+
+
+int
+bpoll_stream_write (bpoll_stream_t * const restrict stream,
+                    const void * const restrict buf, const size_t len)
+{
+    bpoll_stream_slab_t * const restrict slab = stream->slab;
+    struct bpoll_stream_chain * const restrict wr = &stream->wr;
+    const uint32_t seg_sz = slab->seg_sz;
+    bpoll_stream_seg_t * restrict tail = wr->tail;
+    bpoll_stream_seg_t *head = NULL, *last = NULL, *seg;
+    const char * restrict p = (const char *)buf;
+    size_t rem = len;
+    size_t space = (tail != NULL && tail->kind == BPOLL_STREAM_SEG_DATA)
+      ? seg_sz - tail->len
+      : 0;
+
+    if (__builtin_expect( (stream->state & BPOLL_STREAM_ERR), 0))
+        return (errno = stream->err);
+
+    /* (allocate all segments needed before copying; all or nothing) */
+    if (rem > space) {
+        size_t nsegs = (rem - space + seg_sz - 1) / seg_sz;
+        do {
+            if (NULL == (seg = bpoll_stream_seg_alloc(slab))) {
+                while (NULL != (seg = head)) {
+                    head = seg->next;
+                    bpoll_stream_seg_free(slab, seg);
+                }
+                return (errno = ENOMEM);
+            }
+            if (last != NULL)
+                last->next = seg;
+            else
+                head = seg;
+            last = seg;
+        } while (--nsegs);
+    }
+
+    if (space != 0) {
+        if (space > rem)
+            space = rem;
+        memcpy(tail->data + tail->len, p, space);
+        tail->len += (uint32_t)space;
+        p += space;
+        rem -= space;
+    }
+    for (seg = head; seg != NULL; seg = seg->next) {
+        const size_t n = rem < seg_sz ? rem : seg_sz;
+        memcpy(seg->data, p, n);
+        seg->len = (uint32_t)n;
+        p += n;
+        rem -= n;
+    }
+    if (head != NULL) {
+        if (tail != NULL)
+            tail->next = head;
+        else
+            wr->head = head;
+        wr->tail = last;
+    }
+    wr->bytes += len;
+
+    if (wr->bytes >= stream->wr_hiwat)
+        stream->state |= BPOLL_STREAM_WRFULL;
+    return 0;
+}
+
+
+__attribute_nonnull_x__((1))
+static int
+bpoll_stream_append_ref (bpoll_stream_t * const restrict stream,
+                         const uint32_t kind, const char * const buf,
+                         const int fd, const off_t offset, size_t len,
+                         bpoll_stream_fn_release_t fn_release, void *arg);
+static int
+bpoll_stream_append_ref (bpoll_stream_t * const restrict stream,
+                         const uint32_t kind, const char * const buf,
+                         const int fd, const off_t offset, size_t len,
+                         bpoll_stream_fn_release_t fn_release, void *arg)
+{
+    /* append one segment referencing data per BPOLL_STREAM_REF_MAX bytes
+     * (seg->len is uint32_t; fn_release() set only on last segment) */
+    #define BPOLL_STREAM_REF_MAX 0x40000000u
+    struct bpoll_stream_chain * const restrict wr = &stream->wr;
+    bpoll_stream_seg_t *head = NULL, *last = NULL, *seg;
+    size_t pos = 0;
+    const size_t total = len;
+
+    if (__builtin_expect( (stream->state & BPOLL_STREAM_ERR), 0))
+        return (errno = stream->err);
+    if (len == 0) {
+        if (fn_release != NULL)
+            fn_release(stream, arg);
+        return 0;
+    }
+
+    do {
+        struct bpoll_stream_ref *ref;
+        const size_t n = len < BPOLL_STREAM_REF_MAX ? len:BPOLL_STREAM_REF_MAX;
+        if (NULL == (seg = bpoll_stream_seg_alloc(stream->slab))) {
+            while (NULL != (seg = head)) {
+                head = seg->next;
+                bpoll_stream_seg_free(stream->slab, seg);
+            }
+            return (errno = ENOMEM);
+        }
+        seg->kind = kind;
+        seg->len  = (uint32_t)n;
+        ref = bpoll_stream_seg_ref(seg);
+        ref->fn_release = NULL;
+        ref->arg        = NULL;
+        ref->buf        = buf != NULL ? buf + pos : NULL;
+        ref->offset     = offset + (off_t)pos;
+        ref->fd         = fd;
+        ref->zerocopy   = 0;
+        ref->zc_seq     = 0;
+        if (last != NULL)
+            last->next = seg;
+        else
+            head = seg;
+        last = seg;
+        pos += n;
+        len -= n;
+    } while (len != 0);
+    bpoll_stream_seg_ref(last)->fn_release = fn_release;
+    bpoll_stream_seg_ref(last)->arg        = arg;
+    #undef BPOLL_STREAM_REF_MAX
+
+    if (wr->tail != NULL)
+        wr->tail->next = head;
+    else
+        wr->head = head;
+    wr->tail = last;
+    wr->bytes += total;
+
+    if (wr->bytes >= stream->wr_hiwat)
+        stream->state |= BPOLL_STREAM_WRFULL;
+    return 0;
+}
+
+
+int
+bpoll_stream_sendfile (bpoll_stream_t * const restrict stream,
+                       const int fd, const off_t offset, const size_t len,
+                       bpoll_stream_fn_release_t fn_release, void *arg)
+{
+    if (fd < 0 || offset < 0)
+        return (errno = EINVAL);
+    return bpoll_stream_append_ref(stream, BPOLL_STREAM_SEG_FILE, NULL,
+                                   fd, offset, len, fn_release, arg);
+}
+
+
+int
+bpoll_stream_write_ref (bpoll_stream_t * const restrict stream,
+                        const void * const buf, const size_t len,
+                        bpoll_stream_fn_release_t fn_release, void *arg)
+{
+    return bpoll_stream_append_ref(stream, BPOLL_STREAM_SEG_BUF,
+                                   (const char *)buf, -1, 0, len,
+                                   fn_release, arg);
+}
+
+
+int
+bpoll_stream_zerocopy (bpoll_stream_t * const restrict stream, const int on)
+{
+  #if HAS_ZEROCOPY
+    const int val = (on != 0);
+    if (stream->bpollelt->fdtype != BPOLL_FD_SOCKET)
+        return (errno = EINVAL);
+    if (val && 0 != setsockopt(stream->bpollelt->fd, SOL_SOCKET, SO_ZEROCOPY,
+                               &val, sizeof(val)))
+        return errno;
+    /* (buffers already sent with MSG_ZEROCOPY still complete through
+     *  error queue; stream->zerocopy 0 stops only new MSG_ZEROCOPY sends) */
+    stream->zerocopy = val ? 1 : (stream->zc.head != NULL ? 2 : 0);
+    return 0;
+  #else
+    (void)stream;
+    return on ? (errno = ENOSYS) : 0;
+  #endif
+}
+
+
+int
+bpoll_stream_flush (bpoll_stream_t * const restrict stream)
+{
+    int rc;
+    if (__builtin_expect( (stream->state & BPOLL_STREAM_ERR), 0))
+        return (errno = stream->err);
+    rc = bpoll_stream_drain(stream);
+    if ((stream->state & BPOLL_STREAM_WRFULL)
+        && stream->wr.bytes <= stream->wr_lowat)
+        stream->state &= ~BPOLL_STREAM_WRFULL;
+    bpoll_stream_rearm(stream);  /* arm BPOLLOUT only if output remains */
+    return rc != 0 ? (errno = rc) : 0;
+}
+
+
+#endif /* INCLUDED_BPOLL_STREAM_C */
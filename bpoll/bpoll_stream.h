@@ -0,0 +1,280 @@
+/*
+ * bpoll_stream - buffered non-blocking stream I/O layered on bpoll
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BPOLL_STREAM_H
+#define INCLUDED_BPOLL_STREAM_H
+
+#include "bpoll.h"
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint32_t */
+#include <sys/types.h>  /* off_t */
+#include <sys/uio.h>    /* struct iovec */
+
+/**
+ * @file bpoll_stream.h
+ * @brief buffered non-blocking stream I/O layered on bpoll
+ *
+ * Read and write buffers are chains of fixed-size segments taken from a
+ * per-bpollset slab (allocated in chunks with bpollset fn_mem_alloc()), and
+ * are filled and drained with readv() and writev() to amortize syscalls.
+ * BPOLLOUT is armed only while output is pending and cannot be written
+ * immediately.  BPOLLIN is disarmed while buffered input is at or above the
+ * read high watermark (backpressure on peer) and re-armed when consumed.
+ *
+ * Output may also reference data not copied into segments: file ranges sent
+ * with sendfile(), and large application buffers sent with MSG_ZEROCOPY (if
+ * enabled with bpoll_stream_zerocopy()).  These are queued in order with
+ * buffered output and the application is notified through a release callback
+ * when the kernel no longer references the data; MSG_ZEROCOPY completions are
+ * read from the socket error queue when bpollelt reports BPOLLERR.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** @see struct bpoll_stream_seg */
+typedef struct bpoll_stream_seg bpoll_stream_seg_t;
+
+/** buffer segment (data follows header; slab seg_sz bytes) */
+struct bpoll_stream_seg {
+    bpoll_stream_seg_t *next;
+    uint32_t off;               /**< offset of unconsumed data */
+    uint32_t len;               /**< offset of end of data */
+    uint32_t kind;              /**< BPOLL_STREAM_SEG_* */
+  #if !defined(__GNUC__) || __GNUC__-0 >= 3
+    char data[];  /* C99 VLA */
+  #else
+    char data[0];
+  #endif
+};
+
+/**
+ * @defgroup bpoll stream segment kinds
+ * (SEG_FILE and SEG_BUF segments hold struct bpoll_stream_ref in data, and
+ *  off and len then track progress through referenced data)
+ * @{
+ */
+enum {
+    BPOLL_STREAM_SEG_DATA = 0,  /**< data copied into segment */
+    BPOLL_STREAM_SEG_FILE = 1,  /**< file range; sendfile() */
+    BPOLL_STREAM_SEG_BUF  = 2   /**< application buffer; MSG_ZEROCOPY */
+};
+/** @} */
+
+/** @see struct bpoll_stream */
+typedef struct bpoll_stream bpoll_stream_t;
+
+/** release callback for data referenced by output (not copied) */
+typedef void (*bpoll_stream_fn_release_t)(bpoll_stream_t * restrict, void *);
+
+/** output referencing a file range or application buffer */
+struct bpoll_stream_ref {
+    bpoll_stream_fn_release_t fn_release;
+    void *arg;                  /**< passed to fn_release() */
+    const char *buf;            /**< SEG_BUF: application buffer */
+    off_t offset;               /**< SEG_FILE: file offset of seg->off */
+    int fd;                     /**< SEG_FILE: file descriptor */
+    int zerocopy;               /**< SEG_BUF: sent with MSG_ZEROCOPY */
+    uint32_t zc_seq;            /**< SEG_BUF: last MSG_ZEROCOPY send */
+};
+
+/** @see struct bpoll_stream_slab */
+typedef struct bpoll_stream_slab bpoll_stream_slab_t;
+
+/** per-bpollset pool of buffer segments */
+struct bpoll_stream_slab {
+    bpollset_t *bpollset;       /**< bpollset providing fn_mem_alloc() */
+    bpoll_stream_seg_t *free;   /**< free list of segments */
+    void *chunks;               /**< list of chunks allocated for segments */
+    size_t stride;              /**< segment header plus data, aligned */
+    uint32_t seg_sz;            /**< data bytes per segment */
+    uint32_t chunk_nsegs;       /**< segments per chunk allocation */
+    size_t nfree;               /**< number of segments on free list */
+    size_t nsegs;               /**< number of segments allocated */
+};
+
+/** chain of buffer segments */
+struct bpoll_stream_chain {
+    bpoll_stream_seg_t *head;
+    bpoll_stream_seg_t *tail;
+    size_t bytes;
+};
+
+/** buffered stream on a bpollelt (embed in bpollelt udata, if desired) */
+struct bpoll_stream {
+    bpollelt_t *bpollelt;
+    bpoll_stream_slab_t *slab;
+    struct bpoll_stream_chain rd;
+    struct bpoll_stream_chain wr;
+    struct bpoll_stream_chain zc; /**< sent MSG_ZEROCOPY awaiting completion */
+    size_t rd_hiwat;            /**< stop reading when rd.bytes >= rd_hiwat */
+    size_t wr_lowat;            /**< BPOLL_STREAM_WR when drained to lowat */
+    size_t wr_hiwat;            /**< bpoll_stream_wr_full() at wr_hiwat */
+    int state;                  /**< BPOLL_STREAM_* (latched) */
+    int err;                    /**< errno if BPOLL_STREAM_ERR */
+    int zerocopy;               /**< MSG_ZEROCOPY on (1); off, not idle (2) */
+    uint32_t zc_seq;            /**< next MSG_ZEROCOPY send sequence number */
+};
+
+/**
+ * @defgroup bpoll stream events (returned by bpoll_stream_event())
+ * @{
+ */
+enum {
+    BPOLL_STREAM_RD     = 1, /**< input buffered (bpoll_stream_read()) */
+    BPOLL_STREAM_WR     = 2, /**< output drained to wr_lowat after full */
+    BPOLL_STREAM_EOF    = 4, /**< peer closed (read returned 0) */
+    BPOLL_STREAM_ERR    = 8, /**< error (stream->err); stream disarmed */
+    BPOLL_STREAM_WRFULL = 16 /**< (private) output reached wr_hiwat */
+};
+/** @} */
+
+#define bpoll_stream_rd_bytes(stream) ((stream)->rd.bytes)
+#define bpoll_stream_wr_bytes(stream) ((stream)->wr.bytes)
+#define bpoll_stream_wr_full(stream) \
+  ((stream)->wr.bytes >= (stream)->wr_hiwat)
+
+
+/* create slab of seg_sz byte segments for streams in bpollset
+ * (segments are allocated chunk_nsegs at a time with bpollset fn_mem_alloc()
+ *  and are recycled through slab free list; not returned until destroy)
+ * (returns pointer to slab on success, NULL on failure and errno set) */
+__attribute_cold__
+__attribute_nonnull__
+__attribute_warn_unused_result__
+EXPORT extern bpoll_stream_slab_t *
+bpoll_stream_slab_create (bpollset_t * const restrict bpollset,
+                          const size_t seg_sz, const unsigned int chunk_nsegs);
+
+/* destroy slab (all streams using slab must have been cleared) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern void
+bpoll_stream_slab_destroy (bpoll_stream_slab_t * const restrict slab);
+
+/* initialize stream for bpollelt (already added to bpollset)
+ * (default watermarks: rd_hiwat 64k, wr_lowat 0, wr_hiwat 64k) */
+__attribute_nonnull__
+EXPORT extern void
+bpoll_stream_init (bpoll_stream_t * const restrict stream,
+                   bpoll_stream_slab_t * const restrict slab,
+                   bpollelt_t * const restrict bpollelt);
+
+/* release buffered data to slab (e.g. prior to bpoll_elt_remove())
+ * (fn_release() is called for referenced output not yet sent or completed) */
+__attribute_nonnull__
+EXPORT extern void
+bpoll_stream_clear (bpoll_stream_t * const restrict stream);
+
+/* set watermarks (0 rd_hiwat or wr_hiwat means unlimited) */
+__attribute_nonnull__
+EXPORT extern void
+bpoll_stream_watermarks (bpoll_stream_t * const restrict stream,
+                         const size_t rd_hiwat,
+                         const size_t wr_lowat, const size_t wr_hiwat);
+
+/* handle revents (bpollelt->revents) for stream bpollelt
+ * (call from fn_cb_event or results loop)
+ * BPOLLIN: readv() into read buffer until EAGAIN or rd_hiwat
+ *   (BPOLLET: at most bpoll_get_elt_budget() bytes (if > 0) per call; if more
+ *    input may remain, bpollelt is marked pending (bpoll_elt_mark_pending()))
+ * BPOLLOUT: writev() pending output
+ * BPOLLERR: read MSG_ZEROCOPY completions from socket error queue
+ * then adjust BPOLLIN/BPOLLOUT interest with bpoll_elt_modify() if changed
+ * (returns mask of BPOLL_STREAM_RD, BPOLL_STREAM_WR, BPOLL_STREAM_EOF,
+ *  BPOLL_STREAM_ERR) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_stream_event (bpoll_stream_t * const restrict stream, const int revents);
+
+/* copy up to len bytes of buffered input to buf and consume it
+ * (returns number of bytes copied) */
+__attribute_nonnull__
+EXPORT extern size_t
+bpoll_stream_read (bpoll_stream_t * const restrict stream,
+                   void * const restrict buf, const size_t len);
+
+/* fill iov with up to iovcnt segments of buffered input (no copy)
+ * (returns number of iov filled) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_stream_peek (bpoll_stream_t * const restrict stream,
+                   struct iovec * const restrict iov, const int iovcnt);
+
+/* consume len bytes of buffered input (e.g. after bpoll_stream_peek()) */
+__attribute_nonnull__
+EXPORT extern void
+bpoll_stream_consume (bpoll_stream_t * const restrict stream, size_t len);
+
+/* append len bytes from buf to output buffer (no syscall)
+ * (many small writes are coalesced and sent by bpoll_stream_flush())
+ * (all or nothing; data is not appended on error)
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_stream_write (bpoll_stream_t * const restrict stream,
+                    const void * const restrict buf, const size_t len);
+
+/* append file range to output; sent with sendfile() (no copy to user space)
+ * (fd must remain open until fn_release(stream, arg) is called, which is when
+ *  range has been sent, or from bpoll_stream_clear(); fn_release may be NULL)
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull_x__((1))
+EXPORT extern int
+bpoll_stream_sendfile (bpoll_stream_t * const restrict stream,
+                       const int fd, const off_t offset, const size_t len,
+                       bpoll_stream_fn_release_t fn_release, void *arg);
+
+/* append reference to application buffer to output (no copy)
+ * (sent with MSG_ZEROCOPY if enabled and len >= BPOLL_STREAM_ZC_MIN; buf must
+ *  not be modified or freed until fn_release(stream, arg) is called, which is
+ *  when kernel reports completion, or from bpoll_stream_clear())
+ * (returns 0 on success, else the value of errno) */
+__attribute_nonnull_x__((1,2))
+EXPORT extern int
+bpoll_stream_write_ref (bpoll_stream_t * const restrict stream,
+                        const void * const buf, const size_t len,
+                        bpoll_stream_fn_release_t fn_release, void *arg);
+
+/* enable (SO_ZEROCOPY) or disable MSG_ZEROCOPY for stream socket
+ * (MSG_ZEROCOPY is disabled automatically if kernel reports it copied data,
+ *  e.g. loopback, since completion notification is then only overhead)
+ * (returns 0 on success, else the value of errno; ENOSYS if unsupported) */
+__attribute_cold__
+__attribute_nonnull__
+EXPORT extern int
+bpoll_stream_zerocopy (bpoll_stream_t * const restrict stream, const int on);
+
+/* writev() pending output now; arm BPOLLOUT only if output remains
+ * (call once after handling BPOLL_STREAM_RD and writing responses)
+ * (returns 0 if output drained, EAGAIN if output remains, else errno) */
+__attribute_nonnull__
+EXPORT extern int
+bpoll_stream_flush (bpoll_stream_t * const restrict stream);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* ! INCLUDED_BPOLL_STREAM_H */
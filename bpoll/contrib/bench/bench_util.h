@@ -0,0 +1,108 @@
+/*
+ * bench_util.h - clock and latency histogram shared by benchbpoll-* programs
+ *
+ *
+ * Copyright (c) 2012, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Glue Logic LLC nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Latency histogram is log-linear: values < 16 exact, else 16 sub-buckets per
+ * power of 2 (values reported within ~6%).
+ */
+
+#ifndef INCLUDED_BENCH_UTIL_H
+#define INCLUDED_BENCH_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef CLOCK_MONOTONIC
+#define BENCH_CLOCK CLOCK_MONOTONIC
+#else
+#define BENCH_CLOCK CLOCK_REALTIME
+#endif
+
+/* latency histogram: values < 16 exact, else 16 sub-buckets per power of 2 */
+#define BENCH_HIST_SZ (61*16)
+
+__attribute__((unused))
+static uint64_t
+bench_now (void)
+{
+    struct timespec ts;
+    clock_gettime(BENCH_CLOCK, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+__attribute__((unused))
+static unsigned int
+bench_hist_idx (const uint64_t v)
+{
+    int b;
+    if (v < 16)
+        return (unsigned int)v;
+    b = 63 - __builtin_clzll(v);
+    return (unsigned int)((b - 3) * 16) + (unsigned int)((v >> (b - 4)) & 15);
+}
+
+__attribute__((unused))
+static uint64_t
+bench_hist_value (const unsigned int idx)
+{
+    /* (midpoint of bucket) */
+    unsigned int b;
+    if (idx < 16)
+        return idx;
+    b = idx / 16 + 3;
+    return ((uint64_t)(16 + idx % 16) << (b - 4)) + (((uint64_t)1<<(b-4)) >> 1);
+}
+
+/* print JSON members ", \"p50\": v, ..." for n values in hist
+ * (percentiles clamped to [min, max] of values recorded) */
+__attribute__((unused))
+static void
+bench_hist_print_pct (const uint64_t * const hist, const uint64_t n,
+                      const uint64_t min, const uint64_t max)
+{
+    static const double pct[] = { 50.0, 90.0, 99.0, 99.9 };
+    static const char * const pctname[] = { "p50","p90","p99","p999" };
+    uint64_t sum = 0;
+    unsigned int j = 0;
+    for (int i = 0; i < (int)(sizeof(pct)/sizeof(*pct)); ++i) {
+        uint64_t target = (uint64_t)(pct[i] / 100.0 * (double)n);
+        uint64_t v = 0;
+        if (target == 0)
+            target = 1;
+        while (j < BENCH_HIST_SZ && sum < target)
+            sum += hist[j++];
+        if (j != 0)
+            v = bench_hist_value(j-1);
+        if (v < min) v = min;
+        if (v > max) v = max;
+        printf(", \"%s\": %llu", pctname[i], (unsigned long long)v);
+    }
+}
+
+#endif /* INCLUDED_BENCH_UTIL_H */
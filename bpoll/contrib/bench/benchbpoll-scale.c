@@ -0,0 +1,589 @@
+/*
+ * benchbpoll-scale.c - grow one bpollset to 1M+ bpollelts; scaling report
+ *
+ * benchbpoll-scale.c grows a single bpollset decade by decade (10, 100, ...
+ * up to -n) and at each decade reports memory (RSS) per bpollelt, add and
+ * remove throughput, bpoll_elt_get() (bpoll_elt_fetch()) latency, and cost
+ * of bpoll_kernel() plus bpoll_process() as a function of nelts and nfound,
+ * as JSON, so that the point where bpollelts resizing, the mem block
+ * allocator, or the kernel mechanism stop scaling can be found and compared
+ * between releases.
+ *
+ *
+ * Copyright (c) 2012, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Glue Logic LLC nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * The first -a bpollelts are socketpairs (made ready by writing one byte to
+ * the other end); the rest are dup() of a pipe never written, so that 1M
+ * bpollelts need ~1M descriptors (socketpairs for all would need 2M, above
+ * the default Linux fs.nr_open).  At each decade:
+ *   rss_bytes, rss_per_elt - resident set size (Linux /proc/self/statm, else
+ *              getrusage() ru_maxrss), and growth per bpollelt since the
+ *              bpollset was created (user-space memory: bpollelts table,
+ *              mem blocks, kernel poll arrays; not kernel socket memory)
+ *   add        - bpoll_elt_init() plus bpoll_elt_add() per bpollelt added
+ *              since previous decade (including early commits each queue_sz
+ *              changes); add_commit is the final bpoll_flush_pending() per
+ *              bpollelt
+ *   remove     - bpoll_elt_remove() per bpollelt, and remove_commit
+ *              (kernel deregistration and close()) per bpollelt, measured
+ *              while shrinking from this decade to the previous
+ *   fetch      - bpoll_elt_get() of random descriptors in bpollset
+ *   kernel     - for nfound 0, 1, 10, ... (up to -a), median over -r rounds
+ *              of time in bpoll_kernel() (zero timeout) until nfound
+ *              bpollelts are returned (more than one call if nfound exceeds
+ *              queue_sz; bpoll_process() and callback read() not timed)
+ * bpollelts_sz and mem_chunk_alloc (with -DBPOLL_STATS=1 library) locate
+ * table resizes and mem block chunk allocations between decades.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+extern char *optarg;
+
+#include <bpoll/bpoll.h>
+
+#include "bench_util.h"
+
+/* bpoll_elt_get() calls timed at each decade */
+#define BENCH_FETCHES (1 << 20)
+
+/* nfound values measured (each up to -a and nelts) */
+#define BENCH_NFOUND_MAX 7
+
+static const struct bench_mech {
+    const char *name;
+    unsigned int mech;
+} bench_mechs[] = {
+    { "poll",    BPOLL_M_POLL    },
+    { "devpoll", BPOLL_M_DEVPOLL },
+    { "epoll",   BPOLL_M_EPOLL   },
+    { "kqueue",  BPOLL_M_KQUEUE  },
+    { "evport",  BPOLL_M_EVPORT  },
+    { "pollset", BPOLL_M_POLLSET }
+};
+
+struct bench_decade {
+    int nelts;
+    unsigned int bpollelts_sz;
+    uint64_t mem_chunk_alloc;
+    uint64_t rss;
+    double add_ns;
+    double add_commit_ns;
+    double remove_ns;
+    double remove_commit_ns;
+    double fetch_ns;
+    int nnfound;
+    int nfound[BENCH_NFOUND_MAX];
+    double kernel_ns[BENCH_NFOUND_MAX];
+};
+
+struct bench_scale {
+    bpollset_t *bpollset;
+    unsigned int mech;
+    int n;                    /* bpollelts at largest decade */
+    int nactive;              /* socketpairs (first nactive bpollelts) */
+    int nelts;                /* bpollelts currently in bpollset */
+    int reps;
+    unsigned int queue_sz;
+    unsigned int block_sz;
+    int *fds;                 /* fd of each bpollelt, in order added */
+    int *wfds;                /* write end of socketpair for each active */
+    int idle_pipe[2];
+    uint64_t rss_base;
+    uint64_t processed;       /* bpollelts processed by callback */
+    uint64_t errors;
+    int ndecades;
+    struct bench_decade decades[32];
+};
+
+
+static uint64_t
+bench_rss (void)
+{
+  #ifdef __linux__
+    unsigned long size, resident;
+    FILE * const fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+        const int rc = fscanf(fp, "%lu %lu", &size, &resident);
+        fclose(fp);
+        if (rc == 2)
+            return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+    }
+  #endif
+    {
+        /* (ru_maxrss is high-water mark; kilobytes on most platforms) */
+        struct rusage ru;
+        return getrusage(RUSAGE_SELF, &ru) == 0
+          ? (uint64_t)ru.ru_maxrss * 1024u
+          : 0;
+    }
+}
+
+static int
+bench_cmp_u64 (const void * const a, const void * const b)
+{
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void
+bench_cb_read (bpollset_t * const restrict bpollset,
+               bpollelt_t * const restrict bpollelt,
+               const int data  __attribute__((unused)))
+{
+    struct bench_scale * const restrict b = bpoll_get_vdata(bpollset);
+    char buf[64];
+    ssize_t r;
+    do {
+        r = read(bpollelt->fd, buf, sizeof(buf));
+    } while (r == -1 && errno == EINTR);
+    if (r <= 0)
+        ++b->errors;
+    ++b->processed;
+}
+
+
+/* create descriptors for bpollelts [b->nelts, nelts) (untimed) */
+static int
+bench_open (struct bench_scale * const restrict b, const int nelts)
+{
+    for (int i = b->nelts; i < nelts; ++i) {
+        if (i < b->nactive) {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+                return errno;
+            b->fds[i]  = sv[0];
+            b->wfds[i] = sv[1];
+        }
+        else if ((b->fds[i] = dup(b->idle_pipe[0])) == -1)
+            return errno;
+    }
+    return 0;
+}
+
+static int
+bench_grow (struct bench_scale * const restrict b,
+            struct bench_decade * const restrict d)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    const int n = d->nelts - b->nelts;
+    uint64_t t0, t1, t2;
+    int rc;
+    if ((rc = bench_open(b, d->nelts)) != 0)
+        return rc;
+    t0 = bench_now();
+    for (int i = b->nelts; i < d->nelts; ++i) {
+        bpollelt_t * const bpollelt =
+          bpoll_elt_init(bpollset, NULL, b->fds[i],
+                         i < b->nactive ? BPOLL_FD_SOCKET : BPOLL_FD_PIPE,
+                         BPOLL_FL_CLOSE);
+        if (bpollelt == NULL || bpoll_elt_add(bpollset, bpollelt, BPOLLIN) != 0)
+            return errno;
+    }
+    t1 = bench_now();
+    if (bpoll_flush_pending(bpollset) != 0)
+        return errno;
+    t2 = bench_now();
+    b->nelts = d->nelts;
+    d->add_ns        = (double)(t1 - t0) / n;
+    d->add_commit_ns = (double)(t2 - t1) / n;
+    return 0;
+}
+
+static int
+bench_shrink (struct bench_scale * const restrict b,
+              struct bench_decade * const restrict d, const int nelts)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    const int n = b->nelts - nelts;
+    uint64_t t0, t1, t2;
+    t0 = bench_now();
+    for (int i = b->nelts - 1; i >= nelts; --i) {
+        if (bpoll_elt_remove_by_fd(bpollset, b->fds[i]) != 0)
+            return errno;
+    }
+    t1 = bench_now();
+    if (bpoll_flush_pending(bpollset) != 0)  /* (BPOLL_FL_CLOSE) */
+        return errno;
+    t2 = bench_now();
+    for (int i = nelts; i < b->nelts; ++i) {
+        b->fds[i] = -1;
+        if (i < b->nactive) {
+            close(b->wfds[i]);
+            b->wfds[i] = -1;
+        }
+    }
+    b->nelts = nelts;
+    d->remove_ns        = (double)(t1 - t0) / n;
+    d->remove_commit_ns = (double)(t2 - t1) / n;
+    return 0;
+}
+
+static void
+bench_fetch (struct bench_scale * const restrict b,
+             struct bench_decade * const restrict d)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    const int * const fds = b->fds;
+    const uint32_t n = (uint32_t)b->nelts;
+    uint32_t x = 2463534242u;  /* (xorshift32) */
+    uintptr_t sink = 0;
+    uint64_t t0, t1;
+    t0 = bench_now();
+    for (int i = 0; i < BENCH_FETCHES; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        sink ^= (uintptr_t)bpoll_elt_get(bpollset, fds[x % n]);
+    }
+    t1 = bench_now();
+    if (sink == 0 && n > 1)  /* (keep loop; (improbable) xor of pointers) */
+        ++b->errors;
+    d->fetch_ns = (double)(t1 - t0) / BENCH_FETCHES;
+}
+
+static int
+bench_kernel (struct bench_scale * const restrict b,
+              struct bench_decade * const restrict d)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    const int nactive = b->nelts < b->nactive ? b->nelts : b->nactive;
+    uint64_t * const samples = calloc((size_t)b->reps, sizeof(uint64_t));
+    if (samples == NULL)
+        return errno;
+    d->nnfound = 0;
+    for (int nfound = 0; nfound <= nactive && d->nnfound < BENCH_NFOUND_MAX;
+         nfound = nfound ? nfound * 10 : 1) {
+        for (int r = 0; r < b->reps; ++r) {
+            uint64_t t0;
+            for (int i = 0; i < nfound; ++i) {
+                if (write(b->wfds[i], "e", 1) != 1)
+                    ++b->errors;
+            }
+            b->processed = 0;
+            samples[r] = 0;
+            do {
+                /* (callback read() is not timed) */
+                t0 = bench_now();
+                if (bpoll_kernel(bpollset, bpoll_timespec(bpollset)) < 0) {
+                    free(samples);
+                    return errno;
+                }
+                samples[r] += bench_now() - t0;
+                bpoll_process(bpollset);
+            } while (b->processed < (uint64_t)nfound);
+        }
+        qsort(samples, (size_t)b->reps, sizeof(uint64_t), bench_cmp_u64);
+        d->nfound[d->nnfound]    = nfound;
+        d->kernel_ns[d->nnfound] = (double)samples[b->reps / 2];
+        ++d->nnfound;
+    }
+    free(samples);
+    return 0;
+}
+
+
+static int
+bench_setup (struct bench_scale * const restrict b)
+{
+    const unsigned int limit = (unsigned int)b->n + 16;
+    b->fds  = malloc((size_t)b->n * sizeof(int));
+    b->wfds = malloc(((size_t)b->nactive + 1) * sizeof(int));
+    if (b->fds == NULL || b->wfds == NULL)
+        return errno;
+    for (int i = 0; i < b->n; ++i)
+        b->fds[i] = -1;
+    for (int i = 0; i < b->nactive; ++i)
+        b->wfds[i] = -1;
+    if (pipe(b->idle_pipe) != 0)
+        return errno;
+    /* (baseline after bench arrays are resident; includes bpoll_init()) */
+    b->rss_base = bench_rss();
+    b->bpollset = bpoll_create(b, bench_cb_read, NULL, NULL, NULL);
+    if (b->bpollset == NULL)
+        return errno;
+    if (bpoll_init(b->bpollset, b->mech, limit, b->queue_sz, b->block_sz) != 0)
+        return errno;
+    b->mech = b->bpollset->mech;
+    bpoll_timespec_from_msec(b->bpollset, 0);
+    return 0;
+}
+
+static void
+bench_teardown (struct bench_scale * const restrict b)
+{
+    /* (bpoll_destroy() closes BPOLL_FL_CLOSE descriptors) */
+    if (b->bpollset != NULL)
+        bpoll_destroy(b->bpollset);
+    if (b->wfds != NULL) {
+        for (int i = 0; i < b->nactive; ++i) {
+            if (b->wfds[i] != -1)
+                close(b->wfds[i]);
+        }
+    }
+    if (b->fds != NULL) {
+        for (int i = b->nelts; i < b->n; ++i) {
+            if (b->fds[i] != -1)  /* (opened, not added) */
+                close(b->fds[i]);
+        }
+    }
+    free(b->fds);
+    free(b->wfds);
+    if (b->idle_pipe[0] != -1) close(b->idle_pipe[0]);
+    if (b->idle_pipe[1] != -1) close(b->idle_pipe[1]);
+}
+
+static int
+bench_scale_run (struct bench_scale * const restrict b)
+{
+    bpoll_stats_t stats;
+    int rc, i;
+
+    b->ndecades = 0;
+    for (int nelts = 10; ; nelts = nelts < b->n / 10 ? nelts * 10 : b->n) {
+        if (nelts > b->n)
+            nelts = b->n;
+        b->decades[b->ndecades++].nelts = nelts;
+        if (nelts == b->n)
+            break;
+    }
+
+    if ((rc = bench_setup(b)) != 0)
+        return rc;
+    for (i = 0; i < b->ndecades; ++i) {
+        struct bench_decade * const d = b->decades+i;
+        if ((rc = bench_grow(b, d)) != 0)
+            return rc;
+        d->rss = bench_rss();
+        d->bpollelts_sz = b->bpollset->bpollelts_sz;
+        d->mem_chunk_alloc = bpoll_stats_get(b->bpollset, &stats) == 0
+          ? stats.mem_chunk_alloc
+          : 0;
+        bench_fetch(b, d);
+        if ((rc = bench_kernel(b, d)) != 0)
+            return rc;
+    }
+    while (i-- > 0) {
+        if ((rc = bench_shrink(b, b->decades+i,
+                               i ? b->decades[i-1].nelts : 0)) != 0)
+            return rc;
+    }
+    return 0;
+}
+
+
+static const char *
+bench_mech_name (const unsigned int mech)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(bench_mechs)/sizeof(*bench_mechs); ++i) {
+        if (bench_mechs[i].mech == mech)
+            return bench_mechs[i].name;
+    }
+    return "default";
+}
+
+/* raise RLIMIT_NOFILE for -n (reduce -n if limit can not be raised) */
+static void
+bench_rlimit (int * const restrict n, const int nactive)
+{
+    const rlim_t overhead = 64;
+    const rlim_t need = (rlim_t)*n + (rlim_t)nactive + overhead;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur >= need)
+        return;
+    rl.rlim_cur = need;
+    if (rl.rlim_max < need) {
+        rl.rlim_max = need;  /* (succeeds if privileged) */
+        if (setrlimit(RLIMIT_NOFILE, &rl) == 0)
+            return;
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+        getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < need) {
+        const int orig = *n;
+        const rlim_t avail = rl.rlim_cur > overhead + (rlim_t)nactive
+          ? rl.rlim_cur - overhead - (rlim_t)nactive
+          : 0;
+        *n = (int)avail;
+        fprintf(stderr, "RLIMIT_NOFILE %lu too low; -n %d reduced to %d\n",
+                (unsigned long)rl.rlim_cur, orig, *n);
+    }
+}
+
+static void
+bench_print (const struct bench_scale * const restrict b, const int rc,
+             const int first)
+{
+    printf("%s\n    {\"mech\": \"%s\", ", first ? "" : ",",
+           bench_mech_name(b->mech));
+    if (rc != 0) {
+        printf("\"error\": \"%s\"}", strerror(rc));
+        return;
+    }
+    printf("\"queue_sz\": %u, \"block_sz\": %u, \"nactive\": %d, "
+           "\"reps\": %d, \"errors\": %llu, \"decades\": [",
+           b->queue_sz, b->block_sz, b->nactive, b->reps,
+           (unsigned long long)b->errors);
+    for (int i = 0; i < b->ndecades; ++i) {
+        const struct bench_decade * const d = b->decades+i;
+        const uint64_t rss = d->rss > b->rss_base ? d->rss - b->rss_base : 0;
+        printf("%s\n      {\"nelts\": %d, \"bpollelts_sz\": %u, "
+               "\"mem_chunk_alloc\": %llu, \"rss_bytes\": %llu, "
+               "\"rss_per_elt\": %.1f,\n       \"add_ns\": %.1f, "
+               "\"add_commit_ns\": %.1f, \"remove_ns\": %.1f, "
+               "\"remove_commit_ns\": %.1f, \"fetch_ns\": %.2f,\n       "
+               "\"kernel_ns\": {",
+               i ? "," : "", d->nelts, d->bpollelts_sz,
+               (unsigned long long)d->mem_chunk_alloc,
+               (unsigned long long)d->rss, (double)rss / d->nelts,
+               d->add_ns, d->add_commit_ns, d->remove_ns,
+               d->remove_commit_ns, d->fetch_ns);
+        for (int j = 0; j < d->nnfound; ++j)
+            printf("%s\"%d\": %.0f", j ? ", " : "",
+                   d->nfound[j], d->kernel_ns[j]);
+        printf("}}");
+    }
+    printf("\n    ]}");
+}
+
+
+static void
+usage (const char * const prog)
+{
+    fprintf(stderr,
+      "usage: %s [-m mech] [-n num] [-a active] [-q queue_sz] [-b block_sz]\n"
+      "       [-r reps]\n"
+      "  -m  poll, devpoll, epoll, kqueue, evport, pollset, default,\n"
+      "      or all (each mechanism supported)          (default all)\n"
+      "  -n  bpollelts at largest decade                (default 1000000)\n"
+      "  -a  socketpairs (max nfound)                   (default 1000)\n"
+      "  -q  bpoll_init() queue_sz                      (default 512)\n"
+      "  -b  bpoll_init() block_sz                      (default 0)\n"
+      "  -r  rounds per nfound (median reported)        (default 16)\n",
+      prog);
+    exit(1);
+}
+
+int
+main (const int argc, char ** const argv)
+{
+    struct bench_scale b;
+    unsigned int mechs = 0, supported = bpoll_mechanisms();
+    int n = 1000000, nactive = 1000, reps = 16, first = 1, c;
+    unsigned int queue_sz = 512, block_sz = 0;
+
+    while ((c = getopt(argc, argv, "m:n:a:q:b:r:h")) != -1) {
+        switch (c) {
+          case 'm':
+            if (0 == strcmp(optarg, "all"))
+                mechs = supported;
+            else if (0 == strcmp(optarg, "default"))
+                mechs |= 1u << 31; /* (BPOLL_M_NOT_SET) */
+            else {
+                unsigned int i = 0;
+                while (i < sizeof(bench_mechs)/sizeof(*bench_mechs)
+                       && 0 != strcmp(optarg, bench_mechs[i].name))
+                    ++i;
+                if (i == sizeof(bench_mechs)/sizeof(*bench_mechs))
+                    usage(argv[0]);
+                if (!(supported & bench_mechs[i].mech)) {
+                    fprintf(stderr, "%s: mechanism not supported\n", optarg);
+                    return 1;
+                }
+                mechs |= bench_mechs[i].mech;
+            }
+            break;
+          case 'n': if ((n = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'a': if ((nactive = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'q': queue_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'b': block_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'r': if ((reps = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          default:  usage(argv[0]);
+        }
+    }
+    if (mechs == 0)
+        mechs = supported;
+    bench_rlimit(&n, nactive);
+    if (nactive > n)
+        nactive = n;
+    if (n < 1)
+        return 1;
+
+    printf("{\"bench\": \"benchbpoll-scale\", \"n\": %d, \"results\": [", n);
+    for (unsigned int i = 0; i <= sizeof(bench_mechs)/sizeof(*bench_mechs);
+         ++i) {
+        pid_t pid;
+        int rc;
+        memset(&b, 0, sizeof(b));
+        if (i == sizeof(bench_mechs)/sizeof(*bench_mechs)) {
+            if (!(mechs & (1u << 31)))
+                break;
+            b.mech = BPOLL_M_NOT_SET;
+        }
+        else if (mechs & bench_mechs[i].mech)
+            b.mech = bench_mechs[i].mech;
+        else
+            continue;
+        b.n        = n;
+        b.nactive  = nactive;
+        b.reps     = reps;
+        b.queue_sz = queue_sz;
+        b.block_sz = block_sz;
+        b.idle_pipe[0] = b.idle_pipe[1] = -1;
+        /* (each mechanism in child process so that RSS is not retained
+         *  from a previous run) */
+        fflush(stdout);
+        if ((pid = fork()) == 0) {
+            rc = bench_scale_run(&b);
+            bench_print(&b, rc, first);
+            bench_teardown(&b);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid == -1 || waitpid(pid, &rc, 0) != pid
+            || !WIFEXITED(rc) || WEXITSTATUS(rc) != 0)
+            return perror("fork"), 1;
+        first = 0;
+    }
+    printf("\n]}\n");
+    return 0;
+}
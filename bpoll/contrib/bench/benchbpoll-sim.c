@@ -0,0 +1,355 @@
+/*
+ * benchbpoll-sim.c - microbenchmark of bpoll bookkeeping (BPOLL_M_SIM)
+ *
+ * benchbpoll-sim.c runs bpoll against the simulated kernel mechanism
+ * (BPOLL_M_SIM; see bpoll_sim_ready()), which keeps interest set and readiness
+ * in user space, so that the cost of bpoll itself (bpollelt alloc and free,
+ * fd table, pending change list, rmlist, results and callback dispatch) is
+ * measured without syscalls or kernel variance.  No descriptors are opened.
+ *
+ *
+ * Copyright (c) 2012, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Glue Logic LLC nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Operations (each repetition runs all, in order, on a new bpollset):
+ *   add      - bpoll_elt_init() and bpoll_elt_add() n bpollelts, then commit
+ *   modify   - bpoll_elt_modify() each bpollelt (toggle BPOLLOUT), then commit
+ *   ready    - make ready -a bpollelts at a time, then bpoll_kernel() and
+ *              bpoll_process() (callback) until none ready; per event
+ *   results  - as ready, but bpoll_process() fills results list (no callback)
+ *              and results are iterated; per event
+ *   dispatch - as ready, with BPOLLDISPATCH; callback re-arms; per event
+ *   churn    - bpoll_elt_remove() one bpollelt and add another (new fd),
+ *              committing each queue_sz; per remove and add pair
+ *   remove   - bpoll_elt_remove() each bpollelt, then commit (frees)
+ * Reported per operation: min and median over repetitions of ns per op, and
+ * of cycles per op (x86 rdtsc; reference cycles, not core cycles).
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+extern char *optarg;
+
+#include <bpoll/bpoll.h>
+
+#include "bench_util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_CYCLES() __builtin_ia32_rdtsc()
+#define BENCH_HAS_CYCLES 1
+#else
+#define BENCH_CYCLES() 0
+#define BENCH_HAS_CYCLES 0
+#endif
+
+enum bench_op {
+    BENCH_ADD = 0,
+    BENCH_MODIFY,
+    BENCH_READY,
+    BENCH_RESULTS,
+    BENCH_DISPATCH,
+    BENCH_CHURN,
+    BENCH_REMOVE,
+    BENCH_NOPS
+};
+
+static const char * const bench_op_names[] = {
+    "add", "modify", "ready", "results", "dispatch", "churn", "remove"
+};
+
+struct bench_sim {
+    bpollset_t *bpollset;
+    bpollelt_t **elts;
+    int n;
+    int active;
+    unsigned int queue_sz;
+    unsigned int block_sz;
+    int fd_next;              /* next fd for churn (n .. 2n-1) */
+    int rearm;                /* dispatch: callback re-arms */
+    uint64_t events;          /* events delivered to callback */
+};
+
+
+static void
+bench_cb (bpollset_t * const bpollset, bpollelt_t * const bpollelt,
+          const int data  __attribute__((unused)))
+{
+    struct bench_sim * const b = bpoll_get_vdata(bpollset);
+    ++b->events;
+    if (b->rearm)
+        bpoll_elt_modify(bpollset, bpollelt, bpollelt->events);
+}
+
+static int
+bench_setup (struct bench_sim * const b, const int results)
+{
+    b->bpollset = bpoll_create(b, results ? NULL : bench_cb, NULL, NULL, NULL);
+    if (b->bpollset == NULL)
+        return errno;
+    if (0 != bpoll_init(b->bpollset, BPOLL_M_SIM, (unsigned int)b->n*2+8,
+                        b->queue_sz, b->block_sz)) {
+        const int rc = errno;
+        bpoll_destroy(b->bpollset);
+        return rc;
+    }
+    bpoll_timespec_from_msec(b->bpollset, 0);
+    b->fd_next = b->n;
+    b->rearm   = 0;
+    b->events  = 0;
+    return 0;
+}
+
+static uint64_t
+bench_add (struct bench_sim * const b)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    for (int i = 0; i < b->n; ++i) {
+        b->elts[i] = bpoll_elt_init(bpollset, NULL, i, BPOLL_FD_SOCKET,
+                                    BPOLL_FL_ZERO);
+        if (b->elts[i] == NULL
+            || 0 != bpoll_elt_add(bpollset, b->elts[i], BPOLLIN))
+            return 0;
+    }
+    return 0 == bpoll_flush_pending(bpollset) ? (uint64_t)b->n : 0;
+}
+
+static uint64_t
+bench_modify (struct bench_sim * const b)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    for (int i = 0; i < b->n; ++i) {
+        if (0 != bpoll_elt_modify(bpollset, b->elts[i],
+                                  b->elts[i]->events ^ BPOLLOUT))
+            return 0;
+    }
+    return 0 == bpoll_flush_pending(bpollset) ? (uint64_t)b->n : 0;
+}
+
+static uint64_t
+bench_ready (struct bench_sim * const b, const int results)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    uint64_t nevents = 0;
+    int nfound;
+    b->events = 0;
+    for (int i = 0; i < b->n; i += b->active) {
+        const int m = b->n - i < b->active ? b->n - i : b->active;
+        for (int j = 0; j < m; ++j)
+            bpoll_sim_ready(bpollset, b->elts[i+j]->fd, BPOLLIN);
+        while ((nfound = bpoll_kernel(bpollset, bpoll_timespec(bpollset))) > 0){
+            bpoll_process(bpollset);
+            if (results) {
+                bpollelt_t ** const restrict r = bpoll_get_results(bpollset);
+                for (int j = 0; j < nfound; ++j)
+                    nevents += (r[j]->revents != 0);
+            }
+        }
+        if (nfound < 0)
+            return 0;
+    }
+    return results ? nevents : b->events;
+}
+
+static uint64_t
+bench_churn (struct bench_sim * const b)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    for (int i = 0; i < b->n; ++i) {
+        if (0 != bpoll_elt_remove(bpollset, b->elts[i]))
+            return 0;
+        b->elts[i] = bpoll_elt_init(bpollset, NULL, b->fd_next++,
+                                    BPOLL_FD_SOCKET, BPOLL_FL_ZERO);
+        if (b->elts[i] == NULL
+            || 0 != bpoll_elt_add(bpollset, b->elts[i], BPOLLIN))
+            return 0;
+        if ((unsigned int)i % b->queue_sz == b->queue_sz - 1
+            && 0 != bpoll_flush_pending(bpollset))
+            return 0;
+    }
+    return 0 == bpoll_flush_pending(bpollset) ? (uint64_t)b->n : 0;
+}
+
+static uint64_t
+bench_remove (struct bench_sim * const b)
+{
+    bpollset_t * const bpollset = b->bpollset;
+    for (int i = 0; i < b->n; ++i) {
+        if (0 != bpoll_elt_remove(bpollset, b->elts[i]))
+            return 0;
+    }
+    return 0 == bpoll_flush_pending(bpollset) ? (uint64_t)b->n : 0;
+}
+
+static uint64_t
+bench_op (struct bench_sim * const b, const int op)
+{
+    switch (op) {
+      case BENCH_ADD:      return bench_add(b);
+      case BENCH_MODIFY:   return bench_modify(b);
+      case BENCH_READY:    return bench_ready(b, 0);
+      case BENCH_RESULTS:  return bench_ready(b, 1);
+      case BENCH_DISPATCH: return bench_ready(b, 0);
+      case BENCH_CHURN:    return bench_churn(b);
+      case BENCH_REMOVE:   return bench_remove(b);
+      default:             return 0;
+    }
+}
+
+static int
+bench_setup_op (struct bench_sim * const b, const int op)
+{
+    /* (untimed) BENCH_RESULTS runs on separate bpollset without callback;
+     * BENCH_DISPATCH re-arms all with BPOLLDISPATCH */
+    if (op == BENCH_RESULTS || op == BENCH_DISPATCH) {
+        bpoll_destroy(b->bpollset);
+        if (0 != bench_setup(b, op == BENCH_RESULTS) || 0 == bench_add(b))
+            return -1;
+    }
+    if (op == BENCH_DISPATCH) {
+        b->rearm = 1;
+        for (int i = 0; i < b->n; ++i)
+            bpoll_elt_modify(b->bpollset, b->elts[i], BPOLLIN|BPOLLDISPATCH);
+        if (0 != bpoll_flush_pending(b->bpollset))
+            return -1;
+    }
+    else
+        b->rearm = 0;
+    return 0;
+}
+
+static int
+bench_cmp (const void * const x, const void * const y)
+{
+    const double a = *(const double *)x, c = *(const double *)y;
+    return a < c ? -1 : a > c;
+}
+
+static void
+usage (const char * const prog)
+{
+    fprintf(stderr,
+      "usage: %s [-n num] [-a active] [-q queue_sz] [-b block_sz] [-r reps]\n"
+      "  -n  bpollelts                                  (default 100000)\n"
+      "  -a  bpollelts made ready at a time             (default 64)\n"
+      "  -q  bpoll_init() queue_sz                      (default 512)\n"
+      "  -b  bpoll_init() block_sz                      (default 0)\n"
+      "  -r  repetitions (min and median reported)      (default 9)\n",
+      prog);
+    exit(1);
+}
+
+int
+main (const int argc, char ** const argv)
+{
+    struct bench_sim b;
+    double *ns, *cy;
+    uint64_t ops[BENCH_NOPS];
+    int reps = 9, c;
+
+    memset(&b, 0, sizeof(b));
+    b.n = 100000;
+    b.active = 64;
+    b.queue_sz = 512;
+
+    while ((c = getopt(argc, argv, "n:a:q:b:r:h")) != -1) {
+        switch (c) {
+          case 'n': if ((b.n = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'a': if ((b.active = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'q': b.queue_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'b': b.block_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'r': if ((reps = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          default:  usage(argv[0]);
+        }
+    }
+    if (b.queue_sz == 0 || b.queue_sz > (unsigned int)b.n*2+8)
+        b.queue_sz = (unsigned int)b.n*2+8;
+
+    b.elts = malloc((size_t)b.n * sizeof(*b.elts));
+    ns = malloc((size_t)reps * BENCH_NOPS * sizeof(double));
+    cy = malloc((size_t)reps * BENCH_NOPS * sizeof(double));
+    if (b.elts == NULL || ns == NULL || cy == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    for (int r = 0; r < reps; ++r) {
+        if (0 != (errno = bench_setup(&b, 0))) {
+            perror("bpoll_init BPOLL_M_SIM");
+            return 1;
+        }
+        for (int op = 0; op < BENCH_NOPS; ++op) {
+            uint64_t t0, t1, c0, c1;
+            if (0 != bench_setup_op(&b, op)) {
+                fprintf(stderr, "%s: setup failed\n", bench_op_names[op]);
+                return 1;
+            }
+            t0 = bench_now();
+            c0 = BENCH_CYCLES();
+            ops[op] = bench_op(&b, op);
+            c1 = BENCH_CYCLES();
+            t1 = bench_now();
+            if (ops[op] == 0) {
+                fprintf(stderr, "%s: %s\n", bench_op_names[op],strerror(errno));
+                return 1;
+            }
+            ns[op*reps+r] = (double)(t1 - t0) / (double)ops[op];
+            cy[op*reps+r] = (double)(c1 - c0) / (double)ops[op];
+        }
+        bpoll_destroy(b.bpollset);
+    }
+
+    printf("{\"bench\": \"benchbpoll-sim\", \"n\": %d, \"active\": %d, "
+           "\"queue_sz\": %u, \"block_sz\": %u, \"reps\": %d, \"results\": [",
+           b.n, b.active, b.queue_sz, b.block_sz, reps);
+    for (int op = 0; op < BENCH_NOPS; ++op) {
+        qsort(ns+op*reps, (size_t)reps, sizeof(double), bench_cmp);
+        qsort(cy+op*reps, (size_t)reps, sizeof(double), bench_cmp);
+        printf("%s\n    {\"op\": \"%s\", \"ops\": %llu, "
+               "\"ns_per_op_min\": %.2f, \"ns_per_op_median\": %.2f",
+               op ? "," : "", bench_op_names[op], (unsigned long long)ops[op],
+               ns[op*reps], ns[op*reps+reps/2]);
+        if (BENCH_HAS_CYCLES)
+            printf(", \"cycles_per_op_min\": %.1f, "
+                   "\"cycles_per_op_median\": %.1f",
+                   cy[op*reps], cy[op*reps+reps/2]);
+        printf("}");
+    }
+    printf("\n]}\n");
+
+    free(cy);
+    free(ns);
+    free(b.elts);
+    return 0;
+}
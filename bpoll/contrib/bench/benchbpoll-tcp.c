@@ -0,0 +1,967 @@
+/*
+ * benchbpoll-tcp.c - loopback TCP echo server and load generator using bpoll
+ *
+ * benchbpoll-tcp.c exercises the accept(), connect() and TCP paths over
+ * 127.0.0.1 (benchbpoll-v3 uses only pipes and socketpairs).  Echo server
+ * threads and load generator threads each run their own bpollset, and results
+ * are emitted as JSON so that results can be compared between releases.
+ *
+ *
+ * Copyright (c) 2012, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Glue Logic LLC nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Server: listening socket is added to the bpollset of each server thread;
+ *   accepted connections are read into a per-connection buffer and written
+ *   back (interest switches to BPOLLOUT while echo is blocked).
+ * Client: each connection is connect()ed non-blocking (connect latency is
+ *   from connect() until writable) and, once all are connected, keeps -P
+ *   requests of -s bytes in flight; latency is from queueing a request until
+ *   its echo is completely read (responses arrive in order on a stream).
+ * Latency percentiles are from a log-linear histogram (16 sub-buckets per
+ * power of 2; values reported within ~6%).
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+extern char *optarg;
+
+#include <bpoll/bpoll.h>
+
+#include "bench_util.h"
+
+/* server per-connection echo buffer; client read and write chunk */
+#define BENCH_BUFSZ 4096
+
+/* reads or writes per callback before yielding to other connections */
+#define BENCH_BUDGET 16
+
+/* seconds allowed for all client connections to be established */
+#define BENCH_CONNECT_SECS 10
+
+enum bench_mode {
+    BENCH_BOTH = 0,
+    BENCH_SERVER_ONLY,
+    BENCH_CLIENT_ONLY
+};
+
+enum bench_kind {
+    BENCH_LISTENER = 0,
+    BENCH_SERVER,
+    BENCH_CLIENT
+};
+
+static const struct bench_mech {
+    const char *name;
+    unsigned int mech;
+} bench_mechs[] = {
+    { "poll",    BPOLL_M_POLL    },
+    { "devpoll", BPOLL_M_DEVPOLL },
+    { "epoll",   BPOLL_M_EPOLL   },
+    { "kqueue",  BPOLL_M_KQUEUE  },
+    { "evport",  BPOLL_M_EVPORT  },
+    { "pollset", BPOLL_M_POLLSET }
+};
+
+struct bench_run;
+struct bench_thread;
+
+struct bench_lat {
+    uint64_t n;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t hist[BENCH_HIST_SZ];
+};
+
+struct bench_conn {
+    struct bench_thread *thr;
+    int kind;
+    bpollelt_t *bpollelt;     /* client: NULL once removed */
+    uint64_t t_connect;       /* client: non-zero while connect in progress */
+    uint64_t *t0;             /* client: ring of -P request send times */
+    unsigned int head;        /* client: oldest request in flight */
+    unsigned int inflight;    /* client: requests in flight */
+    size_t rcvd;              /* client: bytes of oldest response received */
+    size_t sendq;             /* client: bytes queued and not yet written */
+    unsigned int inlen;       /* server: bytes in buf */
+    unsigned int outoff;      /* server: bytes of buf echoed */
+    char *buf;                /* server: echo buffer (BENCH_BUFSZ) */
+};
+
+struct bench_thread {
+    pthread_t tid;
+    struct bench_run *run;
+    bpollset_t *bpollset;
+    struct bench_conn listener;   /* server */
+    struct bench_conn *conns;     /* client */
+    uint64_t *t0s;                /* client: conns[i].t0 storage */
+    int nconns;                   /* client: connections to open */
+    int nconnecting;              /* client: connect in progress */
+    int nconnected;               /* client: connections established */
+    int rc;                       /* errno if setup failed */
+    unsigned int mech;
+    uint64_t t_end;
+    uint64_t requests;            /* client: echoes completely read */
+    uint64_t accepted;            /* server */
+    uint64_t bytes;               /* server: bytes echoed */
+    uint64_t errors;
+    struct bench_lat lat;         /* client: request latency */
+    struct bench_lat lat_connect; /* client: connect latency */
+    char rbuf[BENCH_BUFSZ];       /* client: responses (discarded) */
+};
+
+struct bench_run {
+    int mode;
+    unsigned int mech;
+    int nthreads;
+    int nconns;               /* total client connections */
+    unsigned int pipeline;    /* requests in flight per connection */
+    size_t msg_sz;
+    unsigned int queue_sz;
+    unsigned int block_sz;
+    double duration;
+    int lfd;
+    struct sockaddr_in addr;
+    char *msg;                /* request bytes (min(msg_sz, BENCH_BUFSZ)) */
+    size_t msg_chunk;
+    int stop;                 /* clients stop sending requests */
+    int server_stop;
+    pthread_barrier_t barrier;
+};
+
+
+static void
+bench_lat (struct bench_lat * const restrict lat,
+           const uint64_t t0, const uint64_t t1)
+{
+    const uint64_t d = t1 - t0;
+    ++lat->n;
+    lat->sum += d;
+    if (d < lat->min)
+        lat->min = d;
+    if (d > lat->max)
+        lat->max = d;
+    ++lat->hist[bench_hist_idx(d)];
+}
+
+static void
+bench_lat_merge (struct bench_lat * const restrict lat,
+                 const struct bench_lat * const restrict from)
+{
+    lat->n   += from->n;
+    lat->sum += from->sum;
+    if (lat->min > from->min)
+        lat->min = from->min;
+    if (lat->max < from->max)
+        lat->max = from->max;
+    for (unsigned int j = 0; j < BENCH_HIST_SZ; ++j)
+        lat->hist[j] += from->hist[j];
+}
+
+static void
+bench_lat_print (const char * const name,
+                 const struct bench_lat * const restrict lat)
+{
+    const uint64_t lat_min = lat->n ? lat->min : 0;
+    printf("\"%s\": {\"min\": %llu, \"mean\": %llu", name,
+           (unsigned long long)lat_min,
+           (unsigned long long)(lat->n ? lat->sum / lat->n : 0));
+    bench_hist_print_pct(lat->hist, lat->n, lat_min, lat->max);
+    printf(", \"max\": %llu}", (unsigned long long)lat->max);
+}
+
+static int
+bench_sock_opts (const int fd)
+{
+    const int one = 1;
+    const int fl = fcntl(fd, F_GETFL);
+    if (fl == -1 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) != 0)
+        return errno;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0
+      ? 0
+      : errno;
+}
+
+static void
+bench_cb_close (bpollset_t * const restrict bpollset
+                  __attribute__((unused)),
+                bpollelt_t * const restrict bpollelt)
+{
+    struct bench_conn * const restrict c = bpollelt->udata;
+    while (close(bpollelt->fd) == -1 && errno == EINTR) ;
+    if (c != NULL && c->kind == BENCH_SERVER)
+        free(c);
+}
+
+
+/* server: accept connections and add each to this thread's bpollset */
+static void
+bench_accept (struct bench_thread * const restrict thr, const int lfd)
+{
+    bpollset_t * const bpollset = thr->bpollset;
+    for (int n = 0; n < BENCH_BUDGET; ++n) {
+        struct bench_conn *c;
+        bpollelt_t *bpollelt;
+        const int fd = accept(lfd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK
+                && errno != ECONNABORTED)
+                ++thr->errors;
+            return;
+        }
+        if (bench_sock_opts(fd) != 0
+            || (c = malloc(sizeof(struct bench_conn) + BENCH_BUFSZ)) == NULL) {
+            ++thr->errors;
+            close(fd);
+            continue;
+        }
+        memset(c, 0, sizeof(struct bench_conn));
+        c->thr  = thr;
+        c->kind = BENCH_SERVER;
+        c->buf  = (char *)(c+1);
+        bpollelt = bpoll_elt_init(bpollset, NULL, fd,
+                                  BPOLL_FD_SOCKET, BPOLL_FL_CLOSE);
+        if (bpollelt == NULL) {
+            ++thr->errors;
+            free(c);
+            close(fd);
+            continue;
+        }
+        bpollelt->udata = c;
+        if (bpoll_elt_add(bpollset, bpollelt, BPOLLIN) != 0) {
+            /* (add fails before bpollelt is entered in bpollset) */
+            ++thr->errors;
+            bpollelt->udata = NULL;
+            bpoll_elt_destroy(bpollset, bpollelt);
+            free(c);
+            close(fd);
+            continue;
+        }
+        ++thr->accepted;
+    }
+}
+
+/* server: echo what is read; BPOLLOUT interest only while echo is blocked */
+static void
+bench_cb_server (bpollset_t * const restrict bpollset,
+                 bpollelt_t * const restrict bpollelt,
+                 const int data  __attribute__((unused)))
+{
+    struct bench_conn * const restrict c = bpollelt->udata;
+    struct bench_thread * const restrict thr = c->thr;
+    const int fd = bpollelt->fd;
+    ssize_t n;
+    int events;
+    if (c->kind == BENCH_LISTENER) {
+        bench_accept(thr, fd);
+        return;
+    }
+    for (int i = 0; i < BENCH_BUDGET; ++i) {
+        if (c->outoff < c->inlen) {
+            n = write(fd, c->buf + c->outoff, c->inlen - c->outoff);
+            if (n > 0) {
+                c->outoff += (unsigned int)n;
+                thr->bytes += (uint64_t)n;
+                continue;
+            }
+        }
+        else {
+            c->inlen = c->outoff = 0;
+            n = read(fd, c->buf, BENCH_BUFSZ);
+            if (n > 0) {
+                c->inlen = (unsigned int)n;
+                continue;
+            }
+            if (n == 0) {  /* EOF */
+                bpoll_elt_remove(bpollset, bpollelt);
+                return;
+            }
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            /* (client closing with echo unread resets connection) */
+            if (errno != ECONNRESET && errno != EPIPE)
+                ++thr->errors;
+            bpoll_elt_remove(bpollset, bpollelt);
+            return;
+        }
+        break;
+    }
+    events = c->outoff < c->inlen ? BPOLLOUT : BPOLLIN;
+    if (bpollelt->events != events
+        && bpoll_elt_modify(bpollset, bpollelt, events) != 0) {
+        ++thr->errors;
+        bpoll_elt_remove(bpollset, bpollelt);
+    }
+}
+
+
+static void
+bench_client_close (struct bench_conn * const restrict c)
+{
+    bpoll_elt_remove(c->thr->bpollset, c->bpollelt);
+    c->bpollelt = NULL;
+    c->inflight = 0;
+    c->sendq = 0;
+}
+
+/* client: write queued requests; BPOLLOUT interest only while blocked */
+static void
+bench_client_send (struct bench_conn * const restrict c)
+{
+    struct bench_thread * const restrict thr = c->thr;
+    struct bench_run * const run = thr->run;
+    bpollelt_t * const bpollelt = c->bpollelt;
+    int events;
+    while (c->sendq) {
+        const ssize_t w = write(bpollelt->fd, run->msg,
+                                c->sendq < run->msg_chunk
+                                  ? c->sendq
+                                  : run->msg_chunk);
+        if (w > 0)
+            c->sendq -= (size_t)w;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else if (errno != EINTR) {
+            ++thr->errors;
+            bench_client_close(c);
+            return;
+        }
+    }
+    events = c->sendq ? BPOLLIN|BPOLLOUT : BPOLLIN;
+    if (bpollelt->events != events
+        && bpoll_elt_modify(thr->bpollset, bpollelt, events) != 0) {
+        ++thr->errors;
+        bench_client_close(c);
+    }
+}
+
+static void
+bench_client_queue (struct bench_conn * const restrict c, const uint64_t now)
+{
+    const unsigned int pipeline = c->thr->run->pipeline;
+    c->t0[(c->head + c->inflight) % pipeline] = now;
+    ++c->inflight;
+    c->sendq += c->thr->run->msg_sz;
+}
+
+static void
+bench_client_connected (struct bench_conn * const restrict c)
+{
+    struct bench_thread * const restrict thr = c->thr;
+    bench_lat(&thr->lat_connect, c->t_connect, bench_now());
+    c->t_connect = 0;
+    --thr->nconnecting;
+    ++thr->nconnected;
+}
+
+/* client: complete connect; read echoes, queueing a new request for each */
+static void
+bench_cb_client (bpollset_t * const restrict bpollset,
+                 bpollelt_t * const restrict bpollelt,
+                 const int data  __attribute__((unused)))
+{
+    struct bench_conn * const restrict c = bpollelt->udata;
+    struct bench_thread * const restrict thr = c->thr;
+    struct bench_run * const run = thr->run;
+    const int fd = bpollelt->fd;
+
+    if (c->t_connect != 0) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+            err = errno;
+        if (err == 0 && bpoll_elt_modify(bpollset, bpollelt, BPOLLIN) == 0)
+            bench_client_connected(c);
+        else {
+            ++thr->errors;
+            --thr->nconnecting;
+            bench_client_close(c);
+        }
+        return;
+    }
+
+    if (bpollelt->revents & ~BPOLLOUT) {
+        for (int i = 0; i < BENCH_BUDGET; ++i) {
+            const ssize_t r = read(fd, thr->rbuf, sizeof(thr->rbuf));
+            if (r > 0) {
+                uint64_t now = 0;
+                c->rcvd += (size_t)r;
+                while (c->rcvd >= run->msg_sz && c->inflight) {
+                    if (now == 0)
+                        now = bench_now();
+                    c->rcvd -= run->msg_sz;
+                    bench_lat(&thr->lat, c->t0[c->head], now);
+                    c->head = (c->head + 1) % run->pipeline;
+                    --c->inflight;
+                    ++thr->requests;
+                    if (!__atomic_load_n(&run->stop, __ATOMIC_RELAXED))
+                        bench_client_queue(c, now);
+                }
+                if ((size_t)r < sizeof(thr->rbuf))
+                    break;
+            }
+            else if (r == -1 && errno == EINTR)
+                continue;
+            else if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            else {  /* (EOF or error) */
+                ++thr->errors;
+                bench_client_close(c);
+                return;
+            }
+        }
+    }
+    bench_client_send(c);
+}
+
+
+static int
+bench_server_setup (struct bench_thread * const restrict thr)
+{
+    struct bench_run * const run = thr->run;
+    bpollelt_t *bpollelt;
+    /* (any thread may accept any connection; removed bpollelts count against
+     *  limit until next flush) */
+    const unsigned int limit = (unsigned int)run->nconns * 2 + 16;
+    thr->bpollset = bpoll_create(thr, bench_cb_server, bench_cb_close,
+                                 NULL, NULL);
+    if (thr->bpollset == NULL)
+        return errno;
+    if (bpoll_init(thr->bpollset, run->mech, limit,
+                   run->queue_sz, run->block_sz) != 0)
+        return errno;
+    thr->mech = thr->bpollset->mech;
+    bpoll_timespec_from_msec(thr->bpollset, 100);
+    thr->listener.thr  = thr;
+    thr->listener.kind = BENCH_LISTENER;
+    /* (listening socket shared by server threads; closed by main()) */
+    bpollelt = bpoll_elt_init(thr->bpollset, NULL, run->lfd,
+                              BPOLL_FD_SOCKET, BPOLL_FL_ZERO);
+    if (bpollelt == NULL)
+        return errno;
+    bpollelt->udata = &thr->listener;
+    if (bpoll_elt_add(thr->bpollset, bpollelt, BPOLLIN) != 0)
+        return errno;
+    return bpoll_flush_pending(thr->bpollset) == 0 ? 0 : errno;
+}
+
+static void *
+bench_server_main (void * const arg)
+{
+    struct bench_thread * const restrict thr = arg;
+    struct bench_run * const run = thr->run;
+    thr->rc = bench_server_setup(thr);
+    pthread_barrier_wait(&run->barrier);
+    while (thr->rc == 0
+           && !__atomic_load_n(&run->server_stop, __ATOMIC_RELAXED)) {
+        if (bpoll_poll(thr->bpollset, bpoll_timespec(thr->bpollset)) == -1
+            && errno != EINTR) {
+            ++thr->errors;
+            break;
+        }
+    }
+    thr->t_end = bench_now();
+    /* (bpoll_destroy() closes accepted connections and frees bench_conn) */
+    if (thr->bpollset != NULL)
+        bpoll_destroy(thr->bpollset);
+    return NULL;
+}
+
+static int
+bench_client_open (struct bench_thread * const restrict thr,
+                   struct bench_conn * const restrict c)
+{
+    struct bench_run * const run = thr->run;
+    int rc;
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return errno;
+    if ((rc = bench_sock_opts(fd)) != 0) {
+        close(fd);
+        return rc;
+    }
+    c->bpollelt = bpoll_elt_init(thr->bpollset, NULL, fd,
+                                 BPOLL_FD_SOCKET, BPOLL_FL_CLOSE);
+    if (c->bpollelt == NULL) {
+        rc = errno;
+        close(fd);
+        return rc;
+    }
+    c->bpollelt->udata = c;
+    c->t_connect = bench_now();
+    if (connect(fd, (struct sockaddr *)&run->addr, sizeof(run->addr)) == 0)
+        rc = BPOLLIN;
+    else if (errno == EINPROGRESS)
+        rc = BPOLLOUT;
+    else {
+        rc = errno;
+        c->bpollelt->udata = NULL;
+        bpoll_elt_destroy(thr->bpollset, c->bpollelt);
+        c->bpollelt = NULL;
+        close(fd);
+        return rc;
+    }
+    if (bpoll_elt_add(thr->bpollset, c->bpollelt, rc) != 0) {
+        rc = errno;
+        c->bpollelt->udata = NULL;
+        bpoll_elt_destroy(thr->bpollset, c->bpollelt);
+        c->bpollelt = NULL;
+        close(fd);
+        return rc;
+    }
+    ++thr->nconnecting;
+    if (rc == BPOLLIN)  /* (loopback connect may complete immediately) */
+        bench_client_connected(c);
+    return 0;
+}
+
+static int
+bench_client_setup (struct bench_thread * const restrict thr)
+{
+    struct bench_run * const run = thr->run;
+    uint64_t deadline;
+    thr->bpollset = bpoll_create(thr, bench_cb_client, bench_cb_close,
+                                 NULL, NULL);
+    if (thr->bpollset == NULL)
+        return errno;
+    if (bpoll_init(thr->bpollset, run->mech, (unsigned int)thr->nconns + 8,
+                   run->queue_sz, run->block_sz) != 0)
+        return errno;
+    thr->mech = thr->bpollset->mech;
+    bpoll_timespec_from_msec(thr->bpollset, 100);
+
+    thr->conns = calloc((size_t)thr->nconns + 1, sizeof(struct bench_conn));
+    thr->t0s = calloc((size_t)thr->nconns * run->pipeline, sizeof(uint64_t));
+    if (thr->conns == NULL || thr->t0s == NULL)
+        return errno;
+    for (int i = 0; i < thr->nconns; ++i) {
+        struct bench_conn * const c = thr->conns+i;
+        c->thr  = thr;
+        c->kind = BENCH_CLIENT;
+        c->t0   = thr->t0s + (size_t)i * run->pipeline;
+        if (bench_client_open(thr, c) != 0)
+            ++thr->errors;
+    }
+
+    /* establish connections before timing starts */
+    deadline = bench_now() + BENCH_CONNECT_SECS * 1000000000ull;
+    while (thr->nconnecting > 0 && bench_now() < deadline) {
+        if (bpoll_poll(thr->bpollset, bpoll_timespec(thr->bpollset)) == -1
+            && errno != EINTR)
+            return errno;
+    }
+    if (thr->nconnecting > 0) {
+        thr->errors += (uint64_t)thr->nconnecting;
+        for (int i = 0; i < thr->nconns; ++i) {
+            if (thr->conns[i].bpollelt != NULL && thr->conns[i].t_connect)
+                bench_client_close(thr->conns+i);
+        }
+        thr->nconnecting = 0;
+    }
+    return thr->nconnected > 0 ? 0 : ECONNREFUSED;
+}
+
+static void *
+bench_client_main (void * const arg)
+{
+    struct bench_thread * const restrict thr = arg;
+    struct bench_run * const run = thr->run;
+    bpollset_t *bpollset;
+    thr->rc = bench_client_setup(thr);
+    pthread_barrier_wait(&run->barrier);
+    bpollset = thr->bpollset;
+    if (thr->rc == 0) {
+        const uint64_t now = bench_now();
+        for (int i = 0; i < thr->nconns; ++i) {
+            struct bench_conn * const c = thr->conns+i;
+            if (c->bpollelt == NULL)
+                continue;
+            for (unsigned int j = 0; j < run->pipeline; ++j)
+                bench_client_queue(c, now);
+            bench_client_send(c);
+        }
+        while (!__atomic_load_n(&run->stop, __ATOMIC_RELAXED)) {
+            if (bpoll_poll(bpollset, bpoll_timespec(bpollset)) == -1
+                && errno != EINTR) {
+                ++thr->errors;
+                break;
+            }
+        }
+    }
+    thr->t_end = bench_now();
+    /* (bpoll_destroy() closes client connections) */
+    if (bpollset != NULL)
+        bpoll_destroy(bpollset);
+    free(thr->conns);
+    free(thr->t0s);
+    return NULL;
+}
+
+
+static const char *
+bench_mech_name (const unsigned int mech)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(bench_mechs)/sizeof(*bench_mechs); ++i) {
+        if (bench_mechs[i].mech == mech)
+            return bench_mechs[i].name;
+    }
+    return "default";
+}
+
+/* raise RLIMIT_NOFILE for connections (reduce run->nconns if not possible) */
+static void
+bench_rlimit (struct bench_run * const restrict run)
+{
+    const rlim_t overhead = (rlim_t)run->nthreads * 16 + 64;
+    const rlim_t per = run->mode == BENCH_BOTH ? 2 : 1;
+    const rlim_t need = (rlim_t)run->nconns * per + overhead;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur >= need)
+        return;
+    rl.rlim_cur = need;
+    if (rl.rlim_max < need) {
+        rl.rlim_max = need;  /* (succeeds if privileged) */
+        if (setrlimit(RLIMIT_NOFILE, &rl) == 0)
+            return;
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+        getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < need) {
+        const int n = run->nconns;
+        const rlim_t avail = rl.rlim_cur > overhead ? rl.rlim_cur-overhead : 0;
+        run->nconns = (int)(avail / per);
+        if (run->nconns < run->nthreads)
+            run->nconns = run->nthreads;
+        fprintf(stderr, "RLIMIT_NOFILE %lu too low; -c %d reduced to %d\n",
+                (unsigned long)rl.rlim_cur, n, run->nconns);
+    }
+}
+
+static int
+bench_listen (struct bench_run * const restrict run)
+{
+    const int one = 1;
+    socklen_t len = sizeof(run->addr);
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return perror("socket"), -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&run->addr, sizeof(run->addr)) != 0
+        || listen(fd, SOMAXCONN) != 0
+        || getsockname(fd, (struct sockaddr *)&run->addr, &len) != 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    run->lfd = fd;
+    return 0;
+}
+
+static int
+bench_run (struct bench_run * const restrict run, const int first)
+{
+    const int nservers = run->mode != BENCH_CLIENT_ONLY ? run->nthreads : 0;
+    const int nclients = run->mode != BENCH_SERVER_ONLY ? run->nthreads : 0;
+    struct bench_thread ** const thrs =
+      calloc((size_t)(nservers + nclients), sizeof(struct bench_thread *));
+    struct bench_lat *lat, *lat_connect;
+    uint64_t t_start, t_end = 0, requests = 0, errors = 0;
+    uint64_t accepted = 0, bytes = 0;
+    int i, rc = 0, nconnected = 0;
+    unsigned int mech = run->mech;
+    struct timespec ts;
+
+    if (thrs == NULL
+        || (lat = calloc(2, sizeof(struct bench_lat))) == NULL)
+        return perror("calloc"), -1;
+    lat_connect = lat+1;
+    lat->min = lat_connect->min = UINT64_MAX;
+
+    run->lfd = -1;
+    if (nservers && bench_listen(run) != 0)
+        return -1;
+    run->stop = run->server_stop = 0;
+
+    /* (servers run until clients are done; barrier: servers setup, then
+     *  clients connected, each time with main thread) */
+    for (int pass = 0; pass < 2; ++pass) {
+        const int nthr = pass == 0 ? nservers : nclients;
+        if (nthr == 0)
+            continue;
+        if (pthread_barrier_init(&run->barrier, NULL,
+                                 (unsigned int)nthr + 1) != 0)
+            return perror("pthread_barrier_init"), -1;
+        for (i = 0; i < nthr; ++i) {
+            struct bench_thread * const thr =
+              thrs[pass == 0 ? i : nservers + i] =
+                calloc(1, sizeof(struct bench_thread));
+            if (thr == NULL)
+                return perror("calloc"), -1;
+            thr->run = run;
+            thr->lat.min = thr->lat_connect.min = UINT64_MAX;
+            thr->nconns = run->nconns / run->nthreads
+                        + (i < run->nconns % run->nthreads);
+            if (pthread_create(&thr->tid, NULL, pass == 0
+                                 ? bench_server_main
+                                 : bench_client_main, thr) != 0)
+                return perror("pthread_create"), -1;
+        }
+        pthread_barrier_wait(&run->barrier);
+        pthread_barrier_destroy(&run->barrier);
+    }
+    if (run->mode == BENCH_SERVER_ONLY)
+        fprintf(stderr, "listening on 127.0.0.1:%u\n",
+                (unsigned int)ntohs(run->addr.sin_port));
+
+    t_start = bench_now();
+    ts.tv_sec  = (time_t)run->duration;
+    ts.tv_nsec = (long)((run->duration - (double)ts.tv_sec) * 1000000000.0);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) ;
+    __atomic_store_n(&run->stop, 1, __ATOMIC_RELAXED);
+
+    for (i = nservers; i < nservers + nclients; ++i) {
+        struct bench_thread * const thr = thrs[i];
+        pthread_join(thr->tid, NULL);
+        if (thr->rc != 0 && rc == 0)
+            rc = thr->rc;
+        if (i == nservers)
+            mech = thr->mech;
+        if (t_end < thr->t_end)
+            t_end = thr->t_end;
+        nconnected += thr->nconnected;
+        requests   += thr->requests;
+        errors     += thr->errors;
+        bench_lat_merge(lat, &thr->lat);
+        bench_lat_merge(lat_connect, &thr->lat_connect);
+        free(thr);
+    }
+    __atomic_store_n(&run->server_stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < nservers; ++i) {
+        struct bench_thread * const thr = thrs[i];
+        pthread_join(thr->tid, NULL);
+        if (thr->rc != 0 && rc == 0)
+            rc = thr->rc;
+        if (i == 0)
+            mech = thr->mech;
+        if (nclients == 0 && t_end < thr->t_end)
+            t_end = thr->t_end;
+        accepted += thr->accepted;
+        bytes    += thr->bytes;
+        errors   += thr->errors;
+        free(thr);
+    }
+    free(thrs);
+    if (run->lfd != -1)
+        close(run->lfd);
+
+    printf("%s\n    {\"mech\": \"%s\", ", first ? "" : ",",
+           bench_mech_name(mech));
+    if (rc != 0) {
+        printf("\"error\": \"%s\"}", strerror(rc));
+        free(lat);
+        return 0;
+    }
+    {
+        const double secs = (double)(t_end - t_start) / 1000000000.0;
+        printf("\"threads\": %d, \"queue_sz\": %u, \"block_sz\": %u, "
+               "\"conns\": %d, \"pipeline\": %u, \"msg_sz\": %lu,\n     "
+               "\"duration_sec\": %.3f, ",
+               run->nthreads, run->queue_sz, run->block_sz, run->nconns,
+               run->pipeline, (unsigned long)run->msg_sz, secs);
+        if (nservers)
+            printf("\"accepted\": %llu, \"echo_bytes\": %llu, ",
+                   (unsigned long long)accepted, (unsigned long long)bytes);
+        if (nclients)
+            printf("\"connected\": %d, \"requests\": %llu, "
+                   "\"requests_per_sec\": %.0f, ", nconnected,
+                   (unsigned long long)requests,
+                   secs > 0.0 ? requests / secs : 0.0);
+        printf("\"errors\": %llu", (unsigned long long)errors);
+        if (nclients) {
+            printf(",\n     ");
+            bench_lat_print("connect_ns", lat_connect);
+            printf(",\n     ");
+            bench_lat_print("latency_ns", lat);
+        }
+        printf("}");
+    }
+    free(lat);
+    return 0;
+}
+
+
+static void
+usage (const char * const prog)
+{
+    fprintf(stderr,
+      "usage: %s [-S | -C] [-p port] [-m mech] [-t threads] [-c conns]\n"
+      "       [-P pipeline] [-s msg_sz] [-q queue_sz] [-b block_sz]"
+      " [-d seconds]\n"
+      "  -S  echo server only (127.0.0.1; ephemeral port unless -p)\n"
+      "  -C  load generator only (connect to 127.0.0.1 -p port)\n"
+      "      (default: both, in one process)\n"
+      "  -p  port                                       (default 0)\n"
+      "  -m  poll, devpoll, epoll, kqueue, evport, pollset, default,\n"
+      "      or all (each mechanism supported)          (default all)\n"
+      "  -t  server threads and client threads, each\n"
+      "      with own bpollset                          (default 1)\n"
+      "  -c  client connections, total                  (default 100)\n"
+      "  -P  requests in flight per connection          (default 1)\n"
+      "  -s  request (and echo) size in bytes           (default 64)\n"
+      "  -q  bpoll_init() queue_sz                      (default 512)\n"
+      "  -b  bpoll_init() block_sz                      (default 0)\n"
+      "  -d  duration of each run in seconds            (default 2)\n",
+      prog);
+    exit(1);
+}
+
+int
+main (const int argc, char ** const argv)
+{
+    struct bench_run run;
+    unsigned int mechs = 0, supported = bpoll_mechanisms();
+    int first = 1, c;
+
+    memset(&run, 0, sizeof(run));
+    run.mode     = BENCH_BOTH;
+    run.nthreads = 1;
+    run.nconns   = 100;
+    run.pipeline = 1;
+    run.msg_sz   = 64;
+    run.queue_sz = 512;
+    run.block_sz = 0;
+    run.duration = 2.0;
+    run.addr.sin_family      = AF_INET;
+    run.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    while ((c = getopt(argc, argv, "SCp:m:t:c:P:s:q:b:d:h")) != -1) {
+        switch (c) {
+          case 'S': run.mode = BENCH_SERVER_ONLY; break;
+          case 'C': run.mode = BENCH_CLIENT_ONLY; break;
+          case 'p': {
+                      const long port = strtol(optarg, NULL, 10);
+                      if (port < 0 || port > 65535) usage(argv[0]);
+                      run.addr.sin_port = htons((unsigned short)port);
+                    }
+                    break;
+          case 'm':
+            if (0 == strcmp(optarg, "all"))
+                mechs = supported;
+            else if (0 == strcmp(optarg, "default"))
+                mechs |= 1u << 31; /* (BPOLL_M_NOT_SET) */
+            else {
+                unsigned int i = 0;
+                while (i < sizeof(bench_mechs)/sizeof(*bench_mechs)
+                       && 0 != strcmp(optarg, bench_mechs[i].name))
+                    ++i;
+                if (i == sizeof(bench_mechs)/sizeof(*bench_mechs))
+                    usage(argv[0]);
+                if (!(supported & bench_mechs[i].mech)) {
+                    fprintf(stderr, "%s: mechanism not supported\n", optarg);
+                    return 1;
+                }
+                mechs |= bench_mechs[i].mech;
+            }
+            break;
+          case 't': if ((run.nthreads = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'c': if ((run.nconns = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'P': if ((run.pipeline = (unsigned int)strtoul(optarg, NULL, 10))
+                        == 0) usage(argv[0]);
+                    break;
+          case 's': if ((run.msg_sz = strtoul(optarg, NULL, 10)) == 0)
+                        usage(argv[0]);
+                    break;
+          case 'q': run.queue_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'b': run.block_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'd': if ((run.duration = strtod(optarg, NULL)) <= 0.0)
+                        usage(argv[0]);
+                    break;
+          default:  usage(argv[0]);
+        }
+    }
+    if (run.mode == BENCH_CLIENT_ONLY && run.addr.sin_port == 0)
+        usage(argv[0]);
+    signal(SIGPIPE, SIG_IGN);  /* (EPIPE instead) */
+    if (mechs == 0)
+        mechs = supported;
+    if (run.nconns < run.nthreads)
+        run.nconns = run.nthreads;
+    bench_rlimit(&run);
+
+    run.msg_chunk = run.msg_sz < BENCH_BUFSZ ? run.msg_sz : BENCH_BUFSZ;
+    if ((run.msg = malloc(run.msg_chunk)) == NULL)
+        return perror("malloc"), 1;
+    memset(run.msg, 'e', run.msg_chunk);
+
+    printf("{\"bench\": \"benchbpoll-tcp\", \"mode\": \"%s\", \"results\": [",
+           run.mode == BENCH_BOTH ? "both"
+           : run.mode == BENCH_SERVER_ONLY ? "server" : "client");
+    for (unsigned int i = 0; i <= sizeof(bench_mechs)/sizeof(*bench_mechs);
+         ++i) {
+        if (i == sizeof(bench_mechs)/sizeof(*bench_mechs)) {
+            if (!(mechs & (1u << 31)))
+                break;
+            run.mech = BPOLL_M_NOT_SET;
+        }
+        else if (mechs & bench_mechs[i].mech)
+            run.mech = bench_mechs[i].mech;
+        else
+            continue;
+        if (bench_run(&run, first) != 0)
+            return 1;
+        first = 0;
+        fflush(stdout);
+    }
+    printf("\n]}\n");
+    free(run.msg);
+    return 0;
+}
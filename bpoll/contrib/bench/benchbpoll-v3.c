@@ -0,0 +1,735 @@
+/*
+ * benchbpoll-v3.c - multi-threaded benchmark suite for bpoll mechanisms
+ *
+ * benchbpoll-v3.c is self-contained (does not use libev) and selects event
+ * mechanism, scenario, thread count, queue_sz, and block_sz at runtime, and
+ * emits results as JSON so that results can be compared between releases.
+ *
+ *
+ * Copyright (c) 2012, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Glue Logic LLC nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Scenarios (each thread runs its own bpollset with its own share of fds):
+ *   pingpong - pipe pairs; each byte read is written to the other pipe;
+ *              latency is round trip (two hops through the event loop)
+ *   fanout   - socketpairs; each round writes one byte to every socketpair;
+ *              latency is from start of round until byte is read
+ *   churn    - socketpairs created, added, read once, and removed (closed);
+ *              latency is from socketpair() until byte is read
+ *   idle     - many idle descriptors (dup() of a pipe never written) plus a
+ *              few active socketpairs (default 0.1%) run as in fanout
+ * Latency percentiles are from a log-linear histogram (16 sub-buckets per
+ * power of 2; values reported within ~6%).
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+extern char *optarg;
+
+#include <bpoll/bpoll.h>
+
+#include "bench_util.h"
+
+enum bench_scenario {
+    BENCH_PINGPONG = 0,
+    BENCH_FANOUT,
+    BENCH_CHURN,
+    BENCH_IDLE,
+    BENCH_NSCENARIOS
+};
+
+static const char * const bench_scenario_names[] = {
+    "pingpong", "fanout", "churn", "idle"
+};
+
+static const struct bench_mech {
+    const char *name;
+    unsigned int mech;
+} bench_mechs[] = {
+    { "poll",    BPOLL_M_POLL    },
+    { "devpoll", BPOLL_M_DEVPOLL },
+    { "epoll",   BPOLL_M_EPOLL   },
+    { "kqueue",  BPOLL_M_KQUEUE  },
+    { "evport",  BPOLL_M_EVPORT  },
+    { "pollset", BPOLL_M_POLLSET }
+};
+
+struct bench_run;
+struct bench_thread;
+
+struct bench_conn {
+    struct bench_thread *thr;
+    int rfd, wfd;             /* pipe or socketpair */
+    int rfd2, wfd2;           /* pingpong return pipe */
+    uint64_t t0;
+};
+
+struct bench_thread {
+    pthread_t tid;
+    struct bench_run *run;
+    bpollset_t *bpollset;
+    struct bench_conn *conns;
+    int n;                    /* descriptors in bpollset */
+    int nconns;               /* pingpong pairs or active socketpairs */
+    int nrecv;                /* fanout, idle: bytes read this round */
+    int idle_pipe[2];
+    int rc;                   /* errno if setup failed */
+    unsigned int mech;
+    uint64_t t_round;
+    uint64_t t_end;
+    uint64_t ops;
+    uint64_t errors;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_sum;
+    uint64_t hist[BENCH_HIST_SZ];
+};
+
+struct bench_run {
+    int scenario;
+    unsigned int mech;
+    int nthreads;
+    int n;                    /* total descriptors (or pairs); see usage */
+    int nactive;              /* idle: total active socketpairs */
+    unsigned int queue_sz;
+    unsigned int block_sz;
+    double duration;
+    int stop;
+    pthread_barrier_t barrier;
+};
+
+
+static void
+bench_lat (struct bench_thread * const restrict thr,
+           const uint64_t t0, const uint64_t t1)
+{
+    const uint64_t d = t1 - t0;
+    ++thr->ops;
+    thr->lat_sum += d;
+    if (d < thr->lat_min)
+        thr->lat_min = d;
+    if (d > thr->lat_max)
+        thr->lat_max = d;
+    ++thr->hist[bench_hist_idx(d)];
+}
+
+static int
+bench_write1 (const int fd)
+{
+    ssize_t w;
+    do {
+        w = write(fd, "e", 1);
+    } while (w == -1 && errno == EINTR);
+    return w == 1 ? 0 : -1;
+}
+
+static int
+bench_read (const int fd)
+{
+    char buf[64];
+    ssize_t r;
+    do {
+        r = read(fd, buf, sizeof(buf));
+    } while (r == -1 && errno == EINTR);
+    return (int)r;
+}
+
+
+/* pingpong: read from pipe a, write to pipe b; read from pipe b, write to a */
+static void
+bench_cb_pingpong (bpollset_t * const restrict bpollset,
+                   bpollelt_t * const restrict bpollelt,
+                   const int data  __attribute__((unused)))
+{
+    struct bench_conn * const restrict c = bpollelt->udata;
+    struct bench_thread * const restrict thr = c->thr;
+    if (bench_read(bpollelt->fd) <= 0) {
+        ++thr->errors;
+        bpoll_elt_remove(bpollset, bpollelt);
+        return;
+    }
+    if (bpollelt->fd == c->rfd) {
+        if (bench_write1(c->wfd2) != 0)
+            ++thr->errors;
+    }
+    else {
+        const uint64_t now = bench_now();
+        bench_lat(thr, c->t0, now);
+        c->t0 = now;
+        if (bench_write1(c->wfd) != 0)
+            ++thr->errors;
+    }
+}
+
+/* fanout, idle: read one byte written at start of round */
+static void
+bench_cb_round (bpollset_t * const restrict bpollset,
+                bpollelt_t * const restrict bpollelt,
+                const int data  __attribute__((unused)))
+{
+    struct bench_conn * const restrict c = bpollelt->udata;
+    struct bench_thread * const restrict thr = c->thr;
+    if (bench_read(bpollelt->fd) <= 0) {
+        ++thr->errors;
+        bpoll_elt_remove(bpollset, bpollelt);
+    }
+    else
+        bench_lat(thr, thr->t_round, bench_now());
+    ++thr->nrecv;
+}
+
+static int
+bench_churn_open (struct bench_thread * const restrict thr,
+                  struct bench_conn * const restrict c)
+{
+    bpollelt_t *bpollelt;
+    int sv[2];
+    c->t0 = bench_now();
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        return errno;
+    if (bench_write1(sv[1]) != 0) {
+        const int errnum = errno;
+        close(sv[0]);
+        close(sv[1]);
+        return errnum;
+    }
+    close(sv[1]);  /* (byte and EOF ready to be read) */
+    bpollelt = bpoll_elt_init(thr->bpollset, NULL, sv[0],
+                              BPOLL_FD_SOCKET, BPOLL_FL_CLOSE);
+    if (bpollelt == NULL) {
+        const int errnum = errno;
+        close(sv[0]);
+        return errnum;
+    }
+    bpollelt->udata = c;
+    c->rfd = sv[0];
+    return bpoll_elt_add(thr->bpollset, bpollelt, BPOLLIN);
+}
+
+/* churn: read byte, remove (and close) socket, replace with new socketpair */
+static void
+bench_cb_churn (bpollset_t * const restrict bpollset,
+                bpollelt_t * const restrict bpollelt,
+                const int data  __attribute__((unused)))
+{
+    struct bench_conn * const restrict c = bpollelt->udata;
+    struct bench_thread * const restrict thr = c->thr;
+    if (bench_read(bpollelt->fd) == 1)
+        bench_lat(thr, c->t0, bench_now());
+    else
+        ++thr->errors;
+    bpoll_elt_remove(bpollset, bpollelt); /* (deferred close; BPOLL_FL_CLOSE)*/
+    c->rfd = -1;
+    if (!__atomic_load_n(&thr->run->stop, __ATOMIC_RELAXED)
+        && bench_churn_open(thr, c) != 0)
+        ++thr->errors;
+}
+
+
+static int
+bench_conn_add (struct bench_thread * const restrict thr,
+                struct bench_conn * const restrict c, const int fd,
+                const bpoll_fdtype_e fdtype)
+{
+    bpollelt_t * const bpollelt =
+      bpoll_elt_init(thr->bpollset, NULL, fd, fdtype, BPOLL_FL_ZERO);
+    if (bpollelt == NULL)
+        return errno;
+    bpollelt->udata = c;
+    return bpoll_elt_add(thr->bpollset, bpollelt, BPOLLIN);
+}
+
+static int
+bench_setup (struct bench_thread * const restrict thr)
+{
+    struct bench_run * const run = thr->run;
+    bpoll_fn_cb_event_t fn_cb_event;
+    unsigned int limit;
+    int i, fd;
+
+    switch (run->scenario) {
+      case BENCH_PINGPONG: fn_cb_event = bench_cb_pingpong; break;
+      case BENCH_CHURN:    fn_cb_event = bench_cb_churn;    break;
+      default:             fn_cb_event = bench_cb_round;    break;
+    }
+    thr->bpollset = bpoll_create(thr, fn_cb_event, NULL, NULL, NULL);
+    if (thr->bpollset == NULL)
+        return errno;
+    /* (churn: removed bpollelts count against limit until next flush) */
+    limit = (unsigned int)thr->n * (run->scenario == BENCH_CHURN ? 2 : 1) + 8;
+    if (bpoll_init(thr->bpollset, run->mech, limit,
+                   run->queue_sz, run->block_sz) != 0)
+        return errno;
+    thr->mech = thr->bpollset->mech;
+    bpoll_timespec_from_msec(thr->bpollset, 100);
+
+    thr->conns = calloc((size_t)thr->nconns + 1, sizeof(struct bench_conn));
+    if (thr->conns == NULL)
+        return errno;
+    for (i = 0; i < thr->nconns; ++i) {
+        struct bench_conn * const c = thr->conns+i;
+        c->thr = thr;
+        c->rfd = c->wfd = c->rfd2 = c->wfd2 = -1;
+    }
+
+    switch (run->scenario) {
+      case BENCH_PINGPONG:
+        for (i = 0; i < thr->nconns; ++i) {
+            struct bench_conn * const c = thr->conns+i;
+            int a[2], b[2];
+            if (pipe(a) != 0)
+                return errno;
+            c->rfd = a[0]; c->wfd = a[1];
+            if (pipe(b) != 0)
+                return errno;
+            c->rfd2 = b[0]; c->wfd2 = b[1];
+            if (bench_conn_add(thr, c, c->rfd,  BPOLL_FD_PIPE) != 0
+                || bench_conn_add(thr, c, c->rfd2, BPOLL_FD_PIPE) != 0)
+                return errno;
+        }
+        break;
+      case BENCH_IDLE:
+        if (pipe(thr->idle_pipe) != 0)
+            return errno;
+        for (i = thr->nconns; i < thr->n; ++i) {
+            bpollelt_t *bpollelt;
+            if ((fd = dup(thr->idle_pipe[0])) == -1)
+                return errno;
+            bpollelt = bpoll_elt_init(thr->bpollset, NULL, fd,
+                                      BPOLL_FD_PIPE, BPOLL_FL_CLOSE);
+            if (bpollelt == NULL) {
+                const int errnum = errno;
+                close(fd);
+                return errnum;
+            }
+            if (bpoll_elt_add(thr->bpollset, bpollelt, BPOLLIN) != 0)
+                return errno;
+        }
+        /* fall through */
+      case BENCH_FANOUT:
+        for (i = 0; i < thr->nconns; ++i) {
+            struct bench_conn * const c = thr->conns+i;
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+                return errno;
+            c->rfd = sv[0]; c->wfd = sv[1];
+            if (bench_conn_add(thr, c, c->rfd, BPOLL_FD_SOCKET) != 0)
+                return errno;
+        }
+        thr->nrecv = thr->nconns;  /* (first round starts in bench_loop()) */
+        break;
+      default: /* BENCH_CHURN (connections opened in bench_loop()) */
+        break;
+    }
+
+    /* commit initial adds to kernel before timing starts */
+    return bpoll_flush_pending(thr->bpollset) == 0 ? 0 : errno;
+}
+
+static void
+bench_teardown (struct bench_thread * const restrict thr)
+{
+    /* (bpoll_destroy() closes BPOLL_FL_CLOSE descriptors) */
+    if (thr->bpollset != NULL)
+        bpoll_destroy(thr->bpollset);
+    if (thr->conns != NULL) {
+        for (int i = 0; i < thr->nconns; ++i) {
+            struct bench_conn * const c = thr->conns+i;
+            if (thr->run->scenario == BENCH_CHURN)
+                continue;
+            if (c->rfd  != -1) close(c->rfd);
+            if (c->wfd  != -1) close(c->wfd);
+            if (c->rfd2 != -1) close(c->rfd2);
+            if (c->wfd2 != -1) close(c->wfd2);
+        }
+        free(thr->conns);
+    }
+    if (thr->idle_pipe[0] != -1) close(thr->idle_pipe[0]);
+    if (thr->idle_pipe[1] != -1) close(thr->idle_pipe[1]);
+}
+
+static void
+bench_loop (struct bench_thread * const restrict thr)
+{
+    struct bench_run * const run = thr->run;
+    bpollset_t * const bpollset = thr->bpollset;
+    int i;
+
+    switch (run->scenario) {
+      case BENCH_PINGPONG:
+        for (i = 0; i < thr->nconns; ++i) {
+            thr->conns[i].t0 = bench_now();
+            if (bench_write1(thr->conns[i].wfd) != 0)
+                ++thr->errors;
+        }
+        break;
+      case BENCH_CHURN:
+        for (i = 0; i < thr->nconns; ++i) {
+            if (bench_churn_open(thr, thr->conns+i) != 0)
+                ++thr->errors;
+        }
+        break;
+      default:
+        break;
+    }
+
+    while (!__atomic_load_n(&run->stop, __ATOMIC_RELAXED)) {
+        if (thr->nrecv == thr->nconns
+            && (run->scenario == BENCH_FANOUT || run->scenario == BENCH_IDLE)) {
+            /* start next round */
+            thr->nrecv = 0;
+            thr->t_round = bench_now();
+            for (i = 0; i < thr->nconns; ++i) {
+                if (bench_write1(thr->conns[i].wfd) != 0)
+                    ++thr->errors;
+            }
+        }
+        if (bpoll_poll(bpollset, bpoll_timespec(bpollset)) == -1
+            && errno != EINTR) {
+            ++thr->errors;
+            break;
+        }
+    }
+    thr->t_end = bench_now();
+}
+
+static void *
+bench_thread_main (void * const arg)
+{
+    struct bench_thread * const restrict thr = arg;
+    thr->rc = bench_setup(thr);
+    pthread_barrier_wait(&thr->run->barrier);
+    if (thr->rc == 0)
+        bench_loop(thr);
+    else
+        thr->t_end = bench_now();
+    bench_teardown(thr);
+    return NULL;
+}
+
+
+static const char *
+bench_mech_name (const unsigned int mech)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(bench_mechs)/sizeof(*bench_mechs); ++i) {
+        if (bench_mechs[i].mech == mech)
+            return bench_mechs[i].name;
+    }
+    return "default";
+}
+
+/* descriptors needed by scenario (beyond those for bpollsets and stdio) */
+static rlim_t
+bench_nfds (const struct bench_run * const restrict run)
+{
+    switch (run->scenario) {
+      case BENCH_PINGPONG: return (rlim_t)run->n * 4;
+      case BENCH_FANOUT:   return (rlim_t)run->n * 2;
+      case BENCH_CHURN:    return (rlim_t)run->n * 3; /*(deferred close)*/
+      default:             return (rlim_t)run->n + (rlim_t)run->nactive
+                                + (rlim_t)run->nthreads * 2;
+    }
+}
+
+/* raise RLIMIT_NOFILE for scenario (reduce run->n if limit can not be raised)*/
+static void
+bench_rlimit (struct bench_run * const restrict run)
+{
+    const rlim_t overhead = (rlim_t)run->nthreads * 8 + 64;
+    const rlim_t need = bench_nfds(run) + overhead;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur >= need)
+        return;
+    rl.rlim_cur = need;
+    if (rl.rlim_max < need) {
+        rl.rlim_max = need;  /* (succeeds if privileged) */
+        if (setrlimit(RLIMIT_NOFILE, &rl) == 0)
+            return;
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+        getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < need) {
+        const int n = run->n;
+        const rlim_t avail = rl.rlim_cur > overhead ? rl.rlim_cur-overhead : 0;
+        while (run->n > run->nthreads && bench_nfds(run) > avail)
+            run->n -= (run->n - run->nthreads + 15) / 16;
+        fprintf(stderr, "%s: RLIMIT_NOFILE %lu too low; -n %d reduced to %d\n",
+                bench_scenario_names[run->scenario],
+                (unsigned long)rl.rlim_cur, n, run->n);
+    }
+}
+
+static int
+bench_run (struct bench_run * const restrict run, const int first)
+{
+    struct bench_thread ** const thrs =
+      calloc((size_t)run->nthreads, sizeof(struct bench_thread *));
+    uint64_t t_start, t_end = 0, ops = 0, errors = 0, lat_sum = 0;
+    uint64_t lat_min = UINT64_MAX, lat_max = 0;
+    uint64_t *hist;
+    int i, rc = 0, nfds = 0, nconns = 0;
+    unsigned int mech = run->mech;
+    struct timespec ts;
+
+    if (thrs == NULL || (hist = calloc(BENCH_HIST_SZ, sizeof(uint64_t)))==NULL)
+        return perror("calloc"), -1;
+
+    run->stop = 0;
+    if (pthread_barrier_init(&run->barrier, NULL,
+                             (unsigned int)run->nthreads + 1) != 0)
+        return perror("pthread_barrier_init"), -1;
+
+    for (i = 0; i < run->nthreads; ++i) {
+        struct bench_thread * const thr = thrs[i] =
+          calloc(1, sizeof(struct bench_thread));
+        if (thr == NULL)
+            return perror("calloc"), -1;
+        thr->run = run;
+        thr->idle_pipe[0] = thr->idle_pipe[1] = -1;
+        thr->lat_min = UINT64_MAX;
+        thr->n = run->n / run->nthreads + (i < run->n % run->nthreads);
+        switch (run->scenario) {
+          case BENCH_PINGPONG:
+            thr->nconns = thr->n;
+            thr->n <<= 1;
+            break;
+          case BENCH_IDLE:
+            thr->nconns = run->nactive / run->nthreads
+                        + (i < run->nactive % run->nthreads);
+            if (thr->nconns == 0)
+                thr->nconns = 1;
+            if (thr->n < thr->nconns)
+                thr->n = thr->nconns;
+            break;
+          default:
+            thr->nconns = thr->n;
+            break;
+        }
+        if (pthread_create(&thr->tid, NULL, bench_thread_main, thr) != 0)
+            return perror("pthread_create"), -1;
+    }
+
+    pthread_barrier_wait(&run->barrier);
+    t_start = bench_now();
+    ts.tv_sec  = (time_t)run->duration;
+    ts.tv_nsec = (long)((run->duration - (double)ts.tv_sec) * 1000000000.0);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) ;
+    __atomic_store_n(&run->stop, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < run->nthreads; ++i) {
+        struct bench_thread * const thr = thrs[i];
+        pthread_join(thr->tid, NULL);
+        if (thr->rc != 0 && rc == 0)
+            rc = thr->rc;
+        if (i == 0)
+            mech = thr->mech;
+        if (t_end < thr->t_end)
+            t_end = thr->t_end;
+        nfds    += thr->n;
+        nconns  += thr->nconns;
+        ops     += thr->ops;
+        errors  += thr->errors;
+        lat_sum += thr->lat_sum;
+        if (lat_min > thr->lat_min)
+            lat_min = thr->lat_min;
+        if (lat_max < thr->lat_max)
+            lat_max = thr->lat_max;
+        for (unsigned int j = 0; j < BENCH_HIST_SZ; ++j)
+            hist[j] += thr->hist[j];
+        free(thr);
+    }
+    free(thrs);
+    pthread_barrier_destroy(&run->barrier);
+
+    printf("%s\n    {\"scenario\": \"%s\", \"mech\": \"%s\", ",
+           first ? "" : ",",
+           bench_scenario_names[run->scenario], bench_mech_name(mech));
+    if (rc != 0) {
+        printf("\"error\": \"%s\"}", strerror(rc));
+        free(hist);
+        return 0;
+    }
+    {
+        const double secs = (double)(t_end - t_start) / 1000000000.0;
+        printf("\"threads\": %d, \"queue_sz\": %u, \"block_sz\": %u, "
+               "\"nfds\": %d, \"nactive\": %d,\n     "
+               "\"duration_sec\": %.3f, \"ops\": %llu, \"ops_per_sec\": %.0f, "
+               "\"errors\": %llu,\n     \"latency_ns\": {",
+               run->nthreads, run->queue_sz, run->block_sz, nfds, nconns,
+               secs, (unsigned long long)ops, secs > 0.0 ? ops / secs : 0.0,
+               (unsigned long long)errors);
+        if (ops == 0)
+            lat_min = 0;
+        printf("\"min\": %llu, \"mean\": %llu",
+               (unsigned long long)lat_min,
+               (unsigned long long)(ops ? lat_sum / ops : 0));
+        bench_hist_print_pct(hist, ops, lat_min, lat_max);
+        printf(", \"max\": %llu}}", (unsigned long long)lat_max);
+    }
+    free(hist);
+    return 0;
+}
+
+
+static void
+usage (const char * const prog)
+{
+    fprintf(stderr,
+      "usage: %s [-s scenario] [-m mech] [-t threads] [-q queue_sz]\n"
+      "       [-b block_sz] [-n num] [-a active] [-d seconds]\n"
+      "  -s  pingpong, fanout, churn, idle, or all     (default all)\n"
+      "  -m  poll, devpoll, epoll, kqueue, evport, pollset, default,\n"
+      "      or all (each mechanism supported)          (default all)\n"
+      "  -t  threads, each with own bpollset            (default 1)\n"
+      "  -q  bpoll_init() queue_sz                      (default 512)\n"
+      "  -b  bpoll_init() block_sz                      (default 0)\n"
+      "  -n  total across threads: pipe pairs (pingpong, default 1 per\n"
+      "      thread), socketpairs (fanout, default 1000), connections in\n"
+      "      flight (churn, default 256), or fds (idle, default 1000000)\n"
+      "  -a  active socketpairs (idle, default n/1000)\n"
+      "  -d  duration of each run in seconds            (default 2)\n",
+      prog);
+    exit(1);
+}
+
+int
+main (const int argc, char ** const argv)
+{
+    struct bench_run run;
+    unsigned int mechs = 0, supported = bpoll_mechanisms();
+    int scenarios = 0, n = 0, nactive = 0, first = 1, c;
+
+    memset(&run, 0, sizeof(run));
+    run.nthreads = 1;
+    run.queue_sz = 512;
+    run.block_sz = 0;
+    run.duration = 2.0;
+
+    while ((c = getopt(argc, argv, "s:m:t:q:b:n:a:d:h")) != -1) {
+        switch (c) {
+          case 's':
+            if (0 == strcmp(optarg, "all"))
+                scenarios = (1 << BENCH_NSCENARIOS) - 1;
+            else {
+                int i = 0;
+                while (i < BENCH_NSCENARIOS
+                       && 0 != strcmp(optarg, bench_scenario_names[i]))
+                    ++i;
+                if (i == BENCH_NSCENARIOS)
+                    usage(argv[0]);
+                scenarios |= 1 << i;
+            }
+            break;
+          case 'm':
+            if (0 == strcmp(optarg, "all"))
+                mechs = supported;
+            else if (0 == strcmp(optarg, "default"))
+                mechs |= 1u << 31; /* (BPOLL_M_NOT_SET) */
+            else {
+                unsigned int i = 0;
+                while (i < sizeof(bench_mechs)/sizeof(*bench_mechs)
+                       && 0 != strcmp(optarg, bench_mechs[i].name))
+                    ++i;
+                if (i == sizeof(bench_mechs)/sizeof(*bench_mechs))
+                    usage(argv[0]);
+                if (!(supported & bench_mechs[i].mech)) {
+                    fprintf(stderr, "%s: mechanism not supported\n", optarg);
+                    return 1;
+                }
+                mechs |= bench_mechs[i].mech;
+            }
+            break;
+          case 't': if ((run.nthreads = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'q': run.queue_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'b': run.block_sz = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+          case 'n': if ((n = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'a': if ((nactive = atoi(optarg)) <= 0) usage(argv[0]);
+                    break;
+          case 'd': if ((run.duration = strtod(optarg, NULL)) <= 0.0)
+                        usage(argv[0]);
+                    break;
+          default:  usage(argv[0]);
+        }
+    }
+    if (scenarios == 0)
+        scenarios = (1 << BENCH_NSCENARIOS) - 1;
+    if (mechs == 0)
+        mechs = supported;
+
+    printf("{\"bench\": \"benchbpoll-v3\", \"results\": [");
+    for (run.scenario = 0; run.scenario < BENCH_NSCENARIOS; ++run.scenario) {
+        if (!(scenarios & (1 << run.scenario)))
+            continue;
+        for (unsigned int i = 0; i <= sizeof(bench_mechs)/sizeof(*bench_mechs);
+             ++i) {
+            if (i == sizeof(bench_mechs)/sizeof(*bench_mechs)) {
+                if (!(mechs & (1u << 31)))
+                    break;
+                run.mech = BPOLL_M_NOT_SET;
+            }
+            else if (mechs & bench_mechs[i].mech)
+                run.mech = bench_mechs[i].mech;
+            else
+                continue;
+            switch (run.scenario) {
+              case BENCH_PINGPONG: run.n = n ? n : run.nthreads; break;
+              case BENCH_FANOUT:   run.n = n ? n : 1000;         break;
+              case BENCH_CHURN:    run.n = n ? n : 256;          break;
+              default:             run.n = n ? n : 1000000;      break;
+            }
+            if (run.n < run.nthreads)
+                run.n = run.nthreads;
+            run.nactive = nactive ? nactive : run.n / 1000;
+            bench_rlimit(&run);
+            if (!nactive)
+                run.nactive = run.n / 1000;
+            if (run.nactive < run.nthreads)
+                run.nactive = run.nthreads;
+            if (bench_run(&run, first) != 0)
+                return 1;
+            first = 0;
+            fflush(stdout);
+        }
+    }
+    printf("\n]}\n");
+    return 0;
+}
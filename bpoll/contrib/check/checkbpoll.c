@@ -0,0 +1,313 @@
+/*
+ * checkbpoll - regression checks for bpoll user-space ready list (rdlist)
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* usage: checkbpoll [-v]
+ *   -v  print each check (default: print only failed checks)
+ * Checks use BPOLL_M_SIM, so that the exact revents returned by the kernel
+ * are controlled with bpoll_sim_ready(), BPOLL_M_POLL, and BPOLL_M_EPOLL,
+ * where available.
+ * Exits 0 if all checks pass, else 1. */
+
+#include <bpoll/bpoll.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_MAX_FD 64
+
+struct check_state {
+    bpollelt_t *mark;       /* bpollelt for callback to mark pending */
+    int mark_revents;
+    int mark_fd;            /* callback for mark_fd marks mark pending */
+    int nmarks;             /* ... and marks[0,nmarks) pending */
+    bpollelt_t *marks[CHECK_MAX_FD];
+    int ncalls[CHECK_MAX_FD];
+    int revents[CHECK_MAX_FD][4];
+};
+
+static int verbose;
+static int nfail;
+static int nsignal;
+
+static void
+check_result (const char * const name, const int ok)
+{
+    if (!ok)
+        ++nfail;
+    if (!ok || verbose)
+        printf("%-40s %s\n", name, ok ? "ok" : "FAIL");
+}
+
+static void
+check_cb_event (bpollset_t * const restrict bpollset,
+                bpollelt_t * const restrict bpollelt, const int data)
+{
+    struct check_state * const restrict st =
+      (struct check_state *)bpoll_get_vdata(bpollset);
+    const int fd = bpollelt->fd;
+    (void)data;
+    if (fd >= 0 && fd < CHECK_MAX_FD) {
+        if (st->ncalls[fd] < 4)
+            st->revents[fd][st->ncalls[fd]] = bpollelt->revents;
+        ++st->ncalls[fd];
+    }
+    if (fd == st->mark_fd && st->mark != NULL) {
+        bpoll_elt_mark_pending(bpollset, st->mark, st->mark_revents);
+        st->mark = NULL;
+    }
+    if (fd == st->mark_fd) {
+        for (int i = 0; i < st->nmarks; ++i)
+            bpoll_elt_mark_pending(bpollset, st->marks[i], st->mark_revents);
+        st->nmarks = 0;
+    }
+}
+
+static bpollset_t *
+check_bpollset (struct check_state * const restrict st, const unsigned int mech)
+{
+    bpollset_t * const bpollset =
+      bpoll_create(st, check_cb_event, NULL, NULL, NULL);
+    memset(st, 0, sizeof(*st));
+    st->mark_fd = -1;
+    if (bpollset == NULL)
+        return NULL;
+    if (0 != bpoll_init(bpollset, mech, CHECK_MAX_FD, CHECK_MAX_FD, 0)) {
+        bpoll_destroy(bpollset);
+        return NULL;
+    }
+    return bpollset;
+}
+
+static bpollelt_t *
+check_elt_add (bpollset_t * const restrict bpollset, const int fd,
+               const int events)
+{
+    bpollelt_t * const bpollelt =
+      bpoll_elt_init(bpollset, NULL, fd, BPOLL_FD_PIPE, BPOLL_FL_ZERO);
+    if (bpollelt != NULL && 0 != bpoll_elt_add(bpollset, bpollelt, events)) {
+        bpoll_elt_destroy(bpollset, bpollelt);
+        return NULL;
+    }
+    return bpollelt;
+}
+
+/* pending edge-triggered bpollelt returned by kernel with different revents
+ * (dispatched through rdlist; pending revents must be kept) */
+static void
+check_pending_kernel_rdlist (void)
+{
+    struct check_state st;
+    struct timespec ts = { 0, 0 };
+    bpollset_t * const bpollset = check_bpollset(&st, BPOLL_M_SIM);
+    bpollelt_t *e;
+    int ok = 0;
+    if (bpollset != NULL
+        && NULL != (e = check_elt_add(bpollset, 3, BPOLLIN|BPOLLOUT|BPOLLET))
+        && 0 == bpoll_flush_pending(bpollset)
+        && 0 == bpoll_elt_mark_pending(bpollset, e, BPOLLIN)
+        && 0 == bpoll_sim_ready(bpollset, 3, BPOLLOUT)) {
+        bpoll_poll(bpollset, &ts);
+        bpoll_poll(bpollset, &ts);
+        ok = st.ncalls[3] == 1 && st.revents[3][0] == (BPOLLIN|BPOLLOUT);
+    }
+    if (bpollset != NULL)
+        bpoll_destroy(bpollset);
+    check_result("pending ET revents kept (rdlist)", ok);
+}
+
+/* bpollelt marked pending by callback of another bpollelt earlier in same
+ * batch of kernel results, then returned by kernel with different revents
+ * (dispatched in fast path; pending revents must be kept for next dispatch) */
+static void
+check_pending_kernel_fast (void)
+{
+    struct check_state st;
+    struct timespec ts = { 0, 0 };
+    bpollset_t * const bpollset = check_bpollset(&st, BPOLL_M_SIM);
+    bpollelt_t *e;
+    int ok = 0;
+    if (bpollset != NULL
+        && NULL != check_elt_add(bpollset, 3, BPOLLIN|BPOLLET)
+        && NULL != (e = check_elt_add(bpollset, 4, BPOLLIN|BPOLLOUT|BPOLLET))
+        && 0 == bpoll_flush_pending(bpollset)
+        && 0 == bpoll_sim_ready(bpollset, 3, BPOLLIN)
+        && 0 == bpoll_sim_ready(bpollset, 4, BPOLLOUT)) {
+        st.mark = e;
+        st.mark_revents = BPOLLIN;
+        st.mark_fd = 3;
+        bpoll_poll(bpollset, &ts);  /* fd 3 marks fd 4 pending; fd 4 ready */
+        bpoll_poll(bpollset, &ts);  /* fd 4 dispatched again from rdlist */
+        ok = st.ncalls[4] == 2 && (st.revents[4][1] & BPOLLIN);
+    }
+    if (bpollset != NULL)
+        bpoll_destroy(bpollset);
+    check_result("pending ET revents kept (fast path)", ok);
+}
+
+/* callback of first of several ready bpollelts dispatched from rdlist marks
+ * nmarks other bpollelts pending (appended to rdlist, possibly resizing it,
+ * while rdlist bpollelts are dispatched; each ready bpollelt must still be
+ * dispatched once, and marked bpollelts on next bpoll_process()) */
+static void
+check_pending_mark_in_dispatch (const int nmarks)
+{
+    struct check_state st;
+    struct timespec ts = { 0, 0 };
+    bpollset_t * const bpollset = check_bpollset(&st, BPOLL_M_SIM);
+    int fd, ok = 0;
+    if (bpollset != NULL
+        && 0 == bpoll_prio_budget_set(bpollset, BPOLL_PRIO_NORMAL, 0)) {
+        for (fd = 3; fd < 7; ++fd) {
+            if (NULL == check_elt_add(bpollset, fd, BPOLLIN))
+                break;
+        }
+        for (; fd < 7 + nmarks; ++fd) {
+            if (NULL == (st.marks[fd-7] = check_elt_add(bpollset, fd, 0)))
+                break;
+        }
+        ok = fd == 7 + nmarks && 0 == bpoll_flush_pending(bpollset);
+        for (fd = 3; ok && fd < 7; ++fd)
+            ok = (0 == bpoll_sim_ready(bpollset, fd, BPOLLIN));
+    }
+    if (ok) {
+        st.nmarks = nmarks;
+        st.mark_revents = BPOLLIN;
+        st.mark_fd = 3;
+        bpoll_poll(bpollset, &ts);
+        for (fd = 3; ok && fd < 7; ++fd)
+            ok = st.ncalls[fd] == 1 && st.revents[fd][0] == BPOLLIN;
+        for (; ok && fd < 7 + nmarks; ++fd)
+            ok = st.ncalls[fd] == 0;
+        bpoll_poll(bpollset, &ts);
+        for (fd = 7; ok && fd < 7 + nmarks; ++fd)
+            ok = st.ncalls[fd] == 1 && st.revents[fd][0] == BPOLLIN;
+    }
+    if (bpollset != NULL)
+        bpoll_destroy(bpollset);
+    check_result(nmarks < 16
+                 ? "mark pending in rdlist dispatch"
+                 : "mark pending in rdlist dispatch (resize)", ok);
+}
+
+static void
+check_cb_signal (bpollset_t * const restrict bpollset, const int signo)
+{
+    (void)bpollset;
+    if (signo == SIGUSR1)
+        ++nsignal;
+}
+
+/* internal bpollelt (bpoll_signal_watch()) dispatched in fast path
+ * (signal callback run; internal bpollelt not passed to fn_cb_event or
+ *  returned in results) */
+static void
+check_internal_fast (const int results)
+{
+    struct check_state st;
+    struct timespec ts = { 0, 0 };
+    bpollset_t * const bpollset =
+      bpoll_create(&st, results ? NULL : check_cb_event, NULL, NULL, NULL);
+    int n = -1, ok = 0;
+    memset(&st, 0, sizeof(st));
+    st.mark_fd = -1;
+    nsignal = 0;
+    if (bpollset != NULL
+        && 0 == bpoll_init(bpollset, BPOLL_M_POLL, CHECK_MAX_FD, CHECK_MAX_FD,
+                           0)
+        && 0 == bpoll_signal_watch(bpollset, SIGUSR1, check_cb_signal)
+        && 0 == raise(SIGUSR1)) {
+        n = bpoll_poll(bpollset, &ts);
+        ok = nsignal == 1 && n == (results ? 0 : 1);
+        for (int i = 0; i < CHECK_MAX_FD; ++i)
+            ok &= (st.ncalls[i] == 0);
+        bpoll_signal_watch(bpollset, SIGUSR1, NULL);
+    }
+    if (bpollset != NULL)
+        bpoll_destroy(bpollset);
+    check_result(results
+                 ? "internal bpollelt fast path (results)"
+                 : "internal bpollelt fast path (callback)", ok);
+}
+
+#ifdef __linux__
+
+/* bpoll_poll_batch() re-polls epoll and merges duplicates while a bpollelt is
+ * pending on rdlist (pending revents must not be overwritten) */
+static void
+check_pending_epoll_batch (void)
+{
+    struct check_state st;
+    struct timespec ts = { 0, 0 };
+    struct timespec max_wait = { 0, 20000000 }; /* 20ms */
+    bpollset_t * const bpollset = check_bpollset(&st, BPOLL_M_EPOLL);
+    bpollelt_t *e;
+    int p[2] = { -1, -1 }, q[2] = { -1, -1 };
+    int ok = 0;
+    if (bpollset != NULL && 0 == pipe(p) && 0 == pipe(q)
+        && p[0] < CHECK_MAX_FD && q[0] < CHECK_MAX_FD
+        && NULL != (e = check_elt_add(bpollset, p[0], BPOLLIN))
+        && NULL != check_elt_add(bpollset, q[0], BPOLLIN)
+        && 0 == bpoll_flush_pending(bpollset)
+        && 1 == write(p[1], "x", 1)
+        && 0 == bpoll_elt_mark_pending(bpollset, e, BPOLLPRI)
+        && 1 == write(q[1], "x", 1)) {
+        bpoll_poll_batch(bpollset, 8, &max_wait);
+        bpoll_poll(bpollset, &ts);
+        ok = st.ncalls[p[0]] >= 1
+          && (st.revents[p[0]][0] & (BPOLLIN|BPOLLPRI)) == (BPOLLIN|BPOLLPRI);
+    }
+    if (bpollset != NULL)
+        bpoll_destroy(bpollset);
+    if (p[0] != -1) { close(p[0]); close(p[1]); }
+    if (q[0] != -1) { close(q[0]); close(q[1]); }
+    check_result("pending revents kept (epoll batch)", ok);
+}
+
+#endif
+
+int
+main (int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "v")) != -1) {
+        switch (c) {
+          case 'v': verbose = 1; break;
+          default:
+            fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    check_pending_kernel_rdlist();
+    check_pending_kernel_fast();
+    check_pending_mark_in_dispatch(6);
+    check_pending_mark_in_dispatch(50);
+    check_internal_fast(0);
+    check_internal_fast(1);
+  #ifdef __linux__
+    check_pending_epoll_batch();
+  #endif
+
+    return nfail != 0;
+}
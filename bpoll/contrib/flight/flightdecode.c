@@ -0,0 +1,170 @@
+/*
+ * flightdecode - decode bpoll flight recorder dump (bpoll_flight_dump())
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* usage: flightdecode [-s usec] [dumpfile]
+ *   -s usec  print only kernel waits and callbacks that took at least usec,
+ *            each preceded by entries since the most recent WAKE
+ * Prints one line per entry: seconds relative to first entry, entry type,
+ * and arguments.  WAKE lines include time spent in kernel poll; CB lines
+ * include callback run time. */
+
+#include <bpoll/bpoll.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char * const fdtypes[] = {
+  "-", "socket", "pipe", "file", "event", "signal", "timer", "inotify",
+  "virtual", "pidfd"
+};
+
+static const char *
+fdtype_name (const unsigned int fdtype)
+{
+    return fdtype < sizeof(fdtypes)/sizeof(*fdtypes) ? fdtypes[fdtype] : "?";
+}
+
+static void
+print_entry (const bpoll_flight_entry_t * const e, const uint64_t t0,
+             const uint64_t twait)  /*(twait: ns in kernel poll if WAKE)*/
+{
+    /*(signed: CB entry ns is callback start, possibly before t0)*/
+    const double t = (double)((int64_t)e->ns - (int64_t)t0) / 1e9;
+    switch (e->type) {
+      case BPOLL_FLIGHT_WAIT:
+        printf("%14.6f WAIT    timeout=%" PRId32 "ms\n", t, e->arg);
+        break;
+      case BPOLL_FLIGHT_WAKE:
+        if (e->arg < 0)
+            printf("%14.6f WAKE    error=%s", t, strerror((int)e->arg2));
+        else
+            printf("%14.6f WAKE    nfound=%" PRId32, t, e->arg);
+        if (twait != 0)
+            printf(" (%" PRIu64 "us in kernel)", twait / 1000);
+        printf("\n");
+        break;
+      case BPOLL_FLIGHT_COMMIT:
+        printf("%14.6f COMMIT  changes=%" PRId32 "\n", t, e->arg);
+        break;
+      case BPOLL_FLIGHT_ADD:
+        printf("%14.6f ADD     fd=%" PRId32 " %s events=0x%" PRIx32 "\n",
+               t, e->arg, fdtype_name(e->fdtype), e->arg2);
+        break;
+      case BPOLL_FLIGHT_REMOVE:
+        printf("%14.6f REMOVE  fd=%" PRId32 " %s\n",
+               t, e->arg, fdtype_name(e->fdtype));
+        break;
+      case BPOLL_FLIGHT_CB:
+        printf("%14.6f CB      fd=%" PRId32 " %s %" PRIu32 "us\n",
+               t, e->arg, fdtype_name(e->fdtype), e->arg2);
+        break;
+      case BPOLL_FLIGHT_NOTE:
+        printf("%14.6f NOTE    %" PRId32 " %" PRIu32 "\n", t, e->arg, e->arg2);
+        break;
+      default:
+        printf("%14.6f type=%u %" PRId32 " %" PRIu32 "\n",
+               t, (unsigned int)e->type, e->arg, e->arg2);
+        break;
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    FILE *fp = stdin;
+    bpoll_flight_hdr_t hdr;
+    bpoll_flight_entry_t *ents;
+    size_t n, i, mark = 0;
+    uint64_t *waited;
+    uint64_t slow = 0, twait = 0, ns;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's')
+            slow = (uint64_t)strtoull(optarg, NULL, 10) * 1000;
+        else {
+            fprintf(stderr, "usage: %s [-s usec] [dumpfile]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind < argc && NULL == (fp = fopen(argv[optind], "rb"))) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (1 != fread(&hdr, sizeof(hdr), 1, fp)
+        || 0 != memcmp(hdr.magic, "BPFLIGHT", sizeof(hdr.magic))
+        || hdr.version != 1
+        || hdr.entry_sz != sizeof(bpoll_flight_entry_t)
+        || hdr.nentries == 0 || hdr.nentries > (SIZE_MAX>>1)/hdr.entry_sz) {
+        fprintf(stderr, "not a bpoll flight recorder dump (version 1)\n");
+        return 1;
+    }
+    ents = malloc((size_t)hdr.nentries * sizeof(*ents));
+    waited = calloc((size_t)hdr.nentries, sizeof(*waited));
+    if (ents == NULL || waited == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    n = fread(ents, sizeof(*ents), (size_t)hdr.nentries, fp);
+    printf("# entries recorded %" PRIu64 ", ring %" PRIu64 ", dumped %zu\n",
+           hdr.nrecorded, hdr.nentries, n);
+    if (n == 0)
+        return 0;
+
+    /* time in kernel poll for each WAKE (from preceding WAIT) */
+    for (i = 0; i < n; ++i) {
+        if (ents[i].type == BPOLL_FLIGHT_WAIT)
+            twait = ents[i].ns;
+        else if (ents[i].type == BPOLL_FLIGHT_WAKE) {
+            waited[i] = twait != 0 && ents[i].ns > twait
+              ? ents[i].ns - twait
+              : 0;
+            twait = 0;
+        }
+    }
+
+    /* -s: print entries from last WAKE up to each slow wait or callback */
+    for (i = 0; i < n; ++i) {
+        const bpoll_flight_entry_t * const e = ents+i;
+        ns = (e->type == BPOLL_FLIGHT_CB)
+          ? (uint64_t)e->arg2 * 1000
+          : (e->type == BPOLL_FLIGHT_WAKE)
+            ? waited[i]
+            : 0;
+        if (slow == 0 || ns >= slow) {
+            if (slow != 0)
+                printf("#\n");
+            for (; mark <= i; ++mark)
+                print_entry(ents+mark, ents[0].ns, waited[mark]);
+        }
+        else if (e->type == BPOLL_FLIGHT_WAKE && mark < i)
+            mark = i;  /*(context restarts at most recent WAKE)*/
+    }
+
+    free(waited);
+    free(ents);
+    return 0;
+}
@@ -0,0 +1,438 @@
+/*
+ * tracereplay - replay bpoll trace (bpoll_trace_enable()) against a mechanism
+ *
+ * Copyright (c) 2011, Glue Logic LLC. All rights reserved. code()gluelogic.com
+ *
+ *  This file is part of bsock.
+ *
+ *  bsock is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  bsock is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with bsock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* usage: tracereplay [-d] [-m mech] [-q queue_sz] [-b block_sz] [-l limit]
+ *                    [-r repeat] tracefile
+ *   -d  print trace records (one per line) instead of replaying
+ *   -m  poll, devpoll, epoll, kqueue, evport, pollset (default: as traced)
+ *   -q  bpoll_init() queue_sz (default: as traced)
+ *   -b  bpoll_init() block_sz (default 0)
+ *   -l  bpoll_init() limit    (default: as traced)
+ *   -r  replay trace repeat times (default 1)
+ * Each traced descriptor is replaced by a socketpair.  Traced add, modify,
+ * and remove are repeated in order.  Before each traced kernel poll, a byte
+ * is written to the socketpair of each descriptor the kernel returned ready
+ * for reading (READY records following the WAKE), and then the kernel is
+ * polled with zero timeout, so the replay runs as fast as bpoll can go and
+ * is deterministic.  Callbacks drain the socket.  Prints one JSON object per
+ * replay with counts, time spent in bpoll calls (bpoll_ns) and in total, and
+ * the number of kernel polls returning a different nfound than traced. */
+
+#include <bpoll/bpoll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef CLOCK_MONOTONIC
+#define REPLAY_CLOCK CLOCK_MONOTONIC
+#else
+#define REPLAY_CLOCK CLOCK_REALTIME
+#endif
+
+/* (revents for which a byte is written to make socketpair readable) */
+#define REPLAY_RDANY (BPOLLRDANY | BPOLLHUP | BPOLLERR)
+
+static const char * const fdtypes[] = {
+  "-", "socket", "pipe", "file", "event", "signal", "timer", "inotify",
+  "virtual", "pidfd"
+};
+
+static const struct { const char *name; unsigned int mech; } mechs[] = {
+    { "poll",    BPOLL_M_POLL    },
+    { "devpoll", BPOLL_M_DEVPOLL },
+    { "epoll",   BPOLL_M_EPOLL   },
+    { "kqueue",  BPOLL_M_KQUEUE  },
+    { "evport",  BPOLL_M_EVPORT  },
+    { "pollset", BPOLL_M_POLLSET }
+};
+
+struct replay_fd {
+    bpollelt_t *bpollelt;
+    int sv[2];
+    int pending;
+};
+
+struct replay {
+    bpollset_t *bpollset;
+    struct replay_fd *fds;
+    size_t nfds;
+    uint64_t adds, modifies, removes, waits;
+    uint64_t ready_expected, ready_observed, wait_mismatch, errors;
+    uint64_t bpoll_ns;
+};
+
+static uint64_t
+replay_now (void)
+{
+    struct timespec ts;
+    clock_gettime(REPLAY_CLOCK, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static const char *
+fdtype_name (const unsigned int fdtype)
+{
+    return fdtype < sizeof(fdtypes)/sizeof(*fdtypes) ? fdtypes[fdtype] : "?";
+}
+
+static const char *
+mech_name (const unsigned int mech)
+{
+    for (unsigned int i = 0; i < sizeof(mechs)/sizeof(*mechs); ++i) {
+        if (mechs[i].mech == mech)
+            return mechs[i].name;
+    }
+    return "?";
+}
+
+static void
+print_rec (const bpoll_trace_rec_t * const r, const uint64_t usec)
+{
+    const double t = (double)usec / 1e6;
+    switch (r->type) {
+      case BPOLL_TRACE_ADD:
+        printf("%14.6f ADD     fd=%" PRId32 " %s events=0x%" PRIx32 "\n",
+               t, r->fd, fdtype_name(r->fdtype), r->events);
+        break;
+      case BPOLL_TRACE_MODIFY:
+        printf("%14.6f MODIFY  fd=%" PRId32 " %s events=0x%" PRIx32 "\n",
+               t, r->fd, fdtype_name(r->fdtype), r->events);
+        break;
+      case BPOLL_TRACE_REMOVE:
+        printf("%14.6f REMOVE  fd=%" PRId32 " %s\n",
+               t, r->fd, fdtype_name(r->fdtype));
+        break;
+      case BPOLL_TRACE_WAIT:
+        printf("%14.6f WAIT    timeout=%" PRId32 "ms\n", t, r->fd);
+        break;
+      case BPOLL_TRACE_WAKE:
+        if (r->fd < 0)
+            printf("%14.6f WAKE    error=%s\n", t, strerror((int)r->events));
+        else
+            printf("%14.6f WAKE    nfound=%" PRId32 "\n", t, r->fd);
+        break;
+      case BPOLL_TRACE_READY:
+        printf("%14.6f READY   fd=%" PRId32 " %s revents=0x%" PRIx32 "\n",
+               t, r->fd, fdtype_name(r->fdtype), r->events);
+        break;
+      default:
+        printf("%14.6f type=%u fd=%" PRId32 " 0x%" PRIx32 "\n",
+               t, (unsigned int)r->type, r->fd, r->events);
+        break;
+    }
+}
+
+static struct replay_fd *
+replay_fd_get (struct replay * const rp, const int32_t fd)
+{
+    if (fd < 0)
+        return NULL;
+    if ((size_t)fd >= rp->nfds) {
+        size_t n = rp->nfds ? rp->nfds : 1024;
+        struct replay_fd *fds;
+        while (n <= (size_t)fd)
+            n <<= 1;
+        fds = realloc(rp->fds, n * sizeof(*fds));
+        if (fds == NULL)
+            return NULL;
+        memset(fds+rp->nfds, 0, (n - rp->nfds) * sizeof(*fds));
+        for (size_t i = rp->nfds; i < n; ++i)
+            fds[i].sv[0] = fds[i].sv[1] = -1;
+        rp->fds  = fds;
+        rp->nfds = n;
+    }
+    return rp->fds+fd;
+}
+
+static void
+replay_cb (bpollset_t * const bpollset, bpollelt_t * const bpollelt,
+           const int data  __attribute__((unused)))
+{
+    struct replay * const rp = bpoll_get_vdata(bpollset);
+    struct replay_fd * const f = bpollelt->udata;
+    char buf[256];
+    while (recv(bpollelt->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) ;
+    f->pending = 0;
+    ++rp->ready_observed;
+}
+
+static void
+replay_add (struct replay * const rp, const bpoll_trace_rec_t * const r)
+{
+    struct replay_fd * const f = replay_fd_get(rp, r->fd);
+    uint64_t t0;
+    int rc;
+    if (r->fdtype == BPOLL_FD_VIRTUAL || f == NULL || f->bpollelt != NULL) {
+        ++rp->errors;
+        return;
+    }
+    if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, f->sv)) {
+        f->sv[0] = f->sv[1] = -1;
+        ++rp->errors;
+        return;
+    }
+    t0 = replay_now();
+    f->bpollelt = bpoll_elt_init(rp->bpollset, NULL, f->sv[0],
+                                 BPOLL_FD_SOCKET, BPOLL_FL_CLOSE);
+    rc = (f->bpollelt != NULL)
+      ? (f->bpollelt->udata = f,
+         bpoll_elt_add(rp->bpollset, f->bpollelt, (int)r->events))
+      : -1;
+    rp->bpoll_ns += replay_now() - t0;
+    if (rc != 0) {
+        if (f->bpollelt != NULL)
+            bpoll_elt_destroy(rp->bpollset, f->bpollelt);
+        close(f->sv[0]);
+        close(f->sv[1]);
+        f->sv[0] = f->sv[1] = -1;
+        f->bpollelt = NULL;
+        ++rp->errors;
+        return;
+    }
+    f->pending = 0;
+    ++rp->adds;
+}
+
+static void
+replay_remove (struct replay * const rp, const bpoll_trace_rec_t * const r)
+{
+    struct replay_fd * const f = replay_fd_get(rp, r->fd);
+    uint64_t t0;
+    if (f == NULL || f->bpollelt == NULL) {
+        ++rp->errors;
+        return;
+    }
+    t0 = replay_now();
+    if (0 != bpoll_elt_remove(rp->bpollset, f->bpollelt))
+        ++rp->errors;
+    rp->bpoll_ns += replay_now() - t0;
+    close(f->sv[1]); /* (sv[0] closed by bpoll; BPOLL_FL_CLOSE) */
+    f->sv[0] = f->sv[1] = -1;
+    f->bpollelt = NULL;
+    ++rp->removes;
+}
+
+static void
+replay_wait (struct replay * const rp, const bpoll_trace_rec_t * const recs,
+             const size_t n, size_t i)
+{
+    bpollset_t * const bpollset = rp->bpollset;
+    int32_t expected = -1;
+    uint64_t t0;
+    int nfound;
+
+    /* make ready the descriptors returned ready by the traced kernel poll */
+    while (++i < n && recs[i].type != BPOLL_TRACE_WAKE
+                   && recs[i].type != BPOLL_TRACE_WAIT) ;
+    if (i < n && recs[i].type == BPOLL_TRACE_WAKE) {
+        expected = recs[i].fd;
+        while (++i < n && recs[i].type == BPOLL_TRACE_READY) {
+            struct replay_fd * const f = replay_fd_get(rp, recs[i].fd);
+            if (f == NULL || f->bpollelt == NULL || f->pending
+                || !(recs[i].events & REPLAY_RDANY))
+                continue;
+            if (1 == write(f->sv[1], "r", 1))
+                f->pending = 1;
+            else
+                ++rp->errors;
+        }
+        if (expected > 0)
+            rp->ready_expected += (uint64_t)expected;
+    }
+
+    t0 = replay_now();
+    nfound = bpoll_kernel(bpollset, bpoll_timespec(bpollset));
+    if (nfound > 0)
+        bpoll_process(bpollset);
+    rp->bpoll_ns += replay_now() - t0;
+    if (nfound < 0)
+        ++rp->errors;
+    else if (expected >= 0 && nfound != expected)
+        ++rp->wait_mismatch;
+    ++rp->waits;
+}
+
+static int
+replay (const char * const path, const bpoll_trace_hdr_t * const hdr,
+        const bpoll_trace_rec_t * const recs, const size_t n,
+        const unsigned int mech, const unsigned int limit,
+        const unsigned int queue_sz, const unsigned int block_sz)
+{
+    struct replay rp;
+    uint64_t t0, t1;
+    size_t i;
+    memset(&rp, 0, sizeof(rp));
+
+    rp.bpollset = bpoll_create(&rp, replay_cb, NULL, NULL, NULL);
+    if (rp.bpollset == NULL
+        || 0 != bpoll_init(rp.bpollset, mech, limit, queue_sz, block_sz)) {
+        perror("bpoll_create, bpoll_init");
+        return 1;
+    }
+    bpoll_timespec_from_msec(rp.bpollset, 0);
+
+    t0 = replay_now();
+    for (i = 0; i < n; ++i) {
+        const bpoll_trace_rec_t * const r = recs+i;
+        switch (r->type) {
+          case BPOLL_TRACE_ADD:
+            replay_add(&rp, r);
+            break;
+          case BPOLL_TRACE_MODIFY: {
+            struct replay_fd * const f = replay_fd_get(&rp, r->fd);
+            uint64_t tm;
+            if (f == NULL || f->bpollelt == NULL) {
+                ++rp.errors;
+                break;
+            }
+            tm = replay_now();
+            if (0 != bpoll_elt_modify(rp.bpollset,f->bpollelt,(int)r->events))
+                ++rp.errors;
+            rp.bpoll_ns += replay_now() - tm;
+            ++rp.modifies;
+            break;
+          }
+          case BPOLL_TRACE_REMOVE:
+            replay_remove(&rp, r);
+            break;
+          case BPOLL_TRACE_WAIT:
+            replay_wait(&rp, recs, n, i);
+            break;
+          default: /* (WAKE, READY handled by replay_wait()) */
+            break;
+        }
+    }
+    t1 = replay_now();
+
+    bpoll_destroy(rp.bpollset);
+    for (i = 0; i < rp.nfds; ++i) {
+        if (rp.fds[i].sv[1] != -1)
+            close(rp.fds[i].sv[1]);
+    }
+    free(rp.fds);
+
+    printf("{\"trace\": \"%s\", \"traced_mech\": \"%s\", \"mech\": \"%s\", "
+           "\"limit\": %u, \"queue_sz\": %u, \"block_sz\": %u, "
+           "\"records\": %zu, \"adds\": %" PRIu64 ", \"modifies\": %" PRIu64
+           ", \"removes\": %" PRIu64 ", \"waits\": %" PRIu64 ", "
+           "\"ready_expected\": %" PRIu64 ", \"ready_observed\": %" PRIu64
+           ", \"wait_mismatch\": %" PRIu64 ", \"errors\": %" PRIu64 ", "
+           "\"bpoll_ns\": %" PRIu64 ", \"total_ns\": %" PRIu64 "}\n",
+           path, mech_name(hdr->mech), mech_name(mech),
+           limit, queue_sz, block_sz, n, rp.adds, rp.modifies, rp.removes,
+           rp.waits, rp.ready_expected, rp.ready_observed, rp.wait_mismatch,
+           rp.errors, rp.bpoll_ns, t1 - t0);
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    FILE *fp;
+    bpoll_trace_hdr_t hdr;
+    bpoll_trace_rec_t *recs = NULL;
+    size_t n = 0, sz = 0;
+    unsigned int mech = 0, limit = 0, queue_sz = 0, block_sz = 0;
+    int opt, dump = 0, repeat = 1, rc = 0;
+
+    while ((opt = getopt(argc, argv, "dm:q:b:l:r:")) != -1) {
+        switch (opt) {
+          case 'd': dump = 1; break;
+          case 'm':
+            for (unsigned int i = 0; i < sizeof(mechs)/sizeof(*mechs); ++i) {
+                if (0 == strcmp(optarg, mechs[i].name))
+                    mech = mechs[i].mech;
+            }
+            if (mech == 0 || !(bpoll_mechanisms() & mech)) {
+                fprintf(stderr, "%s: mechanism not supported\n", optarg);
+                return 2;
+            }
+            break;
+          case 'q': queue_sz = (unsigned int)strtoul(optarg, NULL, 10); break;
+          case 'b': block_sz = (unsigned int)strtoul(optarg, NULL, 10); break;
+          case 'l': limit    = (unsigned int)strtoul(optarg, NULL, 10); break;
+          case 'r': if ((repeat = atoi(optarg)) > 0) break; /* fall through */
+          default:
+            fprintf(stderr, "usage: %s [-d] [-m mech] [-q queue_sz] "
+                            "[-b block_sz] [-l limit] [-r repeat] tracefile\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "%s: tracefile required\n", argv[0]);
+        return 2;
+    }
+    if (NULL == (fp = fopen(argv[optind], "rb"))) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (1 != fread(&hdr, sizeof(hdr), 1, fp)
+        || 0 != memcmp(hdr.magic, "BPTRACE", sizeof("BPTRACE"))
+        || hdr.version != 1
+        || hdr.rec_sz != sizeof(bpoll_trace_rec_t)) {
+        fprintf(stderr, "not a bpoll trace (version 1)\n");
+        return 1;
+    }
+    do {
+        if (n == sz) {
+            bpoll_trace_rec_t * const p =
+              realloc(recs, (sz = sz ? sz << 1 : 65536) * sizeof(*recs));
+            if (p == NULL) {
+                perror("realloc");
+                return 1;
+            }
+            recs = p;
+        }
+        n += fread(recs+n, sizeof(*recs), sz - n, fp);
+    } while (n == sz);
+    fclose(fp);
+
+    if (dump) {
+        uint64_t usec = 0;
+        printf("# mech %s, limit %" PRIu32 ", queue_sz %" PRIu32 ", "
+               "records %zu\n", mech_name(hdr.mech), hdr.limit, hdr.queue_sz, n);
+        for (size_t i = 0; i < n; ++i)
+            print_rec(recs+i, (usec += recs[i].usec));
+    }
+    else {
+        if (mech == 0)
+            mech = (bpoll_mechanisms() & hdr.mech) ? hdr.mech : 0;
+        if (limit == 0)
+            limit = hdr.limit;
+        if (queue_sz == 0)
+            queue_sz = hdr.queue_sz;
+        while (rc == 0 && repeat--)
+            rc = replay(argv[optind], &hdr, recs, n,
+                        mech, limit, queue_sz, block_sz);
+    }
+
+    free(recs);
+    return rc;
+}
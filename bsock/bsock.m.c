@@ -48,6 +48,7 @@
 #include <bsock_unix.h>
 
 #include <bpoll/bpoll.h>
+#include <bpoll/bpoll_sdt.h>
 
 #ifndef BSOCK_SYSLOG_IDENT
 #define BSOCK_SYSLOG_IDENT "bsock"
@@ -134,14 +135,6 @@ static int
 nointr_close (const int fd)
 { int r; retry_eintr_do_while(r = close(fd), r != 0); return r; }
 
-static volatile sig_atomic_t signalled_hup = true;
-
-static void
-bsock_sa_handler_sighup (const int signo  __attribute_unused__)
-{
-    signalled_hup = true; /*set flag to run reconfigure steps when convenient*/
-}
-
 __attribute_cold__
 __attribute_noinline__
 static void
@@ -161,24 +154,30 @@ bsock_sigaction_sighup (void)
     endservent();
 }
 
+/* signals are received via bpoll_signal_watch() as ordinary ready events
+ * (signalfd on Linux), so callbacks run in event loop (not signal context)
+ * and a signal received right before bpoll_poll() blocks is not missed */
+
+__attribute_cold__
+static void
+bsock_signal_sighup (bpollset_t * const bpollset  __attribute_unused__,
+                     const int signo  __attribute_unused__)
+{
+    bsock_sigaction_sighup();
+}
+
 static time_t epochsec;
 
 static void
-bsock_sa_handler_sigalrm (const int signo  __attribute_unused__)
+bsock_signal_sigalrm (bpollset_t * const bpollset  __attribute_unused__,
+                      const int signo  __attribute_unused__)
 {
     ++epochsec;
     /* Note: bsock is not concerned with precision less than +/- 1 sec,
-     * or else this signal handler could use clock_gettime() to calculate
+     * or else this callback could use clock_gettime() to calculate
      * drift and timer_gettime() and timer_settime() to adjust.
-     * (clock_gettime(), timer_gettime(), timer_settime() are async-signal-safe)
-     * Would need to modify sigaction() to pass SA_SIGINFO to obtain timer_t,
-     * and to modify the parameters taken by this routine to receive siginfo_t.
-     * In addition, timerfd would be preferred over signal handler to avoid
-     * race condition of signal received right before bpoll_poll(), resulting
-     * in extra interval passing before bpoll_poll() interrupted by SIGALRM.
-     * On the other hand, if we were to be more lax about precision in cleaning
-     * up idle connections, use sigevent SIGEV_THREAD instead of signal handler
-     * and have bpoll_poll() return e.g. once a min instead of once a sec */
+     * (multiple SIGALRM between polls are coalesced into a single callback;
+     *  bsock_event_loop() resyncs epochsec with time() while timer disarmed)*/
 }
 
 /* simple fixed-size statically allocated hash table
@@ -343,6 +342,8 @@ bsock_client_handler (struct bsock_client_st * const restrict c,
     else if (0 == (flag = errno))
         flag = EACCES;  /*(iov.iov_base = &flag)*/
 
+    BPOLL_SDT_PROBE3(bsock, client_handler, c->uid, ai->ai_family, flag);
+
     /* send 4-byte value in data to indicate success or errno value
      * (send socket fd to client if new socket, no poll since only one send) */
     if (c->fd != fd) {
@@ -519,6 +520,8 @@ bsock_accept_loop (const int sfd,
     int logbuf_idx = 0; /* logbuf[] MUST be sized to hold accept_max entries! */
     char logbuf[8192];  /* accept_max * (63 bytes (max) + '\0') per log entry */
 
+    BPOLL_SDT_PROBE1(bsock, accept_loop_entry, sfd);
+
     /* accept loop
      * accept, get client credentials, insert into table, handle ready events */
     do {
@@ -528,6 +531,7 @@ bsock_accept_loop (const int sfd,
          * (speculative recv: see if data ready; skip unnecessary poll) */
         if (-1 != (m.fd = accept(sfd, NULL, NULL))) {
             if (0 == bsock_unix_getpeereid(m.fd, &m.uid, &m.gid)) {
+                BPOLL_SDT_PROBE3(bsock, accept, m.fd, m.uid, m.gid);
                 bsock_infostr(logbuf+logbuf_idx, m.fd, m.uid, m.gid);
                 logbuf_idx += 64;
                 /*(set O_NONBLOCK if non-blocking recvmsg() is unsupported)*/
@@ -569,6 +573,8 @@ bsock_accept_loop (const int sfd,
 
     } while (--accept_max);
 
+    BPOLL_SDT_PROBE2(bsock, accept_loop_exit, logbuf_idx >> 6, rv);
+
     /* flush buffered LOG_INFO entries
      * (log info can be extremely useful, but it is not free;
      *  there can be measurable cost to info/metrics collection) */
@@ -601,14 +607,20 @@ bsock_event_loop (const int sfd)
     /* create/init bpollset and add sfd
      * typical expected bsock use is low concurrency;
      * use BPOLL_M_POLL instead of BPOLL_M_NOT_SET
+     * (+1 for internal bpollelt of bpoll_signal_watch() below)
      * No cleanup of bpollset is done on error since program exits soon after */
     if (NULL == bpollset
         || 0 != bpoll_init(bpollset, BPOLL_M_POLL,
-                           BSOCK_CONNECTION_MAX, BSOCK_CONNECTION_MAX,
+                           BSOCK_CONNECTION_MAX+1, BSOCK_CONNECTION_MAX+1,
                            sizeof(struct bsock_client_st))) {
         bsock_syslog(errno, LOG_ERR, "bpoll_create, bpoll_init");
         return EXIT_FAILURE;
     }
+    if (0 != bpoll_signal_watch(bpollset, SIGHUP, bsock_signal_sighup)
+        || 0 != bpoll_signal_watch(bpollset, SIGALRM, bsock_signal_sigalrm)) {
+        bsock_syslog(errno, LOG_ERR, "bpoll_signal_watch");
+        return EXIT_FAILURE;
+    }
     (void)fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL, 0) | O_NONBLOCK);
     bpollelt = bpoll_elt_init(bpollset,NULL,sfd,BPOLL_FD_SOCKET,BPOLL_FL_CLOSE);
     if (NULL == bpollelt
@@ -621,11 +633,9 @@ bsock_event_loop (const int sfd)
     if (!bsock_ctrlbuf_alloc())
         return EXIT_FAILURE;
 
-    /* create interval timer (disarmed), set bpoll_poll() timer 60 secs
-     * so that bpoll_poll() periodically returns and checks for sighup */
-    if (timer_create(CLOCK_REALTIME, NULL, &timerid) == 0)
-        bpoll_timespec_from_sec_nsec(bpollset, 60, 0);
-    else {
+    /* create interval timer (disarmed)
+     * (no bpoll_poll() timeout; SIGHUP and SIGALRM are bpollset events) */
+    if (timer_create(CLOCK_REALTIME, NULL, &timerid) != 0) {
         bsock_syslog(errno, LOG_ERR, "timer_create");
         return EXIT_FAILURE;
     }
@@ -634,7 +644,7 @@ bsock_event_loop (const int sfd)
     do {
 
         /* check if interval timer needs to be enabled/disabled
-         * (timer SIGALRM will interrupt bpoll_poll(), when timer is set)
+         * (timer SIGALRM will wake bpoll_poll(), when timer is set)
          * (interval timer is more efficient than calling time() after
          *  returning from each and every bpoll_poll() */
         if (sentinel.tnext != &sentinel) {  /* client connections exist */
@@ -650,7 +660,7 @@ bsock_event_loop (const int sfd)
             }
         }
 
-        nfound = bpoll_poll(bpollset, bpoll_timespec(bpollset));
+        nfound = bpoll_poll(bpollset, NULL);
 
         if (-1 == nfound && errno != EINTR) {  /* should not happen */
             bsock_syslog(errno, LOG_ERR, "bpoll_poll");
@@ -658,13 +668,6 @@ bsock_event_loop (const int sfd)
             nanosleep(&it.it_interval, NULL);/* reuse 'it' timespec for 1 sec */
         } /* fall through to do processing */
 
-        /* efficiency: keep databases open (advantageous for nss_mcdb module) */
-        /* perform database open in event thread (thread-specific in nss_mcdb)*/
-        if (signalled_hup) {
-            signalled_hup = false;
-            bsock_sigaction_sighup();
-        }
-
         results = bpoll_get_results(bpollset);
         for (i = 0; i < nfound; ++i) {
             bpollelt = results[i];
@@ -714,7 +717,7 @@ bsock_event_loop (const int sfd)
          * (on the other hand, waiting too long to accept new connections might
          *  result in full kernel TCP SYN queue, and packets getting dropped) */
     } while (   !accepting
-             || nfound == BSOCK_CONNECTION_MAX /*(? is this test useful ?)*/
+             || nfound == BSOCK_CONNECTION_MAX+1 /*(? is test useful ?)*/
              || (accepting = 0,
                  bsock_accept_loop(sfd,&sentinel,bpollset) == EAGAIN)   );
 
@@ -917,17 +920,6 @@ main (int argc, char *argv[])
 
     bsock_uid_table_init();  /* used to permit one concurrent request per uid */
 
-    {
-        struct sigaction act = { .sa_handler = bsock_sa_handler_sighup,
-                                 .sa_flags   = SA_RESTART };
-        sigemptyset(&act.sa_mask);
-        if (0 != sigaction(SIGHUP, &act, NULL))
-            bsock_syslog(errno, LOG_ERR, "sigaction");
-        act.sa_handler = bsock_sa_handler_sigalrm;
-        if (0 != sigaction(SIGALRM, &act, NULL))
-            bsock_syslog(errno, LOG_ERR, "sigaction");
-    }
-
     bsock_sigaction_sighup();  /* trigger initial config setup */
     return bsock_event_loop(sfd);
 }